@@ -12,6 +12,7 @@
 #include <linux/init.h>
 #include <linux/platform_device.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
 #include <linux/of.h>
 #include <linux/of_platform.h>
 #include <linux/of_reserved_mem.h>
@@ -24,20 +25,14 @@
 #include "ion/ion_priv.h"
 #include "ion_of.h"
 
-static int ion_of_reserved_mem_device_init(struct device *dev)
+static int ion_of_read_region(struct device_node *np,
+			struct ion_of_region *region)
 {
-	struct platform_device *pdev = to_platform_device(dev);
-	struct ion_platform_heap *heap = pdev->dev.platform_data;
-	struct device_node *np;
 	u32 res[4];
 	int cell_base, cell_size;
 	u64 val_base, val_size;
 	int pos, ret, i;
 
-	np = of_parse_phandle(dev->of_node, "memory-region", 0);
-	if (!np)
-		return -ENODEV;
-
 	cell_base = of_n_addr_cells(np);
 	cell_size = of_n_size_cells(np);
 	if (cell_base + cell_size > ARRAY_SIZE(res)) {
@@ -60,11 +55,87 @@ static int ion_of_reserved_mem_device_init(struct device *dev)
 		pos++;
 	}
 
-	heap->base = val_base;
-	heap->size = val_size;
+	region->base = val_base;
+	region->size = val_size;
+
+	return 0;
+}
 
-	pr_info("memory-region: base:%lx, size:%lx\n",
-		(long)heap->base, (long)heap->size);
+/**
+ * Read all regions of 'memory-region' of the heap node, sorted by base.
+ *
+ * @param np heap node
+ * @param regions returns regions
+ * @param max size of regions
+ * @return number of regions on success, negative error code on error
+ */
+int ion_of_heap_regions(struct device_node *np,
+			struct ion_of_region *regions, int max)
+{
+	struct device_node *rn;
+	struct ion_of_region r;
+	int nr, ret, i;
+
+	for (nr = 0; ; nr++) {
+		rn = of_parse_phandle(np, "memory-region", nr);
+		if (!rn)
+			break;
+		if (nr >= max) {
+			of_node_put(rn);
+			return -E2BIG;
+		}
+		ret = ion_of_read_region(rn, &r);
+		of_node_put(rn);
+		if (ret)
+			return ret;
+
+		/* insertion sort, regions are few */
+		for (i = nr; i > 0 && regions[i - 1].base > r.base; i--)
+			regions[i] = regions[i - 1];
+		regions[i] = r;
+	}
+
+	for (i = 1; i < nr; i++) {
+		if (regions[i - 1].base + regions[i - 1].size > regions[i].base)
+			return -EINVAL;
+	}
+
+	return nr;
+}
+
+static int ion_of_reserved_mem_device_init(struct device *dev)
+{
+	struct platform_device *pdev = to_platform_device(dev);
+	struct ion_platform_heap *heap = pdev->dev.platform_data;
+	struct ion_of_region regions[ION_OF_MAX_REGIONS];
+	int nr, i;
+
+	nr = ion_of_heap_regions(dev->of_node, regions, ARRAY_SIZE(regions));
+	if (nr < 0) {
+		pr_err("%s: invalid memory-region %d\n", heap->name, nr);
+		return nr;
+	}
+	if (!nr)
+		return -ENODEV;
+
+	/*
+	 * Several regions are allowed for carveout heaps, that reserve the
+	 * holes between them. Others get only one region.
+	 */
+	if (nr > 1 && heap->type != ION_HEAP_TYPE_CARVEOUT) {
+		pr_err("%s: only carveout heap can have %d memory-regions\n",
+			heap->name, nr);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < nr; i++)
+		pr_info("memory-region: base:%lx, size:%lx\n",
+			(long)regions[i].base, (long)regions[i].size);
+
+	/* the heap spans from the lowest region to the highest */
+	heap->base = regions[0].base;
+	heap->size = regions[nr - 1].base + regions[nr - 1].size -
+		regions[0].base;
 
 	return 0;
 }
@@ -75,7 +146,11 @@ int ion_parse_dt_heap_common(struct device_node *heap_node,
 {
 	int i;
 	u32 type = 0;
+	u32 chunk_size = 0;
 	bool keep = false;
+	bool early = false;
+	bool lazy = false;
+	bool cma = false;
 	int ret;
 
 	for (i = 0; compatible[i].name != NULL; i++) {
@@ -90,14 +165,40 @@ int ion_parse_dt_heap_common(struct device_node *heap_node,
 	if (ret < 0)
 		type = compatible[i].type;
 
+	/* chunk-size makes the heap chunk heap, unless heap_type is given */
+	if (!of_property_read_u32(heap_node, "chunk-size", &chunk_size) &&
+	    ret < 0)
+		type = ION_HEAP_TYPE_CHUNK;
+	if (type == ION_HEAP_TYPE_CHUNK &&
+	    (!chunk_size || !PAGE_ALIGNED(chunk_size))) {
+		pr_err("%s: invalid chunk-size %x\n", compatible[i].name,
+			chunk_size);
+		return -EINVAL;
+	}
+
+	/* socionext,cma makes the heap CMA heap, unless heap_type is given */
+	cma = of_property_read_bool(heap_node, "socionext,cma");
+	if (cma && ret < 0)
+		type = ION_HEAP_TYPE_DMA;
+
 	keep = of_property_read_bool(heap_node, "socionext,keep-contents");
+	early = of_property_read_bool(heap_node, "socionext,early-init");
+	lazy = of_property_read_bool(heap_node, "socionext,lazy-init");
 
 	heap->id = compatible[i].heap_id;
 	heap->type = type;
 	heap->name = compatible[i].name;
 	heap->align = compatible[i].align;
+	if (type == ION_HEAP_TYPE_CHUNK)
+		heap->align = chunk_size;
 	if (keep)
-		heap->flags = ION_PLAT_FLAG_KEEP;
+		heap->flags |= ION_PLAT_FLAG_KEEP;
+	if (early)
+		heap->flags |= ION_PLAT_FLAG_EARLY;
+	if (lazy)
+		heap->flags |= ION_PLAT_FLAG_LAZY;
+	if (cma && type == ION_HEAP_TYPE_DMA)
+		heap->flags |= ION_PLAT_FLAG_CMA;
 
 	/* Some kind of callback function pointer? */
 
@@ -211,6 +312,11 @@ int ion_release_dt(struct platform_device *pdev,
 	for (i = 0; i < num_heaps; i++) {
 		struct platform_device *heap_pdev = heaps[i].priv;
 
+		/* priv of DMA heap is the device, see ion_parse_dt() */
+		if (heaps[i].type == ION_HEAP_TYPE_DMA)
+			heap_pdev = to_platform_device(
+				(struct device *)heaps[i].priv);
+
 #ifdef OF_POPULATED
 		/*
 		 * FIXME: We cannot call of_platform_device_destroy() function,
@@ -224,3 +330,18 @@ int ion_release_dt(struct platform_device *pdev,
 
 	return 0;
 }
+
+struct device_node *ion_of_heap_node(struct ion_platform_heap *heap)
+{
+	struct device *dev = heap->priv;
+
+	/* priv is set by ion_parse_dt(), NULL if using platform_data */
+	if (!heap->priv)
+		return NULL;
+
+	/* priv of DMA heap is the device, others the platform_device */
+	if (heap->type != ION_HEAP_TYPE_DMA)
+		dev = &((struct platform_device *)heap->priv)->dev;
+
+	return dev->of_node;
+}
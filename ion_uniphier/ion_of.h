@@ -12,6 +12,42 @@
 #ifndef _ION_OF_H
 #define _ION_OF_H
 
+/*
+ * Platform heap flags of UniPhier, the low 16 bits are used by ion
+ * (ION_PLAT_FLAG_*).
+ */
+#define ION_PLAT_FLAG_EARLY        (1 << 17)	/*
+						 * create the heap in
+						 * probe, not async
+						 * (socionext,early-init).
+						 */
+#define ION_PLAT_FLAG_LAZY         (1 << 18)	/*
+						 * set up the heap on
+						 * the first allocation
+						 * (socionext,lazy-init).
+						 */
+#define ION_PLAT_FLAG_CMA          (1 << 19)	/*
+						 * CMA heap of this
+						 * driver (socionext,cma).
+						 */
+
+/*
+ * The chunk heap (DT property 'chunk-size') gets the chunk size by
+ * align of struct ion_platform_heap, because priv is used for the device
+ * of heap.
+ */
+
+struct device_node;
+struct ion_platform_heap;
+
+/* Max number of 'memory-region' of a heap */
+#define ION_OF_MAX_REGIONS 8
+
+struct ion_of_region {
+	phys_addr_t base;
+	size_t size;
+};
+
 struct ion_of_heap {
 	const char *compat;
 	int heap_id;
@@ -33,5 +69,8 @@ struct ion_platform_data *ion_parse_dt(struct platform_device *pdev,
 					struct ion_of_heap *compatible);
 int ion_release_dt(struct platform_device *pdev,
 			struct ion_platform_data *pdata);
+int ion_of_heap_regions(struct device_node *np,
+			struct ion_of_region *regions, int max);
+struct device_node *ion_of_heap_node(struct ion_platform_heap *heap);
 
 #endif
@@ -0,0 +1,800 @@
+/*
+ * Ion driver for Socionext UniPhier series.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
+#include <linux/vmalloc.h>
+
+#define ion_uniphier_alloc_zalloc(size)    vzalloc(size)
+#define ion_uniphier_alloc_free(p)         vfree(p)
+#define ion_uniphier_alloc_ffs(w)          __ffs(w)
+#define ion_uniphier_alloc_fls(w)          __fls(w)
+#else
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ion_uniphier_alloc_zalloc(size)    calloc(1, size)
+#define ion_uniphier_alloc_free(p)         free(p)
+#define ion_uniphier_alloc_ffs(w)          __builtin_ctzl(w)
+#define ion_uniphier_alloc_fls(w)          \
+	(sizeof(unsigned long) * 8 - 1 - __builtin_clzl(w))
+#endif
+
+#include "ion_uniphier_alloc.h"
+
+#define ION_UNIPHIER_ALLOC_BPW          (sizeof(unsigned long) * 8)
+#define ION_UNIPHIER_ALLOC_NOTFOUND     (~0UL)
+
+static const char * const ion_uniphier_alloc_policy_names[] = {
+	[ION_UNIPHIER_ALLOC_FIRST_FIT] = "first-fit",
+	[ION_UNIPHIER_ALLOC_BEST_FIT]  = "best-fit",
+	[ION_UNIPHIER_ALLOC_NEXT_FIT]  = "next-fit",
+};
+
+/**
+ * Find the next granule that is allocated (set != 0) or free (set == 0).
+ *
+ * @param a     allocator
+ * @param i     start position of search
+ * @param end   end position of search
+ * @param set   search allocated granule or not
+ * @return position of found granule, or end if not found
+ */
+static unsigned long ion_uniphier_alloc_find(struct ion_uniphier_alloc *a,
+	unsigned long i, unsigned long end, int set)
+{
+	while (i < end) {
+		unsigned long w = a->bitmap[i / ION_UNIPHIER_ALLOC_BPW];
+
+		if (!set) {
+			w = ~w;
+		}
+		w >>= i % ION_UNIPHIER_ALLOC_BPW;
+		if (w) {
+			i += ion_uniphier_alloc_ffs(w);
+			return (i < end) ? i : end;
+		}
+		i = (i / ION_UNIPHIER_ALLOC_BPW + 1) * ION_UNIPHIER_ALLOC_BPW;
+	}
+
+	return end;
+}
+
+/**
+ * Find the last granule before i that is allocated (set != 0) or free
+ * (set == 0), search downward.
+ *
+ * @param a      allocator
+ * @param i      end position of search, not included
+ * @param start  start position of search
+ * @param set    search allocated granule or not
+ * @return position of found granule + 1, or start if not found
+ */
+static unsigned long ion_uniphier_alloc_rfind(struct ion_uniphier_alloc *a,
+	unsigned long i, unsigned long start, int set)
+{
+	while (i > start) {
+		unsigned long bit = i - 1;
+		unsigned long w = a->bitmap[bit / ION_UNIPHIER_ALLOC_BPW];
+
+		if (!set) {
+			w = ~w;
+		}
+		w &= ~0UL >> (ION_UNIPHIER_ALLOC_BPW - 1 -
+			bit % ION_UNIPHIER_ALLOC_BPW);
+		if (w) {
+			i = bit / ION_UNIPHIER_ALLOC_BPW * ION_UNIPHIER_ALLOC_BPW +
+				ion_uniphier_alloc_fls(w) + 1;
+			return (i > start) ? i : start;
+		}
+		i = bit / ION_UNIPHIER_ALLOC_BPW * ION_UNIPHIER_ALLOC_BPW;
+	}
+
+	return start;
+}
+
+static void ion_uniphier_alloc_fill(struct ion_uniphier_alloc *a,
+	unsigned long i, unsigned long nr, int set)
+{
+	unsigned long end = i + nr;
+
+	for (; i < end; i++) {
+		unsigned long mask = 1UL << (i % ION_UNIPHIER_ALLOC_BPW);
+
+		if (set) {
+			a->bitmap[i / ION_UNIPHIER_ALLOC_BPW] |= mask;
+		} else {
+			a->bitmap[i / ION_UNIPHIER_ALLOC_BPW] &= ~mask;
+		}
+	}
+}
+
+/**
+ * Get the first aligned position that nr granules fit in the free run.
+ *
+ * @param a      allocator
+ * @param start  start position of the free run
+ * @param end    end position of the free run
+ * @param nr     number of granules to allocate
+ * @param align  alignment in bytes, power of 2
+ * @param colour bank colour of the start address, -1 for any
+ * @return position, or ION_UNIPHIER_ALLOC_NOTFOUND if it does not fit
+ */
+static unsigned long ion_uniphier_alloc_fit(struct ion_uniphier_alloc *a,
+	unsigned long start, unsigned long end, unsigned long nr, u64 align,
+	int colour)
+{
+	u64 addr = a->base + ((u64)start << a->order);
+	u64 mask, want;
+	unsigned long pos;
+
+	addr = (addr + align - 1) & ~(align - 1);
+	if (colour >= 0) {
+		/* next address whose colour is wanted, in the same period */
+		mask = ((u64)a->nr_colours << a->colour_shift) - 1;
+		want = (u64)colour << a->colour_shift;
+		addr += (want - (addr & mask)) & mask;
+	}
+	pos = (unsigned long)((addr - a->base) >> a->order);
+	if (pos + nr > end || pos < start) {
+		return ION_UNIPHIER_ALLOC_NOTFOUND;
+	}
+
+	return pos;
+}
+
+/**
+ * Get the last aligned position that nr granules fit in the free run.
+ *
+ * @param a      allocator
+ * @param start  start position of the free run
+ * @param end    end position of the free run
+ * @param nr     number of granules to allocate
+ * @param align  alignment in bytes, power of 2
+ * @param colour bank colour of the start address, -1 for any
+ * @return position, or ION_UNIPHIER_ALLOC_NOTFOUND if it does not fit
+ */
+static unsigned long ion_uniphier_alloc_fit_top(struct ion_uniphier_alloc *a,
+	unsigned long start, unsigned long end, unsigned long nr, u64 align,
+	int colour)
+{
+	u64 low = a->base + ((u64)start << a->order);
+	u64 addr, mask, want, down;
+
+	if (end - start < nr) {
+		return ION_UNIPHIER_ALLOC_NOTFOUND;
+	}
+	addr = a->base + ((u64)(end - nr) << a->order);
+	addr &= ~(align - 1);
+	if (addr < low) {
+		return ION_UNIPHIER_ALLOC_NOTFOUND;
+	}
+	if (colour >= 0) {
+		/* previous address whose colour is wanted */
+		mask = ((u64)a->nr_colours << a->colour_shift) - 1;
+		want = (u64)colour << a->colour_shift;
+		down = ((addr & mask) - want) & mask;
+		if (addr - low < down) {
+			return ION_UNIPHIER_ALLOC_NOTFOUND;
+		}
+		addr -= down;
+	}
+
+	return (unsigned long)((addr - a->base) >> a->order);
+}
+
+/**
+ * Search the free run from the end of the range, for top-down placement.
+ *
+ * @param a      allocator
+ * @param nr     number of granules to allocate
+ * @param align  alignment in bytes, power of 2
+ * @param colour bank colour of the start address, -1 for any
+ * @return position, or ION_UNIPHIER_ALLOC_NOTFOUND if not found
+ */
+static unsigned long ion_uniphier_alloc_search_top(
+	struct ion_uniphier_alloc *a, unsigned long nr, u64 align, int colour)
+{
+	unsigned long s, e, pos;
+
+	e = a->nr_bits;
+	while (e > 0) {
+		e = ion_uniphier_alloc_rfind(a, e, 0, 0);
+		if (e == 0) {
+			break;
+		}
+		s = ion_uniphier_alloc_rfind(a, e, 0, 1);
+
+		pos = ion_uniphier_alloc_fit_top(a, s, e, nr, align, colour);
+		if (pos != ION_UNIPHIER_ALLOC_NOTFOUND) {
+			return pos;
+		}
+		e = s;
+	}
+
+	return ION_UNIPHIER_ALLOC_NOTFOUND;
+}
+
+/**
+ * Search the free run from start to end.
+ *
+ * @param a      allocator
+ * @param start  start position of search
+ * @param end    end position of search
+ * @param nr     number of granules to allocate
+ * @param align  alignment in bytes, power of 2
+ * @param colour bank colour of the start address, -1 for any
+ * @param best   find the smallest run that fits, otherwise the first one
+ * @return position, or ION_UNIPHIER_ALLOC_NOTFOUND if not found
+ */
+static unsigned long ion_uniphier_alloc_search(struct ion_uniphier_alloc *a,
+	unsigned long start, unsigned long end, unsigned long nr, u64 align,
+	int colour, int best)
+{
+	unsigned long found = ION_UNIPHIER_ALLOC_NOTFOUND;
+	unsigned long found_len = ~0UL;
+	unsigned long s, e, pos;
+
+	s = start;
+	while (s < end) {
+		s = ion_uniphier_alloc_find(a, s, end, 0);
+		if (s >= end) {
+			break;
+		}
+		e = ion_uniphier_alloc_find(a, s, end, 1);
+
+		pos = ion_uniphier_alloc_fit(a, s, e, nr, align, colour);
+		if (pos != ION_UNIPHIER_ALLOC_NOTFOUND) {
+			if (!best) {
+				return pos;
+			}
+			if (e - s < found_len) {
+				found = pos;
+				found_len = e - s;
+				if (found_len == nr) {
+					/* cannot be better than this */
+					break;
+				}
+			}
+		}
+		s = e;
+	}
+
+	return found;
+}
+
+/**
+ * Search the position by the placement policy.
+ *
+ * @param a      allocator
+ * @param nr     number of granules to allocate
+ * @param align  alignment in bytes, power of 2
+ * @param colour bank colour of the start address, -1 for any
+ * @return position, or ION_UNIPHIER_ALLOC_NOTFOUND if not found
+ */
+static unsigned long ion_uniphier_alloc_place(struct ion_uniphier_alloc *a,
+	unsigned long nr, u64 align, int colour)
+{
+	unsigned long pos;
+
+	switch (a->policy) {
+	case ION_UNIPHIER_ALLOC_BEST_FIT:
+		pos = ion_uniphier_alloc_search(a, 0, a->nr_bits, nr, align,
+			colour, 1);
+		break;
+	case ION_UNIPHIER_ALLOC_NEXT_FIT:
+		pos = ion_uniphier_alloc_search(a, a->next, a->nr_bits, nr,
+			align, colour, 0);
+		if (pos == ION_UNIPHIER_ALLOC_NOTFOUND && a->next != 0) {
+			pos = ion_uniphier_alloc_search(a, 0, a->nr_bits, nr,
+				align, colour, 0);
+		}
+		break;
+	case ION_UNIPHIER_ALLOC_FIRST_FIT:
+	default:
+		pos = ion_uniphier_alloc_search(a, 0, a->nr_bits, nr, align,
+			colour, 0);
+		break;
+	}
+
+	return pos;
+}
+
+/**
+ * Initialize the allocator.
+ *
+ * @param a       allocator
+ * @param base    start address of the range, aligned to the granule
+ * @param size    size of the range in bytes
+ * @param order   log2 of the allocation granule (e.g. PAGE_SHIFT)
+ * @param policy  placement policy
+ * @return 0 on success, -errno on error
+ */
+int ion_uniphier_alloc_init(struct ion_uniphier_alloc *a, u64 base, u64 size,
+	unsigned int order, enum ion_uniphier_alloc_policy policy)
+{
+	unsigned long words;
+
+	if (policy >= ION_UNIPHIER_ALLOC_NR_POLICIES ||
+		(base & ((1ULL << order) - 1))) {
+		return -EINVAL;
+	}
+
+	memset(a, 0, sizeof(*a));
+	a->base = base;
+	a->size = size;
+	a->order = order;
+	a->nr_bits = (unsigned long)(size >> order);
+	a->nr_free = a->nr_bits;
+	a->policy = policy;
+
+	words = (a->nr_bits + ION_UNIPHIER_ALLOC_BPW - 1) / ION_UNIPHIER_ALLOC_BPW;
+	a->bitmap = ion_uniphier_alloc_zalloc((words ? words : 1) *
+		sizeof(unsigned long));
+	if (!a->bitmap) {
+		return -ENOMEM;
+	}
+
+	/* tail of the last word is never free */
+	ion_uniphier_alloc_fill(a, a->nr_bits,
+		words * ION_UNIPHIER_ALLOC_BPW - a->nr_bits, 1);
+
+	return 0;
+}
+
+void ion_uniphier_alloc_destroy(struct ion_uniphier_alloc *a)
+{
+	ion_uniphier_alloc_free(a->bitmap);
+	a->bitmap = NULL;
+}
+
+static int ion_uniphier_alloc_test(const unsigned long *bitmap,
+	unsigned long i)
+{
+	return !!(bitmap[i / ION_UNIPHIER_ALLOC_BPW] &
+		(1UL << (i % ION_UNIPHIER_ALLOC_BPW)));
+}
+
+/**
+ * Change the managed range, e.g. to move free space at the boundary to
+ * the adjacent heap. Granules that are dropped must be free, granules
+ * that are added are free. Allocated ranges keep their addresses.
+ * Shrinking is done in place and never fails for memory, so the caller
+ * can undo a grow by shrinking.
+ *
+ * @param a     allocator
+ * @param base  new start address, aligned to the granule
+ * @param size  new size in bytes, aligned to the granule
+ * @return 0 on success, -EINVAL if parameters are invalid, -EBUSY if
+ *         a dropped granule is used, -ENOMEM if no memory
+ */
+int ion_uniphier_alloc_resize(struct ion_uniphier_alloc *a, u64 base,
+	u64 size)
+{
+	u64 granule = 1ULL << a->order;
+	u64 end = base + size, old_end = a->base + a->size;
+	unsigned long nr_bits, words, shift, i, nr_free = 0;
+	unsigned long *bitmap;
+	u64 addr;
+
+	if (size == 0 || ((base | size) & (granule - 1)) || end < base) {
+		return -EINVAL;
+	}
+
+	/* granules out of the new range must be free */
+	for (addr = a->base; addr < old_end; addr += granule) {
+		if (addr >= base && addr < end) {
+			addr = end - granule;
+			continue;
+		}
+		if (ion_uniphier_alloc_test(a->bitmap,
+			(unsigned long)((addr - a->base) >> a->order))) {
+			return -EBUSY;
+		}
+	}
+
+	nr_bits = (unsigned long)(size >> a->order);
+	words = (nr_bits + ION_UNIPHIER_ALLOC_BPW - 1) / ION_UNIPHIER_ALLOC_BPW;
+	if (base >= a->base && end <= old_end) {
+		/* shift down in place */
+		bitmap = a->bitmap;
+		shift = (unsigned long)((base - a->base) >> a->order);
+		for (i = 0; i < nr_bits; i++) {
+			ion_uniphier_alloc_fill(a, i, 1,
+				ion_uniphier_alloc_test(bitmap, i + shift));
+		}
+	} else {
+		bitmap = ion_uniphier_alloc_zalloc((words ? words : 1) *
+			sizeof(unsigned long));
+		if (!bitmap) {
+			return -ENOMEM;
+		}
+		for (addr = base; addr < end; addr += granule) {
+			if (addr < a->base || addr >= old_end ||
+				!ion_uniphier_alloc_test(a->bitmap,
+				(unsigned long)((addr - a->base) >> a->order))) {
+				continue;
+			}
+			i = (unsigned long)((addr - base) >> a->order);
+			bitmap[i / ION_UNIPHIER_ALLOC_BPW] |=
+				1UL << (i % ION_UNIPHIER_ALLOC_BPW);
+		}
+		ion_uniphier_alloc_free(a->bitmap);
+		a->bitmap = bitmap;
+	}
+
+	a->base = base;
+	a->size = size;
+	a->nr_bits = nr_bits;
+	a->next = 0;
+	/* tail of the last word is never free */
+	ion_uniphier_alloc_fill(a, nr_bits,
+		words * ION_UNIPHIER_ALLOC_BPW - nr_bits, 1);
+
+	for (i = 0; i < nr_bits; i++) {
+		nr_free += !ion_uniphier_alloc_test(a->bitmap, i);
+	}
+	a->nr_free = nr_free;
+
+	return 0;
+}
+
+/**
+ * Enable the bank colouring. The start address of each allocation gets
+ * the next colour of the previous one, so that buffers allocated
+ * together start on different DRAM banks. The colour of an address is
+ * (addr / stride) % nr_colours. Up to stride * (nr_colours - 1) bytes
+ * in front of the buffer may be skipped to get the colour.
+ *
+ * @param a           allocator
+ * @param stride      bank interleave stride in bytes, power of 2, not
+ *                    less than the granule
+ * @param nr_colours  number of colours, power of 2, 0 or 1 to disable
+ * @return 0 on success, -EINVAL if parameters are invalid
+ */
+int ion_uniphier_alloc_set_colour(struct ion_uniphier_alloc *a, u64 stride,
+	unsigned int nr_colours)
+{
+	unsigned int shift = 0;
+
+	if (nr_colours <= 1) {
+		a->nr_colours = 0;
+		return 0;
+	}
+	if ((stride & (stride - 1)) || (nr_colours & (nr_colours - 1)) ||
+		stride < (1ULL << a->order)) {
+		return -EINVAL;
+	}
+	while ((1ULL << shift) < stride) {
+		shift++;
+	}
+
+	a->colour_shift = shift;
+	a->nr_colours = nr_colours;
+	a->next_colour = 0;
+
+	return 0;
+}
+
+/**
+ * Get the bank colour of the address.
+ *
+ * @param a     allocator
+ * @param addr  physical address
+ * @return colour, 0 if colouring is disabled
+ */
+unsigned int ion_uniphier_alloc_colour(struct ion_uniphier_alloc *a,
+	u64 addr)
+{
+	if (!a->nr_colours) {
+		return 0;
+	}
+
+	return (unsigned int)(addr >> a->colour_shift) & (a->nr_colours - 1);
+}
+
+/**
+ * Allocate the range.
+ *
+ * @param a      allocator
+ * @param size   size in bytes
+ * @param align  alignment in bytes
+ * @param top    place from the end of the range instead of the policy
+ * @return start address, or ION_UNIPHIER_ALLOC_FAIL if no space
+ */
+static u64 ion_uniphier_alloc_get_common(struct ion_uniphier_alloc *a,
+	u64 size, u64 align, int top)
+{
+	u64 granule = 1ULL << a->order;
+	unsigned long nr, pos;
+	u64 addr;
+	int colour;
+
+	if (size == 0) {
+		return ION_UNIPHIER_ALLOC_FAIL;
+	}
+	nr = (unsigned long)((size + granule - 1) >> a->order);
+	if (nr > a->nr_free) {
+		return ION_UNIPHIER_ALLOC_FAIL;
+	}
+
+	if (align < granule) {
+		align = granule;
+	}
+	while (align & (align - 1)) {
+		/* round up to power of 2 */
+		align = (align | (align - 1)) + 1;
+	}
+
+	/*
+	 * Colouring is best effort, it is not possible if the alignment is
+	 * larger than the stride. Fall back to any colour if no space.
+	 */
+	colour = -1;
+	if (a->nr_colours && align <= (1ULL << a->colour_shift)) {
+		colour = a->next_colour;
+	}
+	if (top) {
+		pos = ion_uniphier_alloc_search_top(a, nr, align, colour);
+		if (pos == ION_UNIPHIER_ALLOC_NOTFOUND && colour >= 0) {
+			pos = ion_uniphier_alloc_search_top(a, nr, align, -1);
+		}
+	} else {
+		pos = ion_uniphier_alloc_place(a, nr, align, colour);
+		if (pos == ION_UNIPHIER_ALLOC_NOTFOUND && colour >= 0) {
+			pos = ion_uniphier_alloc_place(a, nr, align, -1);
+		}
+	}
+	if (pos == ION_UNIPHIER_ALLOC_NOTFOUND) {
+		return ION_UNIPHIER_ALLOC_FAIL;
+	}
+
+	ion_uniphier_alloc_fill(a, pos, nr, 1);
+	a->nr_free -= nr;
+	if (!top) {
+		a->next = (pos + nr < a->nr_bits) ? pos + nr : 0;
+	}
+	addr = a->base + ((u64)pos << a->order);
+	if (a->nr_colours) {
+		/* spread buffers that are allocated one after another */
+		a->next_colour = (ion_uniphier_alloc_colour(a, addr) + 1) &
+			(a->nr_colours - 1);
+	}
+
+	return addr;
+}
+
+/**
+ * Allocate the range by the placement policy.
+ *
+ * @param a      allocator
+ * @param size   size in bytes
+ * @param align  alignment in bytes
+ * @return start address, or ION_UNIPHIER_ALLOC_FAIL if no space
+ */
+u64 ion_uniphier_alloc_get(struct ion_uniphier_alloc *a, u64 size, u64 align)
+{
+	return ion_uniphier_alloc_get_common(a, size, align, 0);
+}
+
+/**
+ * Allocate the range at the highest address that fits, regardless of
+ * the policy. Long-lived buffers are placed by this and transient ones
+ * by ion_uniphier_alloc_get(), so that freeing transient buffers does
+ * not leave holes between long-lived ones.
+ *
+ * @param a      allocator
+ * @param size   size in bytes
+ * @param align  alignment in bytes
+ * @return start address, or ION_UNIPHIER_ALLOC_FAIL if no space
+ */
+u64 ion_uniphier_alloc_get_top(struct ion_uniphier_alloc *a, u64 size,
+	u64 align)
+{
+	return ion_uniphier_alloc_get_common(a, size, align, 1);
+}
+
+/**
+ * Move the allocated range to the lowest range that fits below its end,
+ * regardless of the policy and the colouring. The old range counts as
+ * free for the search, so the new range may overlap it and the range
+ * slides down into a free block that is smaller than itself. This is
+ * used by the compaction, the caller moves the data like memmove().
+ *
+ * @param a      allocator
+ * @param addr   start address of the allocated range
+ * @param size   size in bytes
+ * @param align  alignment in bytes
+ * @return new start address, lower than addr, or ION_UNIPHIER_ALLOC_FAIL
+ *         if the range cannot be moved down
+ */
+u64 ion_uniphier_alloc_move_down(struct ion_uniphier_alloc *a, u64 addr,
+	u64 size, u64 align)
+{
+	u64 granule = 1ULL << a->order;
+	unsigned long nr, old, pos;
+
+	if (size == 0 || addr < a->base || (addr & (granule - 1)) ||
+		addr + size < addr || addr + size > a->base + a->size) {
+		return ION_UNIPHIER_ALLOC_FAIL;
+	}
+	old = (unsigned long)((addr - a->base) >> a->order);
+	nr = (unsigned long)((size + granule - 1) >> a->order);
+
+	if (align < granule) {
+		align = granule;
+	}
+	while (align & (align - 1)) {
+		/* round up to power of 2 */
+		align = (align | (align - 1)) + 1;
+	}
+
+	ion_uniphier_alloc_fill(a, old, nr, 0);
+	pos = ion_uniphier_alloc_search(a, 0, old + nr, nr, align, -1, 0);
+	if (pos == ION_UNIPHIER_ALLOC_NOTFOUND || pos >= old) {
+		pos = old;
+	}
+	ion_uniphier_alloc_fill(a, pos, nr, 1);
+	if (pos == old) {
+		return ION_UNIPHIER_ALLOC_FAIL;
+	}
+
+	return a->base + ((u64)pos << a->order);
+}
+
+/**
+ * Allocate the specified range, for the data that is already there.
+ *
+ * @param a     allocator
+ * @param addr  start address, aligned to the granule
+ * @param size  size in bytes
+ * @return 0 on success, -EINVAL if out of range, -EBUSY if used
+ */
+int ion_uniphier_alloc_claim(struct ion_uniphier_alloc *a, u64 addr, u64 size)
+{
+	u64 granule = 1ULL << a->order;
+	unsigned long nr, pos;
+
+	if (size == 0 || addr < a->base || (addr & (granule - 1)) ||
+		addr + size < addr || addr + size > a->base + a->size) {
+		return -EINVAL;
+	}
+	pos = (unsigned long)((addr - a->base) >> a->order);
+	nr = (unsigned long)((size + granule - 1) >> a->order);
+
+	if (ion_uniphier_alloc_find(a, pos, pos + nr, 1) != pos + nr) {
+		return -EBUSY;
+	}
+
+	ion_uniphier_alloc_fill(a, pos, nr, 1);
+	a->nr_free -= nr;
+
+	return 0;
+}
+
+/**
+ * Reserve the range that must never be allocated, e.g. the hole between
+ * memory regions when the allocator covers several regions. The range
+ * is not counted in the total of ion_uniphier_alloc_stat().
+ *
+ * @param a     allocator
+ * @param addr  start address, aligned to the granule
+ * @param size  size in bytes
+ * @return 0 on success, -EINVAL if out of range, -EBUSY if used
+ */
+int ion_uniphier_alloc_reserve(struct ion_uniphier_alloc *a, u64 addr,
+	u64 size)
+{
+	u64 granule = 1ULL << a->order;
+	int ret;
+
+	ret = ion_uniphier_alloc_claim(a, addr, size);
+	if (ret) {
+		return ret;
+	}
+	a->reserved += (size + granule - 1) & ~(granule - 1);
+
+	return 0;
+}
+
+/**
+ * Free the range allocated by ion_uniphier_alloc_get() or
+ * ion_uniphier_alloc_claim().
+ *
+ * @param a     allocator
+ * @param addr  start address
+ * @param size  size in bytes, same as when allocated
+ */
+void ion_uniphier_alloc_put(struct ion_uniphier_alloc *a, u64 addr, u64 size)
+{
+	u64 granule = 1ULL << a->order;
+	unsigned long nr, pos;
+
+	if (addr == ION_UNIPHIER_ALLOC_FAIL || addr < a->base ||
+		addr + size > a->base + a->size) {
+		return;
+	}
+	pos = (unsigned long)((addr - a->base) >> a->order);
+	nr = (unsigned long)((size + granule - 1) >> a->order);
+
+	ion_uniphier_alloc_fill(a, pos, nr, 0);
+	a->nr_free += nr;
+}
+
+void ion_uniphier_alloc_stat(struct ion_uniphier_alloc *a,
+	struct ion_uniphier_alloc_stat *st)
+{
+	unsigned long s, e, largest = 0;
+
+	memset(st, 0, sizeof(*st));
+	st->total = a->size - a->reserved;
+	st->free = (u64)a->nr_free << a->order;
+
+	s = 0;
+	while (s < a->nr_bits) {
+		s = ion_uniphier_alloc_find(a, s, a->nr_bits, 0);
+		if (s >= a->nr_bits) {
+			break;
+		}
+		e = ion_uniphier_alloc_find(a, s, a->nr_bits, 1);
+		if (e - s > largest) {
+			largest = e - s;
+		}
+		st->nr_free_blocks++;
+		s = e;
+	}
+	st->largest_free = (u64)largest << a->order;
+
+	st->head_free = (u64)ion_uniphier_alloc_find(a, 0, a->nr_bits, 1) <<
+		a->order;
+	st->tail_free = (u64)(a->nr_bits -
+		ion_uniphier_alloc_rfind(a, a->nr_bits, 0, 1)) << a->order;
+}
+
+const char *ion_uniphier_alloc_policy_name(enum ion_uniphier_alloc_policy policy)
+{
+	if (policy >= ION_UNIPHIER_ALLOC_NR_POLICIES) {
+		return "unknown";
+	}
+
+	return ion_uniphier_alloc_policy_names[policy];
+}
+
+/**
+ * Get the policy from its name.
+ *
+ * @param name  name of policy, e.g. "best-fit"
+ * @return policy, or -EINVAL if unknown
+ */
+int ion_uniphier_alloc_policy_parse(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ION_UNIPHIER_ALLOC_NR_POLICIES; i++) {
+		if (strcmp(name, ion_uniphier_alloc_policy_names[i]) == 0) {
+			return i;
+		}
+	}
+
+	return -EINVAL;
+}
@@ -0,0 +1,127 @@
+/*
+ * Ion driver for Socionext UniPhier series.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ION_UNIPHIER_ALLOC_H__
+#define ION_UNIPHIER_ALLOC_H__
+
+/*
+ * Placement core of the carveout heaps.
+ *
+ * This file and ion_uniphier_alloc.c do not depend on the kernel, they are
+ * also compiled in userspace by the replay tool (test/alloc_replay.c) to
+ * evaluate the placement policies with recorded allocation traces.
+ * The caller has to serialize calls for the same allocator.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint64_t u64;
+#endif
+
+/* Since 0 may be a valid address, this is used to indicate failure */
+#define ION_UNIPHIER_ALLOC_FAIL    ((u64)-1)
+
+enum ion_uniphier_alloc_policy {
+	ION_UNIPHIER_ALLOC_FIRST_FIT,
+	ION_UNIPHIER_ALLOC_BEST_FIT,
+	ION_UNIPHIER_ALLOC_NEXT_FIT,
+	ION_UNIPHIER_ALLOC_NR_POLICIES,
+};
+
+/**
+ * struct ion_uniphier_alloc - allocator of a physically contiguous range
+ *
+ * @param base     start address of the managed range
+ * @param size     size of the managed range in bytes
+ * @param order    log2 of the allocation granule
+ * @param nr_bits  number of granules
+ * @param nr_free  number of free granules
+ * @param next     next search position of the next-fit policy
+ * @param bitmap   one bit per granule, set if allocated
+ * @param policy   placement policy
+ * @param colour_shift  log2 of the bank interleave stride
+ * @param nr_colours    number of bank colours, 0 if colouring is disabled
+ * @param next_colour   colour of the next allocation
+ * @param reserved      bytes that are never allocated (holes between
+ *                      memory regions of the heap)
+ */
+struct ion_uniphier_alloc {
+	u64 base;
+	u64 size;
+	unsigned int order;
+	unsigned long nr_bits;
+	unsigned long nr_free;
+	unsigned long next;
+	unsigned long *bitmap;
+	enum ion_uniphier_alloc_policy policy;
+	unsigned int colour_shift;
+	unsigned int nr_colours;
+	unsigned int next_colour;
+	u64 reserved;
+};
+
+/**
+ * struct ion_uniphier_alloc_stat - snapshot of the allocator state
+ *
+ * @param total           size of the managed range in bytes, except
+ *                        reserved holes
+ * @param free            total free bytes
+ * @param largest_free    largest free block in bytes
+ * @param nr_free_blocks  number of free blocks
+ * @param head_free       free bytes at the start of the range
+ * @param tail_free       free bytes at the end of the range
+ */
+struct ion_uniphier_alloc_stat {
+	u64 total;
+	u64 free;
+	u64 largest_free;
+	unsigned long nr_free_blocks;
+	u64 head_free;
+	u64 tail_free;
+};
+
+int ion_uniphier_alloc_init(struct ion_uniphier_alloc *a, u64 base, u64 size,
+	unsigned int order, enum ion_uniphier_alloc_policy policy);
+void ion_uniphier_alloc_destroy(struct ion_uniphier_alloc *a);
+int ion_uniphier_alloc_resize(struct ion_uniphier_alloc *a, u64 base,
+	u64 size);
+int ion_uniphier_alloc_set_colour(struct ion_uniphier_alloc *a, u64 stride,
+	unsigned int nr_colours);
+unsigned int ion_uniphier_alloc_colour(struct ion_uniphier_alloc *a,
+	u64 addr);
+u64 ion_uniphier_alloc_get(struct ion_uniphier_alloc *a, u64 size, u64 align);
+u64 ion_uniphier_alloc_get_top(struct ion_uniphier_alloc *a, u64 size,
+	u64 align);
+u64 ion_uniphier_alloc_move_down(struct ion_uniphier_alloc *a, u64 addr,
+	u64 size, u64 align);
+int ion_uniphier_alloc_claim(struct ion_uniphier_alloc *a, u64 addr, u64 size);
+int ion_uniphier_alloc_reserve(struct ion_uniphier_alloc *a, u64 addr,
+	u64 size);
+void ion_uniphier_alloc_put(struct ion_uniphier_alloc *a, u64 addr, u64 size);
+void ion_uniphier_alloc_stat(struct ion_uniphier_alloc *a,
+	struct ion_uniphier_alloc_stat *st);
+
+const char *ion_uniphier_alloc_policy_name(enum ion_uniphier_alloc_policy policy);
+int ion_uniphier_alloc_policy_parse(const char *name);
+
+#endif /* ION_UNIPHIER_ALLOC_H__ */
@@ -0,0 +1,438 @@
+/*
+ * Ion driver for Socionext UniPhier series.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define pr_fmt(fmt) "ion-uniphier-async: " fmt
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/types.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/idr.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/pid.h>
+#include <linux/sched.h>
+#include <linux/completion.h>
+#include <linux/workqueue.h>
+#include <linux/eventfd.h>
+
+#include "ion/ion.h"
+#include "ion/ion_priv.h"
+
+#include "ion_uniphier_core.h"
+#include "uapi/ion_uniphier.h"
+
+/*
+ * Asynchronous allocation.
+ *
+ * A worker allocates the buffer by the kernel client of the driver and
+ * keeps the handle, because fds can be installed only by the process
+ * that collects the result. Tickets are ids of idr, they are bound to
+ * the ion client and the process that has queued the request.
+ *
+ * Legacy ion tells nothing when a client is destroyed, and a new client
+ * may get the address of the old one. So the owner of requests holds
+ * the /dev/ion file of the client, the client lives while it has
+ * requests. Once the user has closed the file, only the owner holds it
+ * and the results of the client are freed. It is checked by queue and
+ * collect, and by the reaper that runs while requests exist.
+ */
+
+/* Requests of a client, queued and not collected */
+#define ION_UNIPHIER_ASYNC_MAX_PER_CLIENT  64
+#define ION_UNIPHIER_ASYNC_REAP            HZ
+
+/**
+ * struct ion_uniphier_async_owner - ion client that has requests
+ *
+ * @param list     entry of ion_uniphier_async_owners
+ * @param file     /dev/ion file of the client, holds the client
+ * @param nr_reqs  number of requests of the client
+ */
+struct ion_uniphier_async_owner {
+	struct list_head list;
+	struct file *file;
+	unsigned int nr_reqs;
+};
+
+/**
+ * struct ion_uniphier_async_req - queued allocation
+ *
+ * @param work        work of the allocation
+ * @param done        completed the allocation
+ * @param ticket      id in ion_uniphier_async_idr
+ * @param owner       ion client of the caller
+ * @param pid         process of the caller
+ * @param eventfd     signalled on completion, may be NULL
+ * @param len         argument of ion_alloc()
+ * @param align       argument of ion_alloc()
+ * @param heap_id_mask argument of ion_alloc()
+ * @param flags       argument of ion_alloc()
+ * @param handle      handle of the kernel client, result
+ * @param result      0 or error code of the allocation
+ * @param collecting  the owner is collecting the result
+ */
+struct ion_uniphier_async_req {
+	struct work_struct work;
+	struct completion done;
+	int ticket;
+	struct ion_uniphier_async_owner *owner;
+	struct pid *pid;
+	struct eventfd_ctx *eventfd;
+	size_t len;
+	size_t align;
+	unsigned int heap_id_mask;
+	unsigned int flags;
+	struct ion_handle *handle;
+	int result;
+	bool collecting;
+};
+
+static DEFINE_IDR(ion_uniphier_async_idr);
+static DEFINE_MUTEX(ion_uniphier_async_lock);
+static LIST_HEAD(ion_uniphier_async_owners);
+static unsigned int ion_uniphier_async_count;
+static struct workqueue_struct *ion_uniphier_async_wq;
+static struct ion_client *ion_uniphier_async_client;
+
+static void ion_uniphier_async_reap(struct work_struct *work);
+static DECLARE_DELAYED_WORK(ion_uniphier_async_reap_work,
+	ion_uniphier_async_reap);
+
+static void ion_uniphier_async_work(struct work_struct *work)
+{
+	struct ion_uniphier_async_req *req = container_of(work,
+		struct ion_uniphier_async_req, work);
+	struct ion_handle *handle;
+
+	handle = ion_alloc(ion_uniphier_async_client, req->len, req->align,
+		req->heap_id_mask, req->flags);
+	if (IS_ERR_OR_NULL(handle)) {
+		req->result = handle ? PTR_ERR(handle) : -ENOMEM;
+	} else {
+		req->handle = handle;
+	}
+
+	complete_all(&req->done);
+	if (req->eventfd) {
+		eventfd_signal(req->eventfd, 1);
+	}
+}
+
+/**
+ * Get the owner of the client, that holds the /dev/ion file of the
+ * client. Called with the lock held.
+ *
+ * @param client ion client of caller
+ * @return owner on success, ERR_PTR on error
+ */
+static struct ion_uniphier_async_owner *ion_uniphier_async_owner_get_locked(
+	struct ion_client *client)
+{
+	struct ion_uniphier_async_owner *owner;
+	struct file *file;
+
+	file = ion_uniphier_client_file_get(client);
+	if (IS_ERR(file)) {
+		return ERR_CAST(file);
+	}
+
+	list_for_each_entry(owner, &ion_uniphier_async_owners, list) {
+		if (owner->file == file) {
+			fput(file);
+			return owner;
+		}
+	}
+
+	owner = kzalloc(sizeof(*owner), GFP_KERNEL);
+	if (!owner) {
+		fput(file);
+		return ERR_PTR(-ENOMEM);
+	}
+	owner->file = file;
+	list_add(&owner->list, &ion_uniphier_async_owners);
+
+	return owner;
+}
+
+/* Called with the lock held, drops the client if it has no request */
+static void ion_uniphier_async_owner_put_locked(
+	struct ion_uniphier_async_owner *owner)
+{
+	if (owner->nr_reqs) {
+		return;
+	}
+
+	list_del(&owner->list);
+	fput(owner->file);
+	kfree(owner);
+}
+
+/* Called with the lock held, the request must be completed */
+static void ion_uniphier_async_free_locked(struct ion_uniphier_async_req *req)
+{
+	idr_remove(&ion_uniphier_async_idr, req->ticket);
+	ion_uniphier_async_count--;
+	req->owner->nr_reqs--;
+	ion_uniphier_async_owner_put_locked(req->owner);
+
+	if (req->handle) {
+		ion_free(ion_uniphier_async_client, req->handle);
+	}
+	if (req->eventfd) {
+		eventfd_ctx_put(req->eventfd);
+	}
+	put_pid(req->pid);
+	kfree(req);
+}
+
+/*
+ * Drop completed requests of processes that have exited, and of clients
+ * that the user has closed (only the owner holds the file).
+ */
+static void ion_uniphier_async_reap_locked(void)
+{
+	struct ion_uniphier_async_req *req;
+	int id;
+
+	idr_for_each_entry(&ion_uniphier_async_idr, req, id) {
+		if (completion_done(&req->done) && !req->collecting &&
+			(!pid_task(req->pid, PIDTYPE_PID) ||
+			file_count(req->owner->file) == 1)) {
+			ion_uniphier_async_free_locked(req);
+		}
+	}
+}
+
+static void ion_uniphier_async_reap(struct work_struct *work)
+{
+	mutex_lock(&ion_uniphier_async_lock);
+	ion_uniphier_async_reap_locked();
+	if (ion_uniphier_async_count) {
+		schedule_delayed_work(&ion_uniphier_async_reap_work,
+			ION_UNIPHIER_ASYNC_REAP);
+	}
+	mutex_unlock(&ion_uniphier_async_lock);
+}
+
+/**
+ * Queue the allocation.
+ *
+ * @param client ion client of caller
+ * @param data argument of ION_UNIP_IOC_ALLOC_ASYNC
+ * @return 0 on success, error code on error
+ */
+int ion_uniphier_async_alloc(struct ion_client *client,
+	struct ion_uniphier_alloc_async_data *data)
+{
+	struct ion_uniphier_async_req *req;
+	int ret;
+
+	if (!ion_uniphier_async_wq) {
+		return -ENODEV;
+	}
+	if (!data->len || data->len > SIZE_MAX || data->align > SIZE_MAX) {
+		return -EINVAL;
+	}
+
+	req = kzalloc(sizeof(*req), GFP_KERNEL);
+	if (!req) {
+		return -ENOMEM;
+	}
+	INIT_WORK(&req->work, ion_uniphier_async_work);
+	init_completion(&req->done);
+	req->pid = get_task_pid(current->group_leader, PIDTYPE_PID);
+	req->len = data->len;
+	req->align = data->align;
+	req->heap_id_mask = data->heap_id_mask;
+	req->flags = data->flags;
+
+	if (data->eventfd != -1) {
+		req->eventfd = eventfd_ctx_fdget(data->eventfd);
+		if (IS_ERR(req->eventfd)) {
+			ret = PTR_ERR(req->eventfd);
+			req->eventfd = NULL;
+			goto err_free;
+		}
+	}
+
+	mutex_lock(&ion_uniphier_async_lock);
+	ion_uniphier_async_reap_locked();
+	req->owner = ion_uniphier_async_owner_get_locked(client);
+	if (IS_ERR(req->owner)) {
+		mutex_unlock(&ion_uniphier_async_lock);
+		ret = PTR_ERR(req->owner);
+		goto err_free;
+	}
+	if (req->owner->nr_reqs >= ION_UNIPHIER_ASYNC_MAX_PER_CLIENT) {
+		ion_uniphier_async_owner_put_locked(req->owner);
+		mutex_unlock(&ion_uniphier_async_lock);
+		ret = -EBUSY;
+		goto err_free;
+	}
+	/* cyclic, so that stale tickets do not hit new requests soon */
+	ret = idr_alloc_cyclic(&ion_uniphier_async_idr, req, 1, 0,
+		GFP_KERNEL);
+	if (ret < 0) {
+		ion_uniphier_async_owner_put_locked(req->owner);
+		mutex_unlock(&ion_uniphier_async_lock);
+		goto err_free;
+	}
+	req->ticket = ret;
+	req->owner->nr_reqs++;
+	if (!ion_uniphier_async_count++) {
+		schedule_delayed_work(&ion_uniphier_async_reap_work,
+			ION_UNIPHIER_ASYNC_REAP);
+	}
+	data->ticket = req->ticket;
+	queue_work(ion_uniphier_async_wq, &req->work);
+	mutex_unlock(&ion_uniphier_async_lock);
+
+	return 0;
+
+err_free:
+	if (req->eventfd) {
+		eventfd_ctx_put(req->eventfd);
+	}
+	put_pid(req->pid);
+	kfree(req);
+
+	return ret;
+}
+
+/**
+ * Collect the result of the queued allocation.
+ *
+ * @param client ion client of caller
+ * @param data argument of ION_UNIP_IOC_ALLOC_RESULT
+ * @return 0 on success, error code on error
+ */
+int ion_uniphier_async_result(struct ion_client *client,
+	struct ion_uniphier_alloc_result_data *data)
+{
+	struct ion_uniphier_async_req *req;
+	ion_phys_addr_t phys;
+	size_t len;
+	int ret;
+
+	if (data->flags & ~ION_UNIP_ASYNC_WAIT || data->reserved) {
+		return -EINVAL;
+	}
+
+	mutex_lock(&ion_uniphier_async_lock);
+	ion_uniphier_async_reap_locked();
+	req = idr_find(&ion_uniphier_async_idr, data->ticket);
+	if (!req || req->owner->file->private_data != client ||
+		req->pid != task_pid(current->group_leader)) {
+		mutex_unlock(&ion_uniphier_async_lock);
+		return -ENOENT;
+	}
+	if (req->collecting) {
+		mutex_unlock(&ion_uniphier_async_lock);
+		return -EBUSY;
+	}
+	if (!completion_done(&req->done)) {
+		if (!(data->flags & ION_UNIP_ASYNC_WAIT)) {
+			mutex_unlock(&ion_uniphier_async_lock);
+			return -EAGAIN;
+		}
+
+		/* the request stays while collecting is set */
+		req->collecting = true;
+		mutex_unlock(&ion_uniphier_async_lock);
+		ret = wait_for_completion_interruptible(&req->done);
+		mutex_lock(&ion_uniphier_async_lock);
+		req->collecting = false;
+		if (ret) {
+			mutex_unlock(&ion_uniphier_async_lock);
+			return ret;
+		}
+	}
+
+	ret = req->result;
+	if (!ret) {
+		data->fd = ion_share_dma_buf_fd(ion_uniphier_async_client,
+			req->handle);
+		if (data->fd < 0) {
+			/* keep the request, the caller may try again */
+			ret = data->fd;
+			mutex_unlock(&ion_uniphier_async_lock);
+			return ret;
+		}
+		ion_uniphier_trace_buffer(ION_UNIP_TRACE_SHARE,
+			ion_handle_buffer(req->handle));
+		if (ion_phys(ion_uniphier_async_client, req->handle, &phys,
+			&len)) {
+			phys = 0;
+			len = ion_handle_buffer(req->handle)->size;
+		}
+		data->phys = phys;
+		data->len = len;
+	}
+	ion_uniphier_async_free_locked(req);
+	mutex_unlock(&ion_uniphier_async_lock);
+
+	return ret;
+}
+
+/**
+ * Start the worker of asynchronous allocations.
+ *
+ * @param client kernel client that holds buffers until collected
+ * @return 0 on success, error code on error
+ */
+int ion_uniphier_async_init(struct ion_client *client)
+{
+	/* unbound, so that large clears of heaps run in parallel */
+	ion_uniphier_async_wq = alloc_workqueue("ion_uniphier_async",
+		WQ_UNBOUND, 0);
+	if (!ion_uniphier_async_wq) {
+		return -ENOMEM;
+	}
+	ion_uniphier_async_client = client;
+
+	return 0;
+}
+
+/**
+ * Wait for queued allocations and free results that are not collected,
+ * before the kernel client is destroyed.
+ */
+void ion_uniphier_async_destroy(void)
+{
+	struct ion_uniphier_async_req *req;
+	int id;
+
+	if (!ion_uniphier_async_wq) {
+		return;
+	}
+
+	destroy_workqueue(ion_uniphier_async_wq);
+	ion_uniphier_async_wq = NULL;
+	cancel_delayed_work_sync(&ion_uniphier_async_reap_work);
+
+	mutex_lock(&ion_uniphier_async_lock);
+	idr_for_each_entry(&ion_uniphier_async_idr, req, id) {
+		ion_uniphier_async_free_locked(req);
+	}
+	ion_uniphier_async_client = NULL;
+	mutex_unlock(&ion_uniphier_async_lock);
+}
@@ -0,0 +1,1250 @@
+/*
+ * Ion driver for Socionext UniPhier series.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define pr_fmt(fmt) "ion-uniphier-carveout: " fmt
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/types.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/list_sort.h>
+#include <linux/ktime.h>
+#include <linux/vmalloc.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/compiler.h>
+#include <linux/seq_file.h>
+#include <linux/scatterlist.h>
+#include <linux/dma-mapping.h>
+#include <linux/dma-buf.h>
+#include <linux/fs.h>
+#include <linux/platform_device.h>
+#include <linux/of.h>
+
+#include "ion/ion.h"
+#include "ion/ion_priv.h"
+
+#include "ion_of.h"
+#include "ion_uniphier_core.h"
+#include "ion_uniphier_alloc.h"
+#include "uapi/ion_uniphier.h"
+
+/**
+ * struct ion_uniphier_carveout_heap - carveout heap of UniPhier
+ *
+ * This is same as carveout heap of ion core, except for the placement
+ * that is done by ion_uniphier_alloc (shared with the replay tool) and
+ * the alignment of allocations that is honoured.
+ *
+ * The heap may have several memory regions (DT 'memory-region' with
+ * several phandles). The allocator covers from the lowest region to the
+ * highest, and the holes between regions are reserved, so that buffers
+ * never cross a hole.
+ *
+ * A lazy heap (DT 'socionext,lazy-init') is added to ion with its id,
+ * but the allocator and its bitmap are set up and the regions are
+ * cleared on the first allocation, for heaps that most sessions never
+ * use.
+ *
+ * @param heap   ion heap
+ * @param lock   protects alloc
+ * @param alloc  placement of buffers
+ * @param base   physical base address of the heap
+ * @param size   size of the heap, including holes between regions
+ * @param regions     memory regions, sorted by base
+ * @param nr_regions  number of regions
+ * @param align  minimum alignment of buffers
+ * @param wrap_lock   serializes wraps of physical range
+ * @param wrap_owner  task that is wrapping the range
+ * @param wrap_phys   physical address to wrap, used by wrap_owner
+ * @param nr_long_lived    number of long-lived buffers, protected by lock
+ * @param long_lived_size  total size of long-lived buffers
+ * @param min_largest_free low-water mark of the largest free block
+ * @param movable          movable buffers, protected by lock
+ * @param nr_movable       number of movable buffers
+ * @param nr_compact       number of compactions
+ * @param compact_moved    total bytes moved by compactions
+ * @param compact_last_ns  time of the last compaction
+ * @param policy        placement policy, for the setup
+ * @param bank_stride   bank interleave stride, for the setup
+ * @param bank_colours  number of bank colours, for the setup
+ * @param lazy   set up on the first allocation (socionext,lazy-init)
+ * @param ready  allocator is set up and regions are cleared
+ * @param nr_rebalance     number of moves of the boundary
+ * @param rebalanced       bytes got from (positive) or given to
+ *                         (negative) the adjacent heaps
+ */
+struct ion_uniphier_carveout_heap {
+	struct ion_heap heap;
+	struct mutex lock;
+	struct ion_uniphier_alloc alloc;
+	ion_phys_addr_t base;
+	size_t size;
+	struct ion_of_region regions[ION_OF_MAX_REGIONS];
+	int nr_regions;
+	ion_phys_addr_t align;
+	struct mutex wrap_lock;
+	struct task_struct *wrap_owner;
+	ion_phys_addr_t wrap_phys;
+	unsigned long nr_long_lived;
+	u64 long_lived_size;
+	u64 min_largest_free;
+	struct list_head movable;
+	unsigned long nr_movable;
+	unsigned long nr_compact;
+	u64 compact_moved;
+	u64 compact_last_ns;
+	enum ion_uniphier_alloc_policy policy;
+	u32 bank_stride;
+	u32 bank_colours;
+	bool lazy;
+	bool ready;
+	unsigned long nr_rebalance;
+	s64 rebalanced;
+};
+
+/**
+ * struct ion_uniphier_carveout_buffer - private data of the buffer
+ *
+ * @param table  sg_table of the buffer, returned by map_dma
+ * @param id     unique id of the buffer, for the event recorder
+ * @param phys   physical address of the buffer
+ * @param long_lived  placed from the top of the heap
+ * @param movable  may be moved by the compaction
+ * @param lock     protects phys, kmapped, pinned and vmas of the movable
+ *                 buffer (the lock of ion buffer is not initialized
+ *                 until allocate returns)
+ * @param kmapped  mapped to the kernel
+ * @param pinned   movable, but cannot be moved (a vma is not tracked,
+ *                 or the physical address is given out)
+ * @param buffer   ion buffer, for the compaction
+ * @param size     size of the buffer
+ * @param align    alignment of the buffer
+ * @param node     entry of movable list of the heap
+ * @param vmas     user mappings of the movable buffer
+ */
+struct ion_uniphier_carveout_buffer {
+	struct sg_table table;
+	u64 id;
+	ion_phys_addr_t phys;
+	bool long_lived;
+	bool movable;
+	struct mutex lock;
+	bool kmapped;
+	bool pinned;
+	struct ion_buffer *buffer;
+	size_t size;
+	u64 align;
+	struct list_head node;
+	struct list_head vmas;
+};
+
+/**
+ * struct ion_uniphier_carveout_vma - user mapping of movable buffer
+ *
+ * @param list  entry of vmas of the buffer
+ * @param vma   user mapping
+ */
+struct ion_uniphier_carveout_vma {
+	struct list_head list;
+	struct vm_area_struct *vma;
+};
+
+#define to_carveout_heap(h) \
+	container_of(h, struct ion_uniphier_carveout_heap, heap)
+
+/**
+ * Set up the allocator and clear the regions. Lazy heaps do this on the
+ * first allocation, others at create. Called with the lock of heap held,
+ * or before the heap is added.
+ *
+ * @param ch carveout heap
+ * @return 0 on success, error code on error
+ */
+static int ion_uniphier_carveout_heap_setup_locked(
+	struct ion_uniphier_carveout_heap *ch)
+{
+	struct ion_uniphier_alloc_stat st;
+	struct page *page;
+	ktime_t start;
+	int ret, i;
+
+	if (ch->ready) {
+		return 0;
+	}
+	start = ktime_get();
+
+	for (i = 0; i < ch->nr_regions && !(ch->heap.flags & ION_HEAP_FLAG_KEEP);
+		i++) {
+		/* holes may be used by others, clear only the regions */
+		page = pfn_to_page(PFN_DOWN(ch->regions[i].base));
+
+		ion_pages_sync_for_device(NULL, page, ch->regions[i].size,
+			DMA_BIDIRECTIONAL);
+		ret = ion_heap_pages_zero(page, ch->regions[i].size,
+			pgprot_writecombine(PAGE_KERNEL));
+		if (ret) {
+			return ret;
+		}
+	}
+
+	ret = ion_uniphier_alloc_init(&ch->alloc, ch->base, ch->size,
+		PAGE_SHIFT, ch->policy);
+	if (ret) {
+		return ret;
+	}
+	for (i = 1; i < ch->nr_regions; i++) {
+		phys_addr_t hole = ch->regions[i - 1].base +
+			ch->regions[i - 1].size;
+
+		if (hole == ch->regions[i].base) {
+			continue;
+		}
+		ret = ion_uniphier_alloc_reserve(&ch->alloc, hole,
+			ch->regions[i].base - hole);
+		if (ret) {
+			pr_warning("%s: cannot reserve hole %lx-%lx.\n",
+				ch->heap.name, (unsigned long)hole,
+				(unsigned long)ch->regions[i].base);
+			goto err_destroy;
+		}
+	}
+	ret = ion_uniphier_alloc_set_colour(&ch->alloc, ch->bank_stride,
+		ch->bank_colours);
+	if (ret) {
+		pr_warning("%s: invalid bank-stride:%x, bank-colours:%u.\n",
+			ch->heap.name, ch->bank_stride, ch->bank_colours);
+		goto err_destroy;
+	}
+	ion_uniphier_alloc_stat(&ch->alloc, &st);
+	ch->min_largest_free = st.largest_free;
+	WRITE_ONCE(ch->ready, true);
+
+	if (ch->lazy) {
+		pr_info("%s: set up on first use in %lld us.\n", ch->heap.name,
+			ktime_to_us(ktime_sub(ktime_get(), start)));
+	}
+
+	return 0;
+
+err_destroy:
+	ion_uniphier_alloc_destroy(&ch->alloc);
+
+	return ret;
+}
+
+static int ion_uniphier_carveout_heap_phys(struct ion_heap *heap,
+	struct ion_buffer *buffer, ion_phys_addr_t *addr, size_t *len)
+{
+	struct ion_uniphier_carveout_buffer *cb = buffer->priv_virt;
+
+	/* a device may keep the address, never move the buffer after this */
+	if (cb->movable) {
+		mutex_lock(&cb->lock);
+		cb->pinned = true;
+		mutex_unlock(&cb->lock);
+	}
+
+	*addr = cb->phys;
+	*len = buffer->size;
+
+	return 0;
+}
+
+static void *ion_uniphier_carveout_vmap(ion_phys_addr_t phys, size_t size,
+	pgprot_t prot)
+{
+	struct page *page = pfn_to_page(PFN_DOWN(phys));
+	int npages = PAGE_ALIGN(size) / PAGE_SIZE;
+	struct page **pages;
+	void *vaddr;
+	int i;
+
+	pages = vmalloc(sizeof(struct page *) * npages);
+	if (!pages) {
+		return NULL;
+	}
+	for (i = 0; i < npages; i++) {
+		pages[i] = nth_page(page, i);
+	}
+
+	vaddr = vmap(pages, npages, VM_MAP, prot);
+	vfree(pages);
+
+	return vaddr;
+}
+
+/**
+ * Move the buffer down to the new range. User mappings are unmapped,
+ * they are mapped again on fault. Called with the lock of heap and cb
+ * held.
+ *
+ * @param ch carveout heap
+ * @param cb buffer to move
+ * @param to physical address of new range below the buffer, allocated
+ *           by caller, it may overlap the buffer
+ * @return 0 on success, error code on error
+ */
+static int ion_uniphier_carveout_buffer_move(
+	struct ion_uniphier_carveout_heap *ch,
+	struct ion_uniphier_carveout_buffer *cb, ion_phys_addr_t to)
+{
+	struct ion_buffer *buffer = cb->buffer;
+	struct ion_uniphier_carveout_vma *cv;
+	ion_phys_addr_t from = cb->phys, freed;
+	size_t size = PAGE_ALIGN(cb->size);
+	bool cached = ion_buffer_cached(buffer);
+	pgprot_t prot;
+	void *src, *dst, *span = NULL;
+
+	prot = cached ? PAGE_KERNEL : pgprot_writecombine(PAGE_KERNEL);
+	if (to + size > from) {
+		/* overlapped, memmove() needs both in one mapping */
+		span = ion_uniphier_carveout_vmap(to, from + size - to, prot);
+		if (!span) {
+			return -ENOMEM;
+		}
+		dst = span;
+		src = span + (from - to);
+	} else {
+		src = ion_uniphier_carveout_vmap(from, size, prot);
+		dst = ion_uniphier_carveout_vmap(to, size, prot);
+		if (!src || !dst) {
+			if (src) {
+				vunmap(src);
+			}
+			if (dst) {
+				vunmap(dst);
+			}
+			return -ENOMEM;
+		}
+	}
+
+	list_for_each_entry(cv, &cb->vmas, list) {
+		zap_vma_ptes(cv->vma, cv->vma->vm_start,
+			cv->vma->vm_end - cv->vma->vm_start);
+	}
+
+	/* write back the data that user wrote through cached mapping */
+	if (cached) {
+		ion_pages_sync_for_device(NULL, pfn_to_page(PFN_DOWN(from)),
+			size, DMA_BIDIRECTIONAL);
+	}
+	memmove(dst, src, size);
+	if (span) {
+		vunmap(span);
+	} else {
+		vunmap(src);
+		vunmap(dst);
+	}
+	if (cached) {
+		ion_pages_sync_for_device(NULL, pfn_to_page(PFN_DOWN(to)),
+			size, DMA_BIDIRECTIONAL);
+		ion_pages_sync_for_device(NULL, pfn_to_page(PFN_DOWN(from)),
+			size, DMA_BIDIRECTIONAL);
+	}
+
+	cb->phys = to;
+	sg_set_page(cb->table.sgl, pfn_to_page(PFN_DOWN(to)), cb->size, 0);
+	/* same as ion_buffer_create() does */
+	sg_dma_address(cb->table.sgl) = sg_phys(cb->table.sgl);
+	sg_dma_len(cb->table.sgl) = cb->table.sgl->length;
+
+	/* free space of the heap is kept cleared */
+	freed = max_t(ion_phys_addr_t, from, to + size);
+	if (!(ch->heap.flags & ION_HEAP_FLAG_KEEP)) {
+		ion_heap_pages_zero(pfn_to_page(PFN_DOWN(freed)),
+			from + size - freed, pgprot_writecombine(PAGE_KERNEL));
+	}
+
+	return 0;
+}
+
+/**
+ * Check that no device may keep the address of the buffer. Legacy ion
+ * gives heaps no hook on dma-buf attach, so the buffer is movable only
+ * if it has at most one dma-buf, that is known by the tracked vmas.
+ * The caller checks the attachments of the dma-buf with its lock held.
+ * Called with the lock of buffer held.
+ *
+ * @param cb buffer to move
+ * @param dmabuf returns the dma-buf of the buffer, or NULL if none
+ * @return true if the buffer may be moved, false otherwise
+ */
+static bool ion_uniphier_carveout_buffer_unshared(
+	struct ion_uniphier_carveout_buffer *cb, struct dma_buf **dmabuf)
+{
+	struct ion_buffer *buffer = cb->buffer;
+	struct ion_uniphier_carveout_vma *cv;
+	struct dma_buf *db = NULL;
+	int handles, nr_dmabufs;
+
+	/*
+	 * Handles are counted after the reference is taken and before it
+	 * is dropped, read the count of handles first not to underestimate
+	 * the dma-bufs.
+	 */
+	handles = READ_ONCE(buffer->handle_count);
+	smp_rmb();
+	nr_dmabufs = ion_uniphier_buffer_refcount(buffer) - handles;
+
+	list_for_each_entry(cv, &cb->vmas, list) {
+		struct file *file = cv->vma->vm_file;
+
+		if (!file || (db && file->private_data != db)) {
+			return false;
+		}
+		db = file->private_data;
+	}
+	if (nr_dmabufs != (db ? 1 : 0)) {
+		return false;
+	}
+
+	*dmabuf = db;
+
+	return true;
+}
+
+static int ion_uniphier_carveout_buffer_cmp(void *priv, struct list_head *a,
+	struct list_head *b)
+{
+	struct ion_uniphier_carveout_buffer *ca, *cb;
+
+	ca = list_entry(a, struct ion_uniphier_carveout_buffer, node);
+	cb = list_entry(b, struct ion_uniphier_carveout_buffer, node);
+	if (ca->phys == cb->phys) {
+		return 0;
+	}
+
+	return (ca->phys < cb->phys) ? -1 : 1;
+}
+
+/**
+ * Move movable buffers to the lowest free space that fits, from the
+ * lowest buffer, so that free blocks are merged at the top of movable
+ * buffers. The new range may overlap the buffer, so a buffer slides
+ * down into a hole next to it that is smaller than itself. Buffers that
+ * are mapped to the kernel, whose physical address is given out, or
+ * that may be attached to devices are left.
+ * Called with the lock of heap held.
+ *
+ * @param ch carveout heap
+ * @return bytes moved
+ */
+static u64 ion_uniphier_carveout_heap_compact_locked(
+	struct ion_uniphier_carveout_heap *ch)
+{
+	struct ion_uniphier_carveout_buffer *cb;
+	unsigned long nr_moved = 0;
+	u64 moved = 0, from, to;
+	ktime_t start;
+
+	start = ktime_get();
+	list_sort(NULL, &ch->movable, ion_uniphier_carveout_buffer_cmp);
+
+	list_for_each_entry(cb, &ch->movable, node) {
+		struct dma_buf *dmabuf = NULL;
+		int ret;
+
+		mutex_lock(&cb->lock);
+		if (cb->pinned || cb->kmapped ||
+			!ion_uniphier_carveout_buffer_unshared(cb, &dmabuf)) {
+			mutex_unlock(&cb->lock);
+			continue;
+		}
+		/* devices attach under this lock, hold it during the move */
+		if (dmabuf) {
+			mutex_lock(&dmabuf->lock);
+			if (!list_empty(&dmabuf->attachments)) {
+				mutex_unlock(&dmabuf->lock);
+				mutex_unlock(&cb->lock);
+				continue;
+			}
+		}
+
+		ret = -ENOMEM;
+		from = cb->phys;
+		to = ion_uniphier_alloc_move_down(&ch->alloc, cb->phys,
+			cb->size, cb->align);
+		if (to != ION_UNIPHIER_ALLOC_FAIL) {
+			ret = ion_uniphier_carveout_buffer_move(ch, cb, to);
+			if (ret) {
+				/* nobody allocates under the lock of heap */
+				ion_uniphier_alloc_put(&ch->alloc, to,
+					cb->size);
+				ion_uniphier_alloc_claim(&ch->alloc, from,
+					cb->size);
+			}
+		}
+		if (dmabuf) {
+			mutex_unlock(&dmabuf->lock);
+		}
+		mutex_unlock(&cb->lock);
+		if (ret) {
+			continue;
+		}
+
+		nr_moved++;
+		moved += cb->size;
+	}
+
+	ch->nr_compact++;
+	ch->compact_moved += moved;
+	ch->compact_last_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	pr_info("%s: compaction moved %lu buffers, %llu bytes in %llu us.\n",
+		ch->heap.name, nr_moved, (unsigned long long)moved,
+		(unsigned long long)ch->compact_last_ns / NSEC_PER_USEC);
+
+	return moved;
+}
+
+/**
+ * Compact the carveout heap, see ion_uniphier_carveout_heap_compact_locked().
+ *
+ * @param heap carveout heap
+ * @return bytes moved
+ */
+u64 ion_uniphier_carveout_heap_compact(struct ion_heap *heap)
+{
+	struct ion_uniphier_carveout_heap *ch = to_carveout_heap(heap);
+	u64 moved;
+
+	mutex_lock(&ch->lock);
+	moved = ion_uniphier_carveout_heap_compact_locked(ch);
+	mutex_unlock(&ch->lock);
+
+	return moved;
+}
+
+/**
+ * Allocate the range, compact the heap and retry if there is no space.
+ * Called with the lock of heap held.
+ */
+static u64 ion_uniphier_carveout_heap_get(
+	struct ion_uniphier_carveout_heap *ch, u64 size, u64 align, bool top)
+{
+	u64 paddr;
+
+	paddr = top ? ion_uniphier_alloc_get_top(&ch->alloc, size, align) :
+		ion_uniphier_alloc_get(&ch->alloc, size, align);
+	if (paddr != ION_UNIPHIER_ALLOC_FAIL || !ch->nr_movable) {
+		return paddr;
+	}
+
+	if (!ion_uniphier_carveout_heap_compact_locked(ch)) {
+		return paddr;
+	}
+
+	return top ? ion_uniphier_alloc_get_top(&ch->alloc, size, align) :
+		ion_uniphier_alloc_get(&ch->alloc, size, align);
+}
+
+static int ion_uniphier_carveout_heap_allocate(struct ion_heap *heap,
+	struct ion_buffer *buffer, unsigned long size, unsigned long align,
+	unsigned long flags)
+{
+	struct ion_uniphier_carveout_heap *ch = to_carveout_heap(heap);
+	struct ion_uniphier_carveout_buffer *cb;
+	u64 paddr;
+	int ret;
+
+	if (!READ_ONCE(ch->ready)) {
+		mutex_lock(&ch->lock);
+		ret = ion_uniphier_carveout_heap_setup_locked(ch);
+		mutex_unlock(&ch->lock);
+		if (ret) {
+			pr_warning("%s: setup failed %d.\n", heap->name, ret);
+			return ret;
+		}
+	}
+
+	cb = kzalloc(sizeof(*cb), GFP_KERNEL);
+	if (!cb) {
+		return -ENOMEM;
+	}
+	ret = sg_alloc_table(&cb->table, 1, GFP_KERNEL);
+	if (ret) {
+		goto err_free;
+	}
+	cb->id = ion_uniphier_new_buffer_id();
+	mutex_init(&cb->lock);
+	cb->buffer = buffer;
+	cb->size = size;
+	cb->align = max(align, ch->align);
+	INIT_LIST_HEAD(&cb->node);
+	INIT_LIST_HEAD(&cb->vmas);
+
+	if (READ_ONCE(ch->wrap_owner) == current) {
+		/* called by ion_uniphier_carveout_heap_wrap() */
+		paddr = ch->wrap_phys;
+		mutex_lock(&ch->lock);
+		ret = ion_uniphier_alloc_claim(&ch->alloc, paddr, size);
+		mutex_unlock(&ch->lock);
+	} else if (flags & ION_UNIP_FLAG_LONG_LIVED) {
+		mutex_lock(&ch->lock);
+		paddr = ion_uniphier_carveout_heap_get(ch, size,
+			max(align, ch->align), true);
+		if (paddr != ION_UNIPHIER_ALLOC_FAIL) {
+			ch->nr_long_lived++;
+			ch->long_lived_size += size;
+		}
+		mutex_unlock(&ch->lock);
+		ret = (paddr == ION_UNIPHIER_ALLOC_FAIL) ? -ENOMEM : 0;
+		cb->long_lived = true;
+	} else {
+		mutex_lock(&ch->lock);
+		paddr = ion_uniphier_carveout_heap_get(ch, size,
+			max(align, ch->align), false);
+		mutex_unlock(&ch->lock);
+		ret = (paddr == ION_UNIPHIER_ALLOC_FAIL) ? -ENOMEM : 0;
+		cb->movable = !!(flags & ION_UNIP_FLAG_MOVABLE);
+	}
+	if (ret) {
+		ion_uniphier_trace_record(ION_UNIP_TRACE_ALLOC_FAIL, heap->id,
+			cb->id, paddr, size, align, flags, task_tgid_nr(current));
+		goto err_free_table;
+	}
+
+	cb->phys = paddr;
+	if (flags & (ION_UNIP_FLAG_PREFAULT | ION_UNIP_FLAG_MOVABLE)) {
+		/* ion core maps the buffer by map_user instead of on fault */
+		buffer->flags |= ION_FLAG_CACHED_NEEDS_SYNC;
+	}
+	sg_set_page(cb->table.sgl, pfn_to_page(PFN_DOWN(paddr)), size, 0);
+	buffer->priv_virt = cb;
+	if (cb->movable) {
+		mutex_lock(&ch->lock);
+		list_add_tail(&cb->node, &ch->movable);
+		ch->nr_movable++;
+		mutex_unlock(&ch->lock);
+	}
+
+	ion_uniphier_trace_record(ION_UNIP_TRACE_ALLOC, heap->id, cb->id,
+		paddr, size, align, flags, task_tgid_nr(current));
+
+	return 0;
+
+err_free_table:
+	sg_free_table(&cb->table);
+err_free:
+	kfree(cb);
+
+	return ret;
+}
+
+static void ion_uniphier_carveout_heap_free(struct ion_buffer *buffer)
+{
+	struct ion_heap *heap = buffer->heap;
+	struct ion_uniphier_carveout_heap *ch = to_carveout_heap(heap);
+	struct ion_uniphier_carveout_buffer *cb = buffer->priv_virt;
+	struct sg_table *table = &cb->table;
+	ion_phys_addr_t paddr = cb->phys;
+	struct ion_uniphier_alloc_stat st;
+
+	if (cb->movable) {
+		/* not moved any more, phys is stable from here */
+		mutex_lock(&ch->lock);
+		list_del(&cb->node);
+		ch->nr_movable--;
+		mutex_unlock(&ch->lock);
+		paddr = cb->phys;
+	}
+
+	ion_uniphier_trace_record(ION_UNIP_TRACE_FREE, heap->id, cb->id,
+		paddr, buffer->size, 0, buffer->flags, buffer->pid);
+
+	if (!(heap->flags & ION_HEAP_FLAG_KEEP)) {
+		ion_heap_buffer_zero(buffer);
+	}
+
+	if (ion_buffer_cached(buffer)) {
+		dma_sync_sg_for_device(NULL, table->sgl, table->nents,
+			DMA_BIDIRECTIONAL);
+	}
+
+	mutex_lock(&ch->lock);
+	/*
+	 * The heap is fuller before free than after, sample the largest
+	 * free block here. Free is deferred, this is not on the hot path.
+	 */
+	ion_uniphier_alloc_stat(&ch->alloc, &st);
+	if (st.largest_free < ch->min_largest_free) {
+		ch->min_largest_free = st.largest_free;
+	}
+	if (cb->long_lived) {
+		ch->nr_long_lived--;
+		ch->long_lived_size -= buffer->size;
+	}
+	ion_uniphier_alloc_put(&ch->alloc, paddr, buffer->size);
+	mutex_unlock(&ch->lock);
+
+	sg_free_table(table);
+	kfree(cb);
+}
+
+static struct sg_table *ion_uniphier_carveout_heap_map_dma(
+	struct ion_heap *heap, struct ion_buffer *buffer)
+{
+	struct ion_uniphier_carveout_buffer *cb = buffer->priv_virt;
+
+	return &cb->table;
+}
+
+static void ion_uniphier_carveout_heap_unmap_dma(struct ion_heap *heap,
+	struct ion_buffer *buffer)
+{
+}
+
+/*
+ * User mapping of movable buffer. The vma is mapped on fault with the
+ * current physical address, the compaction unmaps the tracked vmas when
+ * it moves the buffer.
+ */
+static int ion_uniphier_carveout_vma_add(struct ion_uniphier_carveout_buffer *cb,
+	struct vm_area_struct *vma)
+{
+	struct ion_uniphier_carveout_vma *cv;
+
+	cv = kzalloc(sizeof(*cv), GFP_KERNEL);
+	if (!cv) {
+		return -ENOMEM;
+	}
+	cv->vma = vma;
+	list_add(&cv->list, &cb->vmas);
+
+	return 0;
+}
+
+static void ion_uniphier_carveout_movable_vm_open(struct vm_area_struct *vma)
+{
+	struct ion_buffer *buffer = vma->vm_private_data;
+	struct ion_uniphier_carveout_buffer *cb = buffer->priv_virt;
+
+	mutex_lock(&cb->lock);
+	if (ion_uniphier_carveout_vma_add(cb, vma)) {
+		/* cannot unmap this vma on move */
+		pr_warning("buffer %llu is pinned.\n", cb->id);
+		cb->pinned = true;
+	}
+	mutex_unlock(&cb->lock);
+}
+
+static void ion_uniphier_carveout_movable_vm_close(struct vm_area_struct *vma)
+{
+	struct ion_buffer *buffer = vma->vm_private_data;
+	struct ion_uniphier_carveout_buffer *cb = buffer->priv_virt;
+	struct ion_uniphier_carveout_vma *cv, *tmp;
+
+	mutex_lock(&cb->lock);
+	list_for_each_entry_safe(cv, tmp, &cb->vmas, list) {
+		if (cv->vma == vma) {
+			list_del(&cv->list);
+			kfree(cv);
+			break;
+		}
+	}
+	mutex_unlock(&cb->lock);
+}
+
+static int ion_uniphier_carveout_movable_vm_fault(struct vm_area_struct *vma,
+	struct vm_fault *vmf)
+{
+	struct ion_buffer *buffer = vma->vm_private_data;
+	struct ion_uniphier_carveout_buffer *cb = buffer->priv_virt;
+	int ret;
+
+	if (vmf->pgoff >= PAGE_ALIGN(cb->size) >> PAGE_SHIFT) {
+		return VM_FAULT_SIGBUS;
+	}
+
+	mutex_lock(&cb->lock);
+	ret = vm_insert_pfn(vma, (unsigned long)vmf->virtual_address,
+		PFN_DOWN(cb->phys) + vmf->pgoff);
+	mutex_unlock(&cb->lock);
+	if (ret && ret != -EBUSY) {
+		return VM_FAULT_SIGBUS;
+	}
+
+	return VM_FAULT_NOPAGE;
+}
+
+static const struct vm_operations_struct ion_uniphier_carveout_movable_vm_ops = {
+	.open  = ion_uniphier_carveout_movable_vm_open,
+	.close = ion_uniphier_carveout_movable_vm_close,
+	.fault = ion_uniphier_carveout_movable_vm_fault,
+};
+
+static int ion_uniphier_carveout_heap_map_user_movable(
+	struct ion_buffer *buffer, struct vm_area_struct *vma)
+{
+	struct ion_uniphier_carveout_buffer *cb = buffer->priv_virt;
+	int ret;
+
+	/* vm_insert_pfn() cannot map a COW mapping */
+	if (!(vma->vm_flags & VM_SHARED)) {
+		pr_warning("buffer %llu: private mapping is not supported.\n",
+			cb->id);
+		return -EINVAL;
+	}
+
+	mutex_lock(&cb->lock);
+	ret = ion_uniphier_carveout_vma_add(cb, vma);
+	mutex_unlock(&cb->lock);
+	if (ret) {
+		return ret;
+	}
+
+	vma->vm_flags |= VM_IO | VM_PFNMAP | VM_DONTEXPAND | VM_DONTDUMP;
+	vma->vm_private_data = buffer;
+	vma->vm_ops = &ion_uniphier_carveout_movable_vm_ops;
+
+	return 0;
+}
+
+static int ion_uniphier_carveout_heap_map_user(struct ion_heap *heap,
+	struct ion_buffer *buffer, struct vm_area_struct *vma)
+{
+	struct ion_uniphier_carveout_buffer *cb = buffer->priv_virt;
+
+	ion_uniphier_trace_record(ION_UNIP_TRACE_MAP_USER, heap->id, cb->id,
+		cb->phys, vma->vm_end - vma->vm_start, 0, buffer->flags,
+		task_tgid_nr(current));
+
+	if (cb->movable) {
+		return ion_uniphier_carveout_heap_map_user_movable(buffer, vma);
+	}
+
+	return ion_heap_map_user(heap, buffer, vma);
+}
+
+static void *ion_uniphier_carveout_heap_map_kernel(struct ion_heap *heap,
+	struct ion_buffer *buffer)
+{
+	struct ion_uniphier_carveout_buffer *cb = buffer->priv_virt;
+	void *vaddr;
+
+	/* the buffer is not moved while it is mapped to the kernel */
+	mutex_lock(&cb->lock);
+	vaddr = ion_heap_map_kernel(heap, buffer);
+	cb->kmapped = !IS_ERR_OR_NULL(vaddr);
+	mutex_unlock(&cb->lock);
+
+	return vaddr;
+}
+
+static void ion_uniphier_carveout_heap_unmap_kernel(struct ion_heap *heap,
+	struct ion_buffer *buffer)
+{
+	struct ion_uniphier_carveout_buffer *cb = buffer->priv_virt;
+
+	mutex_lock(&cb->lock);
+	ion_heap_unmap_kernel(heap, buffer);
+	cb->kmapped = false;
+	mutex_unlock(&cb->lock);
+}
+
+static int ion_uniphier_carveout_heap_debug_show(struct ion_heap *heap,
+	struct seq_file *s, void *unused)
+{
+	struct ion_uniphier_carveout_heap *ch = to_carveout_heap(heap);
+	struct ion_uniphier_alloc_stat st;
+	unsigned long nr_long_lived, nr_movable, nr_compact;
+	u64 long_lived_size, min_largest_free, compact_moved, compact_last_ns;
+	unsigned long nr_rebalance;
+	s64 rebalanced;
+	ion_phys_addr_t base;
+	size_t size;
+	int i;
+
+	mutex_lock(&ch->lock);
+	if (!ch->ready) {
+		mutex_unlock(&ch->lock);
+		seq_printf(s, "%16s %16s\n", "lazy", "not set up");
+		return 0;
+	}
+	ion_uniphier_alloc_stat(&ch->alloc, &st);
+	base = ch->base;
+	size = ch->size;
+	nr_rebalance = ch->nr_rebalance;
+	rebalanced = ch->rebalanced;
+	nr_long_lived = ch->nr_long_lived;
+	long_lived_size = ch->long_lived_size;
+	min_largest_free = min(ch->min_largest_free, st.largest_free);
+	nr_movable = ch->nr_movable;
+	nr_compact = ch->nr_compact;
+	compact_moved = ch->compact_moved;
+	compact_last_ns = ch->compact_last_ns;
+	mutex_unlock(&ch->lock);
+
+	seq_printf(s, "%16s %16s\n", "policy",
+		ion_uniphier_alloc_policy_name(ch->alloc.policy));
+	seq_printf(s, "%16s %16lx\n", "base", (unsigned long)base);
+	seq_printf(s, "%16s %16lx\n", "end", (unsigned long)(base + size));
+	if (ch->nr_regions > 1) {
+		for (i = 0; i < ch->nr_regions; i++) {
+			seq_printf(s, "%16s %16lx %16zx\n", "region",
+				(unsigned long)ch->regions[i].base,
+				ch->regions[i].size);
+		}
+	}
+	if (ch->alloc.nr_colours) {
+		seq_printf(s, "%16s %16llx\n", "bank stride",
+			1ULL << ch->alloc.colour_shift);
+		seq_printf(s, "%16s %16u\n", "bank colours",
+			ch->alloc.nr_colours);
+	}
+	seq_printf(s, "%16s %16llu\n", "total", (unsigned long long)st.total);
+	seq_printf(s, "%16s %16llu\n", "free", (unsigned long long)st.free);
+	seq_printf(s, "%16s %16llu\n", "largest free",
+		(unsigned long long)st.largest_free);
+	seq_printf(s, "%16s %16lu\n", "free blocks", st.nr_free_blocks);
+	seq_printf(s, "%16s %16llu\n", "head free",
+		(unsigned long long)st.head_free);
+	seq_printf(s, "%16s %16llu\n", "tail free",
+		(unsigned long long)st.tail_free);
+	seq_printf(s, "%16s %16llu\n", "min largest free",
+		(unsigned long long)min_largest_free);
+	seq_printf(s, "%16s %16lu\n", "long-lived", nr_long_lived);
+	seq_printf(s, "%16s %16llu\n", "long-lived size",
+		(unsigned long long)long_lived_size);
+	seq_printf(s, "%16s %16lu\n", "movable", nr_movable);
+	seq_printf(s, "%16s %16lu\n", "compactions", nr_compact);
+	seq_printf(s, "%16s %16llu\n", "compact moved",
+		(unsigned long long)compact_moved);
+	seq_printf(s, "%16s %16llu\n", "last compact us",
+		(unsigned long long)compact_last_ns / NSEC_PER_USEC);
+	seq_printf(s, "%16s %16lu\n", "rebalances", nr_rebalance);
+	seq_printf(s, "%16s %16lld\n", "rebalanced", (long long)rebalanced);
+
+	return 0;
+}
+
+static struct ion_heap_ops ion_uniphier_carveout_heap_ops = {
+	.allocate     = ion_uniphier_carveout_heap_allocate,
+	.free         = ion_uniphier_carveout_heap_free,
+	.phys         = ion_uniphier_carveout_heap_phys,
+	.map_dma      = ion_uniphier_carveout_heap_map_dma,
+	.unmap_dma    = ion_uniphier_carveout_heap_unmap_dma,
+	.map_user     = ion_uniphier_carveout_heap_map_user,
+	.map_kernel   = ion_uniphier_carveout_heap_map_kernel,
+	.unmap_kernel = ion_uniphier_carveout_heap_unmap_kernel,
+};
+
+/**
+ * Get the id of the buffer for the event recorder.
+ *
+ * @param buffer ion buffer of the carveout heap
+ * @return unique id of the buffer
+ */
+u64 ion_uniphier_carveout_buffer_id(struct ion_buffer *buffer)
+{
+	struct ion_uniphier_carveout_buffer *cb = buffer->priv_virt;
+
+	return cb->id;
+}
+
+/**
+ * Get the range of the carveout heap, it changes by rebalancing.
+ *
+ * @param heap carveout heap
+ * @param base returns the physical base address
+ * @param size returns the size
+ */
+void ion_uniphier_carveout_heap_range(struct ion_heap *heap,
+	phys_addr_t *base, size_t *size)
+{
+	struct ion_uniphier_carveout_heap *ch = to_carveout_heap(heap);
+
+	mutex_lock(&ch->lock);
+	*base = ch->base;
+	*size = ch->size;
+	mutex_unlock(&ch->lock);
+}
+
+/**
+ * Create the buffer of the existing data in the heap. The range must be
+ * inside of the heap and must not be used by other buffers. The data is
+ * cleared when the buffer is freed, unless the heap keeps the contents
+ * (socionext,keep-contents).
+ *
+ * @param heap carveout heap
+ * @param client ion client that gets the handle
+ * @param phys physical address of the range, page aligned
+ * @param len length of the range
+ * @param flags ion allocation flags
+ * @return handle on success, ERR_PTR on error
+ */
+struct ion_handle *ion_uniphier_carveout_heap_wrap(struct ion_heap *heap,
+	struct ion_client *client, ion_phys_addr_t phys, size_t len,
+	unsigned long flags)
+{
+	struct ion_uniphier_carveout_heap *ch = to_carveout_heap(heap);
+	struct ion_handle *handle;
+	phys_addr_t base;
+	size_t size;
+
+	ion_uniphier_carveout_heap_range(heap, &base, &size);
+	if (!len || !PAGE_ALIGNED(phys) || phys < base ||
+		phys + len < phys || phys + len > base + size) {
+		pr_warning("%s: phys:%lx, len:%zx is out of heap.\n",
+			heap->name, (unsigned long)phys, len);
+		return ERR_PTR(-EINVAL);
+	}
+
+	mutex_lock(&ch->wrap_lock);
+	ch->wrap_phys = phys;
+	WRITE_ONCE(ch->wrap_owner, current);
+	handle = ion_alloc(client, len, PAGE_SIZE, 1 << heap->id, flags);
+	WRITE_ONCE(ch->wrap_owner, NULL);
+	mutex_unlock(&ch->wrap_lock);
+
+	if (!IS_ERR_OR_NULL(handle)) {
+		ion_uniphier_trace_buffer(ION_UNIP_TRACE_IMPORT,
+			ion_handle_buffer(handle));
+	}
+
+	return handle;
+}
+
+/**
+ * Move free space at the boundary of two adjacent carveout heaps, e.g.
+ * from the tail of one heap to the head of the next heap, so that heap
+ * sizes follow the mode of the product without reloading the driver.
+ * Only free space can be moved. Movable buffers are compacted first if
+ * the tail is not free enough.
+ *
+ * @param from heap that gives the space
+ * @param to heap that gets the space, adjacent to from
+ * @param size bytes to move, page aligned, less than the region of from
+ *             at the boundary
+ * @return 0 on success, -EINVAL if heaps are not adjacent, -EBUSY if the
+ *         space is used, -ENOMEM if no memory
+ */
+int ion_uniphier_carveout_heap_rebalance(struct ion_heap *from,
+	struct ion_heap *to, size_t size)
+{
+	struct ion_uniphier_carveout_heap *fh = to_carveout_heap(from);
+	struct ion_uniphier_carveout_heap *th = to_carveout_heap(to);
+	struct ion_uniphier_carveout_heap *lo, *hi;
+	struct ion_uniphier_alloc_stat st;
+	struct ion_of_region *fr, *tr;
+	ion_phys_addr_t addr;
+	bool tail;
+	int ret;
+
+	if (fh == th || !size || !PAGE_ALIGNED(size)) {
+		return -EINVAL;
+	}
+
+	/* lock in the order of address, heaps do not overlap */
+	lo = (fh->base < th->base) ? fh : th;
+	hi = (lo == fh) ? th : fh;
+	mutex_lock(&lo->lock);
+	mutex_lock_nested(&hi->lock, SINGLE_DEPTH_NESTING);
+
+	if (lo->base + lo->size != hi->base) {
+		pr_warning("%s and %s are not adjacent.\n", from->name,
+			to->name);
+		ret = -EINVAL;
+		goto out;
+	}
+	ret = ion_uniphier_carveout_heap_setup_locked(fh);
+	if (!ret) {
+		ret = ion_uniphier_carveout_heap_setup_locked(th);
+	}
+	if (ret) {
+		goto out;
+	}
+	tail = (lo == fh);
+	fr = tail ? &fh->regions[fh->nr_regions - 1] : &fh->regions[0];
+	tr = tail ? &th->regions[0] : &th->regions[th->nr_regions - 1];
+	if (size >= fr->size) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ion_uniphier_alloc_stat(&fh->alloc, &st);
+	if (tail && st.tail_free < size && fh->nr_movable) {
+		ion_uniphier_carveout_heap_compact_locked(fh);
+		ion_uniphier_alloc_stat(&fh->alloc, &st);
+	}
+	if ((tail ? st.tail_free : st.head_free) < size) {
+		ret = -EBUSY;
+		goto out;
+	}
+	addr = tail ? fh->base + fh->size - size : fh->base;
+
+	/* grow first, shrinking never fails and can undo the grow */
+	ret = ion_uniphier_alloc_resize(&th->alloc,
+		tail ? th->base - size : th->base, th->size + size);
+	if (ret) {
+		goto out;
+	}
+	ret = ion_uniphier_alloc_resize(&fh->alloc,
+		tail ? fh->base : fh->base + size, fh->size - size);
+	if (ret) {
+		ion_uniphier_alloc_resize(&th->alloc, th->base, th->size);
+		goto out;
+	}
+
+	if ((from->flags & ION_HEAP_FLAG_KEEP) &&
+		!(to->flags & ION_HEAP_FLAG_KEEP)) {
+		/* free space of the keep heap may have old data */
+		ion_heap_pages_zero(pfn_to_page(PFN_DOWN(addr)), size,
+			pgprot_writecombine(PAGE_KERNEL));
+	}
+
+	fh->size -= size;
+	fr->size -= size;
+	if (!tail) {
+		fh->base += size;
+		fr->base += size;
+	}
+	th->size += size;
+	tr->size += size;
+	if (tail) {
+		th->base -= size;
+		tr->base -= size;
+	}
+	fh->nr_rebalance++;
+	fh->rebalanced -= size;
+	th->nr_rebalance++;
+	th->rebalanced += size;
+	ion_uniphier_alloc_stat(&fh->alloc, &st);
+	fh->min_largest_free = min(fh->min_largest_free, st.largest_free);
+
+	pr_info("moved %zx bytes at %lx from %s to %s, %s:%lx-%lx, %s:%lx-%lx\n",
+		size, (unsigned long)addr, from->name, to->name,
+		lo->heap.name, (unsigned long)lo->base,
+		(unsigned long)(lo->base + lo->size),
+		hi->heap.name, (unsigned long)hi->base,
+		(unsigned long)(hi->base + hi->size));
+
+out:
+	mutex_unlock(&hi->lock);
+	mutex_unlock(&lo->lock);
+
+	return ret;
+}
+
+struct ion_heap *ion_uniphier_carveout_heap_create(
+	struct ion_platform_heap *heap_data)
+{
+	struct ion_uniphier_carveout_heap *ch;
+	struct device_node *np = ion_of_heap_node(heap_data);
+	enum ion_uniphier_alloc_policy policy = ION_UNIPHIER_ALLOC_FIRST_FIT;
+	struct ion_of_region regions[ION_OF_MAX_REGIONS];
+	const char *name;
+	u32 bank_stride = 0, bank_colours = 0;
+	int nr_regions = 0, ret, i;
+
+	if (np) {
+		nr_regions = ion_of_heap_regions(np, regions,
+			ARRAY_SIZE(regions));
+		if (nr_regions < 0) {
+			return ERR_PTR(nr_regions);
+		}
+	}
+	if (nr_regions <= 1) {
+		regions[0].base = heap_data->base;
+		regions[0].size = heap_data->size;
+		nr_regions = 1;
+	} else {
+		/* put each buffer in the region that fits best by default */
+		policy = ION_UNIPHIER_ALLOC_BEST_FIT;
+	}
+
+	if (np && !of_property_read_string(np, "socionext,alloc-policy",
+		&name)) {
+		ret = ion_uniphier_alloc_policy_parse(name);
+		if (ret < 0) {
+			pr_warning("%s: unknown alloc-policy '%s'.\n",
+				heap_data->name, name);
+			return ERR_PTR(ret);
+		}
+		policy = ret;
+	}
+	if (np) {
+		of_property_read_u32(np, "socionext,bank-stride", &bank_stride);
+		of_property_read_u32(np, "socionext,bank-colours",
+			&bank_colours);
+	}
+
+	ch = kzalloc(sizeof(*ch), GFP_KERNEL);
+	if (!ch) {
+		return ERR_PTR(-ENOMEM);
+	}
+
+	mutex_init(&ch->lock);
+	mutex_init(&ch->wrap_lock);
+	INIT_LIST_HEAD(&ch->movable);
+	ch->base = heap_data->base;
+	ch->size = heap_data->size;
+	memcpy(ch->regions, regions, sizeof(regions[0]) * nr_regions);
+	ch->nr_regions = nr_regions;
+	ch->policy = policy;
+	ch->bank_stride = bank_stride;
+	ch->bank_colours = bank_colours;
+	ch->lazy = !!(heap_data->flags & ION_PLAT_FLAG_LAZY);
+	ch->align = max_t(ion_phys_addr_t, heap_data->align, PAGE_SIZE);
+
+	ch->heap.ops = &ion_uniphier_carveout_heap_ops;
+	ch->heap.type = heap_data->type;
+	ch->heap.id = heap_data->id;
+	ch->heap.name = heap_data->name;
+	ch->heap.flags = ION_HEAP_FLAG_DEFER_FREE;
+	if (heap_data->flags & ION_PLAT_FLAG_KEEP) {
+		ch->heap.flags |= ION_HEAP_FLAG_KEEP;
+	}
+	ch->heap.debug_show = ion_uniphier_carveout_heap_debug_show;
+
+	if (!ch->lazy) {
+		ret = ion_uniphier_carveout_heap_setup_locked(ch);
+		if (ret) {
+			kfree(ch);
+			return ERR_PTR(ret);
+		}
+	}
+
+	pr_info("%s: base:%lx, size:%lx, policy:%s%s\n", heap_data->name,
+		(long)ch->base, (long)ch->size,
+		ion_uniphier_alloc_policy_name(policy),
+		ch->lazy ? ", lazy" : "");
+	for (i = 0; i < nr_regions && nr_regions > 1; i++) {
+		pr_info("%s: region %d base:%lx, size:%lx\n", heap_data->name,
+			i, (long)regions[i].base, (long)regions[i].size);
+	}
+	if (bank_colours > 1) {
+		pr_info("%s: bank-stride:%x, bank-colours:%u\n",
+			heap_data->name, bank_stride, bank_colours);
+	}
+
+	return &ch->heap;
+}
+
+void ion_uniphier_carveout_heap_destroy(struct ion_heap *heap)
+{
+	struct ion_uniphier_carveout_heap *ch = to_carveout_heap(heap);
+
+	ion_uniphier_alloc_destroy(&ch->alloc);
+	kfree(ch);
+}
@@ -0,0 +1,138 @@
+/*
+ * Ion driver for Socionext UniPhier series.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/vmalloc.h>
+#include <linux/math64.h>
+
+#define ion_uniphier_chunk_zalloc(size)    vzalloc(size)
+#define ion_uniphier_chunk_free(p)         vfree(p)
+#define ion_uniphier_chunk_div(a, b)       div64_u64(a, b)
+#else
+#include <errno.h>
+#include <stdlib.h>
+
+#define ion_uniphier_chunk_zalloc(size)    calloc(1, size)
+#define ion_uniphier_chunk_free(p)         free(p)
+#define ion_uniphier_chunk_div(a, b)       ((a) / (b))
+#endif
+
+#include "ion_uniphier_chunk.h"
+
+/**
+ * Initialize the pool. The tail of the range that is smaller than
+ * the chunk is not used.
+ *
+ * @param c           pool
+ * @param base        start address of the range
+ * @param size        size of the range in bytes
+ * @param chunk_size  size of each chunk in bytes
+ * @return 0 on success, negative error code on error
+ */
+int ion_uniphier_chunk_init(struct ion_uniphier_chunk *c, u64 base, u64 size,
+	u64 chunk_size)
+{
+	unsigned long i;
+
+	if (chunk_size == 0 || size < chunk_size) {
+		return -EINVAL;
+	}
+
+	c->base = base;
+	c->chunk_size = chunk_size;
+	c->nr_chunks = (unsigned long)ion_uniphier_chunk_div(size, chunk_size);
+	c->stack = ion_uniphier_chunk_zalloc(sizeof(unsigned long) *
+		c->nr_chunks);
+	c->used = ion_uniphier_chunk_zalloc(c->nr_chunks);
+	if (!c->stack || !c->used) {
+		ion_uniphier_chunk_destroy(c);
+		return -ENOMEM;
+	}
+
+	/* lower chunks are on the top of stack, they are used first */
+	for (i = 0; i < c->nr_chunks; i++) {
+		c->stack[i] = c->nr_chunks - 1 - i;
+	}
+	c->nr_free = c->nr_chunks;
+	c->min_free = c->nr_chunks;
+
+	return 0;
+}
+
+void ion_uniphier_chunk_destroy(struct ion_uniphier_chunk *c)
+{
+	ion_uniphier_chunk_free(c->stack);
+	ion_uniphier_chunk_free(c->used);
+	c->stack = NULL;
+	c->used = NULL;
+	c->nr_chunks = 0;
+	c->nr_free = 0;
+}
+
+/**
+ * Allocate a chunk.
+ *
+ * @param c  pool
+ * @return start address, or ION_UNIPHIER_CHUNK_FAIL if no chunk is free
+ */
+u64 ion_uniphier_chunk_get(struct ion_uniphier_chunk *c)
+{
+	unsigned long i;
+
+	if (c->nr_free == 0) {
+		return ION_UNIPHIER_CHUNK_FAIL;
+	}
+
+	i = c->stack[--c->nr_free];
+	c->used[i] = 1;
+	if (c->nr_free < c->min_free) {
+		c->min_free = c->nr_free;
+	}
+
+	return c->base + (u64)i * c->chunk_size;
+}
+
+/**
+ * Free the chunk.
+ *
+ * @param c     pool
+ * @param addr  start address returned by ion_uniphier_chunk_get()
+ * @return 0 on success, -EINVAL if addr is not an allocated chunk
+ */
+int ion_uniphier_chunk_put(struct ion_uniphier_chunk *c, u64 addr)
+{
+	unsigned long i;
+
+	if (addr < c->base) {
+		return -EINVAL;
+	}
+	i = (unsigned long)ion_uniphier_chunk_div(addr - c->base,
+		c->chunk_size);
+	if (i >= c->nr_chunks || !c->used[i] ||
+		addr != c->base + (u64)i * c->chunk_size) {
+		return -EINVAL;
+	}
+
+	c->used[i] = 0;
+	c->stack[c->nr_free++] = i;
+
+	return 0;
+}
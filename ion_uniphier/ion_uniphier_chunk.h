@@ -0,0 +1,74 @@
+/*
+ * Ion driver for Socionext UniPhier series.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ION_UNIPHIER_CHUNK_H__
+#define ION_UNIPHIER_CHUNK_H__
+
+/*
+ * Fixed-size chunk pool of the chunk heaps.
+ *
+ * The range is divided into chunks of the same size, free chunks are
+ * kept in a stack, so that get and put are O(1) and there is no external
+ * fragmentation. The last freed chunk is reused first.
+ *
+ * Like ion_uniphier_alloc.c, this does not depend on the kernel and is
+ * also compiled in userspace by the stand-in of /dev/ion (test/ion_stub.c).
+ * The caller has to serialize calls for the same pool.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint64_t u64;
+#endif
+
+/* Since 0 may be a valid address, this is used to indicate failure */
+#define ION_UNIPHIER_CHUNK_FAIL    ((u64)-1)
+
+/**
+ * struct ion_uniphier_chunk - pool of fixed-size chunks
+ *
+ * @param base        start address of the pool
+ * @param chunk_size  size of each chunk in bytes
+ * @param nr_chunks   number of chunks
+ * @param nr_free     number of free chunks, also the depth of stack
+ * @param min_free    low-water mark of nr_free
+ * @param stack       indices of free chunks
+ * @param used        one byte per chunk, set if allocated
+ */
+struct ion_uniphier_chunk {
+	u64 base;
+	u64 chunk_size;
+	unsigned long nr_chunks;
+	unsigned long nr_free;
+	unsigned long min_free;
+	unsigned long *stack;
+	unsigned char *used;
+};
+
+int ion_uniphier_chunk_init(struct ion_uniphier_chunk *c, u64 base, u64 size,
+	u64 chunk_size);
+void ion_uniphier_chunk_destroy(struct ion_uniphier_chunk *c);
+u64 ion_uniphier_chunk_get(struct ion_uniphier_chunk *c);
+int ion_uniphier_chunk_put(struct ion_uniphier_chunk *c, u64 addr);
+
+#endif /* ION_UNIPHIER_CHUNK_H__ */
@@ -0,0 +1,310 @@
+/*
+ * Ion driver for Socionext UniPhier series.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define pr_fmt(fmt) "ion-uniphier-chunk: " fmt
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/types.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/scatterlist.h>
+#include <linux/dma-mapping.h>
+
+#include "ion/ion.h"
+#include "ion/ion_priv.h"
+
+#include "ion_of.h"
+#include "ion_uniphier_core.h"
+#include "ion_uniphier_chunk.h"
+#include "uapi/ion_uniphier.h"
+
+/**
+ * struct ion_uniphier_chunk_heap - chunk heap of UniPhier
+ *
+ * The heap is divided into chunks of the same size, each buffer takes
+ * one chunk. Allocation time does not depend on the state of the heap
+ * and the heap is never fragmented, this is for pools of video frames.
+ *
+ * The chunk heap of ion core gets the chunk size from priv of platform
+ * heap, but ion_parse_dt() uses priv for the device of heap. So this
+ * driver has own chunk heap, the chunk size is passed by align of
+ * platform heap (DT property 'chunk-size').
+ *
+ * @param heap       ion heap
+ * @param lock       protects chunk and statistics
+ * @param chunk      pool of chunks
+ * @param base       physical base address of the heap
+ * @param size       size of the heap
+ * @param chunk_size size of each chunk
+ * @param nr_failed  number of failed allocations
+ */
+struct ion_uniphier_chunk_heap {
+	struct ion_heap heap;
+	struct mutex lock;
+	struct ion_uniphier_chunk chunk;
+	ion_phys_addr_t base;
+	size_t size;
+	size_t chunk_size;
+	unsigned long nr_failed;
+};
+
+/**
+ * struct ion_uniphier_chunk_buffer - private data of the buffer
+ *
+ * @param table  sg_table of the buffer, returned by map_dma
+ * @param id     unique id of the buffer, for the event recorder
+ * @param phys   physical address of the chunk
+ */
+struct ion_uniphier_chunk_buffer {
+	struct sg_table table;
+	u64 id;
+	ion_phys_addr_t phys;
+};
+
+#define to_chunk_heap(h) \
+	container_of(h, struct ion_uniphier_chunk_heap, heap)
+
+static int ion_uniphier_chunk_heap_allocate(struct ion_heap *heap,
+	struct ion_buffer *buffer, unsigned long size, unsigned long align,
+	unsigned long flags)
+{
+	struct ion_uniphier_chunk_heap *kh = to_chunk_heap(heap);
+	struct ion_uniphier_chunk_buffer *kb;
+	u64 paddr;
+	int ret;
+
+	/* chunks are placed at base + n * chunk_size */
+	if (size > kh->chunk_size ||
+		(align > PAGE_SIZE && (kh->base % align ||
+			kh->chunk_size % align))) {
+		return -EINVAL;
+	}
+
+	kb = kzalloc(sizeof(*kb), GFP_KERNEL);
+	if (!kb) {
+		return -ENOMEM;
+	}
+	ret = sg_alloc_table(&kb->table, 1, GFP_KERNEL);
+	if (ret) {
+		goto err_free;
+	}
+	kb->id = ion_uniphier_new_buffer_id();
+
+	mutex_lock(&kh->lock);
+	paddr = ion_uniphier_chunk_get(&kh->chunk);
+	if (paddr == ION_UNIPHIER_CHUNK_FAIL) {
+		kh->nr_failed++;
+	}
+	mutex_unlock(&kh->lock);
+	if (paddr == ION_UNIPHIER_CHUNK_FAIL) {
+		ion_uniphier_trace_record(ION_UNIP_TRACE_ALLOC_FAIL, heap->id,
+			kb->id, paddr, size, align, flags, task_tgid_nr(current));
+		ret = -ENOMEM;
+		goto err_free_table;
+	}
+
+	kb->phys = paddr;
+	sg_set_page(kb->table.sgl, pfn_to_page(PFN_DOWN(paddr)), size, 0);
+	buffer->priv_virt = kb;
+
+	ion_uniphier_trace_record(ION_UNIP_TRACE_ALLOC, heap->id, kb->id,
+		paddr, size, align, flags, task_tgid_nr(current));
+
+	return 0;
+
+err_free_table:
+	sg_free_table(&kb->table);
+err_free:
+	kfree(kb);
+
+	return ret;
+}
+
+static void ion_uniphier_chunk_heap_free(struct ion_buffer *buffer)
+{
+	struct ion_heap *heap = buffer->heap;
+	struct ion_uniphier_chunk_heap *kh = to_chunk_heap(heap);
+	struct ion_uniphier_chunk_buffer *kb = buffer->priv_virt;
+	struct sg_table *table = &kb->table;
+
+	ion_uniphier_trace_record(ION_UNIP_TRACE_FREE, heap->id, kb->id,
+		kb->phys, buffer->size, 0, buffer->flags, buffer->pid);
+
+	if (!(heap->flags & ION_HEAP_FLAG_KEEP)) {
+		ion_heap_buffer_zero(buffer);
+	}
+
+	if (ion_buffer_cached(buffer)) {
+		dma_sync_sg_for_device(NULL, table->sgl, table->nents,
+			DMA_BIDIRECTIONAL);
+	}
+
+	mutex_lock(&kh->lock);
+	if (ion_uniphier_chunk_put(&kh->chunk, kb->phys)) {
+		pr_warning("%s: phys:%lx is not a chunk.\n", heap->name,
+			(unsigned long)kb->phys);
+	}
+	mutex_unlock(&kh->lock);
+
+	sg_free_table(table);
+	kfree(kb);
+}
+
+static int ion_uniphier_chunk_heap_phys(struct ion_heap *heap,
+	struct ion_buffer *buffer, ion_phys_addr_t *addr, size_t *len)
+{
+	struct ion_uniphier_chunk_buffer *kb = buffer->priv_virt;
+
+	*addr = kb->phys;
+	*len = buffer->size;
+
+	return 0;
+}
+
+static struct sg_table *ion_uniphier_chunk_heap_map_dma(
+	struct ion_heap *heap, struct ion_buffer *buffer)
+{
+	struct ion_uniphier_chunk_buffer *kb = buffer->priv_virt;
+
+	return &kb->table;
+}
+
+static void ion_uniphier_chunk_heap_unmap_dma(struct ion_heap *heap,
+	struct ion_buffer *buffer)
+{
+}
+
+static int ion_uniphier_chunk_heap_debug_show(struct ion_heap *heap,
+	struct seq_file *s, void *unused)
+{
+	struct ion_uniphier_chunk_heap *kh = to_chunk_heap(heap);
+	unsigned long nr_free, min_free, nr_failed;
+
+	mutex_lock(&kh->lock);
+	nr_free = kh->chunk.nr_free;
+	min_free = kh->chunk.min_free;
+	nr_failed = kh->nr_failed;
+	mutex_unlock(&kh->lock);
+
+	seq_printf(s, "%16s %16lx\n", "base", (unsigned long)kh->base);
+	seq_printf(s, "%16s %16zx\n", "chunk size", kh->chunk_size);
+	seq_printf(s, "%16s %16lu\n", "chunks", kh->chunk.nr_chunks);
+	seq_printf(s, "%16s %16lu\n", "free chunks", nr_free);
+	seq_printf(s, "%16s %16lu\n", "min free chunks", min_free);
+	seq_printf(s, "%16s %16lu\n", "failed", nr_failed);
+
+	return 0;
+}
+
+static struct ion_heap_ops ion_uniphier_chunk_heap_ops = {
+	.allocate     = ion_uniphier_chunk_heap_allocate,
+	.free         = ion_uniphier_chunk_heap_free,
+	.phys         = ion_uniphier_chunk_heap_phys,
+	.map_dma      = ion_uniphier_chunk_heap_map_dma,
+	.unmap_dma    = ion_uniphier_chunk_heap_unmap_dma,
+	.map_user     = ion_heap_map_user,
+	.map_kernel   = ion_heap_map_kernel,
+	.unmap_kernel = ion_heap_unmap_kernel,
+};
+
+/**
+ * Get the id of the buffer for the event recorder.
+ *
+ * @param buffer ion buffer of the chunk heap
+ * @return unique id of the buffer
+ */
+u64 ion_uniphier_chunk_buffer_id(struct ion_buffer *buffer)
+{
+	struct ion_uniphier_chunk_buffer *kb = buffer->priv_virt;
+
+	return kb->id;
+}
+
+struct ion_heap *ion_uniphier_chunk_heap_create(
+	struct ion_platform_heap *heap_data)
+{
+	struct ion_uniphier_chunk_heap *kh;
+	size_t chunk_size = heap_data->align;
+	struct page *page;
+	int ret;
+
+	if (!chunk_size || !PAGE_ALIGNED(chunk_size)) {
+		pr_warning("%s: invalid chunk-size:%zx.\n", heap_data->name,
+			chunk_size);
+		return ERR_PTR(-EINVAL);
+	}
+
+	if (!(heap_data->flags & ION_PLAT_FLAG_KEEP)) {
+		page = pfn_to_page(PFN_DOWN(heap_data->base));
+
+		ion_pages_sync_for_device(NULL, page, heap_data->size,
+			DMA_BIDIRECTIONAL);
+		ret = ion_heap_pages_zero(page, heap_data->size,
+			pgprot_writecombine(PAGE_KERNEL));
+		if (ret) {
+			return ERR_PTR(ret);
+		}
+	}
+
+	kh = kzalloc(sizeof(*kh), GFP_KERNEL);
+	if (!kh) {
+		return ERR_PTR(-ENOMEM);
+	}
+
+	ret = ion_uniphier_chunk_init(&kh->chunk, heap_data->base,
+		heap_data->size, chunk_size);
+	if (ret) {
+		pr_warning("%s: size:%zx is smaller than chunk-size:%zx.\n",
+			heap_data->name, heap_data->size, chunk_size);
+		kfree(kh);
+		return ERR_PTR(ret);
+	}
+	mutex_init(&kh->lock);
+	kh->base = heap_data->base;
+	kh->size = heap_data->size;
+	kh->chunk_size = chunk_size;
+
+	kh->heap.ops = &ion_uniphier_chunk_heap_ops;
+	kh->heap.type = ION_HEAP_TYPE_CHUNK;
+	kh->heap.id = heap_data->id;
+	kh->heap.name = heap_data->name;
+	kh->heap.flags = ION_HEAP_FLAG_DEFER_FREE;
+	if (heap_data->flags & ION_PLAT_FLAG_KEEP) {
+		kh->heap.flags |= ION_HEAP_FLAG_KEEP;
+	}
+	kh->heap.debug_show = ion_uniphier_chunk_heap_debug_show;
+
+	pr_info("%s: base:%lx, size:%lx, chunk-size:%zx, chunks:%lu\n",
+		heap_data->name, (long)kh->base, (long)kh->size, chunk_size,
+		kh->chunk.nr_chunks);
+
+	return &kh->heap;
+}
+
+void ion_uniphier_chunk_heap_destroy(struct ion_heap *heap)
+{
+	struct ion_uniphier_chunk_heap *kh = to_chunk_heap(heap);
+
+	ion_uniphier_chunk_destroy(&kh->chunk);
+	kfree(kh);
+}
@@ -0,0 +1,518 @@
+/*
+ * Ion driver for Socionext UniPhier series.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define pr_fmt(fmt) "ion-uniphier-cma: " fmt
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/types.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/seq_file.h>
+#include <linux/scatterlist.h>
+#include <linux/dma-mapping.h>
+
+#include "ion/ion.h"
+#include "ion/ion_priv.h"
+
+#include "ion_uniphier_core.h"
+#include "uapi/ion_uniphier.h"
+
+/*
+ * CMA heap.
+ *
+ * Buffers are allocated from the CMA area of the heap device (reusable
+ * 'shared-dma-pool' of DT, assigned by of_reserved_mem_device_init()),
+ * so the memory serves the page cache while no buffer is allocated.
+ * The allocation may have to migrate pages, that takes time. To hide
+ * it, the user can pre-warm blocks before a stream starts, and hard
+ * real-time allocations (ION_UNIP_FLAG_REALTIME) use only pre-warmed
+ * blocks, otherwise they fall through to the next heap in the mask.
+ *
+ * The heap device has no IOMMU, the dma address is the physical
+ * address.
+ */
+
+/* Max number of pre-warmed blocks of a heap */
+#define ION_UNIPHIER_CMA_MAX_WARM       64
+/* Pre-warmed blocks are released if not used for this time */
+#define ION_UNIPHIER_CMA_WARM_TIMEOUT   (10 * HZ)
+
+/* Upper bounds of the latency histogram in us, the last is the rest */
+static const unsigned int ion_uniphier_cma_hist_us[] = {
+	100, 1000, 10000, 100000,
+};
+#define ION_UNIPHIER_CMA_NR_HIST  (ARRAY_SIZE(ion_uniphier_cma_hist_us) + 1)
+
+/**
+ * struct ion_uniphier_cma_block - block allocated from CMA
+ *
+ * @param list    entry of warm list of the heap
+ * @param cookie  returned by dma_alloc_attrs()
+ * @param phys    physical address
+ * @param size    size of the block
+ */
+struct ion_uniphier_cma_block {
+	struct list_head list;
+	void *cookie;
+	dma_addr_t phys;
+	size_t size;
+};
+
+/**
+ * struct ion_uniphier_cma_heap - CMA heap
+ *
+ * @param heap          ion heap
+ * @param dev           device that has the CMA area
+ * @param lock          protects warm list and statistics
+ * @param warm          pre-warmed blocks
+ * @param nr_warm       number of pre-warmed blocks
+ * @param warm_size     total size of pre-warmed blocks
+ * @param idle_work     releases pre-warmed blocks when they are not used
+ * @param used          total size of buffers
+ * @param peak_used     high-water mark of used
+ * @param nr_alloc      number of allocations from CMA
+ * @param nr_failed     number of failed allocations from CMA
+ * @param nr_warm_hit   number of buffers that took a pre-warmed block
+ * @param nr_rt_refused number of real-time allocations refused
+ * @param alloc_ns      total time of allocations from CMA
+ * @param alloc_ns_max  longest time of allocation from CMA
+ * @param hist          histogram of allocation time from CMA
+ */
+struct ion_uniphier_cma_heap {
+	struct ion_heap heap;
+	struct device *dev;
+	struct mutex lock;
+	struct list_head warm;
+	unsigned int nr_warm;
+	size_t warm_size;
+	struct delayed_work idle_work;
+	size_t used;
+	size_t peak_used;
+	unsigned long nr_alloc;
+	unsigned long nr_failed;
+	unsigned long nr_warm_hit;
+	unsigned long nr_rt_refused;
+	u64 alloc_ns;
+	u64 alloc_ns_max;
+	unsigned long hist[ION_UNIPHIER_CMA_NR_HIST];
+};
+
+/**
+ * struct ion_uniphier_cma_buffer - private data of the buffer
+ *
+ * @param table  sg_table of the buffer, returned by map_dma
+ * @param id     unique id of the buffer, for the event recorder
+ * @param block  backing block
+ */
+struct ion_uniphier_cma_buffer {
+	struct sg_table table;
+	u64 id;
+	struct ion_uniphier_cma_block *block;
+};
+
+#define to_cma_heap(h) \
+	container_of(h, struct ion_uniphier_cma_heap, heap)
+
+/**
+ * Allocate the block from CMA and clear it, record the time that
+ * includes the migration of pages.
+ *
+ * @param mh CMA heap
+ * @param size size of the block, page aligned
+ * @return block on success, NULL on error
+ */
+static struct ion_uniphier_cma_block *ion_uniphier_cma_block_alloc(
+	struct ion_uniphier_cma_heap *mh, size_t size)
+{
+	struct ion_uniphier_cma_block *blk;
+	struct page *page;
+	ktime_t start;
+	u64 ns;
+	int i;
+
+	blk = kzalloc(sizeof(*blk), GFP_KERNEL);
+	if (!blk) {
+		return NULL;
+	}
+
+	start = ktime_get();
+	blk->cookie = dma_alloc_attrs(mh->dev, size, &blk->phys, GFP_KERNEL,
+		DMA_ATTR_NO_KERNEL_MAPPING);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	mutex_lock(&mh->lock);
+	if (!blk->cookie) {
+		mh->nr_failed++;
+	} else {
+		mh->nr_alloc++;
+		mh->alloc_ns += ns;
+		mh->alloc_ns_max = max(mh->alloc_ns_max, ns);
+		for (i = 0; i < ARRAY_SIZE(ion_uniphier_cma_hist_us); i++) {
+			if (ns < ion_uniphier_cma_hist_us[i] * NSEC_PER_USEC) {
+				break;
+			}
+		}
+		mh->hist[i]++;
+	}
+	mutex_unlock(&mh->lock);
+
+	if (!blk->cookie) {
+		kfree(blk);
+		return NULL;
+	}
+	blk->size = size;
+
+	/* pages of CMA had other data, clear them */
+	page = pfn_to_page(PFN_DOWN(blk->phys));
+	ion_heap_pages_zero(page, size, pgprot_writecombine(PAGE_KERNEL));
+	ion_pages_sync_for_device(NULL, page, size, DMA_BIDIRECTIONAL);
+
+	return blk;
+}
+
+static void ion_uniphier_cma_block_free(struct ion_uniphier_cma_heap *mh,
+	struct ion_uniphier_cma_block *blk)
+{
+	dma_free_attrs(mh->dev, blk->size, blk->cookie, blk->phys,
+		DMA_ATTR_NO_KERNEL_MAPPING);
+	kfree(blk);
+}
+
+/**
+ * Take the pre-warmed block of the size. Called with the lock held.
+ */
+static struct ion_uniphier_cma_block *ion_uniphier_cma_take_warm(
+	struct ion_uniphier_cma_heap *mh, size_t size)
+{
+	struct ion_uniphier_cma_block *blk;
+
+	list_for_each_entry(blk, &mh->warm, list) {
+		if (blk->size == size) {
+			list_del(&blk->list);
+			mh->nr_warm--;
+			mh->warm_size -= size;
+			mh->nr_warm_hit++;
+			return blk;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Return all pre-warmed blocks to the system.
+ */
+static void ion_uniphier_cma_release_warm(struct ion_uniphier_cma_heap *mh)
+{
+	struct ion_uniphier_cma_block *blk, *tmp;
+	LIST_HEAD(list);
+
+	mutex_lock(&mh->lock);
+	list_splice_init(&mh->warm, &list);
+	mh->nr_warm = 0;
+	mh->warm_size = 0;
+	mutex_unlock(&mh->lock);
+
+	list_for_each_entry_safe(blk, tmp, &list, list) {
+		ion_uniphier_cma_block_free(mh, blk);
+	}
+}
+
+static void ion_uniphier_cma_idle_work(struct work_struct *work)
+{
+	struct ion_uniphier_cma_heap *mh = container_of(to_delayed_work(work),
+		struct ion_uniphier_cma_heap, idle_work);
+
+	ion_uniphier_cma_release_warm(mh);
+}
+
+static int ion_uniphier_cma_heap_allocate(struct ion_heap *heap,
+	struct ion_buffer *buffer, unsigned long size, unsigned long align,
+	unsigned long flags)
+{
+	struct ion_uniphier_cma_heap *mh = to_cma_heap(heap);
+	struct ion_uniphier_cma_buffer *mb;
+	struct ion_uniphier_cma_block *blk;
+	int ret;
+
+	size = PAGE_ALIGN(size);
+	/* CMA aligns the block to its order */
+	if (align > (PAGE_SIZE << get_order(size))) {
+		return -EINVAL;
+	}
+
+	mb = kzalloc(sizeof(*mb), GFP_KERNEL);
+	if (!mb) {
+		return -ENOMEM;
+	}
+	ret = sg_alloc_table(&mb->table, 1, GFP_KERNEL);
+	if (ret) {
+		goto err_free;
+	}
+	mb->id = ion_uniphier_new_buffer_id();
+
+	mutex_lock(&mh->lock);
+	blk = ion_uniphier_cma_take_warm(mh, size);
+	if (blk) {
+		/* the stream is active, keep the rest of blocks */
+		mod_delayed_work(system_wq, &mh->idle_work,
+			ION_UNIPHIER_CMA_WARM_TIMEOUT);
+	} else if (flags & ION_UNIP_FLAG_REALTIME) {
+		mh->nr_rt_refused++;
+	}
+	mutex_unlock(&mh->lock);
+
+	if (!blk && !(flags & ION_UNIP_FLAG_REALTIME)) {
+		blk = ion_uniphier_cma_block_alloc(mh, size);
+	}
+	if (!blk) {
+		ion_uniphier_trace_record(ION_UNIP_TRACE_ALLOC_FAIL, heap->id,
+			mb->id, (u64)-1, size, align, flags,
+			task_tgid_nr(current));
+		ret = (flags & ION_UNIP_FLAG_REALTIME) ? -EAGAIN : -ENOMEM;
+		goto err_free_table;
+	}
+
+	mb->block = blk;
+	sg_set_page(mb->table.sgl, pfn_to_page(PFN_DOWN(blk->phys)), size, 0);
+	buffer->priv_virt = mb;
+
+	mutex_lock(&mh->lock);
+	mh->used += size;
+	mh->peak_used = max(mh->peak_used, mh->used);
+	mutex_unlock(&mh->lock);
+
+	ion_uniphier_trace_record(ION_UNIP_TRACE_ALLOC, heap->id, mb->id,
+		blk->phys, size, align, flags, task_tgid_nr(current));
+
+	return 0;
+
+err_free_table:
+	sg_free_table(&mb->table);
+err_free:
+	kfree(mb);
+
+	return ret;
+}
+
+static void ion_uniphier_cma_heap_free(struct ion_buffer *buffer)
+{
+	struct ion_uniphier_cma_heap *mh = to_cma_heap(buffer->heap);
+	struct ion_uniphier_cma_buffer *mb = buffer->priv_virt;
+
+	ion_uniphier_trace_record(ION_UNIP_TRACE_FREE, mh->heap.id, mb->id,
+		mb->block->phys, mb->block->size, 0, buffer->flags,
+		buffer->pid);
+
+	mutex_lock(&mh->lock);
+	mh->used -= mb->block->size;
+	mutex_unlock(&mh->lock);
+
+	/* the memory goes back to the system, cleared on next allocation */
+	ion_uniphier_cma_block_free(mh, mb->block);
+	sg_free_table(&mb->table);
+	kfree(mb);
+}
+
+static int ion_uniphier_cma_heap_phys(struct ion_heap *heap,
+	struct ion_buffer *buffer, ion_phys_addr_t *addr, size_t *len)
+{
+	struct ion_uniphier_cma_buffer *mb = buffer->priv_virt;
+
+	*addr = mb->block->phys;
+	*len = buffer->size;
+
+	return 0;
+}
+
+static struct sg_table *ion_uniphier_cma_heap_map_dma(struct ion_heap *heap,
+	struct ion_buffer *buffer)
+{
+	struct ion_uniphier_cma_buffer *mb = buffer->priv_virt;
+
+	return &mb->table;
+}
+
+static void ion_uniphier_cma_heap_unmap_dma(struct ion_heap *heap,
+	struct ion_buffer *buffer)
+{
+}
+
+static int ion_uniphier_cma_heap_debug_show(struct ion_heap *heap,
+	struct seq_file *s, void *unused)
+{
+	struct ion_uniphier_cma_heap *mh = to_cma_heap(heap);
+	int i;
+
+	mutex_lock(&mh->lock);
+	seq_printf(s, "%16s %16zu\n", "used", mh->used);
+	seq_printf(s, "%16s %16zu\n", "peak used", mh->peak_used);
+	seq_printf(s, "%16s %16u\n", "warm blocks", mh->nr_warm);
+	seq_printf(s, "%16s %16zu\n", "warm size", mh->warm_size);
+	seq_printf(s, "%16s %16lu\n", "cma allocs", mh->nr_alloc);
+	seq_printf(s, "%16s %16lu\n", "cma failed", mh->nr_failed);
+	seq_printf(s, "%16s %16lu\n", "warm hits", mh->nr_warm_hit);
+	seq_printf(s, "%16s %16lu\n", "rt refused", mh->nr_rt_refused);
+	seq_printf(s, "%16s %16llu\n", "alloc avg us",
+		mh->nr_alloc ? (unsigned long long)div64_u64(mh->alloc_ns,
+			mh->nr_alloc) / NSEC_PER_USEC : 0ULL);
+	seq_printf(s, "%16s %16llu\n", "alloc max us",
+		(unsigned long long)mh->alloc_ns_max / NSEC_PER_USEC);
+	for (i = 0; i < ION_UNIPHIER_CMA_NR_HIST; i++) {
+		if (i < ARRAY_SIZE(ion_uniphier_cma_hist_us)) {
+			seq_printf(s, "%10s %5u %16lu\n", "alloc us <",
+				ion_uniphier_cma_hist_us[i], mh->hist[i]);
+		} else {
+			seq_printf(s, "%16s %16lu\n", "alloc us longer",
+				mh->hist[i]);
+		}
+	}
+	mutex_unlock(&mh->lock);
+
+	return 0;
+}
+
+static struct ion_heap_ops ion_uniphier_cma_heap_ops = {
+	.allocate     = ion_uniphier_cma_heap_allocate,
+	.free         = ion_uniphier_cma_heap_free,
+	.phys         = ion_uniphier_cma_heap_phys,
+	.map_dma      = ion_uniphier_cma_heap_map_dma,
+	.unmap_dma    = ion_uniphier_cma_heap_unmap_dma,
+	.map_user     = ion_heap_map_user,
+	.map_kernel   = ion_heap_map_kernel,
+	.unmap_kernel = ion_heap_unmap_kernel,
+};
+
+/**
+ * Get the id of the buffer for the event recorder.
+ *
+ * @param buffer ion buffer of the CMA heap
+ * @return unique id of the buffer
+ */
+u64 ion_uniphier_cma_buffer_id(struct ion_buffer *buffer)
+{
+	struct ion_uniphier_cma_buffer *mb = buffer->priv_virt;
+
+	return mb->id;
+}
+
+/**
+ * Pre-warm the CMA heap, see struct ion_uniphier_cma_prewarm_data.
+ *
+ * @param heap CMA heap
+ * @param size size of each block
+ * @param count number of blocks to add, 0 to release all
+ * @return number of pre-warmed blocks on success, error code on error
+ */
+int ion_uniphier_cma_heap_prewarm(struct ion_heap *heap, size_t size,
+	unsigned int count)
+{
+	struct ion_uniphier_cma_heap *mh = to_cma_heap(heap);
+	struct ion_uniphier_cma_block *blk;
+	unsigned int i, nr_warm;
+	ktime_t start;
+
+	if (count == 0) {
+		cancel_delayed_work_sync(&mh->idle_work);
+		ion_uniphier_cma_release_warm(mh);
+		return 0;
+	}
+	size = PAGE_ALIGN(size);
+	if (!size || count > ION_UNIPHIER_CMA_MAX_WARM) {
+		return -EINVAL;
+	}
+
+	start = ktime_get();
+	for (i = 0; i < count; i++) {
+		mutex_lock(&mh->lock);
+		nr_warm = mh->nr_warm;
+		mutex_unlock(&mh->lock);
+		if (nr_warm >= ION_UNIPHIER_CMA_MAX_WARM) {
+			break;
+		}
+
+		blk = ion_uniphier_cma_block_alloc(mh, size);
+		if (!blk) {
+			break;
+		}
+
+		mutex_lock(&mh->lock);
+		list_add_tail(&blk->list, &mh->warm);
+		mh->nr_warm++;
+		mh->warm_size += size;
+		mutex_unlock(&mh->lock);
+	}
+	pr_info("%s: pre-warmed %u blocks of %zx bytes in %lld us.\n",
+		heap->name, i, size,
+		ktime_to_us(ktime_sub(ktime_get(), start)));
+
+	mutex_lock(&mh->lock);
+	nr_warm = mh->nr_warm;
+	mod_delayed_work(system_wq, &mh->idle_work,
+		ION_UNIPHIER_CMA_WARM_TIMEOUT);
+	mutex_unlock(&mh->lock);
+
+	return (i == 0) ? -ENOMEM : nr_warm;
+}
+
+struct ion_heap *ion_uniphier_cma_heap_create(
+	struct ion_platform_heap *heap_data)
+{
+	struct ion_uniphier_cma_heap *mh;
+
+	/* priv is the heap device, set by ion_parse_dt() */
+	if (!heap_data->priv) {
+		pr_warning("%s: no device of CMA.\n", heap_data->name);
+		return ERR_PTR(-EINVAL);
+	}
+
+	mh = kzalloc(sizeof(*mh), GFP_KERNEL);
+	if (!mh) {
+		return ERR_PTR(-ENOMEM);
+	}
+	mh->dev = heap_data->priv;
+	mutex_init(&mh->lock);
+	INIT_LIST_HEAD(&mh->warm);
+	INIT_DELAYED_WORK(&mh->idle_work, ion_uniphier_cma_idle_work);
+
+	mh->heap.ops = &ion_uniphier_cma_heap_ops;
+	mh->heap.type = ION_UNIPHIER_HEAP_TYPE_CMA;
+	mh->heap.id = heap_data->id;
+	mh->heap.name = heap_data->name;
+	mh->heap.debug_show = ion_uniphier_cma_heap_debug_show;
+
+	pr_info("%s: CMA of %s\n", heap_data->name, dev_name(mh->dev));
+
+	return &mh->heap;
+}
+
+void ion_uniphier_cma_heap_destroy(struct ion_heap *heap)
+{
+	struct ion_uniphier_cma_heap *mh = to_cma_heap(heap);
+
+	cancel_delayed_work_sync(&mh->idle_work);
+	ion_uniphier_cma_release_warm(mh);
+	kfree(mh);
+}
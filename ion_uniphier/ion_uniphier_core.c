@@ -23,6 +23,7 @@
 
 #include <linux/module.h>
 #include <linux/moduleparam.h>
+#include <linux/version.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/errno.h>
@@ -31,24 +32,52 @@
 #include <linux/device.h>
 #include <linux/uaccess.h>
 #include <linux/highmem.h>
+#include <linux/scatterlist.h>
 #include <linux/platform_device.h>
 #include <linux/dma-mapping.h>
 #include <linux/of.h>
+#include <linux/debugfs.h>
+#include <linux/dma-buf.h>
+#include <linux/capability.h>
+#include <linux/file.h>
+#include <linux/fdtable.h>
+#include <linux/fs.h>
+#include <linux/sched.h>
+#include <linux/async.h>
+#include <linux/atomic.h>
 
 #include <ion/ion.h>
 #include <ion/ion_priv.h>
 #include <ion_of.h>
 
 #include "ion_uniphier_core.h"
+#include "ion_uniphier_planes.h"
 #include "uapi/ion_uniphier.h"
 
+struct ion_uniphier_device;
+
+/**
+ * struct ion_uniphier_heap_init - argument of the async heap creation
+ *
+ * @param d      device
+ * @param index  index of the heap in ion_pdata
+ */
+struct ion_uniphier_heap_init {
+	struct ion_uniphier_device *d;
+	int index;
+};
+
 struct ion_uniphier_device {
 	struct ion_device *ion_dev;
 	struct ion_platform_data *ion_pdata;
 	struct ion_platform_heap *ion_plat_heaps;
 	int ion_num_heaps;
 	struct ion_heap **ion_heaps;
+	struct ion_uniphier_heap_init *heap_inits;
+	struct ion_heap *userptr_heap;
+	struct ion_client *kclient;
 	int use_dt;
+	struct dentry *debug_root;
 };
 
 static struct ion_device *ion_dev;
@@ -58,19 +87,195 @@ struct ion_device *ion_uniphier_get_ion_device(void)
 }
 EXPORT_SYMBOL(ion_uniphier_get_ion_device);
 
+static struct ion_uniphier_device *ion_uniphier_dev;
+
+/*
+ * Heaps are created in parallel by the async init, except for early
+ * heaps (socionext,early-init of DT) that are created in probe. Other
+ * heaps come online as they finish, clearing of large carveouts is not
+ * on the critical path of boot. Heaps used during boot, e.g. the fb heap
+ * for the splash, must be marked early in DT.
+ */
+static bool async_init = true;
+module_param(async_init, bool, 0444);
+MODULE_PARM_DESC(async_init, "Create heaps that are not early in parallel after probe");
+
+static ASYNC_DOMAIN_EXCLUSIVE(ion_uniphier_async_domain);
+
+/**
+ * Wait for the async heap creation. The ioctls and the exported
+ * functions that look up heaps of this driver call this first, so that
+ * they see every heap that is created successfully, with its
+ * preallocated buffers. Returns at once after all heaps are up.
+ */
+static void ion_uniphier_heaps_wait(void)
+{
+	async_synchronize_full_domain(&ion_uniphier_async_domain);
+}
+
+/**
+ * Find the heap of this driver.
+ *
+ * @param d device
+ * @param heap_id id of heap
+ * @return heap, or NULL if not found
+ */
+static struct ion_heap *ion_uniphier_find_heap(struct ion_uniphier_device *d,
+	unsigned int heap_id)
+{
+	struct ion_heap *heap;
+	int i;
+
+	ion_uniphier_heaps_wait();
+	for (i = 0; i < d->ion_num_heaps; i++) {
+		/* async heaps are published after they are added */
+		heap = smp_load_acquire(&d->ion_heaps[i]);
+		if (heap && heap->id == heap_id) {
+			return heap;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * debugfs 'ion_uniphier/compact', write the heap id to compact the
+ * carveout heap, e.g. echo 15 > compact. The result is printed to the
+ * kernel log and to debug_show of the heap.
+ */
+static int ion_uniphier_compact_set(void *data, u64 val)
+{
+	struct ion_uniphier_device *d = data;
+	struct ion_heap *heap;
+
+	heap = ion_uniphier_find_heap(d, val);
+	if (!heap || heap->type != ION_HEAP_TYPE_CARVEOUT) {
+		return -ENODEV;
+	}
+	ion_uniphier_carveout_heap_compact(heap);
+
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(ion_uniphier_compact_fops, NULL,
+	ion_uniphier_compact_set, "%llu\n");
+
+/**
+ * Move free space between adjacent carveout heaps, see struct
+ * ion_uniphier_rebalance_data.
+ *
+ * @param data argument of ION_UNIP_IOC_REBALANCE
+ * @return 0 on success, error code on error
+ */
+static int ion_uniphier_rebalance(struct ion_uniphier_rebalance_data *data)
+{
+	struct ion_uniphier_device *d = ion_uniphier_dev;
+	struct ion_heap *from, *to;
+	phys_addr_t base;
+	size_t size;
+	int ret;
+
+	if (!d) {
+		return -ENODEV;
+	}
+
+	from = ion_uniphier_find_heap(d, data->from_heap_id);
+	to = ion_uniphier_find_heap(d, data->to_heap_id);
+	if (!from || from->type != ION_HEAP_TYPE_CARVEOUT ||
+		!to || to->type != ION_HEAP_TYPE_CARVEOUT) {
+		pr_warning("heap:%u or heap:%u is not carveout heap.\n",
+			data->from_heap_id, data->to_heap_id);
+		return -EINVAL;
+	}
+	if (data->size > SIZE_MAX) {
+		return -EINVAL;
+	}
+
+	ret = ion_uniphier_carveout_heap_rebalance(from, to, data->size);
+	if (ret) {
+		return ret;
+	}
+
+	ion_uniphier_carveout_heap_range(from, &base, &size);
+	data->from_base = base;
+	data->from_size = size;
+	ion_uniphier_carveout_heap_range(to, &base, &size);
+	data->to_base = base;
+	data->to_size = size;
+
+	return 0;
+}
+
+static struct ion_handle *ion_uniphier_wrap_phys_handle(
+	struct ion_client *client, unsigned int heap_id, u64 phys, u64 len,
+	unsigned long flags)
+{
+	struct ion_uniphier_device *d = ion_uniphier_dev;
+	struct ion_heap *heap;
+
+	if (!d) {
+		return ERR_PTR(-ENODEV);
+	}
+
+	heap = ion_uniphier_find_heap(d, heap_id);
+	if (!heap || heap->type != ION_HEAP_TYPE_CARVEOUT) {
+		pr_warning("heap:%u is not carveout heap.\n", heap_id);
+		return ERR_PTR(-EINVAL);
+	}
+
+	return ion_uniphier_carveout_heap_wrap(heap, client, phys, len, flags);
+}
+
+/**
+ * Wrap the physical range of the carveout heap as dma-buf, for drivers
+ * that share the data that firmware or co-processors have made.
+ * The range must be inside of the heap and must not be used by other
+ * buffers. The data is cleared when the dma-buf is released, unless the
+ * heap keeps the contents (socionext,keep-contents).
+ *
+ * @param heap_id id of carveout heap that has the range
+ * @param phys physical address of the range, page aligned
+ * @param len length of the range
+ * @param flags ion allocation flags
+ * @return dma-buf on success, ERR_PTR on error
+ */
+struct dma_buf *ion_uniphier_wrap_phys(unsigned int heap_id, phys_addr_t phys,
+	size_t len, unsigned long flags)
+{
+	struct ion_uniphier_device *d = ion_uniphier_dev;
+	struct ion_handle *handle;
+	struct dma_buf *dmabuf;
+
+	if (!d) {
+		return ERR_PTR(-ENODEV);
+	}
+
+	handle = ion_uniphier_wrap_phys_handle(d->kclient, heap_id, phys, len,
+		flags);
+	if (IS_ERR(handle)) {
+		return ERR_CAST(handle);
+	}
+
+	/* dma-buf holds the buffer, the handle is no longer needed */
+	dmabuf = ion_share_dma_buf(d->kclient, handle);
+	ion_free(d->kclient, handle);
+
+	return dmabuf;
+}
+EXPORT_SYMBOL(ion_uniphier_wrap_phys);
+
 /*
  * Use Device Tree:
  *   struct ion_of_heap of_heaps[]
- *     --[ion_parse_dt()]-----> struct ion_platform_data *
- *     --[.heaps]-------------> struct ion_platform_heap *
- *     --[ion_heap_create()]--> struct ion_heap *
+ *     --[ion_parse_dt()]--------------> struct ion_platform_data *
+ *     --[.heaps]----------------------> struct ion_platform_heap *
+ *     --[ion_uniphier_heap_create()]--> struct ion_heap *
  *
  * Not use Device Tree:
  *   struct platform_device *
- *     --[.dev]---------------> struct device *
- *     --[.platform_data]-----> struct ion_platform_data *
- *     --[.heaps]-------------> struct ion_platform_heap *
- *     --[ion_heap_create()]--> struct ion_heap *
+ *     --[.dev]------------------------> struct device *
+ *     --[.platform_data]--------------> struct ion_platform_data *
+ *     --[.heaps]----------------------> struct ion_platform_heap *
+ *     --[ion_uniphier_heap_create()]--> struct ion_heap *
  */
 static struct ion_of_heap of_heaps[] = {
 	PLATFORM_HEAP("socionext,media-heap", ION_HEAP_ID_MEDIA, ION_HEAP_TYPE_CARVEOUT, "media"),
@@ -155,6 +360,514 @@ static unsigned long ion_uniphier_virt_lookup(u64 virt)
 	return ((pte_v & PAGE_MASK) | (virt & ~PAGE_MASK));
 }
 
+/**
+ * Create the heap. Carveout, chunk and CMA heaps (socionext,cma) are
+ * created by this driver, others are created by ion core.
+ *
+ * @param heap_data platform heap
+ * @return heap on success, ERR_PTR on error
+ */
+static struct ion_heap *ion_uniphier_heap_create(struct ion_platform_heap *heap_data)
+{
+	switch (heap_data->type) {
+	case ION_HEAP_TYPE_CARVEOUT:
+		return ion_uniphier_carveout_heap_create(heap_data);
+	case ION_HEAP_TYPE_CHUNK:
+		return ion_uniphier_chunk_heap_create(heap_data);
+	case ION_HEAP_TYPE_DMA:
+		if (heap_data->flags & ION_PLAT_FLAG_CMA) {
+			return ion_uniphier_cma_heap_create(heap_data);
+		}
+		return ion_heap_create(heap_data);
+	default:
+		return ion_heap_create(heap_data);
+	}
+}
+
+static bool ion_uniphier_heap_is_early(struct ion_platform_heap *heap_data)
+{
+	/* lazy heaps are cheap to create, masks resolve as soon as probe */
+	return !async_init ||
+		(heap_data->flags & (ION_PLAT_FLAG_EARLY | ION_PLAT_FLAG_LAZY));
+}
+
+/**
+ * Create the heap and add it to the ion device.
+ *
+ * @param d device
+ * @param i index of the heap in ion_pdata
+ * @return 0 on success, error code on error
+ */
+static int ion_uniphier_heap_init(struct ion_uniphier_device *d, int i)
+{
+	struct ion_platform_heap *heap_data = &d->ion_pdata->heaps[i];
+	struct ion_heap *heap;
+	ktime_t start;
+
+	start = ktime_get();
+	heap = ion_uniphier_heap_create(heap_data);
+	if (IS_ERR_OR_NULL(heap)) {
+		pr_warning("ion_uniphier_heap_create(%s) failed.\n",
+			heap_data->name);
+		return heap ? PTR_ERR(heap) : -ENODEV;
+	}
+	ion_device_add_heap(d->ion_dev, heap);
+	ion_uniphier_prealloc_create(d->kclient, heap, heap_data);
+	smp_store_release(&d->ion_heaps[i], heap);
+
+	pr_info("%s: ready in %lld us%s.\n", heap_data->name,
+		ktime_to_us(ktime_sub(ktime_get(), start)),
+		ion_uniphier_heap_is_early(heap_data) ? "" : " (async)");
+
+	return 0;
+}
+
+static void ion_uniphier_heap_init_async(void *data, async_cookie_t cookie)
+{
+	struct ion_uniphier_heap_init *hi = data;
+
+	/* the heap stays offline on error, probe has already returned */
+	ion_uniphier_heap_init(hi->d, hi->index);
+}
+
+static void ion_uniphier_heap_destroy(struct ion_heap *heap)
+{
+	if (IS_ERR_OR_NULL(heap)) {
+		return;
+	}
+
+	switch (heap->type) {
+	case ION_HEAP_TYPE_CARVEOUT:
+		ion_uniphier_carveout_heap_destroy(heap);
+		break;
+	case ION_HEAP_TYPE_CHUNK:
+		ion_uniphier_chunk_heap_destroy(heap);
+		break;
+	case ION_UNIPHIER_HEAP_TYPE_CMA:
+		ion_uniphier_cma_heap_destroy(heap);
+		break;
+	case ION_UNIPHIER_HEAP_TYPE_USERPTR:
+		ion_uniphier_userptr_heap_destroy(heap);
+		break;
+	default:
+		ion_heap_destroy(heap);
+		break;
+	}
+}
+
+/**
+ * Get the ion buffer from dma-buf fd. The fd is imported to the client,
+ * caller must release the handle by ion_free() after use of the buffer.
+ *
+ * @param client ion client of caller
+ * @param fd dma-buf fd of the buffer
+ * @param handle returns imported handle
+ * @return buffer on success, ERR_PTR on error
+ */
+static struct ion_buffer *ion_uniphier_buffer_get(struct ion_client *client,
+	int fd, struct ion_handle **handle)
+{
+	struct ion_handle *h;
+
+	h = ion_import_dma_buf(client, fd);
+	if (IS_ERR_OR_NULL(h)) {
+		pr_warning("ion_import_dma_buf(fd:%d) failed.\n", fd);
+		return h ? ERR_CAST(h) : ERR_PTR(-EINVAL);
+	}
+
+	*handle = h;
+
+	return ion_handle_buffer(h);
+}
+
+static int ion_uniphier_match_client(const void *client, struct file *file,
+	unsigned int fd)
+{
+	if (file->private_data != client ||
+		!S_ISCHR(file_inode(file)->i_mode)) {
+		return 0;
+	}
+
+	return fd + 1;
+}
+
+/**
+ * Get the /dev/ion file of the client from the files of the caller.
+ * Legacy ion has no reference count of clients and tells nothing when
+ * a client is destroyed, so users that keep the client after the ioctl
+ * hold its file instead. The user has closed the client when the file
+ * count drops to the references of such users.
+ *
+ * @param client ion client of caller
+ * @return file on success, ERR_PTR on error
+ */
+struct file *ion_uniphier_client_file_get(struct ion_client *client)
+{
+	struct file *file;
+	int fd;
+
+	fd = iterate_fd(current->files, 0, ion_uniphier_match_client,
+		client) - 1;
+	if (fd < 0) {
+		return ERR_PTR(-EINVAL);
+	}
+	file = fget(fd);
+	if (!file) {
+		return ERR_PTR(-EBADF);
+	}
+	/* closed or replaced after the look up */
+	if (file->private_data != client) {
+		fput(file);
+		return ERR_PTR(-EBADF);
+	}
+
+	return file;
+}
+
+static atomic64_t ion_uniphier_buffer_id = ATOMIC64_INIT(0);
+
+/**
+ * Get the unique id of new buffer, for the event recorder. Ids are
+ * shared by all heaps of this driver so that the trace can tell buffers
+ * apart by id only.
+ *
+ * @return buffer id
+ */
+u64 ion_uniphier_new_buffer_id(void)
+{
+	return atomic64_inc_return(&ion_uniphier_buffer_id);
+}
+
+/**
+ * Get the id of the buffer given by ion_uniphier_new_buffer_id().
+ *
+ * @param buffer ion buffer
+ * @return buffer id, 0 if the buffer is not of heaps of this driver
+ */
+u64 ion_uniphier_buffer_id(struct ion_buffer *buffer)
+{
+	switch (buffer->heap->type) {
+	case ION_HEAP_TYPE_CARVEOUT:
+		return ion_uniphier_carveout_buffer_id(buffer);
+	case ION_HEAP_TYPE_CHUNK:
+		return ion_uniphier_chunk_buffer_id(buffer);
+	case ION_UNIPHIER_HEAP_TYPE_CMA:
+		return ion_uniphier_cma_buffer_id(buffer);
+	case ION_UNIPHIER_HEAP_TYPE_USERPTR:
+		return ion_uniphier_userptr_buffer_id(buffer);
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Read the reference count of ion buffer, that is the number of handles
+ * and dma-bufs of the buffer, and transient references of ion core.
+ *
+ * @param buffer ion buffer
+ * @return reference count
+ */
+unsigned int ion_uniphier_buffer_refcount(struct ion_buffer *buffer)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+	return kref_read(&buffer->ref);
+#else
+	return atomic_read(&buffer->ref.refcount);
+#endif
+}
+
+/**
+ * Clean and/or invalidate the range of the buffer. The edges of range
+ * are not rounded to pages, architecture code takes care of partial
+ * cache lines.
+ *
+ * @param buffer ion buffer
+ * @param offset offset of range from the start of buffer
+ * @param len length of range
+ * @param dir DMA direction
+ * @return 0 on success, error code on error
+ */
+static int ion_uniphier_sync_range(struct ion_buffer *buffer, u64 offset,
+	u64 len, enum dma_data_direction dir)
+{
+	struct sg_table *table = buffer->sg_table;
+	struct scatterlist *sg, sg_range;
+	u64 pos = 0, start, end, in_sg;
+	int i;
+
+	if (offset >= buffer->size || len > buffer->size - offset) {
+		pr_warning("range off:%llx, len:%llx is out of buffer size:%zx.\n",
+			(unsigned long long)offset, (unsigned long long)len,
+			buffer->size);
+		return -EINVAL;
+	}
+
+	for_each_sg(table->sgl, sg, table->nents, i) {
+		struct page *page;
+
+		start = max(offset, pos);
+		end = min(offset + len, pos + sg->length);
+		if (start < end) {
+			/* Same as ion_pages_sync_for_device() except offset */
+			in_sg = start - pos + sg->offset;
+			page = nth_page(sg_page(sg), in_sg >> PAGE_SHIFT);
+
+			sg_init_table(&sg_range, 1);
+			sg_set_page(&sg_range, page, end - start,
+				in_sg & ~PAGE_MASK);
+			sg_dma_address(&sg_range) = page_to_phys(page) +
+				(in_sg & ~PAGE_MASK);
+			dma_sync_sg_for_device(NULL, &sg_range, 1, dir);
+		}
+
+		pos += sg->length;
+		if (pos >= offset + len) {
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Handle ION_UNIP_IOC_SYNC_RANGE, sync the single range or the array of
+ * ranges of user.
+ *
+ * @param client ion client of caller
+ * @param data argument of ioctl
+ * @return 0 on success, error code on error
+ */
+static int ion_uniphier_sync_ranges(struct ion_client *client,
+	struct ion_uniphier_sync_data *data)
+{
+	struct ion_uniphier_sync_range ranges[16];
+	struct ion_uniphier_sync_range __user *uranges;
+	struct ion_handle *handle;
+	struct ion_buffer *buffer;
+	enum dma_data_direction dir;
+	u32 i, n;
+	int ret = 0;
+
+	switch (data->dir) {
+	case ION_UNIP_SYNC_FOR_DEVICE:
+		dir = DMA_TO_DEVICE;
+		break;
+	case ION_UNIP_SYNC_FOR_CPU:
+		dir = DMA_FROM_DEVICE;
+		break;
+	case ION_UNIP_SYNC_BIDIRECTIONAL:
+		dir = DMA_BIDIRECTIONAL;
+		break;
+	default:
+		pr_warning("Unknown sync dir:%d.\n", data->dir);
+		return -EINVAL;
+	}
+	if (data->nr_ranges > ION_UNIP_SYNC_MAX_RANGES) {
+		pr_warning("Too many ranges:%u.\n", data->nr_ranges);
+		return -EINVAL;
+	}
+
+	buffer = ion_uniphier_buffer_get(client, data->fd, &handle);
+	if (IS_ERR(buffer)) {
+		return PTR_ERR(buffer);
+	}
+
+	/* Mapping of uncached buffer need not maintenance */
+	if (!ion_buffer_cached(buffer)) {
+		goto out;
+	}
+
+	if (data->nr_ranges == 0) {
+		ret = ion_uniphier_sync_range(buffer, data->offset, data->len,
+			dir);
+		goto out;
+	}
+
+	uranges = (void __user *)(uintptr_t)data->ranges;
+	for (i = 0; i < data->nr_ranges; i += n) {
+		u32 j;
+
+		n = min_t(u32, data->nr_ranges - i, ARRAY_SIZE(ranges));
+		if (copy_from_user(ranges, &uranges[i], n * sizeof(ranges[0]))) {
+			ret = -EFAULT;
+			goto out;
+		}
+
+		for (j = 0; j < n; j++) {
+			ret = ion_uniphier_sync_range(buffer, ranges[j].offset,
+				ranges[j].len, dir);
+			if (ret) {
+				goto out;
+			}
+		}
+	}
+
+out:
+	ion_free(client, handle);
+
+	return ret;
+}
+
+/* Read by this size to respond to the fatal signal */
+#define ION_UNIPHIER_LOAD_CHUNK    (1024 * 1024)
+
+/**
+ * Handle ION_UNIP_IOC_LOAD_FILE, read the file into the buffer by the
+ * kernel mapping.
+ *
+ * @param client ion client of caller
+ * @param data argument of ioctl
+ * @return 0 on success, error code on error
+ */
+static int ion_uniphier_load_file(struct ion_client *client,
+	struct ion_uniphier_load_file_data *data)
+{
+	struct ion_handle *handle;
+	struct ion_buffer *buffer;
+	struct file *file;
+	char *vaddr;
+	loff_t pos = data->file_offset;
+	int ret = 0;
+
+	data->done = 0;
+
+	file = fget(data->file_fd);
+	if (!file) {
+		return -EBADF;
+	}
+	if (!(file->f_mode & FMODE_READ)) {
+		ret = -EBADF;
+		goto err_fput;
+	}
+
+	buffer = ion_uniphier_buffer_get(client, data->buf_fd, &handle);
+	if (IS_ERR(buffer)) {
+		ret = PTR_ERR(buffer);
+		goto err_fput;
+	}
+	if (data->buf_offset > buffer->size ||
+		data->len > buffer->size - data->buf_offset) {
+		pr_warning("load off:%llx, len:%llx is out of buffer size:%zx.\n",
+			(unsigned long long)data->buf_offset,
+			(unsigned long long)data->len, buffer->size);
+		ret = -EINVAL;
+		goto err_free;
+	}
+	if (ion_uniphier_userptr_buffer_readonly(buffer)) {
+		ret = -EPERM;
+		goto err_free;
+	}
+
+	vaddr = ion_map_kernel(client, handle);
+	if (IS_ERR_OR_NULL(vaddr)) {
+		pr_warning("ion_map_kernel() failed.\n");
+		ret = vaddr ? PTR_ERR(vaddr) : -ENOMEM;
+		goto err_free;
+	}
+
+	while (data->done < data->len) {
+		unsigned long count;
+		int n;
+
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+
+		count = min_t(u64, data->len - data->done,
+			ION_UNIPHIER_LOAD_CHUNK);
+		n = kernel_read(file, pos,
+			vaddr + data->buf_offset + data->done, count);
+		if (n < 0) {
+			ret = n;
+			break;
+		}
+		if (n == 0) {
+			/* end of file */
+			break;
+		}
+		pos += n;
+		data->done += n;
+	}
+
+	/* Same as read(), error after some progress is not reported */
+	if (data->done) {
+		ret = 0;
+	}
+
+	if (data->done && ion_buffer_cached(buffer)) {
+		ion_uniphier_sync_range(buffer, data->buf_offset, data->done,
+			DMA_TO_DEVICE);
+	}
+
+	ion_unmap_kernel(client, handle);
+
+err_free:
+	ion_free(client, handle);
+err_fput:
+	fput(file);
+
+	return ret;
+}
+
+/**
+ * Handle ION_UNIP_IOC_ALLOC_PLANES, allocate one buffer that has all
+ * planes and return the layout of them.
+ *
+ * @param client ion client of caller
+ * @param data argument of ioctl
+ * @return 0 on success, error code on error
+ */
+static int ion_uniphier_alloc_planes(struct ion_client *client,
+	struct ion_uniphier_alloc_planes_data *data)
+{
+	struct ion_handle *handle;
+	ion_phys_addr_t phys;
+	size_t len;
+	u32 i;
+	int ret;
+
+	ret = ion_uniphier_planes_layout(data);
+	if (ret) {
+		pr_warning("invalid planes fmt:%u, %ux%u.\n", data->format,
+			data->width, data->height);
+		return ret;
+	}
+	if (data->size > SIZE_MAX) {
+		pr_warning("planes size:%llx is too large.\n",
+			(unsigned long long)data->size);
+		return -EINVAL;
+	}
+
+	handle = ion_alloc(client, data->size,
+		max_t(u64, ion_uniphier_planes_align(data), PAGE_SIZE),
+		data->heap_id_mask, data->flags);
+	if (IS_ERR_OR_NULL(handle)) {
+		pr_warning("ion_alloc(planes, size:%llx) failed.\n",
+			(unsigned long long)data->size);
+		return handle ? PTR_ERR(handle) : -ENOMEM;
+	}
+
+	/* phys is left 0 if the heap is not physically contiguous */
+	if (!ion_phys(client, handle, &phys, &len)) {
+		for (i = 0; i < data->nr_planes; i++) {
+			data->planes[i].phys = phys + data->planes[i].offset;
+		}
+	}
+
+	data->fd = ion_share_dma_buf_fd(client, handle);
+	if (data->fd >= 0) {
+		ion_uniphier_trace_buffer(ION_UNIP_TRACE_SHARE,
+			ion_handle_buffer(handle));
+	}
+	ion_free(client, handle);
+	if (data->fd < 0) {
+		return data->fd;
+	}
+
+	return 0;
+}
+
 static int ion_uniphier_custom_ioctl_dir(unsigned int cmd)
 {
 	switch (cmd) {
@@ -169,6 +882,18 @@ static long ion_uniphier_custom_ioctl(struct ion_client *client, unsigned int cm
 	union {
 		struct ion_uniphier_virt_to_phys_data v2p;
 		struct ion_uniphier_phys_data phys;
+		struct ion_uniphier_sync_data sync;
+		struct ion_uniphier_userptr_data userptr;
+		struct ion_uniphier_wrap_phys_data wrap;
+		struct ion_uniphier_load_file_data load;
+		struct ion_uniphier_alloc_planes_data planes;
+		struct ion_uniphier_cma_prewarm_data cma;
+		struct ion_uniphier_rebalance_data rebalance;
+		struct ion_uniphier_prealloc_data prealloc;
+		struct ion_uniphier_publish_data publish;
+		struct ion_uniphier_open_named_data named;
+		struct ion_uniphier_alloc_async_data async;
+		struct ion_uniphier_alloc_result_data result;
 	} buf;
 
 	if (_IOC_SIZE(cmd) > sizeof(buf)) {
@@ -244,6 +969,167 @@ static long ion_uniphier_custom_ioctl(struct ion_client *client, unsigned int cm
 		buf.phys.len = len;
 		break;
 	}*/
+	case ION_UNIP_IOC_SYNC_RANGE:
+	{
+		int ret;
+
+		ret = ion_uniphier_sync_ranges(client, &buf.sync);
+		if (ret) {
+			return ret;
+		}
+		break;
+	}
+	case ION_UNIP_IOC_USERPTR:
+	{
+		int ret;
+
+		ret = ion_uniphier_userptr_import(client, &buf.userptr);
+		if (ret) {
+			return ret;
+		}
+		break;
+	}
+	case ION_UNIP_IOC_WRAP_PHYS:
+	{
+		struct ion_handle *h;
+
+		if (!capable(CAP_SYS_RAWIO)) {
+			return -EPERM;
+		}
+
+		h = ion_uniphier_wrap_phys_handle(client, buf.wrap.heap_id,
+			buf.wrap.phys, buf.wrap.len, buf.wrap.flags);
+		if (IS_ERR(h)) {
+			return PTR_ERR(h);
+		}
+
+		buf.wrap.fd = ion_share_dma_buf_fd(client, h);
+		ion_free(client, h);
+		if (buf.wrap.fd < 0) {
+			return buf.wrap.fd;
+		}
+		break;
+	}
+	case ION_UNIP_IOC_LOAD_FILE:
+	{
+		int ret;
+
+		ret = ion_uniphier_load_file(client, &buf.load);
+		if (ret) {
+			return ret;
+		}
+		break;
+	}
+	case ION_UNIP_IOC_ALLOC_PLANES:
+	{
+		int ret;
+
+		ret = ion_uniphier_alloc_planes(client, &buf.planes);
+		if (ret) {
+			return ret;
+		}
+		break;
+	}
+	case ION_UNIP_IOC_CMA_PREWARM:
+	{
+		struct ion_heap *heap = NULL;
+		int ret;
+
+		if (!capable(CAP_SYS_ADMIN)) {
+			return -EPERM;
+		}
+		if (buf.cma.reserved) {
+			return -EINVAL;
+		}
+		if (ion_uniphier_dev) {
+			heap = ion_uniphier_find_heap(ion_uniphier_dev,
+				buf.cma.heap_id);
+		}
+		if (!heap || heap->type != ION_UNIPHIER_HEAP_TYPE_CMA) {
+			pr_warning("heap:%u is not CMA heap.\n",
+				buf.cma.heap_id);
+			return -EINVAL;
+		}
+
+		ret = ion_uniphier_cma_heap_prewarm(heap, buf.cma.size,
+			buf.cma.count);
+		if (ret < 0) {
+			return ret;
+		}
+		buf.cma.warmed = ret;
+		break;
+	}
+	case ION_UNIP_IOC_REBALANCE:
+	{
+		int ret;
+
+		if (!capable(CAP_SYS_ADMIN)) {
+			return -EPERM;
+		}
+
+		ret = ion_uniphier_rebalance(&buf.rebalance);
+		if (ret) {
+			return ret;
+		}
+		break;
+	}
+	case ION_UNIP_IOC_CLAIM_PREALLOC:
+	{
+		int ret;
+
+		if (!ion_uniphier_dev) {
+			return -ENODEV;
+		}
+
+		/* buffers of async heaps are preallocated as they come up */
+		ion_uniphier_heaps_wait();
+		ret = ion_uniphier_prealloc_claim(ion_uniphier_dev->kclient,
+			&buf.prealloc);
+		if (ret) {
+			return ret;
+		}
+		break;
+	}
+	case ION_UNIP_IOC_PUBLISH:
+	{
+		int ret;
+
+		ret = ion_uniphier_registry_publish(client, &buf.publish);
+		if (ret) {
+			return ret;
+		}
+		break;
+	}
+	case ION_UNIP_IOC_OPEN_NAMED:
+	{
+		int ret;
+
+		ret = ion_uniphier_registry_open(&buf.named);
+		if (ret) {
+			return ret;
+		}
+		break;
+	}
+	case ION_UNIP_IOC_ALLOC_ASYNC:
+	{
+		int ret;
+
+		ret = ion_uniphier_async_alloc(client, &buf.async);
+		if (ret) {
+			return ret;
+		}
+		break;
+	}
+	case ION_UNIP_IOC_ALLOC_RESULT:
+	{
+		int ret;
+
+		ret = ion_uniphier_async_result(client, &buf.result);
+		if (ret) {
+			return ret;
+		}
+		break;
+	}
 	default:
 		pr_warning("Unknown ioctl() cmd:0x%x.\n", cmd);
 		return -ENOTTY;
@@ -282,6 +1168,18 @@ static int ion_uniphier_platform_probe(struct platform_device *pdev)
 		return -ENOMEM;
 	}
 
+	d->debug_root = debugfs_create_dir("ion_uniphier", NULL);
+	if (IS_ERR_OR_NULL(d->debug_root)) {
+		pr_warning("debugfs_create_dir() failed.\n");
+		d->debug_root = NULL;
+	}
+
+	result = ion_uniphier_trace_init(d->debug_root);
+	if (result) {
+		pr_warning("ion_uniphier_trace_init() failed.\n");
+		goto err_out;
+	}
+
 	if (node) {
 		pr_devel("Probe: Use the Device Tree.\n");
 		d->ion_pdata = ion_parse_dt(pdev, of_heaps);
@@ -313,30 +1211,94 @@ static int ion_uniphier_platform_probe(struct platform_device *pdev)
 		goto err_out;
 	}
 
+	d->heap_inits = devm_kcalloc(dev, d->ion_num_heaps,
+		sizeof(*d->heap_inits), GFP_KERNEL);
+	if (!d->heap_inits) {
+		pr_warning("devm_kcalloc(heap_inits) failed.\n");
+		result = -ENOMEM;
+		goto err_out;
+	}
+
+	/* preallocated buffers of heaps are held by the kernel client */
+	d->kclient = ion_client_create(d->ion_dev, ION_UNIPHIER_DRVNAME);
+	if (IS_ERR_OR_NULL(d->kclient)) {
+		pr_warning("ion_client_create() failed.\n");
+		result = d->kclient ? PTR_ERR(d->kclient) : -ENOMEM;
+		d->kclient = NULL;
+		goto err_out;
+	}
+	ion_uniphier_registry_init(d->kclient);
+	result = ion_uniphier_async_init(d->kclient);
+	if (result) {
+		pr_warning("ion_uniphier_async_init() failed.\n");
+		goto err_out;
+	}
+
+	/* start async heaps first, they run while early heaps are created */
+	for (i = 0; i < d->ion_num_heaps; i++) {
+		if (ion_uniphier_heap_is_early(&d->ion_pdata->heaps[i])) {
+			continue;
+		}
+		d->heap_inits[i].d = d;
+		d->heap_inits[i].index = i;
+		async_schedule_domain(ion_uniphier_heap_init_async,
+			&d->heap_inits[i], &ion_uniphier_async_domain);
+	}
 	for (i = 0; i < d->ion_num_heaps; i++) {
-		d->ion_heaps[i] = ion_heap_create(&d->ion_pdata->heaps[i]);
-		if (IS_ERR_OR_NULL(d->ion_heaps[i])) {
-			pr_warning("ion_heap_create(i:%d) failed.\n", i);
-			result = PTR_ERR(d->ion_heaps[i]);
+		if (!ion_uniphier_heap_is_early(&d->ion_pdata->heaps[i])) {
+			continue;
+		}
+		if (ion_uniphier_heap_init(d, i)) {
+			pr_warning("ion_uniphier_heap_init(i:%d) failed.\n", i);
 			result = -ENODEV;
 			goto err_out;
 		}
+	}
+
+	if (d->debug_root) {
+		debugfs_create_file("compact", 0200, d->debug_root, d,
+			&ion_uniphier_compact_fops);
+	}
 
-		ion_device_add_heap(d->ion_dev, d->ion_heaps[i]);
+	ion_uniphier_dev = d;
+
+	d->userptr_heap = ion_uniphier_userptr_heap_create();
+	if (IS_ERR(d->userptr_heap)) {
+		pr_warning("ion_uniphier_userptr_heap_create() failed.\n");
+		result = PTR_ERR(d->userptr_heap);
+		d->userptr_heap = NULL;
+		goto err_out;
 	}
+	ion_device_add_heap(d->ion_dev, d->userptr_heap);
 
 	pr_info("probe v.0.2.\n");
 
 	return 0;
 
 err_out:
+	ion_uniphier_dev = NULL;
+	async_synchronize_full_domain(&ion_uniphier_async_domain);
+	if (d->kclient) {
+		ion_uniphier_async_destroy();
+		ion_uniphier_registry_destroy();
+		ion_uniphier_prealloc_destroy(d->kclient);
+		ion_client_destroy(d->kclient);
+		d->kclient = NULL;
+	}
+
+	ion_uniphier_heap_destroy(d->userptr_heap);
+	d->userptr_heap = NULL;
 	for (i = 0; i < d->ion_num_heaps; i++) {
-		ion_heap_destroy(d->ion_heaps[i]);
+		ion_uniphier_heap_destroy(d->ion_heaps[i]);
 		d->ion_heaps[i] = NULL;
 	}
 
 	ion_release_dt(pdev, d->ion_pdata);
 
+	debugfs_remove_recursive(d->debug_root);
+	d->debug_root = NULL;
+	ion_uniphier_trace_exit();
+
 	if (d->ion_dev) {
 		ion_device_destroy(d->ion_dev);
 		d->ion_dev = NULL;
@@ -353,8 +1315,20 @@ static int ion_uniphier_platform_remove(struct platform_device *pdev)
 
 	pr_devel("%s\n", __func__);
 
+	ion_uniphier_dev = NULL;
+	async_synchronize_full_domain(&ion_uniphier_async_domain);
+	if (d->kclient) {
+		ion_uniphier_async_destroy();
+		ion_uniphier_registry_destroy();
+		ion_uniphier_prealloc_destroy(d->kclient);
+		ion_client_destroy(d->kclient);
+		d->kclient = NULL;
+	}
+
+	ion_uniphier_heap_destroy(d->userptr_heap);
+	d->userptr_heap = NULL;
 	for (i = 0; i < d->ion_num_heaps; i++) {
-		ion_heap_destroy(d->ion_heaps[i]);
+		ion_uniphier_heap_destroy(d->ion_heaps[i]);
 		d->ion_heaps[i] = NULL;
 	}
 
@@ -362,6 +1336,10 @@ static int ion_uniphier_platform_remove(struct platform_device *pdev)
 		ion_release_dt(pdev, d->ion_pdata);
 	}
 
+	debugfs_remove_recursive(d->debug_root);
+	d->debug_root = NULL;
+	ion_uniphier_trace_exit();
+
 	if (d->ion_dev) {
 		ion_device_destroy(d->ion_dev);
 		d->ion_dev = NULL;
@@ -20,5 +20,141 @@
 #ifndef ION_UNIPHIER_CORE_H__
 #define ION_UNIPHIER_CORE_H__
 
+#include <linux/types.h>
+#include <linux/compiler.h>
+
+struct dentry;
+struct file;
+struct ion_buffer;
+struct ion_client;
+struct ion_handle;
+struct ion_heap;
+struct ion_platform_heap;
+struct ion_uniphier_userptr_data;
+struct ion_uniphier_prealloc_data;
+struct ion_uniphier_publish_data;
+struct ion_uniphier_open_named_data;
+struct ion_uniphier_alloc_async_data;
+struct ion_uniphier_alloc_result_data;
+
+/* Heap types of this driver, not in enum ion_heap_type */
+#define ION_UNIPHIER_HEAP_TYPE_USERPTR    (ION_HEAP_TYPE_CUSTOM + 1)
+#define ION_UNIPHIER_HEAP_TYPE_CMA        (ION_HEAP_TYPE_CUSTOM + 2)
+
+/* ion_uniphier_async.c */
+int ion_uniphier_async_init(struct ion_client *client);
+void ion_uniphier_async_destroy(void);
+int ion_uniphier_async_alloc(struct ion_client *client,
+	struct ion_uniphier_alloc_async_data *data);
+int ion_uniphier_async_result(struct ion_client *client,
+	struct ion_uniphier_alloc_result_data *data);
+
+/* ion_uniphier_carveout_heap.c */
+struct ion_heap *ion_uniphier_carveout_heap_create(
+	struct ion_platform_heap *heap_data);
+void ion_uniphier_carveout_heap_destroy(struct ion_heap *heap);
+struct ion_handle *ion_uniphier_carveout_heap_wrap(struct ion_heap *heap,
+	struct ion_client *client, unsigned long phys, size_t len,
+	unsigned long flags);
+u64 ion_uniphier_carveout_heap_compact(struct ion_heap *heap);
+int ion_uniphier_carveout_heap_rebalance(struct ion_heap *from,
+	struct ion_heap *to, size_t size);
+void ion_uniphier_carveout_heap_range(struct ion_heap *heap,
+	phys_addr_t *base, size_t *size);
+u64 ion_uniphier_carveout_buffer_id(struct ion_buffer *buffer);
+
+/* ion_uniphier_chunk_heap.c */
+struct ion_heap *ion_uniphier_chunk_heap_create(
+	struct ion_platform_heap *heap_data);
+void ion_uniphier_chunk_heap_destroy(struct ion_heap *heap);
+u64 ion_uniphier_chunk_buffer_id(struct ion_buffer *buffer);
+
+/* ion_uniphier_cma_heap.c */
+struct ion_heap *ion_uniphier_cma_heap_create(
+	struct ion_platform_heap *heap_data);
+void ion_uniphier_cma_heap_destroy(struct ion_heap *heap);
+int ion_uniphier_cma_heap_prewarm(struct ion_heap *heap, size_t size,
+	unsigned int count);
+u64 ion_uniphier_cma_buffer_id(struct ion_buffer *buffer);
+
+/* ion_uniphier_core.c */
+unsigned int ion_uniphier_buffer_refcount(struct ion_buffer *buffer);
+struct file *ion_uniphier_client_file_get(struct ion_client *client);
+u64 ion_uniphier_new_buffer_id(void);
+u64 ion_uniphier_buffer_id(struct ion_buffer *buffer);
+
+/* ion_uniphier_prealloc.c */
+void ion_uniphier_prealloc_create(struct ion_client *client,
+	struct ion_heap *heap, struct ion_platform_heap *heap_data);
+int ion_uniphier_prealloc_claim(struct ion_client *client,
+	struct ion_uniphier_prealloc_data *data);
+void ion_uniphier_prealloc_destroy(struct ion_client *client);
+
+/* ion_uniphier_registry.c */
+void ion_uniphier_registry_init(struct ion_client *client);
+void ion_uniphier_registry_destroy(void);
+int ion_uniphier_registry_publish(struct ion_client *client,
+	struct ion_uniphier_publish_data *data);
+int ion_uniphier_registry_open(struct ion_uniphier_open_named_data *data);
+
+/* ion_uniphier_userptr_heap.c */
+struct ion_heap *ion_uniphier_userptr_heap_create(void);
+void ion_uniphier_userptr_heap_destroy(struct ion_heap *heap);
+int ion_uniphier_userptr_import(struct ion_client *client,
+	struct ion_uniphier_userptr_data *data);
+bool ion_uniphier_userptr_buffer_readonly(struct ion_buffer *buffer);
+u64 ion_uniphier_userptr_buffer_id(struct ion_buffer *buffer);
+
+/* ion_uniphier_trace.c */
+#ifdef CONFIG_ION_UNIPHIER_TRACE
+extern bool ion_uniphier_trace_enabled;
+
+void __ion_uniphier_trace_record(unsigned int type, unsigned int heap_id,
+	u64 buffer_id, u64 phys, u64 size, u64 align, unsigned long flags,
+	pid_t pid);
+void __ion_uniphier_trace_buffer(unsigned int type,
+	struct ion_buffer *buffer);
+int ion_uniphier_trace_init(struct dentry *debug_root);
+void ion_uniphier_trace_exit(void);
+
+static inline void ion_uniphier_trace_record(unsigned int type,
+	unsigned int heap_id, u64 buffer_id, u64 phys, u64 size, u64 align,
+	unsigned long flags, pid_t pid)
+{
+	if (unlikely(ion_uniphier_trace_enabled)) {
+		__ion_uniphier_trace_record(type, heap_id, buffer_id, phys,
+			size, align, flags, pid);
+	}
+}
+
+/* Record the share or import of the buffer by the current process */
+static inline void ion_uniphier_trace_buffer(unsigned int type,
+	struct ion_buffer *buffer)
+{
+	if (unlikely(ion_uniphier_trace_enabled)) {
+		__ion_uniphier_trace_buffer(type, buffer);
+	}
+}
+#else
+static inline void ion_uniphier_trace_record(unsigned int type,
+	unsigned int heap_id, u64 buffer_id, u64 phys, u64 size, u64 align,
+	unsigned long flags, pid_t pid)
+{
+}
+
+static inline void ion_uniphier_trace_buffer(unsigned int type,
+	struct ion_buffer *buffer)
+{
+}
+
+static inline int ion_uniphier_trace_init(struct dentry *debug_root)
+{
+	return 0;
+}
+
+static inline void ion_uniphier_trace_exit(void)
+{
+}
+#endif /* CONFIG_ION_UNIPHIER_TRACE */
 
 #endif /* ION_UNIPHIER_CORE_H__ */
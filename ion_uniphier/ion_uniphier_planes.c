@@ -0,0 +1,161 @@
+/*
+ * Ion driver for Socionext UniPhier series.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#else
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+#include "ion_uniphier_planes.h"
+
+/**
+ * struct ion_uniphier_planes_format - planes of the pixel format
+ *
+ * @param nr_planes  number of planes
+ * @param bpp        bytes per sample of each plane (interleaved CbCr is 2)
+ * @param hsub       horizontal subsampling of each plane
+ * @param vsub       vertical subsampling of each plane
+ */
+struct ion_uniphier_planes_format {
+	unsigned int nr_planes;
+	unsigned int bpp[ION_UNIP_MAX_PLANES];
+	unsigned int hsub[ION_UNIP_MAX_PLANES];
+	unsigned int vsub[ION_UNIP_MAX_PLANES];
+};
+
+static const struct ion_uniphier_planes_format ion_uniphier_planes_formats[] = {
+	[ION_UNIP_FMT_NV12] = {
+		2, { 1, 2 }, { 1, 2 }, { 1, 2 },
+	},
+	[ION_UNIP_FMT_NV16] = {
+		2, { 1, 2 }, { 1, 2 }, { 1, 1 },
+	},
+	[ION_UNIP_FMT_YUV420] = {
+		3, { 1, 1, 1 }, { 1, 2, 2 }, { 1, 2, 2 },
+	},
+	[ION_UNIP_FMT_P010] = {
+		2, { 2, 4 }, { 1, 2 }, { 1, 2 },
+	},
+};
+
+static uint32_t ion_uniphier_planes_roundup(uint32_t v, uint32_t align)
+{
+	if (align <= 1) {
+		return v;
+	}
+
+	return (v + align - 1) / align * align;
+}
+
+/**
+ * Get the alignment of the buffer, that is the maximum alignment of
+ * plane offsets.
+ *
+ * @param data  request of allocation
+ * @return alignment in bytes
+ */
+uint64_t ion_uniphier_planes_align(
+	const struct ion_uniphier_alloc_planes_data *data)
+{
+	uint64_t align = 1;
+	unsigned int i;
+
+	for (i = 0; i < ION_UNIP_MAX_PLANES; i++) {
+		if (data->offset_align[i] > align) {
+			align = data->offset_align[i];
+		}
+	}
+
+	return align;
+}
+
+/**
+ * Compute the layout of planes. Fill nr_planes, size and offset, size,
+ * stride and lines of planes. phys of planes is cleared.
+ *
+ * @param data  request of allocation
+ * @return 0 on success, -EINVAL if the request is invalid
+ */
+int ion_uniphier_planes_layout(struct ion_uniphier_alloc_planes_data *data)
+{
+	const struct ion_uniphier_planes_format *fmt;
+	uint32_t height;
+	uint64_t off = 0;
+	unsigned int i;
+
+	if (data->format >= ION_UNIP_FMT_NR_FORMATS ||
+		data->width == 0 || data->width > ION_UNIP_MAX_PIXELS ||
+		data->height == 0 || data->height > ION_UNIP_MAX_PIXELS) {
+		return -EINVAL;
+	}
+	for (i = 0; i < ION_UNIP_MAX_PLANES; i++) {
+		uint32_t a = data->offset_align[i];
+
+		if (a & (a - 1)) {
+			return -EINVAL;
+		}
+		if (data->stride_align[i] > ION_UNIP_MAX_STRIDE_ALIGN) {
+			return -EINVAL;
+		}
+	}
+	if (data->height_align > ION_UNIP_MAX_HEIGHT_ALIGN) {
+		return -EINVAL;
+	}
+
+	fmt = &ion_uniphier_planes_formats[data->format];
+	height = ion_uniphier_planes_roundup(data->height, data->height_align);
+
+	data->nr_planes = fmt->nr_planes;
+	for (i = 0; i < ION_UNIP_MAX_PLANES; i++) {
+		struct ion_uniphier_plane_info *p = &data->planes[i];
+		uint32_t width;
+
+		p->offset = 0;
+		p->size = 0;
+		p->phys = 0;
+		p->stride = 0;
+		p->lines = 0;
+		if (i >= fmt->nr_planes) {
+			continue;
+		}
+
+		width = (data->width + fmt->hsub[i] - 1) / fmt->hsub[i];
+		p->stride = ion_uniphier_planes_roundup(width * fmt->bpp[i],
+			data->stride_align[i]);
+		p->lines = (height + fmt->vsub[i] - 1) / fmt->vsub[i];
+		p->size = (uint64_t)p->stride * p->lines;
+
+		if (i == 1) {
+			off += data->chroma_skew;
+		}
+		if (data->offset_align[i] > 1) {
+			off = (off + data->offset_align[i] - 1) &
+				~((uint64_t)data->offset_align[i] - 1);
+		}
+		p->offset = off;
+		off += p->size;
+	}
+	data->size = off;
+
+	return 0;
+}
@@ -0,0 +1,41 @@
+/*
+ * Ion driver for Socionext UniPhier series.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ION_UNIPHIER_PLANES_H__
+#define ION_UNIPHIER_PLANES_H__
+
+/*
+ * Plane layout of multi-plane buffers.
+ *
+ * Same as ion_uniphier_alloc.c, this file and ion_uniphier_planes.c do
+ * not depend on the kernel, they are also compiled in userspace by the
+ * stand-in of /dev/ion (test/ion_stub.c).
+ */
+
+#ifdef __KERNEL__
+#include "uapi/ion_uniphier.h"
+#else
+#include <asm/ion_uniphier.h>
+#endif
+
+int ion_uniphier_planes_layout(struct ion_uniphier_alloc_planes_data *data);
+uint64_t ion_uniphier_planes_align(
+	const struct ion_uniphier_alloc_planes_data *data);
+
+#endif /* ION_UNIPHIER_PLANES_H__ */
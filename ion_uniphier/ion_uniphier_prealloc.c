@@ -0,0 +1,283 @@
+/*
+ * Ion driver for Socionext UniPhier series.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define pr_fmt(fmt) "ion-uniphier-prealloc: " fmt
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/types.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/cred.h>
+#include <linux/uidgid.h>
+#include <linux/capability.h>
+#include <linux/of.h>
+
+#include "ion/ion.h"
+#include "ion/ion_priv.h"
+
+#include "ion_of.h"
+#include "ion_uniphier_core.h"
+#include "uapi/ion_uniphier.h"
+
+/*
+ * Preallocated buffers.
+ *
+ * Child nodes of the heap node declare buffers that are allocated when
+ * the heap is created, see struct ion_uniphier_prealloc_data. The
+ * kernel client of the driver holds the handles, users claim them by
+ * name and get dma-buf fds. Only the owner of the buffer (DT 'owner-uid'
+ * and 'owner-gid') and CAP_SYS_ADMIN can claim it.
+ */
+
+/**
+ * struct ion_uniphier_prealloc - preallocated buffer
+ *
+ * @param list     entry of ion_uniphier_preallocs
+ * @param name     name of the buffer, DT node name
+ * @param heap_id  id of the heap that has the buffer
+ * @param handle   handle of the kernel client
+ * @param phys     physical address
+ * @param len      length of the buffer
+ * @param uid      user that can claim, INVALID_UID if none
+ * @param gid      group that can claim, INVALID_GID if none
+ */
+struct ion_uniphier_prealloc {
+	struct list_head list;
+	char name[ION_UNIP_PREALLOC_NAME_LEN];
+	unsigned int heap_id;
+	struct ion_handle *handle;
+	ion_phys_addr_t phys;
+	size_t len;
+	kuid_t uid;
+	kgid_t gid;
+};
+
+/* Heaps are created in parallel, the list is shared by them */
+static LIST_HEAD(ion_uniphier_preallocs);
+static DEFINE_MUTEX(ion_uniphier_prealloc_lock);
+
+static struct ion_uniphier_prealloc *ion_uniphier_prealloc_find(
+	const char *name)
+{
+	struct ion_uniphier_prealloc *pa;
+
+	list_for_each_entry(pa, &ion_uniphier_preallocs, list) {
+		if (!strcmp(pa->name, name)) {
+			return pa;
+		}
+	}
+
+	return NULL;
+}
+
+static bool ion_uniphier_prealloc_allowed(struct ion_uniphier_prealloc *pa)
+{
+	if (uid_valid(pa->uid) && uid_eq(current_euid(), pa->uid)) {
+		return true;
+	}
+	if (gid_valid(pa->gid) && in_egroup_p(pa->gid)) {
+		return true;
+	}
+
+	return capable(CAP_SYS_ADMIN);
+}
+
+/**
+ * Allocate a buffer that is declared by the child node of the heap.
+ *
+ * @param client kernel client that holds the buffer
+ * @param heap heap of the node
+ * @param np child node of the heap node
+ * @return 0 on success, error code on error
+ */
+static int ion_uniphier_prealloc_one(struct ion_client *client,
+	struct ion_heap *heap, struct device_node *np)
+{
+	struct ion_uniphier_prealloc *pa;
+	struct ion_handle *handle;
+	phys_addr_t base;
+	size_t heap_size;
+	u32 size, align = PAGE_SIZE, offset, id;
+	bool fixed;
+	int ret;
+
+	if (of_property_read_u32(np, "size", &size) || !size) {
+		pr_warning("%s/%s: no size.\n", heap->name, np->name);
+		return -EINVAL;
+	}
+	if (strlen(np->name) >= ION_UNIP_PREALLOC_NAME_LEN) {
+		pr_warning("%s/%s: name is too long.\n", heap->name, np->name);
+		return -EINVAL;
+	}
+	of_property_read_u32(np, "align", &align);
+	fixed = !of_property_read_u32(np, "offset", &offset);
+
+	pa = kzalloc(sizeof(*pa), GFP_KERNEL);
+	if (!pa) {
+		return -ENOMEM;
+	}
+	strlcpy(pa->name, np->name, sizeof(pa->name));
+	pa->heap_id = heap->id;
+	pa->uid = INVALID_UID;
+	pa->gid = INVALID_GID;
+	if (!of_property_read_u32(np, "owner-uid", &id)) {
+		pa->uid = make_kuid(&init_user_ns, id);
+	}
+	if (!of_property_read_u32(np, "owner-gid", &id)) {
+		pa->gid = make_kgid(&init_user_ns, id);
+	}
+
+	if (fixed) {
+		/* the data at the offset is kept if the heap keeps contents */
+		if (heap->type != ION_HEAP_TYPE_CARVEOUT) {
+			pr_warning("%s/%s: offset needs carveout heap.\n",
+				heap->name, np->name);
+			ret = -EINVAL;
+			goto err_free;
+		}
+		ion_uniphier_carveout_heap_range(heap, &base, &heap_size);
+		handle = ion_uniphier_carveout_heap_wrap(heap, client,
+			base + offset, PAGE_ALIGN(size), 0);
+	} else {
+		handle = ion_alloc(client, size, align, 1 << heap->id, 0);
+	}
+	if (IS_ERR_OR_NULL(handle)) {
+		pr_warning("%s/%s: cannot allocate %x bytes.\n", heap->name,
+			np->name, size);
+		ret = handle ? PTR_ERR(handle) : -ENOMEM;
+		goto err_free;
+	}
+	pa->handle = handle;
+
+	ret = ion_phys(client, handle, &pa->phys, &pa->len);
+	if (ret) {
+		goto err_free_handle;
+	}
+
+	mutex_lock(&ion_uniphier_prealloc_lock);
+	if (ion_uniphier_prealloc_find(pa->name)) {
+		mutex_unlock(&ion_uniphier_prealloc_lock);
+		pr_warning("%s/%s: name is used.\n", heap->name, np->name);
+		ret = -EEXIST;
+		goto err_free_handle;
+	}
+	list_add_tail(&pa->list, &ion_uniphier_preallocs);
+	mutex_unlock(&ion_uniphier_prealloc_lock);
+
+	pr_info("%s/%s: phys:%lx, len:%zx%s\n", heap->name, pa->name,
+		(unsigned long)pa->phys, pa->len, fixed ? ", fixed" : "");
+
+	return 0;
+
+err_free_handle:
+	ion_free(client, handle);
+err_free:
+	kfree(pa);
+
+	return ret;
+}
+
+/**
+ * Allocate all buffers that are declared by child nodes of the heap
+ * node. A buffer that cannot be allocated is skipped, the heap is still
+ * usable.
+ *
+ * @param client kernel client that holds the buffers
+ * @param heap heap that is created
+ * @param heap_data platform heap of the heap
+ */
+void ion_uniphier_prealloc_create(struct ion_client *client,
+	struct ion_heap *heap, struct ion_platform_heap *heap_data)
+{
+	struct device_node *np = ion_of_heap_node(heap_data);
+	struct device_node *child;
+
+	if (!np) {
+		return;
+	}
+
+	for_each_available_child_of_node(np, child) {
+		ion_uniphier_prealloc_one(client, heap, child);
+	}
+}
+
+/**
+ * Claim the preallocated buffer by name.
+ *
+ * @param client kernel client that holds the buffers
+ * @param data argument of ION_UNIP_IOC_CLAIM_PREALLOC
+ * @return 0 on success, error code on error
+ */
+int ion_uniphier_prealloc_claim(struct ion_client *client,
+	struct ion_uniphier_prealloc_data *data)
+{
+	struct ion_uniphier_prealloc *pa;
+	int ret = 0;
+
+	data->name[ION_UNIP_PREALLOC_NAME_LEN - 1] = '\0';
+
+	mutex_lock(&ion_uniphier_prealloc_lock);
+	pa = ion_uniphier_prealloc_find(data->name);
+	if (!pa) {
+		ret = -ENOENT;
+		goto out;
+	}
+	if (!ion_uniphier_prealloc_allowed(pa)) {
+		ret = -EACCES;
+		goto out;
+	}
+
+	data->fd = ion_share_dma_buf_fd(client, pa->handle);
+	if (data->fd < 0) {
+		ret = data->fd;
+		goto out;
+	}
+	ion_uniphier_trace_buffer(ION_UNIP_TRACE_SHARE,
+		ion_handle_buffer(pa->handle));
+	data->heap_id = pa->heap_id;
+	data->phys = pa->phys;
+	data->len = pa->len;
+
+out:
+	mutex_unlock(&ion_uniphier_prealloc_lock);
+
+	return ret;
+}
+
+/**
+ * Free all preallocated buffers, before the heaps are destroyed.
+ *
+ * @param client kernel client that holds the buffers
+ */
+void ion_uniphier_prealloc_destroy(struct ion_client *client)
+{
+	struct ion_uniphier_prealloc *pa, *tmp;
+
+	mutex_lock(&ion_uniphier_prealloc_lock);
+	list_for_each_entry_safe(pa, tmp, &ion_uniphier_preallocs, list) {
+		list_del(&pa->list);
+		ion_free(client, pa->handle);
+		kfree(pa);
+	}
+	mutex_unlock(&ion_uniphier_prealloc_lock);
+}
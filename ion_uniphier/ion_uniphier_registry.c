@@ -0,0 +1,362 @@
+/*
+ * Ion driver for Socionext UniPhier series.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define pr_fmt(fmt) "ion-uniphier-registry: " fmt
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/types.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/stringhash.h>
+#include <linux/hashtable.h>
+#include <linux/workqueue.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/cred.h>
+#include <linux/capability.h>
+
+#include "ion/ion.h"
+#include "ion/ion_priv.h"
+
+#include "ion_uniphier_core.h"
+#include "uapi/ion_uniphier.h"
+
+/*
+ * Registry of published buffers.
+ *
+ * The kernel client of the driver imports the published buffer, so the
+ * name can be opened while the publisher is alive. The entry holds the
+ * /dev/ion file of the publisher's client. Legacy ion tells nothing
+ * when clients release buffers or are destroyed, so the entry is
+ * dropped when the publisher has closed its client (only the entry
+ * holds the file), or when the handle of the registry is the last
+ * reference of the buffer. It is checked by open and by the sweep that
+ * runs while entries exist.
+ */
+
+#define ION_UNIPHIER_REGISTRY_BITS   6
+#define ION_UNIPHIER_REGISTRY_SWEEP  HZ
+
+/**
+ * struct ion_uniphier_registry_entry - published buffer
+ *
+ * @param node     entry of ion_uniphier_registry
+ * @param name     name of the buffer
+ * @param handle   handle of the kernel client
+ * @param file     /dev/ion file of the publisher's client
+ * @param heap_id  id of the heap that has the buffer
+ * @param phys     physical address, 0 if not contiguous
+ * @param len      length of the buffer
+ * @param uid      effective user of the publisher
+ * @param gid      effective group of the publisher
+ * @param access   ION_UNIP_PUBLISH_* flags
+ */
+struct ion_uniphier_registry_entry {
+	struct hlist_node node;
+	char name[ION_UNIP_PUBLISH_NAME_LEN];
+	struct ion_handle *handle;
+	struct file *file;
+	unsigned int heap_id;
+	ion_phys_addr_t phys;
+	size_t len;
+	kuid_t uid;
+	kgid_t gid;
+	u32 access;
+};
+
+static DEFINE_HASHTABLE(ion_uniphier_registry, ION_UNIPHIER_REGISTRY_BITS);
+static DEFINE_MUTEX(ion_uniphier_registry_lock);
+static unsigned int ion_uniphier_registry_count;
+static struct ion_client *ion_uniphier_registry_client;
+
+static void ion_uniphier_registry_sweep(struct work_struct *work);
+static DECLARE_DELAYED_WORK(ion_uniphier_registry_work,
+	ion_uniphier_registry_sweep);
+
+static u32 ion_uniphier_registry_hash(const char *name)
+{
+	return full_name_hash(NULL, name, strlen(name));
+}
+
+static struct ion_uniphier_registry_entry *ion_uniphier_registry_find(
+	const char *name)
+{
+	struct ion_uniphier_registry_entry *e;
+
+	hash_for_each_possible(ion_uniphier_registry, e, node,
+		ion_uniphier_registry_hash(name)) {
+		if (!strcmp(e->name, name)) {
+			return e;
+		}
+	}
+
+	return NULL;
+}
+
+static bool ion_uniphier_registry_released(
+	struct ion_uniphier_registry_entry *e)
+{
+	struct ion_buffer *buffer = ion_handle_buffer(e->handle);
+
+	/* the publisher has closed its client */
+	if (file_count(e->file) == 1) {
+		return true;
+	}
+
+	/* the handle of the registry is the last one */
+	return ion_uniphier_buffer_refcount(buffer) == 1;
+}
+
+static void ion_uniphier_registry_drop_locked(
+	struct ion_uniphier_registry_entry *e)
+{
+	pr_devel("drop %s.\n", e->name);
+
+	hash_del(&e->node);
+	ion_uniphier_registry_count--;
+	ion_free(ion_uniphier_registry_client, e->handle);
+	fput(e->file);
+	kfree(e);
+}
+
+static void ion_uniphier_registry_sweep(struct work_struct *work)
+{
+	struct ion_uniphier_registry_entry *e;
+	struct hlist_node *tmp;
+	int bkt;
+
+	mutex_lock(&ion_uniphier_registry_lock);
+	hash_for_each_safe(ion_uniphier_registry, bkt, tmp, e, node) {
+		if (ion_uniphier_registry_released(e)) {
+			ion_uniphier_registry_drop_locked(e);
+		}
+	}
+	if (ion_uniphier_registry_count) {
+		schedule_delayed_work(&ion_uniphier_registry_work,
+			ION_UNIPHIER_REGISTRY_SWEEP);
+	}
+	mutex_unlock(&ion_uniphier_registry_lock);
+}
+
+static bool ion_uniphier_registry_allowed(
+	struct ion_uniphier_registry_entry *e)
+{
+	if (uid_eq(current_euid(), e->uid)) {
+		return true;
+	}
+	if ((e->access & ION_UNIP_PUBLISH_GROUP) && in_egroup_p(e->gid)) {
+		return true;
+	}
+	if (e->access & ION_UNIP_PUBLISH_OTHERS) {
+		return true;
+	}
+
+	return capable(CAP_SYS_ADMIN);
+}
+
+static int ion_uniphier_registry_unpublish(const char *name)
+{
+	struct ion_uniphier_registry_entry *e;
+	int ret = 0;
+
+	mutex_lock(&ion_uniphier_registry_lock);
+	e = ion_uniphier_registry_find(name);
+	if (!e) {
+		ret = -ENOENT;
+		goto out;
+	}
+	if (!uid_eq(current_euid(), e->uid) && !capable(CAP_SYS_ADMIN)) {
+		ret = -EPERM;
+		goto out;
+	}
+	ion_uniphier_registry_drop_locked(e);
+
+out:
+	mutex_unlock(&ion_uniphier_registry_lock);
+
+	return ret;
+}
+
+/**
+ * Publish the buffer by name, or unpublish the name if fd is -1.
+ *
+ * @param publisher ion client of caller
+ * @param data argument of ION_UNIP_IOC_PUBLISH
+ * @return 0 on success, error code on error
+ */
+int ion_uniphier_registry_publish(struct ion_client *publisher,
+	struct ion_uniphier_publish_data *data)
+{
+	struct ion_client *client = ion_uniphier_registry_client;
+	struct ion_uniphier_registry_entry *e, *old;
+	int ret;
+
+	if (!client) {
+		return -ENODEV;
+	}
+	data->name[ION_UNIP_PUBLISH_NAME_LEN - 1] = '\0';
+	if (!data->name[0] || data->access &
+		~(ION_UNIP_PUBLISH_GROUP | ION_UNIP_PUBLISH_OTHERS)) {
+		return -EINVAL;
+	}
+	if (data->fd == -1) {
+		return ion_uniphier_registry_unpublish(data->name);
+	}
+
+	e = kzalloc(sizeof(*e), GFP_KERNEL);
+	if (!e) {
+		return -ENOMEM;
+	}
+	strlcpy(e->name, data->name, sizeof(e->name));
+	e->uid = current_euid();
+	e->gid = current_egid();
+	e->access = data->access;
+
+	e->file = ion_uniphier_client_file_get(publisher);
+	if (IS_ERR(e->file)) {
+		ret = PTR_ERR(e->file);
+		goto err_free;
+	}
+
+	e->handle = ion_import_dma_buf(client, data->fd);
+	if (IS_ERR_OR_NULL(e->handle)) {
+		pr_warning("ion_import_dma_buf(fd:%d) failed.\n", data->fd);
+		ret = e->handle ? PTR_ERR(e->handle) : -EINVAL;
+		goto err_fput;
+	}
+	ion_uniphier_trace_buffer(ION_UNIP_TRACE_IMPORT,
+		ion_handle_buffer(e->handle));
+	e->heap_id = ion_handle_buffer(e->handle)->heap->id;
+	if (ion_phys(client, e->handle, &e->phys, &e->len)) {
+		e->phys = 0;
+		e->len = ion_handle_buffer(e->handle)->size;
+	}
+
+	mutex_lock(&ion_uniphier_registry_lock);
+	old = ion_uniphier_registry_find(e->name);
+	if (old && ion_uniphier_registry_released(old)) {
+		ion_uniphier_registry_drop_locked(old);
+		old = NULL;
+	}
+	if (old) {
+		mutex_unlock(&ion_uniphier_registry_lock);
+		ret = -EEXIST;
+		goto err_free_handle;
+	}
+	hash_add(ion_uniphier_registry, &e->node,
+		ion_uniphier_registry_hash(e->name));
+	if (!ion_uniphier_registry_count++) {
+		schedule_delayed_work(&ion_uniphier_registry_work,
+			ION_UNIPHIER_REGISTRY_SWEEP);
+	}
+	mutex_unlock(&ion_uniphier_registry_lock);
+
+	return 0;
+
+err_free_handle:
+	ion_free(client, e->handle);
+err_fput:
+	fput(e->file);
+err_free:
+	kfree(e);
+
+	return ret;
+}
+
+/**
+ * Open the published buffer by name.
+ *
+ * @param data argument of ION_UNIP_IOC_OPEN_NAMED
+ * @return 0 on success, error code on error
+ */
+int ion_uniphier_registry_open(struct ion_uniphier_open_named_data *data)
+{
+	struct ion_uniphier_registry_entry *e;
+	int ret = 0;
+
+	data->name[ION_UNIP_PUBLISH_NAME_LEN - 1] = '\0';
+
+	mutex_lock(&ion_uniphier_registry_lock);
+	e = ion_uniphier_registry_find(data->name);
+	if (e && ion_uniphier_registry_released(e)) {
+		ion_uniphier_registry_drop_locked(e);
+		e = NULL;
+	}
+	if (!e) {
+		ret = -ENOENT;
+		goto out;
+	}
+	if (!ion_uniphier_registry_allowed(e)) {
+		ret = -EACCES;
+		goto out;
+	}
+
+	data->fd = ion_share_dma_buf_fd(ion_uniphier_registry_client,
+		e->handle);
+	if (data->fd < 0) {
+		ret = data->fd;
+		goto out;
+	}
+	ion_uniphier_trace_buffer(ION_UNIP_TRACE_SHARE,
+		ion_handle_buffer(e->handle));
+	data->heap_id = e->heap_id;
+	data->phys = e->phys;
+	data->len = e->len;
+
+out:
+	mutex_unlock(&ion_uniphier_registry_lock);
+
+	return ret;
+}
+
+/**
+ * Start the registry.
+ *
+ * @param client kernel client that holds published buffers
+ */
+void ion_uniphier_registry_init(struct ion_client *client)
+{
+	ion_uniphier_registry_client = client;
+}
+
+/**
+ * Drop all names, before the kernel client is destroyed.
+ */
+void ion_uniphier_registry_destroy(void)
+{
+	struct ion_uniphier_registry_entry *e;
+	struct hlist_node *tmp;
+	int bkt;
+
+	if (!ion_uniphier_registry_client) {
+		return;
+	}
+
+	cancel_delayed_work_sync(&ion_uniphier_registry_work);
+
+	mutex_lock(&ion_uniphier_registry_lock);
+	hash_for_each_safe(ion_uniphier_registry, bkt, tmp, e, node) {
+		ion_uniphier_registry_drop_locked(e);
+	}
+	ion_uniphier_registry_client = NULL;
+	mutex_unlock(&ion_uniphier_registry_lock);
+}
@@ -0,0 +1,269 @@
+/*
+ * Ion driver for Socionext UniPhier series.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define pr_fmt(fmt) "ion-uniphier-trace: " fmt
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/types.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <linux/debugfs.h>
+#include <linux/timekeeping.h>
+#include <linux/sched.h>
+#include <linux/scatterlist.h>
+
+#include "ion/ion.h"
+#include "ion/ion_priv.h"
+
+#include "ion_uniphier_core.h"
+#include "uapi/ion_uniphier.h"
+
+/*
+ * Allocation event recorder.
+ *
+ * Each CPU has own ring of events, the writer takes only the lock of its
+ * CPU that is not contended except with the reader. If the ring is full,
+ * new events are dropped and counted as lost, so the reader always sees
+ * consistent events. The reader copies events from the ring to user
+ * directly, without intermediate buffer.
+ *
+ *   ion_uniphier/alloc_trace         read events (binary)
+ *   ion_uniphier/alloc_trace_enable  start/stop recording
+ *   ion_uniphier/alloc_trace_lost    number of dropped events
+ */
+
+static unsigned int trace_buffer_events = 8192;
+module_param(trace_buffer_events, uint, 0444);
+MODULE_PARM_DESC(trace_buffer_events, "Number of events in the ring per CPU (power of 2)");
+
+static bool trace_enable;
+module_param(trace_enable, bool, 0644);
+MODULE_PARM_DESC(trace_enable, "Record allocation events at load");
+
+bool ion_uniphier_trace_enabled;
+
+struct ion_uniphier_trace_cpu {
+	spinlock_t lock;
+	struct ion_uniphier_trace_event *events;
+	unsigned long head;
+	unsigned long tail;
+	unsigned long lost;
+};
+
+static DEFINE_PER_CPU(struct ion_uniphier_trace_cpu, ion_uniphier_trace_cpus);
+static DEFINE_MUTEX(ion_uniphier_trace_read_lock);
+
+void __ion_uniphier_trace_record(unsigned int type, unsigned int heap_id,
+	u64 buffer_id, u64 phys, u64 size, u64 align, unsigned long flags,
+	pid_t pid)
+{
+	struct ion_uniphier_trace_cpu *tc;
+	struct ion_uniphier_trace_event *ev;
+	unsigned long irqflags;
+	u64 now = ktime_get_ns();
+
+	tc = get_cpu_ptr(&ion_uniphier_trace_cpus);
+	spin_lock_irqsave(&tc->lock, irqflags);
+
+	if (!tc->events || tc->head - tc->tail >= trace_buffer_events) {
+		tc->lost++;
+		goto out;
+	}
+
+	ev = &tc->events[tc->head & (trace_buffer_events - 1)];
+	ev->timestamp = now;
+	ev->phys = phys;
+	ev->size = size;
+	ev->align = align;
+	ev->buffer_id = buffer_id;
+	ev->flags = flags;
+	ev->pid = pid;
+	ev->type = type;
+	ev->heap_id = heap_id;
+	ev->cpu = smp_processor_id();
+	tc->head++;
+
+out:
+	spin_unlock_irqrestore(&tc->lock, irqflags);
+	put_cpu_ptr(&ion_uniphier_trace_cpus);
+}
+
+void __ion_uniphier_trace_buffer(unsigned int type, struct ion_buffer *buffer)
+{
+	u64 phys = 0;
+
+	if (buffer->sg_table) {
+		phys = sg_phys(buffer->sg_table->sgl);
+	}
+
+	__ion_uniphier_trace_record(type, buffer->heap->id,
+		ion_uniphier_buffer_id(buffer), phys, buffer->size, 0,
+		buffer->flags, task_tgid_nr(current));
+}
+
+static ssize_t ion_uniphier_trace_read(struct file *file, char __user *ubuf,
+	size_t count, loff_t *ppos)
+{
+	size_t max_events = count / sizeof(struct ion_uniphier_trace_event);
+	size_t done = 0;
+	int cpu;
+
+	if (max_events == 0) {
+		return -EINVAL;
+	}
+
+	mutex_lock(&ion_uniphier_trace_read_lock);
+	for_each_possible_cpu(cpu) {
+		struct ion_uniphier_trace_cpu *tc;
+		unsigned long head, tail, pos, n;
+		unsigned long irqflags;
+
+		tc = per_cpu_ptr(&ion_uniphier_trace_cpus, cpu);
+		if (!tc->events) {
+			continue;
+		}
+
+		spin_lock_irqsave(&tc->lock, irqflags);
+		head = tc->head;
+		tail = tc->tail;
+		spin_unlock_irqrestore(&tc->lock, irqflags);
+
+		/*
+		 * The writer never overwrites [tail, head), it is safe to
+		 * copy them without the lock.
+		 */
+		while (tail != head && done < max_events) {
+			pos = tail & (trace_buffer_events - 1);
+			n = min3(head - tail, trace_buffer_events - pos,
+				(unsigned long)(max_events - done));
+			if (copy_to_user(ubuf + done * sizeof(tc->events[0]),
+				&tc->events[pos], n * sizeof(tc->events[0]))) {
+				mutex_unlock(&ion_uniphier_trace_read_lock);
+				return -EFAULT;
+			}
+			tail += n;
+			done += n;
+		}
+
+		spin_lock_irqsave(&tc->lock, irqflags);
+		tc->tail = tail;
+		spin_unlock_irqrestore(&tc->lock, irqflags);
+
+		if (done == max_events) {
+			break;
+		}
+	}
+	mutex_unlock(&ion_uniphier_trace_read_lock);
+
+	*ppos += done * sizeof(struct ion_uniphier_trace_event);
+
+	return done * sizeof(struct ion_uniphier_trace_event);
+}
+
+static const struct file_operations ion_uniphier_trace_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ion_uniphier_trace_read,
+	.llseek = noop_llseek,
+};
+
+static int ion_uniphier_trace_lost_get(void *data, u64 *val)
+{
+	int cpu;
+
+	*val = 0;
+	for_each_possible_cpu(cpu) {
+		*val += per_cpu_ptr(&ion_uniphier_trace_cpus, cpu)->lost;
+	}
+
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(ion_uniphier_trace_lost_fops,
+	ion_uniphier_trace_lost_get, NULL, "%llu\n");
+
+int ion_uniphier_trace_init(struct dentry *debug_root)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct ion_uniphier_trace_cpu *tc;
+
+		tc = per_cpu_ptr(&ion_uniphier_trace_cpus, cpu);
+		spin_lock_init(&tc->lock);
+		tc->head = tc->tail = tc->lost = 0;
+		tc->events = NULL;
+	}
+
+	if (!is_power_of_2(trace_buffer_events)) {
+		pr_warning("trace_buffer_events:%u is not power of 2.\n",
+			trace_buffer_events);
+		return -EINVAL;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct ion_uniphier_trace_cpu *tc;
+
+		tc = per_cpu_ptr(&ion_uniphier_trace_cpus, cpu);
+		tc->events = vmalloc(trace_buffer_events * sizeof(tc->events[0]));
+		if (!tc->events) {
+			ion_uniphier_trace_exit();
+			return -ENOMEM;
+		}
+	}
+
+	if (debug_root) {
+		debugfs_create_file("alloc_trace", 0400, debug_root, NULL,
+			&ion_uniphier_trace_fops);
+		debugfs_create_bool("alloc_trace_enable", 0600, debug_root,
+			&ion_uniphier_trace_enabled);
+		debugfs_create_file("alloc_trace_lost", 0400, debug_root, NULL,
+			&ion_uniphier_trace_lost_fops);
+	}
+
+	ion_uniphier_trace_enabled = trace_enable;
+
+	return 0;
+}
+
+void ion_uniphier_trace_exit(void)
+{
+	int cpu;
+
+	ion_uniphier_trace_enabled = false;
+
+	for_each_possible_cpu(cpu) {
+		struct ion_uniphier_trace_cpu *tc;
+		unsigned long irqflags;
+		void *events;
+
+		tc = per_cpu_ptr(&ion_uniphier_trace_cpus, cpu);
+		spin_lock_irqsave(&tc->lock, irqflags);
+		events = tc->events;
+		tc->events = NULL;
+		spin_unlock_irqrestore(&tc->lock, irqflags);
+
+		vfree(events);
+	}
+}
@@ -0,0 +1,401 @@
+/*
+ * Ion driver for Socionext UniPhier series.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define pr_fmt(fmt) "ion-uniphier-userptr: " fmt
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/types.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/compiler.h>
+#include <linux/vmalloc.h>
+#include <linux/scatterlist.h>
+#include <linux/dma-mapping.h>
+
+#include "ion/ion.h"
+#include "ion/ion_priv.h"
+
+#include "ion_uniphier_core.h"
+#include "uapi/ion_uniphier.h"
+
+/*
+ * Userptr heap.
+ *
+ * Legacy ion creates buffers only by ion_alloc(), that passes nothing
+ * but size, align and flags to the heap. So the import ioctl pins the
+ * pages of user memory first, puts them to the heap as pending request
+ * and calls ion_alloc() with the mask of this heap. The allocate op
+ * takes the pages from the request of the same task. Imports are
+ * serialized by the lock of heap.
+ */
+
+/**
+ * struct ion_uniphier_userptr_req - pinned pages waiting for allocate
+ *
+ * @param pages     pinned pages, taken by allocate
+ * @param nr_pages  number of pages
+ * @param write     devices write to the pages
+ */
+struct ion_uniphier_userptr_req {
+	struct page **pages;
+	unsigned long nr_pages;
+	bool write;
+};
+
+/**
+ * struct ion_uniphier_userptr_heap - userptr heap
+ *
+ * @param heap   ion heap
+ * @param lock   serializes imports
+ * @param owner  task that has the pending request
+ * @param req    pending request, only the owner can touch it
+ */
+struct ion_uniphier_userptr_heap {
+	struct ion_heap heap;
+	struct mutex lock;
+	struct task_struct *owner;
+	struct ion_uniphier_userptr_req *req;
+};
+
+/**
+ * struct ion_uniphier_userptr_buffer - private data of the buffer
+ *
+ * @param table     sg_table of the buffer, returned by map_dma
+ * @param id        unique id of the buffer, for the event recorder
+ * @param pages     pinned pages
+ * @param nr_pages  number of pages
+ * @param write     pages may be written by devices
+ */
+struct ion_uniphier_userptr_buffer {
+	struct sg_table table;
+	u64 id;
+	struct page **pages;
+	unsigned long nr_pages;
+	bool write;
+};
+
+#define to_userptr_heap(h) \
+	container_of(h, struct ion_uniphier_userptr_heap, heap)
+
+/* Only one heap exists, ion device of this driver is only one */
+static struct ion_uniphier_userptr_heap *ion_uniphier_userptr_heap;
+
+static void ion_uniphier_userptr_put_pages(struct page **pages,
+	unsigned long nr_pages, bool dirty)
+{
+	unsigned long i;
+
+	for (i = 0; i < nr_pages; i++) {
+		if (dirty) {
+			set_page_dirty_lock(pages[i]);
+		}
+		put_page(pages[i]);
+	}
+	vfree(pages);
+}
+
+static int ion_uniphier_userptr_heap_allocate(struct ion_heap *heap,
+	struct ion_buffer *buffer, unsigned long size, unsigned long align,
+	unsigned long flags)
+{
+	struct ion_uniphier_userptr_heap *uh = to_userptr_heap(heap);
+	struct ion_uniphier_userptr_req *req;
+	struct ion_uniphier_userptr_buffer *ub;
+	int ret;
+
+	/* Only ion_uniphier_userptr_import() can allocate */
+	if (READ_ONCE(uh->owner) != current) {
+		return -EINVAL;
+	}
+	req = uh->req;
+	if (!req->pages || size != req->nr_pages << PAGE_SHIFT) {
+		return -EINVAL;
+	}
+
+	ub = kzalloc(sizeof(*ub), GFP_KERNEL);
+	if (!ub) {
+		return -ENOMEM;
+	}
+
+	ret = sg_alloc_table_from_pages(&ub->table, req->pages, req->nr_pages,
+		0, size, GFP_KERNEL);
+	if (ret) {
+		kfree(ub);
+		return ret;
+	}
+
+	ub->id = ion_uniphier_new_buffer_id();
+	ub->pages = req->pages;
+	ub->nr_pages = req->nr_pages;
+	ub->write = req->write;
+	req->pages = NULL;
+	buffer->priv_virt = ub;
+
+	ion_uniphier_trace_record(ION_UNIP_TRACE_ALLOC, heap->id, ub->id,
+		page_to_phys(ub->pages[0]), size, align, flags,
+		task_tgid_nr(current));
+
+	return 0;
+}
+
+static void ion_uniphier_userptr_heap_free(struct ion_buffer *buffer)
+{
+	struct ion_uniphier_userptr_buffer *ub = buffer->priv_virt;
+
+	ion_uniphier_trace_record(ION_UNIP_TRACE_FREE, buffer->heap->id, ub->id,
+		page_to_phys(ub->pages[0]), buffer->size, 0, buffer->flags,
+		buffer->pid);
+
+	ion_uniphier_userptr_put_pages(ub->pages, ub->nr_pages, ub->write);
+	sg_free_table(&ub->table);
+	kfree(ub);
+}
+
+static int ion_uniphier_userptr_heap_phys(struct ion_heap *heap,
+	struct ion_buffer *buffer, ion_phys_addr_t *addr, size_t *len)
+{
+	struct ion_uniphier_userptr_buffer *ub = buffer->priv_virt;
+
+	/* Physical address is meaningful only if pages are contiguous */
+	if (ub->table.nents != 1) {
+		return -EINVAL;
+	}
+
+	*addr = page_to_phys(ub->pages[0]);
+	*len = buffer->size;
+
+	return 0;
+}
+
+static struct sg_table *ion_uniphier_userptr_heap_map_dma(
+	struct ion_heap *heap, struct ion_buffer *buffer)
+{
+	struct ion_uniphier_userptr_buffer *ub = buffer->priv_virt;
+
+	return &ub->table;
+}
+
+static void ion_uniphier_userptr_heap_unmap_dma(struct ion_heap *heap,
+	struct ion_buffer *buffer)
+{
+}
+
+static int ion_uniphier_userptr_heap_map_user(struct ion_heap *heap,
+	struct ion_buffer *buffer, struct vm_area_struct *vma)
+{
+	struct ion_uniphier_userptr_buffer *ub = buffer->priv_virt;
+
+	/* Pages pinned without write must not be written through the mapping */
+	if (!ub->write) {
+		if (vma->vm_flags & VM_WRITE) {
+			return -EPERM;
+		}
+		vma->vm_flags &= ~VM_MAYWRITE;
+	}
+
+	return ion_heap_map_user(heap, buffer, vma);
+}
+
+static void *ion_uniphier_userptr_heap_map_kernel(struct ion_heap *heap,
+	struct ion_buffer *buffer)
+{
+	struct ion_uniphier_userptr_buffer *ub = buffer->priv_virt;
+	void *vaddr;
+
+	if (ub->write) {
+		return ion_heap_map_kernel(heap, buffer);
+	}
+
+	/* Kernel writes to read-only pages fault instead of corrupting them */
+	vaddr = vmap(ub->pages, ub->nr_pages, VM_MAP, PAGE_KERNEL_RO);
+	if (!vaddr) {
+		return ERR_PTR(-ENOMEM);
+	}
+
+	return vaddr;
+}
+
+static struct ion_heap_ops ion_uniphier_userptr_heap_ops = {
+	.allocate     = ion_uniphier_userptr_heap_allocate,
+	.free         = ion_uniphier_userptr_heap_free,
+	.phys         = ion_uniphier_userptr_heap_phys,
+	.map_dma      = ion_uniphier_userptr_heap_map_dma,
+	.unmap_dma    = ion_uniphier_userptr_heap_unmap_dma,
+	.map_user     = ion_uniphier_userptr_heap_map_user,
+	.map_kernel   = ion_uniphier_userptr_heap_map_kernel,
+	.unmap_kernel = ion_heap_unmap_kernel,
+};
+
+/**
+ * Get the id of the buffer for the event recorder.
+ *
+ * @param buffer ion buffer of the userptr heap
+ * @return unique id of the buffer
+ */
+u64 ion_uniphier_userptr_buffer_id(struct ion_buffer *buffer)
+{
+	struct ion_uniphier_userptr_buffer *ub = buffer->priv_virt;
+
+	return ub->id;
+}
+
+/**
+ * Check the buffer is imported by ION_UNIP_USERPTR_READONLY.
+ *
+ * @param buffer ion buffer
+ * @return true if nothing may write to the buffer, false otherwise
+ */
+bool ion_uniphier_userptr_buffer_readonly(struct ion_buffer *buffer)
+{
+	struct ion_uniphier_userptr_heap *uh = ion_uniphier_userptr_heap;
+	struct ion_uniphier_userptr_buffer *ub;
+
+	if (!uh || buffer->heap != &uh->heap) {
+		return false;
+	}
+	ub = buffer->priv_virt;
+
+	return !ub->write;
+}
+
+/**
+ * Pin the user memory and export it as dma-buf of ion buffer.
+ *
+ * @param client ion client of caller
+ * @param data argument of ION_UNIP_IOC_USERPTR
+ * @return 0 on success, error code on error
+ */
+int ion_uniphier_userptr_import(struct ion_client *client,
+	struct ion_uniphier_userptr_data *data)
+{
+	struct ion_uniphier_userptr_heap *uh = ion_uniphier_userptr_heap;
+	struct ion_uniphier_userptr_req req;
+	struct ion_handle *handle;
+	unsigned long nr_pages, i;
+	int pinned, ret;
+
+	if (!uh) {
+		return -ENODEV;
+	}
+	if (!data->len || !PAGE_ALIGNED(data->virt) ||
+		!PAGE_ALIGNED(data->len) ||
+		data->virt + data->len < data->virt ||
+		data->virt + data->len > TASK_SIZE) {
+		pr_warning("invalid range virt:%llx, len:%llx.\n",
+			(unsigned long long)data->virt,
+			(unsigned long long)data->len);
+		return -EINVAL;
+	}
+	nr_pages = data->len >> PAGE_SHIFT;
+	if (nr_pages > INT_MAX) {
+		return -EINVAL;
+	}
+
+	req.nr_pages = nr_pages;
+	req.write = !(data->flags & ION_UNIP_USERPTR_READONLY);
+	req.pages = vzalloc(sizeof(struct page *) * nr_pages);
+	if (!req.pages) {
+		return -ENOMEM;
+	}
+
+	pinned = get_user_pages_fast(data->virt, nr_pages, req.write,
+		req.pages);
+	if (pinned != nr_pages) {
+		pr_warning("get_user_pages_fast(virt:%llx) pinned %d of %lu.\n",
+			(unsigned long long)data->virt, pinned, nr_pages);
+		ion_uniphier_userptr_put_pages(req.pages, max(pinned, 0), false);
+		return pinned < 0 ? pinned : -EFAULT;
+	}
+
+	data->cont = 1;
+	for (i = 1; i < nr_pages; i++) {
+		if (page_to_pfn(req.pages[i]) != page_to_pfn(req.pages[0]) + i) {
+			data->cont = 0;
+			break;
+		}
+	}
+	data->phys = page_to_phys(req.pages[0]);
+
+	/*
+	 * User memory is cacheable, the buffer is cached. Map it by
+	 * map_user at mmap(), not on fault.
+	 */
+	mutex_lock(&uh->lock);
+	uh->req = &req;
+	WRITE_ONCE(uh->owner, current);
+	handle = ion_alloc(client, data->len, PAGE_SIZE,
+		1 << uh->heap.id, ION_FLAG_CACHED | ION_FLAG_CACHED_NEEDS_SYNC);
+	WRITE_ONCE(uh->owner, NULL);
+	uh->req = NULL;
+	mutex_unlock(&uh->lock);
+
+	if (IS_ERR_OR_NULL(handle)) {
+		pr_warning("ion_alloc(userptr) failed.\n");
+		ret = handle ? PTR_ERR(handle) : -ENOMEM;
+		/* pages are not taken if allocate has failed */
+		if (req.pages) {
+			ion_uniphier_userptr_put_pages(req.pages, nr_pages,
+				false);
+		}
+		return ret;
+	}
+	ion_uniphier_trace_buffer(ION_UNIP_TRACE_IMPORT,
+		ion_handle_buffer(handle));
+
+	/* dma-buf holds the buffer, the handle is no longer needed */
+	data->fd = ion_share_dma_buf_fd(client, handle);
+	ion_free(client, handle);
+	if (data->fd < 0) {
+		pr_warning("ion_share_dma_buf_fd(userptr) failed.\n");
+		return data->fd;
+	}
+
+	return 0;
+}
+
+struct ion_heap *ion_uniphier_userptr_heap_create(void)
+{
+	struct ion_uniphier_userptr_heap *uh;
+
+	uh = kzalloc(sizeof(*uh), GFP_KERNEL);
+	if (!uh) {
+		return ERR_PTR(-ENOMEM);
+	}
+	mutex_init(&uh->lock);
+
+	uh->heap.ops = &ion_uniphier_userptr_heap_ops;
+	uh->heap.type = ION_UNIPHIER_HEAP_TYPE_USERPTR;
+	uh->heap.id = ION_HEAP_ID_USERPTR;
+	uh->heap.name = "userptr";
+
+	ion_uniphier_userptr_heap = uh;
+
+	return &uh->heap;
+}
+
+void ion_uniphier_userptr_heap_destroy(struct ion_heap *heap)
+{
+	struct ion_uniphier_userptr_heap *uh = to_userptr_heap(heap);
+
+	ion_uniphier_userptr_heap = NULL;
+	kfree(uh);
+}
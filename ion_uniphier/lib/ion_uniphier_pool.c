@@ -0,0 +1,534 @@
+/*
+ * Userspace library of ion-uniphier.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include <asm/ion.h>
+#include <asm/ion_uniphier.h>
+
+#include "ion_uniphier_pool.h"
+
+#define ION_DEVNAME          "/dev/ion"
+#define ION_POOL_MAX_CLASSES 32
+#define ION_POOL_MEMCG_ROOT  "/sys/fs/cgroup/memory"
+
+/**
+ * struct ion_uniphier_pool_class - cached buffers of one size
+ *
+ * @param len   length of buffers
+ * @param free  cached buffers, last put is first
+ * @param nr    number of cached buffers
+ */
+struct ion_uniphier_pool_class {
+	size_t len;
+	struct ion_uniphier_pool_buf *free;
+	size_t nr;
+};
+
+struct ion_uniphier_pool {
+	pthread_mutex_t lock;
+	int fd_ion;
+	unsigned int heap_id_mask;
+	unsigned int flags;
+	size_t page_size;
+	size_t max_cached;
+	struct ion_uniphier_pool_class classes[ION_POOL_MAX_CLASSES];
+	unsigned int nr_classes;
+	struct ion_uniphier_pool_stat stat;
+	int fd_pressure;
+	int trim_all;
+};
+
+static void ion_pool_buf_destroy(struct ion_uniphier_pool *pool,
+	struct ion_uniphier_pool_buf *buf)
+{
+	struct ion_handle_data free_buf;
+
+	munmap(buf->addr, buf->len);
+	close(buf->fd);
+
+	memset(&free_buf, 0, sizeof(free_buf));
+	free_buf.handle = buf->handle;
+	ioctl(pool->fd_ion, ION_IOC_FREE, &free_buf);
+
+	free(buf);
+}
+
+static int ion_pool_buf_create(struct ion_uniphier_pool *pool, size_t len,
+	struct ion_uniphier_pool_buf **buf)
+{
+	struct ion_allocation_data alloc_buf;
+	struct ion_fd_data share_buf;
+	struct ion_handle_data free_buf;
+	struct ion_uniphier_virt_to_phys_data v2p_buf;
+	struct ion_custom_data custom_buf;
+	struct ion_uniphier_pool_buf *b;
+	size_t off;
+	int result;
+
+	b = calloc(1, sizeof(*b));
+	if (!b) {
+		return -ENOMEM;
+	}
+
+	memset(&alloc_buf, 0, sizeof(alloc_buf));
+	alloc_buf.len = len;
+	alloc_buf.align = pool->page_size;
+	alloc_buf.heap_id_mask = pool->heap_id_mask;
+	alloc_buf.flags = pool->flags;
+	if (ioctl(pool->fd_ion, ION_IOC_ALLOC, &alloc_buf) != 0) {
+		result = -errno;
+		goto err_free;
+	}
+
+	memset(&share_buf, 0, sizeof(share_buf));
+	share_buf.handle = alloc_buf.handle;
+	if (ioctl(pool->fd_ion, ION_IOC_SHARE, &share_buf) != 0) {
+		result = -errno;
+		goto err_free_handle;
+	}
+
+	b->addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		share_buf.fd, 0);
+	if (b->addr == MAP_FAILED) {
+		result = -errno;
+		goto err_close;
+	}
+	b->fd = share_buf.fd;
+	b->handle = alloc_buf.handle;
+	b->len = len;
+
+	/*
+	 * resolved once, buffers of the pool are not movable. Cached
+	 * buffers are mapped on fault, fault in all pages so that the page
+	 * tables are there for VIRT_TO_PHYS.
+	 */
+	for (off = 0; off < len; off += pool->page_size) {
+		(void)*(volatile char *)((char *)b->addr + off);
+	}
+	memset(&v2p_buf, 0, sizeof(v2p_buf));
+	v2p_buf.handle = b->handle;
+	v2p_buf.virt = (uintptr_t)b->addr;
+	v2p_buf.len = len;
+	memset(&custom_buf, 0, sizeof(custom_buf));
+	custom_buf.cmd = ION_UNIP_IOC_VIRT_TO_PHYS;
+	custom_buf.arg = (unsigned long)&v2p_buf;
+	if (ioctl(pool->fd_ion, ION_IOC_CUSTOM, &custom_buf) == 0 &&
+		v2p_buf.cont) {
+		b->phys = v2p_buf.phys;
+	}
+
+	*buf = b;
+
+	return 0;
+
+err_close:
+	close(share_buf.fd);
+
+err_free_handle:
+	memset(&free_buf, 0, sizeof(free_buf));
+	free_buf.handle = alloc_buf.handle;
+	ioctl(pool->fd_ion, ION_IOC_FREE, &free_buf);
+
+err_free:
+	free(b);
+
+	return result;
+}
+
+static struct ion_uniphier_pool_class *ion_pool_find_class(
+	struct ion_uniphier_pool *pool, size_t len, int create)
+{
+	struct ion_uniphier_pool_class *c;
+	unsigned int i;
+
+	for (i = 0; i < pool->nr_classes; i++) {
+		if (pool->classes[i].len == len) {
+			return &pool->classes[i];
+		}
+	}
+	if (!create || pool->nr_classes == ION_POOL_MAX_CLASSES) {
+		return NULL;
+	}
+
+	c = &pool->classes[pool->nr_classes++];
+	c->len = len;
+	c->free = NULL;
+	c->nr = 0;
+
+	return c;
+}
+
+/**
+ * Release cached buffers until the pool has keep bytes or less, from
+ * the size that has the most bytes. Called with the lock held.
+ *
+ * @return released bytes
+ */
+static size_t ion_pool_trim_locked(struct ion_uniphier_pool *pool,
+	size_t keep)
+{
+	struct ion_uniphier_pool_class *c, *max;
+	struct ion_uniphier_pool_buf *b;
+	size_t trimmed = 0;
+	unsigned int i;
+
+	while (pool->stat.cached_bytes > keep) {
+		max = NULL;
+		for (i = 0; i < pool->nr_classes; i++) {
+			c = &pool->classes[i];
+			if (c->nr && (!max || c->nr * c->len > max->nr * max->len)) {
+				max = c;
+			}
+		}
+		if (!max) {
+			break;
+		}
+
+		b = max->free;
+		max->free = b->next;
+		max->nr--;
+		pool->stat.cached_bufs--;
+		pool->stat.cached_bytes -= b->len;
+		pool->stat.trimmed++;
+		trimmed += b->len;
+		ion_pool_buf_destroy(pool, b);
+	}
+
+	return trimmed;
+}
+
+/**
+ * Open the pool.
+ *
+ * @param heap_id_mask  heaps to allocate from
+ * @param flags         ion allocation flags, ION_UNIP_FLAG_MOVABLE is
+ *                      not allowed because phys of the buffers is
+ *                      cached
+ * @param max_cached    max bytes of cached buffers, more are released
+ * @return pool on success, NULL on error with errno
+ */
+struct ion_uniphier_pool *ion_uniphier_pool_open(unsigned int heap_id_mask,
+	unsigned int flags, size_t max_cached)
+{
+	struct ion_uniphier_pool *pool;
+	int err;
+
+	if (flags & ION_UNIP_FLAG_MOVABLE) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool) {
+		return NULL;
+	}
+
+	pool->fd_ion = open(ION_DEVNAME, O_RDWR | O_CLOEXEC);
+	if (pool->fd_ion == -1) {
+		err = errno;
+		free(pool);
+		errno = err;
+		return NULL;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pool->heap_id_mask = heap_id_mask;
+	pool->flags = flags;
+	pool->page_size = sysconf(_SC_PAGESIZE);
+	pool->max_cached = max_cached;
+	pool->fd_pressure = -1;
+
+	return pool;
+}
+
+/**
+ * Close the pool, buffers that are not put yet stay valid until they
+ * are closed by the user, but are not freed by the pool.
+ */
+void ion_uniphier_pool_close(struct ion_uniphier_pool *pool)
+{
+	if (!pool) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	ion_pool_trim_locked(pool, 0);
+	pthread_mutex_unlock(&pool->lock);
+
+	if (pool->fd_pressure != -1) {
+		close(pool->fd_pressure);
+	}
+	close(pool->fd_ion);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+/**
+ * Get the fd of /dev/ion of the pool, for ioctls on buffers of the pool.
+ */
+int ion_uniphier_pool_ion_fd(struct ion_uniphier_pool *pool)
+{
+	return pool->fd_ion;
+}
+
+/**
+ * Get a buffer, the cached buffer of the same size is used if exists.
+ * Contents of the cached buffer are not cleared.
+ *
+ * @param len  length of the buffer, rounded up to pages
+ * @param buf  returns the buffer
+ * @return 0 on success, -errno on error
+ */
+int ion_uniphier_pool_get(struct ion_uniphier_pool *pool, size_t len,
+	struct ion_uniphier_pool_buf **buf)
+{
+	struct ion_uniphier_pool_class *c;
+	struct ion_uniphier_pool_buf *b;
+	int result;
+
+	if (len == 0) {
+		return -EINVAL;
+	}
+	len = (len + pool->page_size - 1) & ~(pool->page_size - 1);
+
+	pthread_mutex_lock(&pool->lock);
+	c = ion_pool_find_class(pool, len, 0);
+	if (c && c->free) {
+		b = c->free;
+		c->free = b->next;
+		c->nr--;
+		pool->stat.cached_bufs--;
+		pool->stat.cached_bytes -= len;
+		pool->stat.hits++;
+		pool->stat.used_bufs++;
+		pthread_mutex_unlock(&pool->lock);
+
+		b->next = NULL;
+		*buf = b;
+		return 0;
+	}
+	pool->stat.misses++;
+	pthread_mutex_unlock(&pool->lock);
+
+	result = ion_pool_buf_create(pool, len, &b);
+	if (result == -ENOMEM) {
+		/* cached buffers of other sizes may be in the way */
+		pthread_mutex_lock(&pool->lock);
+		ion_pool_trim_locked(pool, 0);
+		pthread_mutex_unlock(&pool->lock);
+		result = ion_pool_buf_create(pool, len, &b);
+	}
+	if (result) {
+		return result;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stat.used_bufs++;
+	pthread_mutex_unlock(&pool->lock);
+
+	*buf = b;
+
+	return 0;
+}
+
+/**
+ * Put the buffer back to the pool. The buffer is released instead if
+ * the pool is full or the size cannot be cached.
+ */
+void ion_uniphier_pool_put(struct ion_uniphier_pool *pool,
+	struct ion_uniphier_pool_buf *buf)
+{
+	struct ion_uniphier_pool_class *c;
+
+	if (!buf) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stat.used_bufs--;
+	c = ion_pool_find_class(pool, buf->len, 1);
+	if (!c || pool->stat.cached_bytes + buf->len > pool->max_cached) {
+		pthread_mutex_unlock(&pool->lock);
+		ion_pool_buf_destroy(pool, buf);
+		return;
+	}
+	buf->next = c->free;
+	c->free = buf;
+	c->nr++;
+	pool->stat.cached_bufs++;
+	pool->stat.cached_bytes += buf->len;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Release cached buffers.
+ *
+ * @param keep  bytes of cached buffers to keep, 0 releases all
+ * @return released bytes
+ */
+size_t ion_uniphier_pool_trim(struct ion_uniphier_pool *pool, size_t keep)
+{
+	size_t trimmed;
+
+	pthread_mutex_lock(&pool->lock);
+	trimmed = ion_pool_trim_locked(pool, keep);
+	pthread_mutex_unlock(&pool->lock);
+
+	return trimmed;
+}
+
+/**
+ * Get the memory cgroup (v1) directory of this process.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int ion_pool_memcg_dir(char *dir, size_t len)
+{
+	char line[512], *p;
+	FILE *f;
+	int result = -1;
+
+	f = fopen("/proc/self/cgroup", "re");
+	if (!f) {
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		/* hierarchy-ID:controller-list:cgroup-path */
+		p = strchr(line, ':');
+		if (!p || strncmp(p + 1, "memory:", 7) != 0) {
+			continue;
+		}
+		p += 8;
+		p[strcspn(p, "\n")] = '\0';
+		snprintf(dir, len, ION_POOL_MEMCG_ROOT "%s", p);
+		result = 0;
+		break;
+	}
+	fclose(f);
+
+	return result;
+}
+
+/**
+ * Get the eventfd that is signalled on memory pressure of the memory
+ * cgroup of this process (memory.pressure_level). Poll it and call
+ * ion_uniphier_pool_pressure_event() when it is readable.
+ *
+ * @param level  "low", "medium" or "critical", buffers are trimmed to the
+ *               half on "low" and all on others
+ * @return eventfd on success, -1 on error with errno
+ */
+int ion_uniphier_pool_pressure_fd(struct ion_uniphier_pool *pool,
+	const char *level)
+{
+	char dir[256], path[320], cmd[64];
+	int fd_event, fd_level, fd_ctl, err;
+
+	if (pool->fd_pressure != -1) {
+		return pool->fd_pressure;
+	}
+	if (ion_pool_memcg_dir(dir, sizeof(dir)) != 0) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	fd_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd_event == -1) {
+		return -1;
+	}
+	snprintf(path, sizeof(path), "%s/memory.pressure_level", dir);
+	fd_level = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd_level == -1) {
+		goto err_close_event;
+	}
+	snprintf(path, sizeof(path), "%s/cgroup.event_control", dir);
+	fd_ctl = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd_ctl == -1) {
+		goto err_close_level;
+	}
+
+	snprintf(cmd, sizeof(cmd), "%d %d %s", fd_event, fd_level, level);
+	if (write(fd_ctl, cmd, strlen(cmd)) < 0) {
+		err = errno;
+		close(fd_ctl);
+		errno = err;
+		goto err_close_level;
+	}
+	/* the kernel holds the registration until the eventfd is closed */
+	close(fd_ctl);
+	close(fd_level);
+
+	pool->fd_pressure = fd_event;
+	pool->trim_all = strcmp(level, "low") != 0;
+
+	return fd_event;
+
+err_close_level:
+	err = errno;
+	close(fd_level);
+	errno = err;
+err_close_event:
+	err = errno;
+	close(fd_event);
+	errno = err;
+
+	return -1;
+}
+
+/**
+ * Handle the event of the fd of ion_uniphier_pool_pressure_fd().
+ *
+ * @return released bytes
+ */
+size_t ion_uniphier_pool_pressure_event(struct ion_uniphier_pool *pool)
+{
+	uint64_t count;
+	size_t trimmed;
+
+	if (pool->fd_pressure == -1 ||
+		read(pool->fd_pressure, &count, sizeof(count)) != sizeof(count)) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	trimmed = ion_pool_trim_locked(pool,
+		pool->trim_all ? 0 : pool->stat.cached_bytes / 2);
+	pthread_mutex_unlock(&pool->lock);
+
+	return trimmed;
+}
+
+void ion_uniphier_pool_get_stat(struct ion_uniphier_pool *pool,
+	struct ion_uniphier_pool_stat *stat)
+{
+	pthread_mutex_lock(&pool->lock);
+	*stat = pool->stat;
+	pthread_mutex_unlock(&pool->lock);
+}
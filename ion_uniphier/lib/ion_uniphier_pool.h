@@ -0,0 +1,110 @@
+/*
+ * Userspace library of ion-uniphier.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ION_UNIPHIER_POOL_H__
+#define ION_UNIPHIER_POOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <asm/ion.h>
+
+/*
+ * Buffer pool of ion-uniphier.
+ *
+ * The pool holds one fd of /dev/ion and keeps released buffers per size,
+ * already allocated, shared, mapped and with the physical address. Get
+ * of the size that has been released before takes no syscall.
+ *
+ *   pool = ion_uniphier_pool_open(1 << ION_HEAP_ID_MEDIA,
+ *       ION_FLAG_CACHED, 64 << 20);
+ *   for (;;) {
+ *       ion_uniphier_pool_get(pool, frame_size, &buf);
+ *       ... use buf->addr, buf->fd, buf->phys ...
+ *       ion_uniphier_pool_put(pool, buf);
+ *   }
+ *   ion_uniphier_pool_close(pool);
+ *
+ * The physical address is resolved once per buffer, so the pool does
+ * not take ION_UNIP_FLAG_MOVABLE.
+ *
+ * Cached buffers are released by ion_uniphier_pool_trim(), or on memory
+ * pressure of the memory cgroup, see ion_uniphier_pool_pressure_fd().
+ * Functions are thread safe.
+ */
+
+struct ion_uniphier_pool;
+
+/**
+ * struct ion_uniphier_pool_buf - buffer of the pool
+ *
+ * Members are read only for users.
+ *
+ * @param fd      dma-buf fd, to be passed to devices or other processes
+ * @param handle  ion handle in the fd of the pool
+ * @param addr    user mapping of the whole buffer
+ * @param len     length of the buffer, page aligned
+ * @param phys    physical address, 0 if the buffer is not contiguous
+ */
+struct ion_uniphier_pool_buf {
+	int fd;
+	ion_user_handle_t handle;
+	void *addr;
+	size_t len;
+	uint64_t phys;
+	/* private */
+	struct ion_uniphier_pool_buf *next;
+};
+
+/**
+ * struct ion_uniphier_pool_stat - statistics of the pool
+ *
+ * @param hits          gets that took a cached buffer
+ * @param misses        gets that allocated a new buffer
+ * @param trimmed       buffers released by trim or pressure
+ * @param cached_bufs   buffers in the pool
+ * @param cached_bytes  bytes in the pool
+ * @param used_bufs     buffers got and not put yet
+ */
+struct ion_uniphier_pool_stat {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t trimmed;
+	size_t cached_bufs;
+	size_t cached_bytes;
+	size_t used_bufs;
+};
+
+struct ion_uniphier_pool *ion_uniphier_pool_open(unsigned int heap_id_mask,
+	unsigned int flags, size_t max_cached);
+void ion_uniphier_pool_close(struct ion_uniphier_pool *pool);
+int ion_uniphier_pool_ion_fd(struct ion_uniphier_pool *pool);
+int ion_uniphier_pool_get(struct ion_uniphier_pool *pool, size_t len,
+	struct ion_uniphier_pool_buf **buf);
+void ion_uniphier_pool_put(struct ion_uniphier_pool *pool,
+	struct ion_uniphier_pool_buf *buf);
+size_t ion_uniphier_pool_trim(struct ion_uniphier_pool *pool, size_t keep);
+int ion_uniphier_pool_pressure_fd(struct ion_uniphier_pool *pool,
+	const char *level);
+size_t ion_uniphier_pool_pressure_event(struct ion_uniphier_pool *pool);
+void ion_uniphier_pool_get_stat(struct ion_uniphier_pool *pool,
+	struct ion_uniphier_pool_stat *stat);
+
+#endif /* ION_UNIPHIER_POOL_H__ */
@@ -0,0 +1,889 @@
+/*
+ * Allocation trace replay for the carveout heaps of ion-uniphier.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Feed the recorded alloc/free trace to the placement core of the driver
+ * (ion_uniphier_alloc.c) and report the fragmentation over time, failed
+ * allocations, largest free block and the cost of each operation.
+ *
+ * Trace format, one event per line, '#' starts a comment:
+ *
+ *   <time_us> a <id> <size> <align> <heap_mask> [<lifetime_us>]
+ *   <time_us> f <id>
+ *
+ * If lifetime is given, the buffer is freed at time + lifetime and
+ * no 'f' line is needed for it.
+ *
+ * With -l, allocations whose lifetime is not given or is not less than
+ * the threshold are treated as ION_UNIP_FLAG_LONG_LIVED and placed from
+ * the top of the heap. Binary traces have the flags of allocations.
+ *
+ * With -m, allocations that are not long-lived are treated as
+ * ION_UNIP_FLAG_MOVABLE, and the heap is compacted like the carveout
+ * heap when an allocation fails: movable buffers are moved to the
+ * lowest free range below them from the lowest one, the range may
+ * overlap the buffer itself, then the allocation is retried.
+ *
+ * With -e, the exit status is an error if an allocation failed.
+ *
+ * With -g, the range at offset of every heap is reserved, like the hole
+ * between memory regions of the heap (several phandles of DT
+ * 'memory-region'). Allocations never cross the hole.
+ *
+ * With -b, the trace is the binary output of the event recorder of the
+ * driver (debugfs ion_uniphier/alloc_trace), e.g.
+ *
+ *   cat /sys/kernel/debug/ion_uniphier/alloc_trace > trace.bin
+ *   alloc_replay -b -p all trace.bin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <asm/ion_uniphier.h>
+
+#include "../ion_uniphier_alloc.h"
+
+#define REPLAY_MAX_HEAPS     32
+#define REPLAY_HASH_SIZE     4096
+#define REPLAY_PAGE_SHIFT    12
+#define REPLAY_MAX_HOLES     8
+
+enum replay_op {
+	REPLAY_OP_ALLOC,
+	REPLAY_OP_FREE,
+};
+
+struct replay_event {
+	uint64_t time;
+	enum replay_op op;
+	uint64_t id;
+	uint64_t size;
+	uint64_t align;
+	unsigned int heap_mask;
+	uint64_t lifetime;
+	unsigned int flags;
+};
+
+struct replay_heap {
+	const char *name;
+	unsigned int id;
+	uint64_t base;
+	uint64_t size;
+	struct ion_uniphier_alloc alloc;
+
+	/* statistics */
+	unsigned long nr_alloc;
+	unsigned long nr_free;
+	unsigned long nr_failed;
+	uint64_t used;
+	uint64_t peak_used;
+	uint64_t min_largest_free;
+	double sum_frag;
+	unsigned long nr_frag;
+	uint64_t alloc_ns;
+	uint64_t alloc_ns_max;
+	uint64_t free_ns;
+	uint64_t free_ns_max;
+	unsigned long nr_movable;
+	unsigned long nr_compact;
+	uint64_t compact_moved;
+	uint64_t compact_ns;
+};
+
+struct replay_buffer {
+	uint64_t id;
+	struct replay_heap *heap;
+	uint64_t addr;
+	uint64_t size;
+	uint64_t align;
+	int movable;
+	struct replay_buffer *next;
+};
+
+/* pending free of the buffer that has lifetime, min-heap by time */
+struct replay_pending {
+	uint64_t time;
+	uint64_t id;
+};
+
+static struct replay_heap heaps[REPLAY_MAX_HEAPS];
+static int nr_heaps;
+
+static struct replay_event *events;
+static size_t nr_events;
+
+static struct replay_buffer *buffers[REPLAY_HASH_SIZE];
+
+static struct replay_pending *pending;
+static size_t nr_pending, max_pending;
+
+static unsigned long interval;
+static unsigned long nr_unknown_free;
+
+static uint64_t bank_stride;
+static unsigned int bank_colours;
+
+static int long_lived_enabled;
+static uint64_t long_lived_us;
+
+static int movable_enabled;
+
+static int strict;
+
+/* holes between memory regions, offset from base of each heap */
+static struct {
+	uint64_t offset;
+	uint64_t size;
+} holes[REPLAY_MAX_HOLES];
+static int nr_holes;
+
+/* Same heaps as of_heaps[] of ion_uniphier_core.c */
+static const struct {
+	const char *name;
+	unsigned int id;
+} default_heaps[] = {
+	{ "media", 15, },
+	{ "gpu", 14, },
+	{ "fb", 13, },
+	{ "vio", 12, },
+	{ "ch0", 11, },
+	{ "ch1", 10, },
+	{ "ch2", 9, },
+	{ "hscadbs", 8, },
+	{ "vmla", 7, },
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int add_heap(const char *name, unsigned int id, uint64_t size,
+	uint64_t base)
+{
+	struct replay_heap *h;
+
+	if (nr_heaps >= REPLAY_MAX_HEAPS) {
+		fprintf(stderr, "Too many heaps.\n");
+		return -ENOMEM;
+	}
+
+	h = &heaps[nr_heaps++];
+	memset(h, 0, sizeof(*h));
+	h->name = name;
+	h->id = id;
+	h->size = size;
+	h->base = base;
+
+	return 0;
+}
+
+/**
+ * Parse heap option 'name:id:size[:base]'.
+ */
+static int parse_heap(char *arg)
+{
+	char *name, *id, *size, *base;
+
+	name = strtok(arg, ":");
+	id = strtok(NULL, ":");
+	size = strtok(NULL, ":");
+	base = strtok(NULL, ":");
+	if (!name || !id || !size) {
+		fprintf(stderr, "Invalid heap '%s'.\n", arg);
+		return -EINVAL;
+	}
+
+	return add_heap(name, strtoul(id, NULL, 0), strtoull(size, NULL, 0),
+		base ? strtoull(base, NULL, 0) : 0);
+}
+
+static void add_event(const struct replay_event *e)
+{
+	static size_t max_events;
+
+	if (nr_events == max_events) {
+		max_events = max_events ? max_events * 2 : 1024;
+		events = realloc(events, max_events * sizeof(*events));
+		if (!events) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+	}
+	events[nr_events++] = *e;
+}
+
+static int load_trace(FILE *fp)
+{
+	char line[256];
+	unsigned long lineno = 0;
+
+	while (fgets(line, sizeof(line), fp)) {
+		struct replay_event e;
+		unsigned long long t, id, size, align, life;
+		unsigned int mask;
+		char op;
+		int n;
+
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n') {
+			continue;
+		}
+
+		memset(&e, 0, sizeof(e));
+		n = sscanf(line, "%lli %c %lli %lli %lli %i %lli",
+			&t, &op, &id, &size, &align, (int *)&mask, &life);
+		if (n >= 6 && op == 'a') {
+			e.op = REPLAY_OP_ALLOC;
+			e.size = size;
+			e.align = align;
+			e.heap_mask = mask;
+			e.lifetime = (n == 7) ? life : 0;
+		} else if (n >= 3 && op == 'f') {
+			e.op = REPLAY_OP_FREE;
+		} else {
+			fprintf(stderr, "Invalid trace at line %lu.\n", lineno);
+			return -EINVAL;
+		}
+		e.time = t;
+		e.id = id;
+		add_event(&e);
+	}
+
+	return 0;
+}
+
+static int compare_record(const void *a, const void *b)
+{
+	const struct ion_uniphier_trace_event *ra = a, *rb = b;
+
+	if (ra->timestamp != rb->timestamp) {
+		return (ra->timestamp < rb->timestamp) ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Load the binary trace of the event recorder. Records of each CPU are
+ * merged by timestamp, only alloc and free are used for replay.
+ */
+static int load_trace_binary(FILE *fp)
+{
+	struct ion_uniphier_trace_event *recs = NULL;
+	size_t nr_recs = 0, max_recs = 0, i;
+	uint64_t first;
+
+	for (;;) {
+		if (nr_recs == max_recs) {
+			max_recs = max_recs ? max_recs * 2 : 4096;
+			recs = realloc(recs, max_recs * sizeof(*recs));
+			if (!recs) {
+				return -ENOMEM;
+			}
+		}
+		if (fread(&recs[nr_recs], sizeof(*recs), 1, fp) != 1) {
+			break;
+		}
+		nr_recs++;
+	}
+
+	qsort(recs, nr_recs, sizeof(*recs), compare_record);
+
+	first = nr_recs ? recs[0].timestamp : 0;
+	for (i = 0; i < nr_recs; i++) {
+		const struct ion_uniphier_trace_event *r = &recs[i];
+		struct replay_event e;
+
+		memset(&e, 0, sizeof(e));
+		e.time = (r->timestamp - first) / 1000;
+		e.id = r->buffer_id;
+
+		switch (r->type) {
+		case ION_UNIP_TRACE_ALLOC:
+		case ION_UNIP_TRACE_ALLOC_FAIL:
+			e.op = REPLAY_OP_ALLOC;
+			e.size = r->size;
+			e.align = r->align;
+			e.heap_mask = 1U << r->heap_id;
+			e.flags = r->flags;
+			break;
+		case ION_UNIP_TRACE_FREE:
+			e.op = REPLAY_OP_FREE;
+			break;
+		default:
+			continue;
+		}
+		add_event(&e);
+	}
+	free(recs);
+
+	return 0;
+}
+
+static void pending_push(uint64_t time, uint64_t id)
+{
+	size_t i;
+
+	if (nr_pending == max_pending) {
+		max_pending = max_pending ? max_pending * 2 : 256;
+		pending = realloc(pending, max_pending * sizeof(*pending));
+		if (!pending) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+	}
+
+	i = nr_pending++;
+	while (i > 0 && pending[(i - 1) / 2].time > time) {
+		pending[i] = pending[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	pending[i].time = time;
+	pending[i].id = id;
+}
+
+static struct replay_pending pending_pop(void)
+{
+	struct replay_pending top = pending[0], last;
+	size_t i = 0, c;
+
+	last = pending[--nr_pending];
+	while ((c = i * 2 + 1) < nr_pending) {
+		if (c + 1 < nr_pending && pending[c + 1].time < pending[c].time) {
+			c++;
+		}
+		if (last.time <= pending[c].time) {
+			break;
+		}
+		pending[i] = pending[c];
+		i = c;
+	}
+	pending[i] = last;
+
+	return top;
+}
+
+static void report(uint64_t time)
+{
+	struct ion_uniphier_alloc_stat st;
+	int i;
+
+	for (i = 0; i < nr_heaps; i++) {
+		struct replay_heap *h = &heaps[i];
+		double frag = 0;
+
+		ion_uniphier_alloc_stat(&h->alloc, &st);
+		if (st.free) {
+			frag = 100.0 * (1.0 - (double)st.largest_free / st.free);
+		}
+		if (st.largest_free < h->min_largest_free) {
+			h->min_largest_free = st.largest_free;
+		}
+		h->sum_frag += frag;
+		h->nr_frag++;
+
+		if (interval) {
+			printf("%llu,%s,%s,%llu,%llu,%llu,%lu,%.2f,%lu\n",
+				(unsigned long long)time, h->name,
+				ion_uniphier_alloc_policy_name(h->alloc.policy),
+				(unsigned long long)h->used,
+				(unsigned long long)st.free,
+				(unsigned long long)st.largest_free,
+				st.nr_free_blocks, frag, h->nr_failed);
+		}
+	}
+}
+
+static void do_free(uint64_t id)
+{
+	struct replay_buffer **pos, *b;
+	struct replay_heap *h;
+	uint64_t start, ns;
+
+	for (pos = &buffers[id % REPLAY_HASH_SIZE]; *pos; pos = &(*pos)->next) {
+		if ((*pos)->id == id) {
+			break;
+		}
+	}
+	b = *pos;
+	if (!b) {
+		/* allocation was failed, or freed before the trace started */
+		nr_unknown_free++;
+		return;
+	}
+	*pos = b->next;
+	h = b->heap;
+
+	start = now_ns();
+	ion_uniphier_alloc_put(&h->alloc, b->addr, b->size);
+	ns = now_ns() - start;
+
+	h->nr_free++;
+	h->nr_movable -= b->movable;
+	h->used -= b->size;
+	h->free_ns += ns;
+	if (ns > h->free_ns_max) {
+		h->free_ns_max = ns;
+	}
+	free(b);
+}
+
+static int compare_addr(const void *a, const void *b)
+{
+	const struct replay_buffer *x = *(struct replay_buffer * const *)a;
+	const struct replay_buffer *y = *(struct replay_buffer * const *)b;
+
+	if (x->addr != y->addr) {
+		return (x->addr < y->addr) ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Compact the heap, same as ion_uniphier_carveout_heap_compact_locked()
+ * of the driver.
+ *
+ * @return bytes moved
+ */
+static uint64_t compact(struct replay_heap *h)
+{
+	struct replay_buffer **list, *b;
+	uint64_t moved = 0, to, start;
+	size_t n = 0, i;
+
+	start = now_ns();
+
+	list = malloc(sizeof(*list) * h->nr_movable);
+	if (!list) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	for (i = 0; i < REPLAY_HASH_SIZE; i++) {
+		for (b = buffers[i]; b; b = b->next) {
+			if (b->heap == h && b->movable) {
+				list[n++] = b;
+			}
+		}
+	}
+	qsort(list, n, sizeof(*list), compare_addr);
+
+	for (i = 0; i < n; i++) {
+		b = list[i];
+		to = ion_uniphier_alloc_move_down(&h->alloc, b->addr,
+			b->size, b->align);
+		if (to == ION_UNIPHIER_ALLOC_FAIL) {
+			continue;
+		}
+		b->addr = to;
+		moved += b->size;
+	}
+	free(list);
+
+	h->nr_compact++;
+	h->compact_moved += moved;
+	h->compact_ns += now_ns() - start;
+
+	return moved;
+}
+
+static void do_alloc(const struct replay_event *e)
+{
+	struct replay_heap *h = NULL, *tried = NULL;
+	struct replay_buffer *b;
+	uint64_t addr = ION_UNIPHIER_ALLOC_FAIL, size, start, ns;
+	int id, i, long_lived, movable;
+
+	size = (e->size + (1 << REPLAY_PAGE_SHIFT) - 1) &
+		~((1ULL << REPLAY_PAGE_SHIFT) - 1);
+	long_lived = (e->flags & ION_UNIP_FLAG_LONG_LIVED) ||
+		(long_lived_enabled &&
+			(!e->lifetime || e->lifetime >= long_lived_us));
+	movable = !long_lived && ((e->flags & ION_UNIP_FLAG_MOVABLE) ||
+		movable_enabled);
+
+	/* higher heap id is tried first, like ion core */
+	for (id = 31; id >= 0 && addr == ION_UNIPHIER_ALLOC_FAIL; id--) {
+		if (!(e->heap_mask & (1U << id))) {
+			continue;
+		}
+		for (i = 0; i < nr_heaps; i++) {
+			if (heaps[i].id != id) {
+				continue;
+			}
+			h = &heaps[i];
+			if (!tried) {
+				tried = h;
+			}
+
+			start = now_ns();
+			if (long_lived) {
+				addr = ion_uniphier_alloc_get_top(&h->alloc,
+					size, e->align);
+			} else {
+				addr = ion_uniphier_alloc_get(&h->alloc, size,
+					e->align);
+			}
+			if (addr == ION_UNIPHIER_ALLOC_FAIL &&
+				h->nr_movable && compact(h)) {
+				addr = long_lived ?
+					ion_uniphier_alloc_get_top(&h->alloc,
+						size, e->align) :
+					ion_uniphier_alloc_get(&h->alloc, size,
+						e->align);
+			}
+			ns = now_ns() - start;
+
+			h->alloc_ns += ns;
+			if (ns > h->alloc_ns_max) {
+				h->alloc_ns_max = ns;
+			}
+			break;
+		}
+	}
+
+	for (i = 0; i < nr_holes && addr != ION_UNIPHIER_ALLOC_FAIL; i++) {
+		if (addr < h->base + holes[i].offset + holes[i].size &&
+			addr + size > h->base + holes[i].offset) {
+			fprintf(stderr, "%s: %llx+%llx crosses the hole.\n",
+				h->name, (unsigned long long)addr,
+				(unsigned long long)size);
+			exit(1);
+		}
+	}
+
+	if (addr == ION_UNIPHIER_ALLOC_FAIL) {
+		/* count the failure to the first heap in the mask */
+		if (tried) {
+			tried->nr_failed++;
+		}
+		return;
+	}
+
+	b = malloc(sizeof(*b));
+	if (!b) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	b->id = e->id;
+	b->heap = h;
+	b->addr = addr;
+	b->size = size;
+	b->align = e->align;
+	b->movable = movable;
+	b->next = buffers[e->id % REPLAY_HASH_SIZE];
+	buffers[e->id % REPLAY_HASH_SIZE] = b;
+
+	h->nr_alloc++;
+	h->nr_movable += movable;
+	h->used += size;
+	if (h->used > h->peak_used) {
+		h->peak_used = h->used;
+	}
+
+	if (e->lifetime) {
+		pending_push(e->time + e->lifetime, e->id);
+	}
+}
+
+static int replay(enum ion_uniphier_alloc_policy policy)
+{
+	struct ion_uniphier_alloc_stat st;
+	unsigned long ops = 0;
+	size_t i;
+	int j, k, result;
+
+	for (j = 0; j < nr_heaps; j++) {
+		struct replay_heap *h = &heaps[j];
+
+		result = ion_uniphier_alloc_init(&h->alloc, h->base, h->size,
+			REPLAY_PAGE_SHIFT, policy);
+		if (result) {
+			fprintf(stderr, "Failed to init heap %s.\n", h->name);
+			return result;
+		}
+		result = ion_uniphier_alloc_set_colour(&h->alloc, bank_stride,
+			bank_colours);
+		if (result) {
+			fprintf(stderr, "Invalid bank colouring %llx:%u.\n",
+				(unsigned long long)bank_stride, bank_colours);
+			ion_uniphier_alloc_destroy(&h->alloc);
+			return result;
+		}
+		for (k = 0; k < nr_holes; k++) {
+			result = ion_uniphier_alloc_reserve(&h->alloc,
+				h->base + holes[k].offset, holes[k].size);
+			if (result) {
+				fprintf(stderr, "Invalid hole %llx:%llx of %s.\n",
+					(unsigned long long)holes[k].offset,
+					(unsigned long long)holes[k].size,
+					h->name);
+				ion_uniphier_alloc_destroy(&h->alloc);
+				return result;
+			}
+		}
+		h->nr_alloc = h->nr_free = h->nr_failed = 0;
+		h->used = h->peak_used = 0;
+		ion_uniphier_alloc_stat(&h->alloc, &st);
+		h->min_largest_free = st.largest_free;
+		h->sum_frag = 0;
+		h->nr_frag = 0;
+		h->alloc_ns = h->alloc_ns_max = 0;
+		h->free_ns = h->free_ns_max = 0;
+		h->nr_movable = h->nr_compact = 0;
+		h->compact_moved = h->compact_ns = 0;
+	}
+	nr_unknown_free = 0;
+
+	for (i = 0; i < nr_events; i++) {
+		const struct replay_event *e = &events[i];
+
+		while (nr_pending && pending[0].time <= e->time) {
+			do_free(pending_pop().id);
+			ops++;
+		}
+
+		if (e->op == REPLAY_OP_ALLOC) {
+			do_alloc(e);
+		} else {
+			do_free(e->id);
+		}
+		ops++;
+
+		if (interval && ops % interval == 0) {
+			report(e->time);
+		}
+	}
+	/* free the rest of buffers that have lifetime */
+	while (nr_pending) {
+		struct replay_pending p = pending_pop();
+
+		do_free(p.id);
+		ops++;
+		if (interval && ops % interval == 0) {
+			report(p.time);
+		}
+	}
+	report(nr_events ? events[nr_events - 1].time : 0);
+
+	printf("# policy: %s, events: %lu, unknown frees: %lu\n",
+		ion_uniphier_alloc_policy_name(policy), ops, nr_unknown_free);
+	if (bank_colours > 1) {
+		printf("# bank stride: %llx, colours: %u\n",
+			(unsigned long long)bank_stride, bank_colours);
+	}
+	for (k = 0; k < nr_holes; k++) {
+		printf("# hole: offset %llx, size %llx\n",
+			(unsigned long long)holes[k].offset,
+			(unsigned long long)holes[k].size);
+	}
+	if (long_lived_enabled) {
+		printf("# long-lived: lifetime >= %llu us or unknown\n",
+			(unsigned long long)long_lived_us);
+	}
+	printf("# %-8s %8s %8s %8s %12s %12s %8s %10s %10s %10s %10s\n",
+		"heap", "alloc", "free", "failed", "peak_used", "min_largest",
+		"avg_frag", "alloc_ns", "alloc_max", "free_ns", "free_max");
+	for (j = 0; j < nr_heaps; j++) {
+		struct replay_heap *h = &heaps[j];
+
+		printf("# %-8s %8lu %8lu %8lu %12llu %12llu %7.2f%% %10llu %10llu %10llu %10llu\n",
+			h->name, h->nr_alloc, h->nr_free, h->nr_failed,
+			(unsigned long long)h->peak_used,
+			(unsigned long long)h->min_largest_free,
+			h->nr_frag ? h->sum_frag / h->nr_frag : 0.0,
+			(unsigned long long)(h->nr_alloc + h->nr_failed ?
+				h->alloc_ns / (h->nr_alloc + h->nr_failed) : 0),
+			(unsigned long long)h->alloc_ns_max,
+			(unsigned long long)(h->nr_free ?
+				h->free_ns / h->nr_free : 0),
+			(unsigned long long)h->free_ns_max);
+	}
+	if (movable_enabled) {
+		printf("# %-8s %8s %12s %12s\n", "heap", "compact",
+			"moved", "compact_us");
+		for (j = 0; j < nr_heaps; j++) {
+			struct replay_heap *h = &heaps[j];
+
+			printf("# %-8s %8lu %12llu %12.1f\n", h->name,
+				h->nr_compact,
+				(unsigned long long)h->compact_moved,
+				h->compact_ns / 1000.0);
+		}
+	}
+
+	/* drop buffers that were not freed in the trace */
+	for (i = 0; i < REPLAY_HASH_SIZE; i++) {
+		while (buffers[i]) {
+			struct replay_buffer *b = buffers[i];
+
+			buffers[i] = b->next;
+			free(b);
+		}
+	}
+	result = 0;
+	for (j = 0; j < nr_heaps; j++) {
+		if (strict && heaps[j].nr_failed) {
+			result = -ENOSPC;
+		}
+		ion_uniphier_alloc_destroy(&heaps[j].alloc);
+	}
+
+	return result;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-b] [-p policy|all] [-H name:id:size[:base]]... "
+		"[-c stride:colours] [-l lifetime] [-m] [-g offset:size]... [-i interval] [-e] [trace]\n"
+		"  -b  trace is the binary output of ion_uniphier/alloc_trace\n"
+		"  -p  placement policy (first-fit, best-fit, next-fit, all)\n"
+		"  -c  bank colouring, same as socionext,bank-stride and\n"
+		"      socionext,bank-colours of the heap\n"
+		"  -l  place allocations whose lifetime (us) is not less than\n"
+		"      this or unknown from the top, as ION_UNIP_FLAG_LONG_LIVED\n"
+		"  -m  treat other allocations as ION_UNIP_FLAG_MOVABLE and\n"
+		"      compact the heap when an allocation fails\n"
+		"  -g  reserve the hole at offset of each heap, like the gap\n"
+		"      between memory regions of the heap\n"
+		"  -H  add heap, default is of_heaps[] with 256MB each\n"
+		"  -i  print the state of heaps every interval events as CSV:\n"
+		"      time,heap,policy,used,free,largest_free,free_blocks,"
+		"frag%%,failed\n"
+		"  -e  exit with error if an allocation failed\n",
+		name);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *policy_name = "first-fit";
+	FILE *fp = stdin;
+	char *p;
+	int opt, policy, result;
+	int binary = 0;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "p:H:c:l:g:i:mebh")) != -1) {
+		switch (opt) {
+		case 'b':
+			binary = 1;
+			break;
+		case 'p':
+			policy_name = optarg;
+			break;
+		case 'H':
+			if (parse_heap(optarg) != 0) {
+				return 1;
+			}
+			break;
+		case 'c':
+			bank_stride = strtoull(optarg, &p, 0);
+			if (*p != ':') {
+				usage(argv[0]);
+				return 1;
+			}
+			bank_colours = strtoul(p + 1, NULL, 0);
+			break;
+		case 'l':
+			long_lived_enabled = 1;
+			long_lived_us = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			movable_enabled = 1;
+			break;
+		case 'e':
+			strict = 1;
+			break;
+		case 'g':
+			if (nr_holes >= REPLAY_MAX_HOLES) {
+				fprintf(stderr, "Too many holes.\n");
+				return 1;
+			}
+			holes[nr_holes].offset = strtoull(optarg, &p, 0);
+			if (*p != ':') {
+				usage(argv[0]);
+				return 1;
+			}
+			holes[nr_holes].size = strtoull(p + 1, NULL, 0);
+			nr_holes++;
+			break;
+		case 'i':
+			interval = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (nr_heaps == 0) {
+		for (i = 0; i < sizeof(default_heaps) / sizeof(default_heaps[0]); i++) {
+			add_heap(default_heaps[i].name, default_heaps[i].id,
+				0x10000000, 0x80000000ULL + i * 0x10000000ULL);
+		}
+	}
+
+	if (optind < argc) {
+		fp = fopen(argv[optind], "r");
+		if (!fp) {
+			fprintf(stderr, "Failed to open '%s'.\n", argv[optind]);
+			return 1;
+		}
+	}
+	result = binary ? load_trace_binary(fp) : load_trace(fp);
+	if (fp != stdin) {
+		fclose(fp);
+	}
+	if (result) {
+		return 1;
+	}
+
+	if (interval) {
+		printf("time,heap,policy,used,free,largest_free,free_blocks,frag%%,failed\n");
+	}
+
+	if (strcmp(policy_name, "all") == 0) {
+		for (policy = 0; policy < ION_UNIPHIER_ALLOC_NR_POLICIES; policy++) {
+			if (replay(policy) != 0) {
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	policy = ion_uniphier_alloc_policy_parse(policy_name);
+	if (policy < 0) {
+		fprintf(stderr, "Unknown policy '%s'.\n", policy_name);
+		return 1;
+	}
+
+	return (replay(policy) == 0) ? 0 : 1;
+}
@@ -0,0 +1,360 @@
+/*
+ * Test of the asynchronous allocation of ion-uniphier.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Queue allocations by ION_UNIP_IOC_ALLOC_ASYNC with an eventfd, poll
+ * the eventfd until all of them complete, collect them by
+ * ION_UNIP_IOC_ALLOC_RESULT and check the buffers. Also check the wait
+ * flag, collected and unknown tickets, tickets of other client, the
+ * limit of requests per client and a failed allocation. Print
+ * the time that the caller is blocked for the queue against
+ * ION_IOC_ALLOC.
+ *
+ *   async_alloc_test [-H heap_id] [-s size] [-n buffers]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include <asm/ion.h>
+#include <asm/ion_uniphier.h>
+
+#define ION_DEVNAME      "/dev/ion"
+#define TEST_MAX_BUFS    32
+#define TEST_TIMEOUT_MS  10000
+/* ION_UNIPHIER_ASYNC_MAX_PER_CLIENT of the driver */
+#define TEST_MAX_QUEUED  64
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int alloc_async(int fd_ion, int heap_id, size_t len, int efd,
+	uint32_t *ticket)
+{
+	struct ion_uniphier_alloc_async_data async_buf;
+	struct ion_custom_data custom_buf;
+
+	memset(&async_buf, 0, sizeof(async_buf));
+	async_buf.len = len;
+	async_buf.heap_id_mask = 0x1 << heap_id;
+	async_buf.flags = ION_FLAG_CACHED;
+	async_buf.eventfd = efd;
+
+	memset(&custom_buf, 0, sizeof(custom_buf));
+	custom_buf.cmd = ION_UNIP_IOC_ALLOC_ASYNC;
+	custom_buf.arg = (unsigned long)&async_buf;
+	if (ioctl(fd_ion, ION_IOC_CUSTOM, &custom_buf) != 0) {
+		return errno;
+	}
+	*ticket = async_buf.ticket;
+
+	return 0;
+}
+
+static int alloc_result(int fd_ion, uint32_t ticket, uint32_t flags,
+	struct ion_uniphier_alloc_result_data *data)
+{
+	struct ion_custom_data custom_buf;
+
+	memset(data, 0, sizeof(*data));
+	data->ticket = ticket;
+	data->flags = flags;
+
+	memset(&custom_buf, 0, sizeof(custom_buf));
+	custom_buf.cmd = ION_UNIP_IOC_ALLOC_RESULT;
+	custom_buf.arg = (unsigned long)data;
+	if (ioctl(fd_ion, ION_IOC_CUSTOM, &custom_buf) != 0) {
+		return errno;
+	}
+
+	return 0;
+}
+
+static int check_buffer(const struct ion_uniphier_alloc_result_data *r,
+	size_t len)
+{
+	uint8_t *addr;
+
+	if (r->len < len) {
+		fprintf(stderr, "Buffer is too small, len:%llx.\n",
+			(unsigned long long)r->len);
+		return -EINVAL;
+	}
+
+	addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+	if (addr == MAP_FAILED) {
+		fprintf(stderr, "Failed to mmap().\n");
+		return errno;
+	}
+	addr[0] = 1;
+	addr[len - 1] = 1;
+	munmap(addr, len);
+
+	return 0;
+}
+
+/**
+ * Wait until the eventfd counts n completions.
+ */
+static int wait_events(int efd, int n)
+{
+	struct pollfd pfd = { .fd = efd, .events = POLLIN };
+	uint64_t count;
+	int done = 0;
+
+	while (done < n) {
+		if (poll(&pfd, 1, TEST_TIMEOUT_MS) != 1) {
+			fprintf(stderr, "Timeout, %d of %d completed.\n",
+				done, n);
+			return -ETIMEDOUT;
+		}
+		if (read(efd, &count, sizeof(count)) != sizeof(count)) {
+			return errno;
+		}
+		done += count;
+	}
+
+	return 0;
+}
+
+/**
+ * Other client cannot collect the ticket, and a client cannot have more
+ * than TEST_MAX_QUEUED requests. Closing the client drops its results.
+ */
+static int check_clients(int heap_id)
+{
+	struct ion_uniphier_alloc_result_data r;
+	uint32_t ticket;
+	int fd_a, fd_b, i, result = 0;
+
+	fd_a = open(ION_DEVNAME, O_RDWR);
+	fd_b = open(ION_DEVNAME, O_RDWR);
+	if (fd_a == -1 || fd_b == -1) {
+		fprintf(stderr, "Failed to open(ion).\n");
+		result = errno;
+		goto out;
+	}
+
+	for (i = 0; i < TEST_MAX_QUEUED; i++) {
+		result = alloc_async(fd_a, heap_id, 0x1000, -1, &ticket);
+		if (result) {
+			fprintf(stderr, "Failed to queue request %d.\n", i);
+			goto out;
+		}
+	}
+	if (alloc_async(fd_a, heap_id, 0x1000, -1, &ticket) != EBUSY) {
+		fprintf(stderr, "Too many requests are queued.\n");
+		result = -EINVAL;
+		goto out;
+	}
+	if (alloc_result(fd_b, ticket, ION_UNIP_ASYNC_WAIT, &r) != ENOENT) {
+		fprintf(stderr, "Ticket of other client is collected.\n");
+		result = -EINVAL;
+		goto out;
+	}
+	result = alloc_result(fd_a, ticket, ION_UNIP_ASYNC_WAIT, &r);
+	if (result) {
+		fprintf(stderr, "Failed to collect ticket %u.\n", ticket);
+		goto out;
+	}
+	close(r.fd);
+
+out:
+	if (fd_a != -1) {
+		close(fd_a);
+	}
+	if (fd_b != -1) {
+		close(fd_b);
+	}
+
+	return result;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-H heap_id] [-s size] [-n buffers]\n",
+		name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct ion_uniphier_alloc_result_data r;
+	struct ion_allocation_data alloc_buf;
+	struct ion_handle_data free_buf;
+	uint32_t tickets[TEST_MAX_BUFS], ticket;
+	int heap_id = ION_HEAP_ID_MEDIA;
+	size_t size = 0x400000;
+	int n = 8;
+	int fd_ion, efd, opt, i, result = 0;
+	uint64_t start, t_queue, t_sync;
+
+	while ((opt = getopt(argc, argv, "H:s:n:h")) != -1) {
+		switch (opt) {
+		case 'H':
+			heap_id = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			n = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (n < 1 || n > TEST_MAX_BUFS) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd_ion = open(ION_DEVNAME, O_RDWR);
+	if (fd_ion == -1) {
+		fprintf(stderr, "Failed to open(ion).\n");
+		return errno;
+	}
+	efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (efd == -1) {
+		result = errno;
+		fprintf(stderr, "Failed to eventfd().\n");
+		goto out;
+	}
+
+	start = now_ns();
+	for (i = 0; i < n; i++) {
+		result = alloc_async(fd_ion, heap_id, size, efd, &tickets[i]);
+		if (result) {
+			fprintf(stderr, "Failed to queue buffer %d.\n", i);
+			goto out_close;
+		}
+	}
+	t_queue = now_ns() - start;
+
+	result = wait_events(efd, n);
+	if (result) {
+		goto out_close;
+	}
+	for (i = 0; i < n; i++) {
+		result = alloc_result(fd_ion, tickets[i], 0, &r);
+		if (result) {
+			fprintf(stderr, "Failed to collect ticket %u.\n",
+				tickets[i]);
+			goto out_close;
+		}
+		result = check_buffer(&r, size);
+		close(r.fd);
+		if (result) {
+			goto out_close;
+		}
+		if (alloc_result(fd_ion, tickets[i], 0, &r) != ENOENT) {
+			fprintf(stderr, "Ticket is collected twice.\n");
+			result = -EINVAL;
+			goto out_close;
+		}
+	}
+
+	/* without eventfd, wait in the result */
+	result = alloc_async(fd_ion, heap_id, size, -1, &ticket);
+	if (result) {
+		goto out_close;
+	}
+	result = alloc_result(fd_ion, ticket, ION_UNIP_ASYNC_WAIT, &r);
+	if (result) {
+		fprintf(stderr, "Failed to wait ticket %u.\n", ticket);
+		goto out_close;
+	}
+	close(r.fd);
+
+	/* error of the allocation is the error of the result */
+	result = alloc_async(fd_ion, heap_id, (size_t)1 << 40, -1, &ticket);
+	if (result == 0) {
+		result = alloc_result(fd_ion, ticket, ION_UNIP_ASYNC_WAIT, &r);
+		if (result == 0) {
+			close(r.fd);
+			fprintf(stderr, "Too large buffer is allocated.\n");
+			result = -EINVAL;
+			goto out_close;
+		}
+		if (alloc_result(fd_ion, ticket, 0, &r) != ENOENT) {
+			fprintf(stderr, "Failed ticket is not collected.\n");
+			result = -EINVAL;
+			goto out_close;
+		}
+	}
+	if (alloc_result(fd_ion, 0x7fffffff, 0, &r) != ENOENT) {
+		fprintf(stderr, "Unknown ticket is not refused.\n");
+		result = -EINVAL;
+		goto out_close;
+	}
+
+	result = check_clients(heap_id);
+	if (result) {
+		goto out_close;
+	}
+
+	/* same buffers by ION_IOC_ALLOC */
+	start = now_ns();
+	for (i = 0; i < n; i++) {
+		memset(&alloc_buf, 0, sizeof(alloc_buf));
+		alloc_buf.len = size;
+		alloc_buf.heap_id_mask = 0x1 << heap_id;
+		alloc_buf.flags = ION_FLAG_CACHED;
+		if (ioctl(fd_ion, ION_IOC_ALLOC, &alloc_buf) != 0) {
+			result = errno;
+			fprintf(stderr, "Failed to ioctl(alloc).\n");
+			goto out_close;
+		}
+		memset(&free_buf, 0, sizeof(free_buf));
+		free_buf.handle = alloc_buf.handle;
+		ioctl(fd_ion, ION_IOC_FREE, &free_buf);
+	}
+	t_sync = now_ns() - start;
+
+	printf("%d buffers of %zx: caller blocked %.1f us by queue, "
+		"%.1f us by ION_IOC_ALLOC\n", n, size, t_queue / 1000.0,
+		t_sync / 1000.0);
+	printf("OK\n");
+	result = 0;
+
+out_close:
+	close(efd);
+
+out:
+	close(fd_ion);
+
+	return result;
+}
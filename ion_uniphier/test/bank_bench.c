@@ -0,0 +1,343 @@
+/*
+ * DRAM bank benchmark of ion-uniphier buffers.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Stream N buffers concurrently (one thread per buffer) and report the
+ * total bandwidth with three placements of buffers:
+ *
+ *   same-bank  buffers in one allocation, all start at the same colour
+ *   coloured   buffers in one allocation, buffer i is shifted by
+ *              (i % colours) * stride, same as the bank colouring of
+ *              the carveout heap
+ *   heap       buffers allocated one by one from the heap, placed by
+ *              the policy of the heap (socionext,bank-stride and
+ *              socionext,bank-colours in DT)
+ *
+ *   bank_bench [-H heap_id] [-s size] [-n buffers] [-S stride]
+ *              [-C colours] [-r passes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <asm/ion.h>
+#include <asm/ion_uniphier.h>
+
+#define ION_DEVNAME      "/dev/ion"
+#define BENCH_MAX_BUFS   16
+
+struct stream_arg {
+	volatile int *go;
+	volatile uint64_t *addr;
+	size_t size;
+	int passes;
+	uint64_t sum;
+};
+
+struct bench_buf {
+	ion_user_handle_t handle;
+	int fd;
+	void *addr;
+	size_t len;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *stream_main(void *p)
+{
+	struct stream_arg *arg = p;
+	size_t words = arg->size / sizeof(uint64_t);
+	uint64_t sum = 0;
+	size_t i;
+	int n;
+
+	while (!__atomic_load_n(arg->go, __ATOMIC_ACQUIRE)) {
+		sched_yield();
+	}
+	for (n = 0; n < arg->passes; n++) {
+		for (i = 0; i < words; i++) {
+			sum += arg->addr[i];
+		}
+	}
+	arg->sum = sum;
+
+	return NULL;
+}
+
+/**
+ * Stream all buffers at the same time.
+ *
+ * @return total bandwidth in MB/s, or negative value on error
+ */
+static double stream(void **addrs, int n, size_t size, int passes)
+{
+	struct stream_arg args[BENCH_MAX_BUFS];
+	pthread_t threads[BENCH_MAX_BUFS];
+	volatile int go = 0;
+	uint64_t start, end;
+	int i, started;
+
+	for (started = 0; started < n; started++) {
+		args[started].go = &go;
+		args[started].addr = addrs[started];
+		args[started].size = size;
+		args[started].passes = passes;
+		if (pthread_create(&threads[started], NULL, stream_main,
+			&args[started]) != 0) {
+			fprintf(stderr, "Failed to pthread_create().\n");
+			break;
+		}
+	}
+	if (started < n) {
+		/* release threads that are waiting without streaming */
+		for (i = 0; i < started; i++) {
+			args[i].passes = 0;
+		}
+	}
+
+	start = now_ns();
+	__atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	end = now_ns();
+
+	if (started < n) {
+		return -1.0;
+	}
+
+	return (double)size * n * passes / ((end - start) / 1000.0);
+}
+
+static int buf_alloc(int fd_ion, int heap_id, size_t len, size_t align,
+	struct bench_buf *b)
+{
+	struct ion_allocation_data alloc_buf;
+	struct ion_fd_data share_buf;
+	struct ion_handle_data free_buf;
+	int result;
+
+	memset(&alloc_buf, 0, sizeof(alloc_buf));
+	alloc_buf.len = len;
+	alloc_buf.align = align;
+	alloc_buf.heap_id_mask = 0x1 << heap_id;
+	alloc_buf.flags = ION_FLAG_CACHED;
+	result = ioctl(fd_ion, ION_IOC_ALLOC, &alloc_buf);
+	if (result != 0) {
+		result = errno;
+		fprintf(stderr, "Failed to ioctl(alloc).\n");
+		return result;
+	}
+
+	memset(&share_buf, 0, sizeof(share_buf));
+	share_buf.handle = alloc_buf.handle;
+	result = ioctl(fd_ion, ION_IOC_SHARE, &share_buf);
+	if (result != 0) {
+		result = errno;
+		fprintf(stderr, "Failed to ioctl(share).\n");
+		goto err_free;
+	}
+
+	b->addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		share_buf.fd, 0);
+	if (b->addr == MAP_FAILED) {
+		result = errno;
+		fprintf(stderr, "Failed to mmap().\n");
+		goto err_close;
+	}
+	/* fault in all pages before the measurement */
+	memset(b->addr, 1, len);
+
+	b->handle = alloc_buf.handle;
+	b->fd = share_buf.fd;
+	b->len = len;
+
+	return 0;
+
+err_close:
+	close(share_buf.fd);
+
+err_free:
+	memset(&free_buf, 0, sizeof(free_buf));
+	free_buf.handle = alloc_buf.handle;
+	ioctl(fd_ion, ION_IOC_FREE, &free_buf);
+
+	return result;
+}
+
+static void buf_free(int fd_ion, struct bench_buf *b)
+{
+	struct ion_handle_data free_buf;
+
+	munmap(b->addr, b->len);
+	close(b->fd);
+
+	memset(&free_buf, 0, sizeof(free_buf));
+	free_buf.handle = b->handle;
+	ioctl(fd_ion, ION_IOC_FREE, &free_buf);
+}
+
+static uint64_t buf_phys(int fd_ion, struct bench_buf *b)
+{
+	struct ion_uniphier_virt_to_phys_data v2p_buf;
+	struct ion_custom_data custom_buf;
+
+	memset(&v2p_buf, 0, sizeof(v2p_buf));
+	v2p_buf.handle = b->handle;
+	v2p_buf.virt = (uintptr_t)b->addr;
+	v2p_buf.len = b->len;
+
+	memset(&custom_buf, 0, sizeof(custom_buf));
+	custom_buf.cmd = ION_UNIP_IOC_VIRT_TO_PHYS;
+	custom_buf.arg = (unsigned long)&v2p_buf;
+	if (ioctl(fd_ion, ION_IOC_CUSTOM, &custom_buf) != 0) {
+		return 0;
+	}
+
+	return v2p_buf.phys;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-H heap_id] [-s size] [-n buffers] "
+		"[-S stride] [-C colours] [-r passes]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_buf big, bufs[BENCH_MAX_BUFS];
+	void *addrs[BENCH_MAX_BUFS];
+	int heap_id = ION_HEAP_ID_MEDIA;
+	size_t size = 0x400000;
+	size_t stride = 0x2000;
+	size_t period, slot;
+	unsigned int colours = 8;
+	int n = 4, passes = 4;
+	int fd_ion, opt, i, nr_bufs, result = 0;
+	double bw;
+
+	while ((opt = getopt(argc, argv, "H:s:n:S:C:r:h")) != -1) {
+		switch (opt) {
+		case 'H':
+			heap_id = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			n = strtol(optarg, NULL, 0);
+			break;
+		case 'S':
+			stride = strtoul(optarg, NULL, 0);
+			break;
+		case 'C':
+			colours = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			passes = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (n < 1 || n > BENCH_MAX_BUFS || colours < 1 || stride == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	size = (size + stride - 1) / stride * stride;
+	period = stride * colours;
+	/* the slot has room for the shift of the coloured placement */
+	slot = (size + period + period - 1) / period * period;
+
+	fd_ion = open(ION_DEVNAME, O_RDWR);
+	if (fd_ion == -1) {
+		fprintf(stderr, "Failed to open(ion).\n");
+		return errno;
+	}
+
+	printf("buffers:%d, size:%zx, stride:%zx, colours:%u, passes:%d\n",
+		n, size, stride, colours, passes);
+	printf("%-10s %12s\n", "placement", "total[MB/s]");
+
+	/* emulated placements in one buffer */
+	result = buf_alloc(fd_ion, heap_id, slot * n, period, &big);
+	if (result) {
+		goto out;
+	}
+	for (i = 0; i < n; i++) {
+		addrs[i] = (uint8_t *)big.addr + slot * i;
+	}
+	bw = stream(addrs, n, size, passes);
+	printf("%-10s %12.1f\n", "same-bank", bw);
+
+	for (i = 0; i < n; i++) {
+		addrs[i] = (uint8_t *)big.addr + slot * i +
+			(i % colours) * stride;
+	}
+	bw = stream(addrs, n, size, passes);
+	printf("%-10s %12.1f\n", "coloured", bw);
+	buf_free(fd_ion, &big);
+
+	/* placement by the heap */
+	for (nr_bufs = 0; nr_bufs < n; nr_bufs++) {
+		result = buf_alloc(fd_ion, heap_id, size, 0,
+			&bufs[nr_bufs]);
+		if (result) {
+			goto out_free;
+		}
+		addrs[nr_bufs] = bufs[nr_bufs].addr;
+	}
+	bw = stream(addrs, n, size, passes);
+	printf("%-10s %12.1f\n", "heap", bw);
+	for (i = 0; i < n; i++) {
+		uint64_t phys = buf_phys(fd_ion, &bufs[i]);
+
+		printf("  buffer %d: phys:%llx, colour:%llu\n", i,
+			(unsigned long long)phys,
+			(unsigned long long)(phys / stride % colours));
+	}
+
+out_free:
+	for (i = 0; i < nr_bufs; i++) {
+		buf_free(fd_ion, &bufs[i]);
+	}
+
+out:
+	close(fd_ion);
+
+	return result;
+}
@@ -0,0 +1,338 @@
+/*
+ * Test of the chunk heap of ion-uniphier.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Check the chunk heap (DT property 'chunk-size'): every buffer takes one
+ * chunk, chunks do not overlap, the buffer larger than the chunk is
+ * refused and the freed chunk is reused first. Then allocate and free
+ * frames of random size in the chunk heap and the carveout heap, and
+ * compare the allocation time and failures.
+ *
+ *   chunk_alloc_test [-H heap_id] [-c chunk_size] [-C carveout_heap_id]
+ *                    [-n frames] [-r rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <math.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <asm/ion.h>
+#include <asm/ion_uniphier.h>
+
+#define ION_DEVNAME      "/dev/ion"
+#define TEST_MAX_FRAMES  256
+
+struct frame {
+	ion_user_handle_t handle;
+	uint64_t phys;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int frame_alloc(int fd_ion, int heap_id, size_t len,
+	ion_user_handle_t *handle)
+{
+	struct ion_allocation_data alloc_buf;
+
+	memset(&alloc_buf, 0, sizeof(alloc_buf));
+	alloc_buf.len = len;
+	alloc_buf.align = 0;
+	alloc_buf.heap_id_mask = 0x1 << heap_id;
+	alloc_buf.flags = 0;
+	if (ioctl(fd_ion, ION_IOC_ALLOC, &alloc_buf) != 0) {
+		return errno;
+	}
+	*handle = alloc_buf.handle;
+
+	return 0;
+}
+
+static void frame_free(int fd_ion, ion_user_handle_t handle)
+{
+	struct ion_handle_data free_buf;
+
+	memset(&free_buf, 0, sizeof(free_buf));
+	free_buf.handle = handle;
+	ioctl(fd_ion, ION_IOC_FREE, &free_buf);
+}
+
+/**
+ * Get the physical address of the buffer by mapping it.
+ *
+ * @return physical address, or 0 on error
+ */
+static uint64_t frame_phys(int fd_ion, ion_user_handle_t handle, size_t len)
+{
+	struct ion_uniphier_virt_to_phys_data v2p_buf;
+	struct ion_custom_data custom_buf;
+	struct ion_fd_data share_buf;
+	uint64_t phys = 0;
+	void *addr;
+
+	memset(&share_buf, 0, sizeof(share_buf));
+	share_buf.handle = handle;
+	if (ioctl(fd_ion, ION_IOC_SHARE, &share_buf) != 0) {
+		return 0;
+	}
+	addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		share_buf.fd, 0);
+	if (addr == MAP_FAILED) {
+		goto out_close;
+	}
+	/* fault in the first page */
+	*(volatile uint8_t *)addr = 0;
+
+	memset(&v2p_buf, 0, sizeof(v2p_buf));
+	v2p_buf.handle = handle;
+	v2p_buf.virt = (uintptr_t)addr;
+	v2p_buf.len = len;
+
+	memset(&custom_buf, 0, sizeof(custom_buf));
+	custom_buf.cmd = ION_UNIP_IOC_VIRT_TO_PHYS;
+	custom_buf.arg = (unsigned long)&v2p_buf;
+	if (ioctl(fd_ion, ION_IOC_CUSTOM, &custom_buf) == 0) {
+		phys = v2p_buf.phys;
+	}
+	munmap(addr, len);
+
+out_close:
+	close(share_buf.fd);
+
+	return phys;
+}
+
+static int check_chunks(int fd_ion, int heap_id, size_t chunk_size)
+{
+	static struct frame frames[TEST_MAX_FRAMES];
+	ion_user_handle_t handle;
+	uint64_t phys;
+	int n, i, j, result = 0;
+
+	/* fill the heap, with buffers smaller than the chunk */
+	for (n = 0; n < TEST_MAX_FRAMES; n++) {
+		if (frame_alloc(fd_ion, heap_id, chunk_size / 2 + n * 0x1000 %
+			(chunk_size / 2), &frames[n].handle) != 0) {
+			break;
+		}
+		frames[n].phys = frame_phys(fd_ion, frames[n].handle,
+			chunk_size / 2);
+		if (!frames[n].phys) {
+			fprintf(stderr, "Failed to get phys of frame %d.\n", n);
+			n++;
+			result = -EIO;
+			goto out;
+		}
+	}
+	printf("chunks: %d of %zx bytes\n", n, chunk_size);
+	if (n == 0 || n == TEST_MAX_FRAMES) {
+		fprintf(stderr, "Heap %d is not a chunk heap.\n", heap_id);
+		result = -EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < i; j++) {
+			uint64_t d = (frames[i].phys > frames[j].phys) ?
+				frames[i].phys - frames[j].phys :
+				frames[j].phys - frames[i].phys;
+
+			if (d < chunk_size || d % chunk_size) {
+				fprintf(stderr, "frame %d (%llx) and %d (%llx) "
+					"are not in different chunks.\n", i,
+					(unsigned long long)frames[i].phys, j,
+					(unsigned long long)frames[j].phys);
+				result = -EINVAL;
+				goto out;
+			}
+		}
+	}
+
+	/* the last freed chunk is reused */
+	i = n / 2;
+	frame_free(fd_ion, frames[i].handle);
+	if (frame_alloc(fd_ion, heap_id, chunk_size, &frames[i].handle) != 0) {
+		fprintf(stderr, "Failed to reuse the freed chunk.\n");
+		frames[i] = frames[--n];
+		result = -ENOMEM;
+		goto out;
+	}
+	phys = frame_phys(fd_ion, frames[i].handle, chunk_size);
+	if (phys != frames[i].phys) {
+		fprintf(stderr, "Reused chunk %llx is not freed one %llx.\n",
+			(unsigned long long)phys,
+			(unsigned long long)frames[i].phys);
+		result = -EINVAL;
+		goto out;
+	}
+
+	/* larger than the chunk */
+	frame_free(fd_ion, frames[--n].handle);
+	if (frame_alloc(fd_ion, heap_id, chunk_size + 0x1000, &handle) == 0) {
+		fprintf(stderr, "Buffer larger than the chunk is accepted.\n");
+		frame_free(fd_ion, handle);
+		result = -EINVAL;
+		goto out;
+	}
+
+out:
+	for (i = 0; i < n; i++) {
+		frame_free(fd_ion, frames[i].handle);
+	}
+
+	return result;
+}
+
+/**
+ * Keep nr_frames frames of random size allocated, free a random one and
+ * allocate a new one for rounds times.
+ */
+static void churn(int fd_ion, int heap_id, size_t max_size, int nr_frames,
+	int rounds)
+{
+	static ion_user_handle_t handles[TEST_MAX_FRAMES];
+	static int live[TEST_MAX_FRAMES];
+	uint64_t t, ns, sum = 0, max = 0, sum_sq = 0;
+	unsigned long nr_alloc = 0, nr_failed = 0;
+	uint32_t x = 2463534242U;
+	double avg;
+	size_t len;
+	int i, r;
+
+	memset(live, 0, sizeof(live));
+	for (r = 0; r < nr_frames + rounds; r++) {
+		/* xorshift32 */
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		i = (r < nr_frames) ? r : (int)(x % nr_frames);
+		if (live[i]) {
+			frame_free(fd_ion, handles[i]);
+			live[i] = 0;
+		}
+
+		len = max_size / 2 + (x >> 8) % (max_size / 2);
+		t = now_ns();
+		live[i] = !frame_alloc(fd_ion, heap_id, len, &handles[i]);
+		ns = now_ns() - t;
+		if (!live[i]) {
+			nr_failed++;
+			continue;
+		}
+		nr_alloc++;
+		sum += ns;
+		sum_sq += ns * ns;
+		if (ns > max) {
+			max = ns;
+		}
+	}
+	for (i = 0; i < nr_frames; i++) {
+		if (live[i]) {
+			frame_free(fd_ion, handles[i]);
+		}
+	}
+
+	avg = nr_alloc ? (double)sum / nr_alloc : 0.0;
+	printf("%-8d %10lu %10lu %12.1f %12llu %12.1f\n", heap_id, nr_alloc,
+		nr_failed, avg, (unsigned long long)max,
+		nr_alloc ? sqrt((double)sum_sq / nr_alloc -
+			avg * avg) : 0.0);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-H heap_id] [-c chunk_size] "
+		"[-C carveout_heap_id] [-n frames] [-r rounds]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	int heap_id = ION_HEAP_ID_VIO;
+	int carveout_id = ION_HEAP_ID_MEDIA;
+	size_t chunk_size = 0x400000;
+	int nr_frames = 8, rounds = 1000;
+	int fd_ion, opt, result;
+
+	while ((opt = getopt(argc, argv, "H:c:C:n:r:h")) != -1) {
+		switch (opt) {
+		case 'H':
+			heap_id = strtol(optarg, NULL, 0);
+			break;
+		case 'c':
+			chunk_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'C':
+			carveout_id = strtol(optarg, NULL, 0);
+			break;
+		case 'n':
+			nr_frames = strtol(optarg, NULL, 0);
+			break;
+		case 'r':
+			rounds = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (chunk_size < 0x2000 || nr_frames < 1 ||
+		nr_frames > TEST_MAX_FRAMES) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd_ion = open(ION_DEVNAME, O_RDWR);
+	if (fd_ion == -1) {
+		fprintf(stderr, "Failed to open(ion).\n");
+		return errno;
+	}
+
+	result = check_chunks(fd_ion, heap_id, chunk_size);
+	if (result) {
+		goto out;
+	}
+
+	printf("frames:%d, rounds:%d, size:%zx-%zx\n", nr_frames, rounds,
+		chunk_size / 2, chunk_size);
+	printf("%-8s %10s %10s %12s %12s %12s\n", "heap", "alloc", "failed",
+		"avg[ns]", "max[ns]", "stddev[ns]");
+	churn(fd_ion, heap_id, chunk_size, nr_frames, rounds);
+	churn(fd_ion, carveout_id, chunk_size, nr_frames, rounds);
+
+	printf("OK\n");
+
+out:
+	close(fd_ion);
+
+	return result;
+}
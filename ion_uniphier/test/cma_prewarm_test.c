@@ -0,0 +1,284 @@
+/*
+ * Pre-warm test of the CMA heap of ion-uniphier.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Check the CMA heap (DT property 'socionext,cma'): the real-time
+ * allocation (ION_UNIP_FLAG_REALTIME) is refused by the CMA heap that
+ * has no pre-warmed block and falls back to the next heap of the mask,
+ * and is served by the CMA heap after ION_UNIP_IOC_CMA_PREWARM. Then
+ * compare the allocation time of cold and pre-warmed blocks.
+ *
+ *   cma_prewarm_test [-H heap_id] [-F fallback_heap_id] [-s size]
+ *                    [-n frames]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <asm/ion.h>
+#include <asm/ion_uniphier.h>
+
+#define ION_DEVNAME      "/dev/ion"
+#define TEST_MAX_FRAMES  64
+
+struct alloc_time {
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int frame_alloc(int fd_ion, unsigned int mask, size_t size,
+	unsigned int flags, ion_user_handle_t *handle, struct alloc_time *t)
+{
+	struct ion_allocation_data alloc_buf;
+	uint64_t start, lat;
+
+	memset(&alloc_buf, 0, sizeof(alloc_buf));
+	alloc_buf.len = size;
+	alloc_buf.heap_id_mask = mask;
+	alloc_buf.flags = flags;
+	start = now_ns();
+	if (ioctl(fd_ion, ION_IOC_ALLOC, &alloc_buf) != 0) {
+		return errno;
+	}
+	lat = now_ns() - start;
+	if (t) {
+		t->total_ns += lat;
+		if (lat > t->max_ns) {
+			t->max_ns = lat;
+		}
+	}
+	*handle = alloc_buf.handle;
+
+	return 0;
+}
+
+static void frame_free(int fd_ion, ion_user_handle_t handle)
+{
+	struct ion_handle_data free_buf;
+
+	memset(&free_buf, 0, sizeof(free_buf));
+	free_buf.handle = handle;
+	ioctl(fd_ion, ION_IOC_FREE, &free_buf);
+}
+
+static int prewarm(int fd_ion, int heap_id, size_t size, unsigned int count,
+	unsigned int *warmed)
+{
+	struct ion_uniphier_cma_prewarm_data cma_buf;
+	struct ion_custom_data custom_buf;
+
+	memset(&cma_buf, 0, sizeof(cma_buf));
+	cma_buf.heap_id = heap_id;
+	cma_buf.count = count;
+	cma_buf.size = size;
+
+	memset(&custom_buf, 0, sizeof(custom_buf));
+	custom_buf.cmd = ION_UNIP_IOC_CMA_PREWARM;
+	custom_buf.arg = (unsigned long)&cma_buf;
+	if (ioctl(fd_ion, ION_IOC_CUSTOM, &custom_buf) != 0) {
+		fprintf(stderr, "Failed to ioctl(cma prewarm).\n");
+		return errno;
+	}
+	if (warmed) {
+		*warmed = cma_buf.warmed;
+	}
+
+	return 0;
+}
+
+/**
+ * Allocate n frames at once and free them.
+ */
+static int alloc_frames(int fd_ion, unsigned int mask, size_t size, int n,
+	unsigned int flags, struct alloc_time *t)
+{
+	ion_user_handle_t handles[TEST_MAX_FRAMES];
+	int i, nr, result = 0;
+
+	for (nr = 0; nr < n; nr++) {
+		result = frame_alloc(fd_ion, mask, size, flags, &handles[nr], t);
+		if (result) {
+			fprintf(stderr, "Failed to allocate frame %d.\n", nr);
+			break;
+		}
+	}
+	for (i = 0; i < nr; i++) {
+		frame_free(fd_ion, handles[i]);
+	}
+
+	return result;
+}
+
+static int check_realtime(int fd_ion, int heap_id, int fb_heap_id,
+	size_t size, int n)
+{
+	ion_user_handle_t handle;
+	unsigned int warmed = 0;
+	int result;
+
+	/* no pre-warmed block, the CMA heap alone refuses */
+	result = frame_alloc(fd_ion, 0x1 << heap_id, size,
+		ION_UNIP_FLAG_REALTIME, &handle, NULL);
+	if (result == 0) {
+		fprintf(stderr, "Real-time allocation of cold CMA is accepted.\n");
+		frame_free(fd_ion, handle);
+		return -EINVAL;
+	}
+
+	/* falls back to the carveout heap */
+	result = frame_alloc(fd_ion, (0x1 << heap_id) | (0x1 << fb_heap_id),
+		size, ION_UNIP_FLAG_REALTIME, &handle, NULL);
+	if (result) {
+		fprintf(stderr, "Real-time allocation does not fall back.\n");
+		return result;
+	}
+	frame_free(fd_ion, handle);
+
+	/* pre-warmed blocks serve real-time allocations */
+	result = prewarm(fd_ion, heap_id, size, n, &warmed);
+	if (result) {
+		return result;
+	}
+	if (warmed != n) {
+		fprintf(stderr, "Pre-warmed %u of %d blocks.\n", warmed, n);
+		return -ENOMEM;
+	}
+	result = alloc_frames(fd_ion, 0x1 << heap_id, size, n,
+		ION_UNIP_FLAG_REALTIME, NULL);
+	if (result) {
+		fprintf(stderr, "Real-time allocation of warm CMA failed.\n");
+		return result;
+	}
+
+	/* blocks are used up, they went back to the system by free */
+	result = frame_alloc(fd_ion, 0x1 << heap_id, size,
+		ION_UNIP_FLAG_REALTIME, &handle, NULL);
+	if (result == 0) {
+		fprintf(stderr, "Used block is pre-warmed again.\n");
+		frame_free(fd_ion, handle);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void print_time(const char *name, const struct alloc_time *t, int n)
+{
+	printf("%-10s %12.1f %12.1f\n", name, t->total_ns / 1000.0 / n,
+		t->max_ns / 1000.0);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-H heap_id] [-F fallback_heap_id] "
+		"[-s size] [-n frames]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct alloc_time cold = { 0 }, warm = { 0 };
+	int heap_id = ION_HEAP_ID_MEDIA;
+	int fb_heap_id = ION_HEAP_ID_VIO;
+	size_t size = 0x7f8000;
+	int n = 8;
+	int fd_ion, opt, result = 0;
+
+	while ((opt = getopt(argc, argv, "H:F:s:n:h")) != -1) {
+		switch (opt) {
+		case 'H':
+			heap_id = strtol(optarg, NULL, 0);
+			break;
+		case 'F':
+			fb_heap_id = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			n = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (n < 1 || n > TEST_MAX_FRAMES || size == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd_ion = open(ION_DEVNAME, O_RDWR);
+	if (fd_ion == -1) {
+		fprintf(stderr, "Failed to open(ion).\n");
+		return errno;
+	}
+
+	result = check_realtime(fd_ion, heap_id, fb_heap_id, size, n);
+	if (result) {
+		goto out;
+	}
+
+	printf("frames:%d, size:%zx\n", n, size);
+	printf("%-10s %12s %12s\n", "blocks", "avg[us]", "max[us]");
+	result = alloc_frames(fd_ion, 0x1 << heap_id, size, n, 0, &cold);
+	if (result) {
+		goto out;
+	}
+	print_time("cold", &cold, n);
+
+	result = prewarm(fd_ion, heap_id, size, n, NULL);
+	if (result) {
+		goto out;
+	}
+	result = alloc_frames(fd_ion, 0x1 << heap_id, size, n, 0, &warm);
+	if (result) {
+		goto out;
+	}
+	print_time("pre-warmed", &warm, n);
+
+	/* return blocks that are left, if any */
+	result = prewarm(fd_ion, heap_id, size, 0, NULL);
+	if (result) {
+		goto out;
+	}
+
+	printf("OK\n");
+
+out:
+	close(fd_ion);
+
+	return result;
+}
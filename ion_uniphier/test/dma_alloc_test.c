@@ -1,5 +1,6 @@
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <errno.h>
 #include <string.h>
@@ -229,12 +230,24 @@ int main(int argc, char *argv[])
 	char *addr = NULL;
 	struct ion_custom_data ioctl_buf;
 	struct ion_uniphier_virt_to_phys_data v2p_buf;
+	struct ion_uniphier_sync_data sync_buf;
+	struct ion_uniphier_sync_range sync_ranges[2];
+	struct ion_uniphier_load_file_data load_buf;
+	char load_tmp[0x1000];
+	int fd_file = -1;
+	unsigned int flags;
 	int rep;
 	int result = -EIO;
 
 	heap_id = ION_HEAP_ID_MEDIA;
 	rep = 1;
 
+	/* e.g.) 0x1 (ION_FLAG_CACHED), 0x0 (write-combined) */
+	flags = 0;
+	if (argc > 1) {
+		flags = strtoul(argv[1], NULL, 0);
+	}
+
 	printf("open\n");
 	getchar();
 
@@ -253,7 +266,7 @@ int main(int argc, char *argv[])
 	alloc_buf.len = 0x2000000;
 	alloc_buf.align = 0x1000;
 	alloc_buf.heap_id_mask = 0x1 << heap_id;
-	alloc_buf.flags = 0;
+	alloc_buf.flags = flags;
 	result = ioctl(fd_ion, ION_IOC_ALLOC, &alloc_buf);
 	if (result != 0) {
 		result = errno;
@@ -321,6 +334,63 @@ int main(int argc, char *argv[])
 		(long)v2p_buf.phys, (int)v2p_buf.len, v2p_buf.cont, addr);
 
 
+	printf("sync range\n");
+	getchar();
+
+	memset(&ioctl_buf, 0, sizeof(ioctl_buf));
+	ioctl_buf.cmd = ION_UNIP_IOC_SYNC_RANGE;
+	ioctl_buf.arg = (unsigned long)&sync_buf;
+	memset(&sync_buf, 0, sizeof(sync_buf));
+	sync_ranges[0].offset = 0;
+	sync_ranges[0].len = 0x1000;
+	sync_ranges[1].offset = alloc_buf.len - 0x1800;
+	sync_ranges[1].len = 0x1800;
+	sync_buf.fd = share_buf.fd;
+	sync_buf.dir = ION_UNIP_SYNC_FOR_DEVICE;
+	sync_buf.nr_ranges = 2;
+	sync_buf.ranges = (uintptr_t)sync_ranges;
+	result = ioctl(fd_ion, ION_IOC_CUSTOM, &ioctl_buf);
+	if (result != 0) {
+		result = errno;
+		fprintf(stderr, "Failed to ioctl(custom, sync_range).\n");
+		goto err_out;
+	}
+	printf("sync ranges:%d\n", (int)sync_buf.nr_ranges);
+
+
+	printf("load file\n");
+	getchar();
+
+	fd_file = open("/proc/self/exe", O_RDONLY);
+	if (fd_file == -1) {
+		result = errno;
+		fprintf(stderr, "Failed to open(file).\n");
+		goto err_out;
+	}
+	memset(&ioctl_buf, 0, sizeof(ioctl_buf));
+	ioctl_buf.cmd = ION_UNIP_IOC_LOAD_FILE;
+	ioctl_buf.arg = (unsigned long)&load_buf;
+	memset(&load_buf, 0, sizeof(load_buf));
+	load_buf.buf_fd = share_buf.fd;
+	load_buf.file_fd = fd_file;
+	load_buf.file_offset = 0;
+	load_buf.buf_offset = 0x1000;
+	load_buf.len = sizeof(load_tmp);
+	result = ioctl(fd_ion, ION_IOC_CUSTOM, &ioctl_buf);
+	if (result != 0) {
+		result = errno;
+		fprintf(stderr, "Failed to ioctl(custom, load_file).\n");
+		goto err_out;
+	}
+	if (pread(fd_file, load_tmp, load_buf.done, 0) != load_buf.done ||
+		memcmp(addr + load_buf.buf_offset, load_tmp, load_buf.done)) {
+		result = -EIO;
+		fprintf(stderr, "Loaded data is not same as the file.\n");
+		goto err_out;
+	}
+	printf("load done:%d\n", (int)load_buf.done);
+
+
 	printf("connect/send\n");
 	getchar();
 
@@ -368,6 +438,11 @@ int main(int argc, char *argv[])
 	result = 0;
 
 err_out:
+	if (fd_file != -1) {
+		close(fd_file);
+		fd_file = -1;
+	}
+
 	if (sock != -1) {
 		close(sock);
 		sock = -1;
@@ -0,0 +1,1557 @@
+/*
+ * Userspace stand-in of /dev/ion for Socionext UniPhier series.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This is LD_PRELOAD shim that emulates the ion-uniphier driver on any
+ * Linux host. It is loaded like:
+ *
+ *   LD_PRELOAD=./libion_stub.so ./dma_alloc_test
+ *
+ * open("/dev/ion") returns an emulated client, every buffer is backed by
+ * memfd and is shared as the fd of memfd instead of dma-buf. The physical
+ * address is emulated per heap, it is stored in the name of memfd so that
+ * the other process that receives the fd can get it too.
+ * ION_UNIP_IOC_VIRT_TO_PHYS finds only the pages that are faulted in, as
+ * the driver walks the page tables.
+ *
+ * Heaps are configured by environment variables:
+ *
+ *   ION_STUB_HEAP_SIZE     size of each heap
+ *   ION_STUB_ALLOC_POLICY  placement policy, e.g. best-fit
+ *   ION_STUB_BANK          bank colouring, <stride>:<colours>
+ *   ION_STUB_CHUNK         chunk heaps, <name>:<chunk_size>[,...]
+ *                          e.g. vio:0x400000, same as 'chunk-size' in DT
+ *   ION_STUB_CMA           CMA heaps, <name>[,...], same as 'socionext,cma'
+ *                          in DT, with the pool of pre-warmed blocks
+ *   ION_STUB_PREALLOC      preallocated buffers,
+ *                          <heap>:<name>:<size>[:<offset>][,...], same as
+ *                          child nodes of the heap node in DT
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <asm/ion.h>
+#include <asm/ion_uniphier.h>
+
+#include "../ion_uniphier_alloc.h"
+#include "../ion_uniphier_chunk.h"
+#include "../ion_uniphier_planes.h"
+
+#define ION_DEVNAME          "/dev/ion"
+#define ION_STUB_PREFIX      "ion:"
+#define ION_STUB_MEMFD_NAME  "/memfd:" ION_STUB_PREFIX
+
+#define ION_STUB_PAGE_SHIFT  12
+#define ION_STUB_PAGE_SIZE   (1UL << ION_STUB_PAGE_SHIFT)
+#define ION_STUB_HEAP_BASE   0x80000000ULL
+#define ION_STUB_HEAP_SIZE   0x10000000ULL
+
+#define ION_STUB_MAX_FDS     1024
+/* same as ION_UNIPHIER_CMA_MAX_WARM of the driver */
+#define ION_STUB_MAX_WARM    64
+#define ION_STUB_MAX_PREALLOC 16
+/* same as ION_UNIPHIER_ASYNC_MAX_PER_CLIENT of the driver */
+#define ION_STUB_ASYNC_MAX   64
+
+struct ion_stub_block {
+	uint64_t phys;
+	uint64_t len;
+};
+
+struct ion_stub_heap {
+	unsigned int id;
+	const char *name;
+	uint64_t base;
+	uint64_t size;
+	/* same placement as the carveout heap of the driver */
+	struct ion_uniphier_alloc alloc;
+	/* chunk heap if chunk_size is not 0 */
+	uint64_t chunk_size;
+	struct ion_uniphier_chunk chunk;
+	/* CMA heap if cma is not 0, blocks are taken from alloc */
+	int cma;
+	struct ion_stub_block warm[ION_STUB_MAX_WARM];
+	unsigned int nr_warm;
+};
+
+struct ion_stub_buffer {
+	int memfd;
+	ino_t ino;
+	uint64_t len;
+	uint64_t phys;
+	unsigned int heap_id;
+	unsigned int flags;
+	/* buffer is allocated by this process, not imported */
+	int owner;
+};
+
+struct ion_stub_handle {
+	ion_user_handle_t id;
+	int ref;
+	struct ion_stub_buffer *buffer;
+	struct ion_stub_handle *next;
+};
+
+struct ion_stub_ticket {
+	uint32_t id;
+	ion_user_handle_t handle;
+	int result;
+	struct ion_stub_ticket *next;
+};
+
+struct ion_stub_client {
+	ion_user_handle_t next_id;
+	struct ion_stub_handle *handles;
+	uint32_t next_ticket;
+	struct ion_stub_ticket *tickets;
+};
+
+struct ion_stub_prealloc {
+	char name[ION_UNIP_PREALLOC_NAME_LEN];
+	int memfd;
+	unsigned int heap_id;
+	uint64_t phys;
+	uint64_t len;
+};
+
+struct ion_stub_named {
+	char name[ION_UNIP_PUBLISH_NAME_LEN];
+	struct ion_stub_client *publisher;
+	int memfd;
+	ino_t ino;
+	unsigned int heap_id;
+	uint64_t phys;
+	uint64_t len;
+	struct ion_stub_named *next;
+};
+
+struct ion_stub_mapping {
+	uintptr_t virt;
+	uint64_t len;
+	uint64_t phys;
+	int on_fault;
+	struct ion_stub_mapping *next;
+};
+
+/* Same heaps as of_heaps[] of ion_uniphier_core.c */
+static struct ion_stub_heap stub_heaps[] = {
+	{ ION_HEAP_ID_MEDIA,   "media", },
+	{ ION_HEAP_ID_GPU,     "gpu", },
+	{ ION_HEAP_ID_FB,      "fb", },
+	{ ION_HEAP_ID_VIO,     "vio", },
+	{ ION_HEAP_ID_CH0,     "ch0", },
+	{ ION_HEAP_ID_CH1,     "ch1", },
+	{ ION_HEAP_ID_CH2,     "ch2", },
+	{ ION_HEAP_ID_HSCADBS, "hscadbs", },
+	{ ION_HEAP_ID_VMLA,    "vmla", },
+	{ ION_HEAP_TYPE_SYSTEM, "system", },
+};
+
+static pthread_mutex_t stub_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t stub_once = PTHREAD_ONCE_INIT;
+static struct ion_stub_client *stub_clients[ION_STUB_MAX_FDS];
+static struct ion_stub_mapping *stub_mappings;
+/* held by the stub, like the kernel client of the driver */
+static struct ion_stub_prealloc stub_preallocs[ION_STUB_MAX_PREALLOC];
+static unsigned int stub_nr_preallocs;
+/* published buffers, only in this process */
+static struct ion_stub_named *stub_nameds;
+
+static int (*real_open)(const char *path, int flags, ...);
+static int (*real_openat)(int dirfd, const char *path, int flags, ...);
+static int (*real_close)(int fd);
+static int (*real_ioctl)(int fd, unsigned long req, ...);
+static void *(*real_mmap)(void *addr, size_t len, int prot, int flags,
+	int fd, off_t off);
+static int (*real_munmap)(void *addr, size_t len);
+
+/**
+ * Make heaps listed in ION_STUB_CHUNK chunk heaps.
+ *
+ * @param env  value of ION_STUB_CHUNK
+ */
+static void ion_stub_init_chunk(const char *env)
+{
+	char name[32], *p;
+	uint64_t chunk_size;
+	size_t i, n;
+
+	while (*env) {
+		n = strcspn(env, ":");
+		if (env[n] != ':' || n >= sizeof(name)) {
+			break;
+		}
+		memcpy(name, env, n);
+		name[n] = '\0';
+		chunk_size = strtoull(env + n + 1, &p, 0);
+
+		for (i = 0; i < sizeof(stub_heaps) / sizeof(stub_heaps[0]); i++) {
+			struct ion_stub_heap *heap = &stub_heaps[i];
+
+			if (strcmp(heap->name, name) != 0) {
+				continue;
+			}
+			if (chunk_size % ION_STUB_PAGE_SIZE ||
+				ion_uniphier_chunk_init(&heap->chunk,
+					heap->base, heap->size, chunk_size)) {
+				fprintf(stderr, "ion_stub: Invalid chunk size "
+					"of %s.\n", name);
+				break;
+			}
+			heap->chunk_size = chunk_size;
+		}
+
+		if (*p != ',') {
+			break;
+		}
+		env = p + 1;
+	}
+}
+
+/**
+ * Make heaps listed in ION_STUB_CMA CMA heaps.
+ *
+ * @param env  value of ION_STUB_CMA
+ */
+static void ion_stub_init_cma(const char *env)
+{
+	size_t i, n;
+
+	while (*env) {
+		n = strcspn(env, ",");
+		for (i = 0; i < sizeof(stub_heaps) / sizeof(stub_heaps[0]); i++) {
+			if (strlen(stub_heaps[i].name) == n &&
+				strncmp(stub_heaps[i].name, env, n) == 0) {
+				stub_heaps[i].cma = 1;
+			}
+		}
+
+		if (env[n] != ',') {
+			break;
+		}
+		env += n + 1;
+	}
+}
+
+static void ion_stub_init_prealloc(const char *env);
+
+static void ion_stub_init(void)
+{
+	enum ion_uniphier_alloc_policy policy = ION_UNIPHIER_ALLOC_FIRST_FIT;
+	const char *env;
+	char *p;
+	uint64_t size = ION_STUB_HEAP_SIZE;
+	uint64_t bank_stride = 0;
+	unsigned int bank_colours = 0;
+	size_t i;
+
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_openat = dlsym(RTLD_NEXT, "openat");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_mmap = dlsym(RTLD_NEXT, "mmap");
+	real_munmap = dlsym(RTLD_NEXT, "munmap");
+
+	env = getenv("ION_STUB_HEAP_SIZE");
+	if (env) {
+		size = strtoull(env, NULL, 0);
+	}
+	env = getenv("ION_STUB_ALLOC_POLICY");
+	if (env && ion_uniphier_alloc_policy_parse(env) >= 0) {
+		policy = ion_uniphier_alloc_policy_parse(env);
+	}
+	env = getenv("ION_STUB_BANK");
+	if (env) {
+		bank_stride = strtoull(env, &p, 0);
+		if (*p == ':') {
+			bank_colours = strtoul(p + 1, NULL, 0);
+		}
+	}
+
+	for (i = 0; i < sizeof(stub_heaps) / sizeof(stub_heaps[0]); i++) {
+		stub_heaps[i].base = ION_STUB_HEAP_BASE + i * size;
+		stub_heaps[i].size = size;
+		ion_uniphier_alloc_init(&stub_heaps[i].alloc, stub_heaps[i].base,
+			size, ION_STUB_PAGE_SHIFT, policy);
+		if (ion_uniphier_alloc_set_colour(&stub_heaps[i].alloc,
+			bank_stride, bank_colours) && i == 0) {
+			fprintf(stderr, "ion_stub: Invalid ION_STUB_BANK '%s'.\n",
+				env);
+		}
+	}
+
+	env = getenv("ION_STUB_CHUNK");
+	if (env) {
+		ion_stub_init_chunk(env);
+	}
+	env = getenv("ION_STUB_CMA");
+	if (env) {
+		ion_stub_init_cma(env);
+	}
+	env = getenv("ION_STUB_PREALLOC");
+	if (env) {
+		ion_stub_init_prealloc(env);
+	}
+}
+
+static void ion_stub_ensure_init(void)
+{
+	pthread_once(&stub_once, ion_stub_init);
+}
+
+static struct ion_stub_client *ion_stub_get_client(int fd)
+{
+	if (fd < 0 || fd >= ION_STUB_MAX_FDS) {
+		return NULL;
+	}
+
+	return stub_clients[fd];
+}
+
+/**
+ * Get the metadata of buffer from the name of memfd.
+ *
+ * @param fd    file descriptor of shared buffer
+ * @param b     buffer metadata to be filled
+ * @return 0 on success, -errno on error
+ */
+static int ion_stub_parse_fd(int fd, struct ion_stub_buffer *b)
+{
+	char path[64], name[256];
+	unsigned long long len, phys;
+	unsigned int heap_id, flags;
+	struct stat st;
+	ssize_t l;
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	l = readlink(path, name, sizeof(name) - 1);
+	if (l < 0) {
+		return -EBADF;
+	}
+	name[l] = '\0';
+
+	if (strncmp(name, ION_STUB_MEMFD_NAME,
+		strlen(ION_STUB_MEMFD_NAME)) != 0) {
+		return -EINVAL;
+	}
+	if (sscanf(name + strlen(ION_STUB_MEMFD_NAME), "%u:%llx:%llx:%x",
+		&heap_id, &phys, &len, &flags) != 4) {
+		return -EINVAL;
+	}
+	if (fstat(fd, &st) != 0) {
+		return -errno;
+	}
+
+	memset(b, 0, sizeof(*b));
+	b->memfd = -1;
+	b->ino = st.st_ino;
+	b->len = len;
+	b->phys = phys;
+	b->heap_id = heap_id;
+	b->flags = flags;
+
+	return 0;
+}
+
+static uint64_t ion_stub_heap_alloc(struct ion_stub_heap *heap,
+	uint64_t len, uint64_t align, unsigned int flags)
+{
+	uint64_t phys;
+
+	if (heap->chunk_size) {
+		/* same as ion_uniphier_chunk_heap_allocate() */
+		if (len > heap->chunk_size || (align > ION_STUB_PAGE_SIZE &&
+			(heap->base % align || heap->chunk_size % align))) {
+			return 0;
+		}
+		phys = ion_uniphier_chunk_get(&heap->chunk);
+
+		return (phys == ION_UNIPHIER_CHUNK_FAIL) ? 0 : phys;
+	}
+	if (heap->cma) {
+		unsigned int i;
+
+		/* same as ion_uniphier_cma_heap_allocate() */
+		for (i = 0; i < heap->nr_warm; i++) {
+			if (heap->warm[i].len == len) {
+				phys = heap->warm[i].phys;
+				heap->warm[i] = heap->warm[--heap->nr_warm];
+				return phys;
+			}
+		}
+		if (flags & ION_UNIP_FLAG_REALTIME) {
+			return 0;
+		}
+	}
+
+	if (flags & ION_UNIP_FLAG_LONG_LIVED) {
+		phys = ion_uniphier_alloc_get_top(&heap->alloc, len, align);
+	} else {
+		phys = ion_uniphier_alloc_get(&heap->alloc, len, align);
+	}
+	if (phys == ION_UNIPHIER_ALLOC_FAIL) {
+		return 0;
+	}
+
+	return phys;
+}
+
+static void ion_stub_heap_free(struct ion_stub_heap *heap, uint64_t phys,
+	uint64_t len)
+{
+	if (heap->chunk_size) {
+		ion_uniphier_chunk_put(&heap->chunk, phys);
+		return;
+	}
+	ion_uniphier_alloc_put(&heap->alloc, phys, len);
+}
+
+static struct ion_stub_heap *ion_stub_find_heap(unsigned int id)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(stub_heaps) / sizeof(stub_heaps[0]); i++) {
+		if (stub_heaps[i].id == id) {
+			return &stub_heaps[i];
+		}
+	}
+
+	return NULL;
+}
+
+static int ion_stub_cma_prewarm(struct ion_uniphier_cma_prewarm_data *data)
+{
+	struct ion_stub_heap *heap = ion_stub_find_heap(data->heap_id);
+	uint64_t len, phys;
+	unsigned int i;
+
+	if (!heap || !heap->cma || data->reserved) {
+		return -EINVAL;
+	}
+
+	if (data->count == 0) {
+		for (i = 0; i < heap->nr_warm; i++) {
+			ion_uniphier_alloc_put(&heap->alloc, heap->warm[i].phys,
+				heap->warm[i].len);
+		}
+		heap->nr_warm = 0;
+		data->warmed = 0;
+		return 0;
+	}
+	len = (data->size + ION_STUB_PAGE_SIZE - 1) & ~(ION_STUB_PAGE_SIZE - 1);
+	if (len == 0 || data->count > ION_STUB_MAX_WARM) {
+		return -EINVAL;
+	}
+
+	for (i = 0; i < data->count && heap->nr_warm < ION_STUB_MAX_WARM;
+		i++) {
+		phys = ion_uniphier_alloc_get(&heap->alloc, len, 0);
+		if (phys == ION_UNIPHIER_ALLOC_FAIL) {
+			break;
+		}
+		heap->warm[heap->nr_warm].phys = phys;
+		heap->warm[heap->nr_warm].len = len;
+		heap->nr_warm++;
+	}
+	if (i == 0) {
+		return -ENOMEM;
+	}
+	data->warmed = heap->nr_warm;
+
+	return 0;
+}
+
+/* same as ion_uniphier_carveout_heap_rebalance() without compaction */
+static int ion_stub_rebalance(struct ion_uniphier_rebalance_data *data)
+{
+	struct ion_stub_heap *from = ion_stub_find_heap(data->from_heap_id);
+	struct ion_stub_heap *to = ion_stub_find_heap(data->to_heap_id);
+	struct ion_uniphier_alloc_stat st;
+	uint64_t size = data->size;
+	int tail, ret;
+
+	if (!from || !to || from == to || from->chunk_size || from->cma ||
+		to->chunk_size || to->cma || size == 0 ||
+		size % ION_STUB_PAGE_SIZE || size >= from->size) {
+		return -EINVAL;
+	}
+	if (from->base + from->size == to->base) {
+		tail = 1;
+	} else if (to->base + to->size == from->base) {
+		tail = 0;
+	} else {
+		return -EINVAL;
+	}
+
+	ion_uniphier_alloc_stat(&from->alloc, &st);
+	if ((tail ? st.tail_free : st.head_free) < size) {
+		return -EBUSY;
+	}
+
+	ret = ion_uniphier_alloc_resize(&to->alloc,
+		tail ? to->base - size : to->base, to->size + size);
+	if (ret) {
+		return ret;
+	}
+	ret = ion_uniphier_alloc_resize(&from->alloc,
+		tail ? from->base : from->base + size, from->size - size);
+	if (ret) {
+		ion_uniphier_alloc_resize(&to->alloc, to->base, to->size);
+		return ret;
+	}
+
+	from->size -= size;
+	to->size += size;
+	if (tail) {
+		to->base -= size;
+	} else {
+		from->base += size;
+	}
+
+	data->from_base = from->base;
+	data->from_size = from->size;
+	data->to_base = to->base;
+	data->to_size = to->size;
+
+	return 0;
+}
+
+static struct ion_stub_handle *ion_stub_find_handle(
+	struct ion_stub_client *c, ion_user_handle_t id)
+{
+	struct ion_stub_handle *h;
+
+	for (h = c->handles; h; h = h->next) {
+		if (h->id == id) {
+			return h;
+		}
+	}
+
+	return NULL;
+}
+
+static struct ion_stub_handle *ion_stub_add_handle(
+	struct ion_stub_client *c, struct ion_stub_buffer *b)
+{
+	struct ion_stub_handle *h;
+
+	h = calloc(1, sizeof(*h));
+	if (!h) {
+		return NULL;
+	}
+	h->id = c->next_id++;
+	h->ref = 1;
+	h->buffer = b;
+	h->next = c->handles;
+	c->handles = h;
+
+	return h;
+}
+
+/**
+ * Drop names of the buffer when the publisher releases it, like the
+ * driver does when nobody but the registry holds the buffer.
+ *
+ * @param memfd  memfd of the buffer
+ */
+static void ion_stub_drop_named(int memfd)
+{
+	struct ion_stub_named **pos, *n;
+	struct stat st;
+
+	if (fstat(memfd, &st) != 0) {
+		return;
+	}
+	for (pos = &stub_nameds; *pos; ) {
+		n = *pos;
+		if (n->ino != st.st_ino) {
+			pos = &n->next;
+			continue;
+		}
+		*pos = n->next;
+		real_close(n->memfd);
+		free(n);
+	}
+}
+
+/**
+ * Drop names that the client has published, like the driver does when
+ * the publisher has closed its client.
+ *
+ * @param c  client that is destroyed
+ */
+static void ion_stub_drop_published(struct ion_stub_client *c)
+{
+	struct ion_stub_named **pos, *n;
+
+	for (pos = &stub_nameds; *pos; ) {
+		n = *pos;
+		if (n->publisher != c) {
+			pos = &n->next;
+			continue;
+		}
+		*pos = n->next;
+		real_close(n->memfd);
+		free(n);
+	}
+}
+
+static void ion_stub_put_handle(struct ion_stub_client *c,
+	struct ion_stub_handle *h)
+{
+	struct ion_stub_handle **pos;
+	struct ion_stub_buffer *b = h->buffer;
+
+	if (--h->ref > 0) {
+		return;
+	}
+
+	for (pos = &c->handles; *pos; pos = &(*pos)->next) {
+		if (*pos == h) {
+			*pos = h->next;
+			break;
+		}
+	}
+
+	/*
+	 * The memory of memfd is released by the kernel when all fds and
+	 * mappings are gone, like the dma-buf. The emulated physical range
+	 * can be reused by this process after the handle is freed.
+	 */
+	if (b->owner) {
+		struct ion_stub_heap *heap = ion_stub_find_heap(b->heap_id);
+
+		if (heap) {
+			ion_stub_heap_free(heap, b->phys, b->len);
+		}
+	}
+	ion_stub_drop_named(b->memfd);
+	real_close(b->memfd);
+	free(b);
+	free(h);
+}
+
+/**
+ * Create the memfd of buffer, the metadata is stored in the name.
+ *
+ * @return fd of memfd, or -errno on error
+ */
+static int ion_stub_create_memfd(unsigned int heap_id, uint64_t phys,
+	uint64_t len, unsigned int flags)
+{
+	char name[128];
+	int fd, result;
+
+	snprintf(name, sizeof(name), ION_STUB_PREFIX "%u:%llx:%llx:%x",
+		heap_id, (unsigned long long)phys, (unsigned long long)len,
+		flags);
+	fd = syscall(SYS_memfd_create, name, MFD_CLOEXEC);
+	if (fd < 0) {
+		return -errno;
+	}
+	if (ftruncate(fd, len) != 0) {
+		result = -errno;
+		real_close(fd);
+		return result;
+	}
+
+	return fd;
+}
+
+static int ion_stub_alloc(struct ion_stub_client *c,
+	struct ion_allocation_data *data)
+{
+	struct ion_stub_buffer *b;
+	struct ion_stub_handle *h;
+	struct ion_stub_heap *heap = NULL;
+	uint64_t len, phys = 0;
+	int id;
+
+	len = (data->len + ION_STUB_PAGE_SIZE - 1) & ~(ION_STUB_PAGE_SIZE - 1);
+	if (len == 0) {
+		return -EINVAL;
+	}
+
+	/* higher heap id is tried first */
+	for (id = ION_NUM_HEAP_IDS - 1; id >= 0; id--) {
+		if (!(data->heap_id_mask & (1U << id))) {
+			continue;
+		}
+		heap = ion_stub_find_heap(id);
+		if (!heap) {
+			continue;
+		}
+		phys = ion_stub_heap_alloc(heap, len, data->align,
+			data->flags);
+		if (phys) {
+			break;
+		}
+	}
+	if (!heap) {
+		return -ENODEV;
+	}
+	if (!phys) {
+		return -ENOMEM;
+	}
+
+	b = calloc(1, sizeof(*b));
+	if (!b) {
+		ion_stub_heap_free(heap, phys, len);
+		return -ENOMEM;
+	}
+
+	b->memfd = ion_stub_create_memfd(heap->id, phys, len, data->flags);
+	if (b->memfd < 0) {
+		int result = b->memfd;
+
+		ion_stub_heap_free(heap, phys, len);
+		free(b);
+		return result;
+	}
+	b->len = len;
+	b->phys = phys;
+	b->heap_id = heap->id;
+	b->flags = data->flags;
+	b->owner = 1;
+
+	h = ion_stub_add_handle(c, b);
+	if (!h) {
+		real_close(b->memfd);
+		ion_stub_heap_free(heap, phys, len);
+		free(b);
+		return -ENOMEM;
+	}
+	data->handle = h->id;
+
+	return 0;
+}
+
+static int ion_stub_import(struct ion_stub_client *c, struct ion_fd_data *data)
+{
+	struct ion_stub_buffer tmp, *b;
+	struct ion_stub_handle *h;
+	int result;
+
+	result = ion_stub_parse_fd(data->fd, &tmp);
+	if (result) {
+		return result;
+	}
+
+	/* same buffer returns same handle, like ion_import_dma_buf() */
+	for (h = c->handles; h; h = h->next) {
+		if (h->buffer->ino == tmp.ino) {
+			h->ref++;
+			data->handle = h->id;
+			return 0;
+		}
+	}
+
+	b = malloc(sizeof(*b));
+	if (!b) {
+		return -ENOMEM;
+	}
+	*b = tmp;
+	b->memfd = fcntl(data->fd, F_DUPFD_CLOEXEC, 0);
+	if (b->memfd < 0) {
+		result = -errno;
+		free(b);
+		return result;
+	}
+
+	h = ion_stub_add_handle(c, b);
+	if (!h) {
+		real_close(b->memfd);
+		free(b);
+		return -ENOMEM;
+	}
+	data->handle = h->id;
+
+	return 0;
+}
+
+/* Pages of memfd are in the page cache once they are faulted in */
+static int ion_stub_mapping_present(struct ion_stub_mapping *m,
+	uintptr_t virt, uint64_t len)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	uintptr_t start = virt & ~(page_size - 1);
+	unsigned char vec;
+
+	if (!m->on_fault) {
+		return 1;
+	}
+	for (; start < virt + len; start += page_size) {
+		if (mincore((void *)start, page_size, &vec) != 0 ||
+			!(vec & 1)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int ion_stub_virt_to_phys(struct ion_uniphier_virt_to_phys_data *v2p)
+{
+	struct ion_stub_mapping *m;
+	uint64_t len = v2p->len;
+
+	if (len <= 0) {
+		len = 1;
+	}
+
+	v2p->phys = 0;
+	v2p->cont = 0;
+	for (m = stub_mappings; m; m = m->next) {
+		if (v2p->virt >= m->virt && v2p->virt < m->virt + m->len) {
+			break;
+		}
+	}
+	if (m && ion_stub_mapping_present(m, v2p->virt, 1)) {
+		v2p->phys = m->phys + (v2p->virt - m->virt);
+		v2p->cont = (v2p->virt + len <= m->virt + m->len) &&
+			ion_stub_mapping_present(m, v2p->virt, len);
+	} else {
+		fprintf(stderr, "ion_stub: Cannot get physical address of %llx.\n",
+			(unsigned long long)v2p->virt);
+	}
+
+	return 0;
+}
+
+static int ion_stub_sync_range(struct ion_uniphier_sync_data *data)
+{
+	const struct ion_uniphier_sync_range *ranges;
+	struct ion_uniphier_sync_range single;
+	struct ion_stub_buffer b;
+	uint32_t i, n;
+	int ret;
+
+	/* memfd is always coherent, only validate the arguments */
+	ret = ion_stub_parse_fd(data->fd, &b);
+	if (ret) {
+		return ret;
+	}
+	if (data->dir < ION_UNIP_SYNC_FOR_DEVICE ||
+		data->dir > ION_UNIP_SYNC_BIDIRECTIONAL ||
+		data->nr_ranges > ION_UNIP_SYNC_MAX_RANGES) {
+		return -EINVAL;
+	}
+
+	if (data->nr_ranges == 0) {
+		single.offset = data->offset;
+		single.len = data->len;
+		ranges = &single;
+		n = 1;
+	} else {
+		ranges = (const void *)(uintptr_t)data->ranges;
+		n = data->nr_ranges;
+	}
+	for (i = 0; i < n; i++) {
+		if (ranges[i].offset >= b.len ||
+			ranges[i].len > b.len - ranges[i].offset) {
+			fprintf(stderr, "ion_stub: range off:%llx, len:%llx is out of buffer size:%llx.\n",
+				(unsigned long long)ranges[i].offset,
+				(unsigned long long)ranges[i].len,
+				(unsigned long long)b.len);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int ion_stub_load_file(struct ion_uniphier_load_file_data *data)
+{
+	struct ion_stub_buffer b;
+	char tmp[65536];
+	ssize_t n;
+	int ret;
+
+	ret = ion_stub_parse_fd(data->buf_fd, &b);
+	if (ret) {
+		return ret;
+	}
+	if (data->buf_offset > b.len || data->len > b.len - data->buf_offset) {
+		return -EINVAL;
+	}
+
+	/* memfd is written through the fd, same as the kernel mapping */
+	data->done = 0;
+	while (data->done < data->len) {
+		size_t count = data->len - data->done;
+
+		if (count > sizeof(tmp)) {
+			count = sizeof(tmp);
+		}
+		n = pread(data->file_fd, tmp, count,
+			data->file_offset + data->done);
+		if (n < 0) {
+			return data->done ? 0 : -errno;
+		}
+		if (n == 0) {
+			break;
+		}
+		if (pwrite(data->buf_fd, tmp, n,
+			data->buf_offset + data->done) != n) {
+			return data->done ? 0 : -EIO;
+		}
+		data->done += n;
+	}
+
+	return 0;
+}
+
+static int ion_stub_alloc_planes(struct ion_stub_client *c,
+	struct ion_uniphier_alloc_planes_data *data)
+{
+	struct ion_allocation_data alloc;
+	struct ion_stub_handle *h;
+	uint32_t i;
+	int ret;
+
+	ret = ion_uniphier_planes_layout(data);
+	if (ret) {
+		return ret;
+	}
+
+	memset(&alloc, 0, sizeof(alloc));
+	alloc.len = data->size;
+	alloc.align = ion_uniphier_planes_align(data);
+	alloc.heap_id_mask = data->heap_id_mask;
+	alloc.flags = data->flags;
+	ret = ion_stub_alloc(c, &alloc);
+	if (ret) {
+		return ret;
+	}
+
+	/*
+	 * The stub cannot know when the fd is released, so the handle is
+	 * kept until the client is closed.
+	 */
+	h = ion_stub_find_handle(c, alloc.handle);
+	data->fd = fcntl(h->buffer->memfd, F_DUPFD_CLOEXEC, 0);
+	if (data->fd < 0) {
+		ret = -errno;
+		ion_stub_put_handle(c, h);
+		return ret;
+	}
+	for (i = 0; i < data->nr_planes; i++) {
+		data->planes[i].phys = h->buffer->phys + data->planes[i].offset;
+	}
+
+	return 0;
+}
+
+/**
+ * Allocate buffers listed in ION_STUB_PREALLOC, they are never freed.
+ *
+ * @param env  value of ION_STUB_PREALLOC
+ */
+static void ion_stub_init_prealloc(const char *env)
+{
+	struct ion_stub_prealloc *pa;
+	struct ion_stub_heap *heap;
+	char heap_name[32], *p;
+	uint64_t offset;
+	size_t i, n;
+	int fixed;
+
+	while (*env && stub_nr_preallocs < ION_STUB_MAX_PREALLOC) {
+		pa = &stub_preallocs[stub_nr_preallocs];
+
+		n = strcspn(env, ":");
+		if (env[n] != ':' || n >= sizeof(heap_name)) {
+			break;
+		}
+		memcpy(heap_name, env, n);
+		heap_name[n] = '\0';
+		env += n + 1;
+
+		n = strcspn(env, ":");
+		if (env[n] != ':' || n >= sizeof(pa->name)) {
+			break;
+		}
+		memcpy(pa->name, env, n);
+		pa->name[n] = '\0';
+		env += n + 1;
+
+		pa->len = strtoull(env, &p, 0);
+		pa->len = (pa->len + ION_STUB_PAGE_SIZE - 1) &
+			~(ION_STUB_PAGE_SIZE - 1);
+		fixed = (*p == ':');
+		offset = fixed ? strtoull(p + 1, &p, 0) : 0;
+
+		heap = NULL;
+		for (i = 0; i < sizeof(stub_heaps) / sizeof(stub_heaps[0]); i++) {
+			if (strcmp(stub_heaps[i].name, heap_name) == 0) {
+				heap = &stub_heaps[i];
+			}
+		}
+		pa->phys = 0;
+		if (heap && pa->len) {
+			if (!fixed) {
+				pa->phys = ion_stub_heap_alloc(heap, pa->len,
+					0, 0);
+			} else if (!ion_uniphier_alloc_claim(&heap->alloc,
+				heap->base + offset, pa->len)) {
+				pa->phys = heap->base + offset;
+			}
+		}
+		if (!pa->phys) {
+			fprintf(stderr, "ion_stub: Cannot preallocate %s/%s.\n",
+				heap_name, pa->name);
+		} else {
+			pa->heap_id = heap->id;
+			pa->memfd = ion_stub_create_memfd(heap->id, pa->phys,
+				pa->len, 0);
+			if (pa->memfd >= 0) {
+				stub_nr_preallocs++;
+			}
+		}
+
+		if (*p != ',') {
+			break;
+		}
+		env = p + 1;
+	}
+}
+
+static int ion_stub_claim_prealloc(struct ion_uniphier_prealloc_data *data)
+{
+	struct ion_stub_prealloc *pa;
+	unsigned int i;
+
+	data->name[ION_UNIP_PREALLOC_NAME_LEN - 1] = '\0';
+	for (i = 0; i < stub_nr_preallocs; i++) {
+		pa = &stub_preallocs[i];
+		if (strcmp(pa->name, data->name) != 0) {
+			continue;
+		}
+
+		/* every claim shares the same buffer */
+		data->fd = fcntl(pa->memfd, F_DUPFD_CLOEXEC, 0);
+		if (data->fd < 0) {
+			return -errno;
+		}
+		data->heap_id = pa->heap_id;
+		data->phys = pa->phys;
+		data->len = pa->len;
+
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+static struct ion_stub_named *ion_stub_find_named(const char *name)
+{
+	struct ion_stub_named *n;
+
+	for (n = stub_nameds; n; n = n->next) {
+		if (strcmp(n->name, name) == 0) {
+			return n;
+		}
+	}
+
+	return NULL;
+}
+
+static int ion_stub_publish(struct ion_stub_client *c,
+	struct ion_uniphier_publish_data *data)
+{
+	struct ion_stub_buffer tmp;
+	struct ion_stub_named *n, **pos;
+	int result;
+
+	data->name[ION_UNIP_PUBLISH_NAME_LEN - 1] = '\0';
+	if (!data->name[0] || data->access &
+		~(ION_UNIP_PUBLISH_GROUP | ION_UNIP_PUBLISH_OTHERS)) {
+		return -EINVAL;
+	}
+
+	/* all users are the publisher in the stub, access is not checked */
+	if (data->fd == -1) {
+		for (pos = &stub_nameds; *pos; pos = &(*pos)->next) {
+			if (strcmp((*pos)->name, data->name) == 0) {
+				n = *pos;
+				*pos = n->next;
+				real_close(n->memfd);
+				free(n);
+				return 0;
+			}
+		}
+		return -ENOENT;
+	}
+	if (ion_stub_find_named(data->name)) {
+		return -EEXIST;
+	}
+
+	result = ion_stub_parse_fd(data->fd, &tmp);
+	if (result) {
+		return result;
+	}
+	n = calloc(1, sizeof(*n));
+	if (!n) {
+		return -ENOMEM;
+	}
+	n->memfd = fcntl(data->fd, F_DUPFD_CLOEXEC, 0);
+	if (n->memfd < 0) {
+		result = -errno;
+		free(n);
+		return result;
+	}
+	strcpy(n->name, data->name);
+	n->publisher = c;
+	n->ino = tmp.ino;
+	n->heap_id = tmp.heap_id;
+	n->phys = tmp.phys;
+	n->len = tmp.len;
+	n->next = stub_nameds;
+	stub_nameds = n;
+
+	return 0;
+}
+
+static int ion_stub_open_named(struct ion_uniphier_open_named_data *data)
+{
+	struct ion_stub_named *n;
+
+	data->name[ION_UNIP_PUBLISH_NAME_LEN - 1] = '\0';
+	n = ion_stub_find_named(data->name);
+	if (!n) {
+		return -ENOENT;
+	}
+
+	data->fd = fcntl(n->memfd, F_DUPFD_CLOEXEC, 0);
+	if (data->fd < 0) {
+		return -errno;
+	}
+	data->heap_id = n->heap_id;
+	data->phys = n->phys;
+	data->len = n->len;
+
+	return 0;
+}
+
+/**
+ * Queue the allocation. The stub allocates at once, so the ticket is
+ * completed and the eventfd is signalled before return.
+ */
+static int ion_stub_alloc_async(struct ion_stub_client *c,
+	struct ion_uniphier_alloc_async_data *data)
+{
+	struct ion_allocation_data alloc;
+	struct ion_stub_ticket *t;
+	uint64_t one = 1;
+	int n;
+
+	if (data->len == 0) {
+		return -EINVAL;
+	}
+	if (data->eventfd != -1 && fcntl(data->eventfd, F_GETFD) == -1) {
+		return -EBADF;
+	}
+	for (t = c->tickets, n = 0; t; t = t->next) {
+		n++;
+	}
+	if (n >= ION_STUB_ASYNC_MAX) {
+		return -EBUSY;
+	}
+
+	t = calloc(1, sizeof(*t));
+	if (!t) {
+		return -ENOMEM;
+	}
+
+	memset(&alloc, 0, sizeof(alloc));
+	alloc.len = data->len;
+	alloc.align = data->align;
+	alloc.heap_id_mask = data->heap_id_mask;
+	alloc.flags = data->flags;
+	t->result = ion_stub_alloc(c, &alloc);
+	t->handle = alloc.handle;
+	t->id = c->next_ticket++;
+	t->next = c->tickets;
+	c->tickets = t;
+	data->ticket = t->id;
+
+	if (data->eventfd != -1 &&
+		write(data->eventfd, &one, sizeof(one)) != sizeof(one)) {
+		fprintf(stderr, "ion_stub: Failed to signal eventfd.\n");
+	}
+
+	return 0;
+}
+
+static int ion_stub_alloc_result(struct ion_stub_client *c,
+	struct ion_uniphier_alloc_result_data *data)
+{
+	struct ion_stub_ticket **pos, *t;
+	struct ion_stub_handle *h;
+	int result;
+
+	if (data->flags & ~ION_UNIP_ASYNC_WAIT || data->reserved) {
+		return -EINVAL;
+	}
+
+	for (pos = &c->tickets; *pos; pos = &(*pos)->next) {
+		if ((*pos)->id == data->ticket) {
+			break;
+		}
+	}
+	t = *pos;
+	if (!t) {
+		return -ENOENT;
+	}
+
+	result = t->result;
+	if (!result) {
+		h = ion_stub_find_handle(c, t->handle);
+		data->fd = fcntl(h->buffer->memfd, F_DUPFD_CLOEXEC, 0);
+		if (data->fd < 0) {
+			return -errno;
+		}
+		/*
+		 * The stub cannot know when the fd is released, so the
+		 * handle is kept until the client is closed.
+		 */
+		data->phys = h->buffer->phys;
+		data->len = h->buffer->len;
+	}
+	*pos = t->next;
+	free(t);
+
+	return result;
+}
+
+static int ion_stub_custom(struct ion_stub_client *c,
+	struct ion_custom_data *data)
+{
+	switch (data->cmd) {
+	case ION_UNIP_IOC_VIRT_TO_PHYS:
+		return ion_stub_virt_to_phys(
+			(struct ion_uniphier_virt_to_phys_data *)data->arg);
+	case ION_UNIP_IOC_PHYS:
+		/* this is no-op in the driver too */
+		return 0;
+	case ION_UNIP_IOC_SYNC_RANGE:
+		return ion_stub_sync_range(
+			(struct ion_uniphier_sync_data *)data->arg);
+	case ION_UNIP_IOC_LOAD_FILE:
+		return ion_stub_load_file(
+			(struct ion_uniphier_load_file_data *)data->arg);
+	case ION_UNIP_IOC_ALLOC_PLANES:
+		return ion_stub_alloc_planes(c,
+			(struct ion_uniphier_alloc_planes_data *)data->arg);
+	case ION_UNIP_IOC_CMA_PREWARM:
+		return ion_stub_cma_prewarm(
+			(struct ion_uniphier_cma_prewarm_data *)data->arg);
+	case ION_UNIP_IOC_REBALANCE:
+		return ion_stub_rebalance(
+			(struct ion_uniphier_rebalance_data *)data->arg);
+	case ION_UNIP_IOC_CLAIM_PREALLOC:
+		return ion_stub_claim_prealloc(
+			(struct ion_uniphier_prealloc_data *)data->arg);
+	case ION_UNIP_IOC_PUBLISH:
+		return ion_stub_publish(c,
+			(struct ion_uniphier_publish_data *)data->arg);
+	case ION_UNIP_IOC_OPEN_NAMED:
+		return ion_stub_open_named(
+			(struct ion_uniphier_open_named_data *)data->arg);
+	case ION_UNIP_IOC_ALLOC_ASYNC:
+		return ion_stub_alloc_async(c,
+			(struct ion_uniphier_alloc_async_data *)data->arg);
+	case ION_UNIP_IOC_ALLOC_RESULT:
+		return ion_stub_alloc_result(c,
+			(struct ion_uniphier_alloc_result_data *)data->arg);
+	default:
+		fprintf(stderr, "ion_stub: Unknown ioctl() cmd:0x%x.\n",
+			data->cmd);
+		return -ENOTTY;
+	}
+}
+
+static int ion_stub_ioctl(struct ion_stub_client *c, unsigned long req,
+	void *arg)
+{
+	switch (req) {
+	case ION_IOC_ALLOC:
+		return ion_stub_alloc(c, arg);
+	case ION_IOC_FREE:
+	{
+		struct ion_handle_data *data = arg;
+		struct ion_stub_handle *h;
+
+		h = ion_stub_find_handle(c, data->handle);
+		if (!h) {
+			return -EINVAL;
+		}
+		ion_stub_put_handle(c, h);
+
+		return 0;
+	}
+	case ION_IOC_MAP:
+	case ION_IOC_SHARE:
+	{
+		struct ion_fd_data *data = arg;
+		struct ion_stub_handle *h;
+
+		h = ion_stub_find_handle(c, data->handle);
+		if (!h) {
+			return -EINVAL;
+		}
+		data->fd = fcntl(h->buffer->memfd, F_DUPFD_CLOEXEC, 0);
+		if (data->fd < 0) {
+			return -errno;
+		}
+
+		return 0;
+	}
+	case ION_IOC_IMPORT:
+		return ion_stub_import(c, arg);
+	case ION_IOC_SYNC:
+	{
+		struct ion_fd_data *data = arg;
+		struct ion_stub_buffer tmp;
+
+		/* memfd is always coherent */
+		return ion_stub_parse_fd(data->fd, &tmp);
+	}
+	case ION_IOC_CUSTOM:
+		return ion_stub_custom(c, arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static int ion_stub_open_client(void)
+{
+	struct ion_stub_client *c;
+	int fd;
+
+	fd = real_open("/dev/null", O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		return fd;
+	}
+	if (fd >= ION_STUB_MAX_FDS) {
+		real_close(fd);
+		errno = EMFILE;
+		return -1;
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		real_close(fd);
+		errno = ENOMEM;
+		return -1;
+	}
+	c->next_id = 1;
+	c->next_ticket = 1;
+
+	pthread_mutex_lock(&stub_lock);
+	stub_clients[fd] = c;
+	pthread_mutex_unlock(&stub_lock);
+
+	return fd;
+}
+
+int open(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+
+	ion_stub_ensure_init();
+
+	if (strcmp(path, ION_DEVNAME) == 0) {
+		return ion_stub_open_client();
+	}
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	return real_open(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+	__attribute__((alias("open")));
+
+int openat(int dirfd, const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+
+	ion_stub_ensure_init();
+
+	if (strcmp(path, ION_DEVNAME) == 0) {
+		return ion_stub_open_client();
+	}
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	return real_openat(dirfd, path, flags, mode);
+}
+
+int close(int fd)
+{
+	struct ion_stub_client *c;
+
+	ion_stub_ensure_init();
+
+	pthread_mutex_lock(&stub_lock);
+	c = ion_stub_get_client(fd);
+	if (c) {
+		/* destroy client and all its tickets and handles */
+		while (c->tickets) {
+			struct ion_stub_ticket *t = c->tickets;
+
+			c->tickets = t->next;
+			free(t);
+		}
+		while (c->handles) {
+			c->handles->ref = 1;
+			ion_stub_put_handle(c, c->handles);
+		}
+		ion_stub_drop_published(c);
+		stub_clients[fd] = NULL;
+		free(c);
+	}
+	pthread_mutex_unlock(&stub_lock);
+
+	return real_close(fd);
+}
+
+int ioctl(int fd, unsigned long req, ...)
+{
+	struct ion_stub_client *c;
+	void *arg;
+	va_list ap;
+	int result;
+
+	ion_stub_ensure_init();
+
+	va_start(ap, req);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	pthread_mutex_lock(&stub_lock);
+	c = ion_stub_get_client(fd);
+	if (!c) {
+		pthread_mutex_unlock(&stub_lock);
+		return real_ioctl(fd, req, arg);
+	}
+	result = ion_stub_ioctl(c, req, arg);
+	pthread_mutex_unlock(&stub_lock);
+
+	if (result < 0) {
+		errno = -result;
+		return -1;
+	}
+
+	return result;
+}
+
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off)
+{
+	struct ion_stub_buffer tmp;
+	struct ion_stub_mapping *m;
+	void *p;
+
+	ion_stub_ensure_init();
+
+	if (fd < 0 || ion_stub_parse_fd(fd, &tmp) != 0) {
+		return real_mmap(addr, len, prot, flags, fd, off);
+	}
+
+	/* same as the carveout heap, all pages are mapped at once */
+	if (tmp.flags & ION_UNIP_FLAG_PREFAULT) {
+		flags |= MAP_POPULATE;
+	}
+
+	p = real_mmap(addr, len, prot, flags, fd, off);
+	if (p == MAP_FAILED) {
+		return p;
+	}
+
+	/* remember the mapping for ION_UNIP_IOC_VIRT_TO_PHYS */
+	m = malloc(sizeof(*m));
+	if (m) {
+		m->virt = (uintptr_t)p;
+		m->len = len;
+		m->phys = tmp.phys + off;
+		/* cached buffers are mapped on fault, unless map_user maps them */
+		m->on_fault = (tmp.flags & ION_UNIP_FLAG_MOVABLE) ||
+			((tmp.flags & ION_FLAG_CACHED) &&
+			!(tmp.flags & (ION_FLAG_CACHED_NEEDS_SYNC |
+			ION_UNIP_FLAG_PREFAULT)));
+		pthread_mutex_lock(&stub_lock);
+		m->next = stub_mappings;
+		stub_mappings = m;
+		pthread_mutex_unlock(&stub_lock);
+	}
+
+	return p;
+}
+
+void *mmap64(void *addr, size_t len, int prot, int flags, int fd, off_t off)
+	__attribute__((alias("mmap")));
+
+int munmap(void *addr, size_t len)
+{
+	struct ion_stub_mapping **pos, *m;
+
+	ion_stub_ensure_init();
+
+	pthread_mutex_lock(&stub_lock);
+	for (pos = &stub_mappings; *pos; ) {
+		m = *pos;
+		if (m->virt >= (uintptr_t)addr &&
+			m->virt + m->len <= (uintptr_t)addr + len) {
+			*pos = m->next;
+			free(m);
+		} else {
+			pos = &m->next;
+		}
+	}
+	pthread_mutex_unlock(&stub_lock);
+
+	return real_munmap(addr, len);
+}
@@ -0,0 +1,238 @@
+/*
+ * Access benchmark of user mappings of ion-uniphier buffers.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Allocate a cached and an uncached buffer (ion maps the latter
+ * write-combined) of the same heap, then compare the sequential write,
+ * sequential read and random read time through the user mapping of
+ * them. Pages are faulted in before the measurement.
+ *
+ *   map_bench [-H heap_id] [-s size] [-n accesses]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <asm/ion.h>
+#include <asm/ion_uniphier.h>
+
+#define ION_DEVNAME      "/dev/ion"
+
+struct map_result {
+	double write_ns;
+	double read_ns;
+	double random_ns;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double bench_write(volatile uint32_t *addr, size_t size)
+{
+	uint64_t start, end;
+	size_t words = size / sizeof(*addr);
+	size_t i;
+
+	start = now_ns();
+	for (i = 0; i < words; i++) {
+		addr[i] = i;
+	}
+	end = now_ns();
+
+	return (double)(end - start) / words;
+}
+
+static double bench_read(volatile uint32_t *addr, size_t size)
+{
+	uint64_t start, end;
+	uint32_t sum = 0;
+	size_t words = size / sizeof(*addr);
+	size_t i;
+
+	start = now_ns();
+	for (i = 0; i < words; i++) {
+		sum += addr[i];
+	}
+	end = now_ns();
+	(void)sum;
+
+	return (double)(end - start) / words;
+}
+
+static double bench_random(volatile uint32_t *addr, size_t size,
+	unsigned long n)
+{
+	uint64_t start, end;
+	uint32_t x = 2463534242U, sum = 0;
+	size_t words = size / sizeof(*addr);
+	unsigned long i;
+
+	start = now_ns();
+	for (i = 0; i < n; i++) {
+		/* xorshift32 */
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		sum += addr[x % words];
+	}
+	end = now_ns();
+	(void)sum;
+
+	return (double)(end - start) / n;
+}
+
+static int bench_one(int fd_ion, int heap_id, size_t size,
+	unsigned int flags, unsigned long n, struct map_result *r)
+{
+	struct ion_allocation_data alloc_buf;
+	struct ion_fd_data share_buf;
+	struct ion_handle_data free_buf;
+	void *addr;
+	int result;
+
+	memset(&alloc_buf, 0, sizeof(alloc_buf));
+	alloc_buf.len = size;
+	alloc_buf.align = 0x1000;
+	alloc_buf.heap_id_mask = 0x1 << heap_id;
+	alloc_buf.flags = flags;
+	result = ioctl(fd_ion, ION_IOC_ALLOC, &alloc_buf);
+	if (result != 0) {
+		fprintf(stderr, "Failed to ioctl(alloc).\n");
+		return errno;
+	}
+
+	memset(&share_buf, 0, sizeof(share_buf));
+	share_buf.handle = alloc_buf.handle;
+	result = ioctl(fd_ion, ION_IOC_SHARE, &share_buf);
+	if (result != 0) {
+		result = errno;
+		fprintf(stderr, "Failed to ioctl(share).\n");
+		goto err_free;
+	}
+
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		share_buf.fd, 0);
+	if (addr == MAP_FAILED) {
+		result = errno;
+		fprintf(stderr, "Failed to mmap().\n");
+		goto err_close;
+	}
+
+	/* fault in all pages before the measurement */
+	memset(addr, 0, size);
+
+	r->write_ns = bench_write(addr, size);
+	r->read_ns = bench_read(addr, size);
+	r->random_ns = bench_random(addr, size, n);
+
+	munmap(addr, size);
+	result = 0;
+
+err_close:
+	close(share_buf.fd);
+
+err_free:
+	memset(&free_buf, 0, sizeof(free_buf));
+	free_buf.handle = alloc_buf.handle;
+	ioctl(fd_ion, ION_IOC_FREE, &free_buf);
+
+	return result;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-H heap_id] [-s size] [-n accesses]\n",
+		name);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct {
+		const char *name;
+		unsigned int flags;
+	} modes[] = {
+		{ "cached", ION_FLAG_CACHED },
+		{ "uncached", 0 },
+	};
+	struct map_result r = { 0, 0, 0 };
+	int heap_id = ION_HEAP_ID_MEDIA;
+	size_t size = 0x2000000;
+	unsigned long n = 1000000;
+	int fd_ion, opt, result = 0;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "H:s:n:h")) != -1) {
+		switch (opt) {
+		case 'H':
+			heap_id = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			n = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	size = (size + 0xfff) & ~(size_t)0xfff;
+	if (size == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd_ion = open(ION_DEVNAME, O_RDWR);
+	if (fd_ion == -1) {
+		fprintf(stderr, "Failed to open(ion).\n");
+		return errno;
+	}
+
+	printf("size:%zx, random accesses:%lu\n", size, n);
+	printf("%-10s %12s %12s %12s   [ns/word]\n",
+		"mapping", "seq write", "seq read", "random");
+	for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		result = bench_one(fd_ion, heap_id, size, modes[i].flags,
+			n, &r);
+		if (result) {
+			break;
+		}
+		printf("%-10s %12.2f %12.2f %12.2f\n", modes[i].name,
+			r.write_ns, r.read_ns, r.random_ns);
+	}
+
+	close(fd_ion);
+
+	return result;
+}
@@ -0,0 +1,266 @@
+/*
+ * Test of multi-plane allocation of ion-uniphier.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Allocate buffers of each pixel format by ION_UNIP_IOC_ALLOC_PLANES,
+ * print the layout of planes and check that planes are aligned as
+ * requested, do not overlap and fit in the buffer.
+ *
+ *   plane_alloc_test [-H heap_id] [-w width] [-h height]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <asm/ion.h>
+#include <asm/ion_uniphier.h>
+
+#define ION_DEVNAME      "/dev/ion"
+
+static const char *format_names[] = {
+	[ION_UNIP_FMT_NV12]   = "NV12",
+	[ION_UNIP_FMT_NV16]   = "NV16",
+	[ION_UNIP_FMT_YUV420] = "YUV420",
+	[ION_UNIP_FMT_P010]   = "P010",
+};
+
+static int check_layout(const struct ion_uniphier_alloc_planes_data *d)
+{
+	const struct ion_uniphier_plane_info *p;
+	uint64_t end = 0;
+	uint32_t i;
+
+	for (i = 0; i < d->nr_planes; i++) {
+		p = &d->planes[i];
+
+		if (d->offset_align[i] &&
+			(p->offset & (d->offset_align[i] - 1))) {
+			fprintf(stderr, "plane %u: offset %llx is not aligned.\n",
+				i, (unsigned long long)p->offset);
+			return -EINVAL;
+		}
+		if (d->stride_align[i] && (p->stride % d->stride_align[i])) {
+			fprintf(stderr, "plane %u: stride %x is not aligned.\n",
+				i, p->stride);
+			return -EINVAL;
+		}
+		if (p->size != (uint64_t)p->stride * p->lines) {
+			fprintf(stderr, "plane %u: size %llx is wrong.\n",
+				i, (unsigned long long)p->size);
+			return -EINVAL;
+		}
+		if (p->offset < end) {
+			fprintf(stderr, "plane %u: overlaps the previous.\n", i);
+			return -EINVAL;
+		}
+		end = p->offset + p->size;
+		if (end > d->size) {
+			fprintf(stderr, "plane %u: exceeds the buffer.\n", i);
+			return -EINVAL;
+		}
+		if (p->phys && i > 0 &&
+			p->phys - d->planes[0].phys != p->offset) {
+			fprintf(stderr, "plane %u: phys %llx is wrong.\n",
+				i, (unsigned long long)p->phys);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int alloc_planes(int fd_ion, int heap_id, uint32_t format,
+	uint32_t width, uint32_t height)
+{
+	struct ion_uniphier_alloc_planes_data planes_buf;
+	struct ion_custom_data custom_buf;
+	uint8_t *addr;
+	uint32_t i;
+	int result;
+
+	memset(&planes_buf, 0, sizeof(planes_buf));
+	planes_buf.heap_id_mask = 0x1 << heap_id;
+	planes_buf.flags = 0;
+	planes_buf.format = format;
+	planes_buf.width = width;
+	planes_buf.height = height;
+	planes_buf.height_align = 16;
+	for (i = 0; i < ION_UNIP_MAX_PLANES; i++) {
+		planes_buf.stride_align[i] = 256;
+		planes_buf.offset_align[i] = 0x1000;
+	}
+	planes_buf.chroma_skew = 0x800;
+
+	memset(&custom_buf, 0, sizeof(custom_buf));
+	custom_buf.cmd = ION_UNIP_IOC_ALLOC_PLANES;
+	custom_buf.arg = (unsigned long)&planes_buf;
+	result = ioctl(fd_ion, ION_IOC_CUSTOM, &custom_buf);
+	if (result != 0) {
+		result = errno;
+		fprintf(stderr, "Failed to ioctl(alloc planes).\n");
+		return result;
+	}
+
+	printf("%-6s %ux%u: size:%llx, fd:%d\n",
+		format_names[format], width, height,
+		(unsigned long long)planes_buf.size, planes_buf.fd);
+	for (i = 0; i < planes_buf.nr_planes; i++) {
+		struct ion_uniphier_plane_info *p = &planes_buf.planes[i];
+
+		printf("  plane %u: offset:%08llx, size:%08llx, stride:%5u, "
+			"lines:%5u, phys:%llx\n",
+			i, (unsigned long long)p->offset,
+			(unsigned long long)p->size, p->stride, p->lines,
+			(unsigned long long)p->phys);
+	}
+
+	result = check_layout(&planes_buf);
+	if (result != 0) {
+		goto err_close;
+	}
+
+	/* touch the last line of the last plane */
+	addr = mmap(NULL, planes_buf.size, PROT_READ | PROT_WRITE,
+		MAP_SHARED, planes_buf.fd, 0);
+	if (addr == MAP_FAILED) {
+		result = errno;
+		fprintf(stderr, "Failed to mmap().\n");
+		goto err_close;
+	}
+	memset(addr + planes_buf.size -
+		planes_buf.planes[planes_buf.nr_planes - 1].stride, 0x80,
+		planes_buf.planes[planes_buf.nr_planes - 1].stride);
+	munmap(addr, planes_buf.size);
+
+	result = 0;
+
+err_close:
+	close(planes_buf.fd);
+
+	return result;
+}
+
+static int alloc_invalid(int fd_ion, int heap_id)
+{
+	struct ion_uniphier_alloc_planes_data planes_buf;
+	struct ion_custom_data custom_buf;
+	int result;
+
+	/* offset alignment that is not power of 2 */
+	memset(&planes_buf, 0, sizeof(planes_buf));
+	planes_buf.heap_id_mask = 0x1 << heap_id;
+	planes_buf.format = ION_UNIP_FMT_NV12;
+	planes_buf.width = 64;
+	planes_buf.height = 64;
+	planes_buf.offset_align[1] = 0x1800;
+
+	memset(&custom_buf, 0, sizeof(custom_buf));
+	custom_buf.cmd = ION_UNIP_IOC_ALLOC_PLANES;
+	custom_buf.arg = (unsigned long)&planes_buf;
+	result = ioctl(fd_ion, ION_IOC_CUSTOM, &custom_buf);
+	if (result == 0) {
+		fprintf(stderr, "Invalid alignment is accepted.\n");
+		close(planes_buf.fd);
+		return -EINVAL;
+	}
+
+	/* stride alignment over the limit */
+	planes_buf.offset_align[1] = 0;
+	planes_buf.stride_align[0] = ION_UNIP_MAX_STRIDE_ALIGN * 2;
+	result = ioctl(fd_ion, ION_IOC_CUSTOM, &custom_buf);
+	if (result == 0) {
+		fprintf(stderr, "Too large stride alignment is accepted.\n");
+		close(planes_buf.fd);
+		return -EINVAL;
+	}
+
+	/* height alignment over the limit */
+	planes_buf.stride_align[0] = 0;
+	planes_buf.height_align = ION_UNIP_MAX_HEIGHT_ALIGN * 2;
+	result = ioctl(fd_ion, ION_IOC_CUSTOM, &custom_buf);
+	if (result == 0) {
+		fprintf(stderr, "Too large height alignment is accepted.\n");
+		close(planes_buf.fd);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-H heap_id] [-w width] [-h height]\n",
+		name);
+}
+
+int main(int argc, char *argv[])
+{
+	int heap_id = ION_HEAP_ID_MEDIA;
+	uint32_t width = 1920, height = 1080, f;
+	int fd_ion, opt, result = 0;
+
+	while ((opt = getopt(argc, argv, "H:w:h:")) != -1) {
+		switch (opt) {
+		case 'H':
+			heap_id = strtol(optarg, NULL, 0);
+			break;
+		case 'w':
+			width = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			height = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	fd_ion = open(ION_DEVNAME, O_RDWR);
+	if (fd_ion == -1) {
+		fprintf(stderr, "Failed to open(ion).\n");
+		return errno;
+	}
+
+	for (f = 0; f < ION_UNIP_FMT_NR_FORMATS; f++) {
+		result = alloc_planes(fd_ion, heap_id, f, width, height);
+		if (result) {
+			goto out;
+		}
+	}
+
+	result = alloc_invalid(fd_ion, heap_id);
+	if (result) {
+		goto out;
+	}
+
+	printf("OK\n");
+
+out:
+	close(fd_ion);
+
+	return result;
+}
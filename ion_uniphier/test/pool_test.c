@@ -0,0 +1,252 @@
+/*
+ * Test of the buffer pool of libion-uniphier.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Get and put frames of the same size through the pool and check that
+ * the steady state recycles cached buffers (same fd, mapping and phys)
+ * without allocations, that the cap of the pool and trim release
+ * buffers, that movable buffers are refused, then print the time of
+ * get/put against alloc, share, mmap and free per frame.
+ *
+ *   pool_test [-H heap_id] [-s size] [-n buffers] [-r rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+
+#include <asm/ion.h>
+#include <asm/ion_uniphier.h>
+
+#include "../lib/ion_uniphier_pool.h"
+
+#define TEST_MAX_BUFS    16
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int get_frames(struct ion_uniphier_pool *pool, size_t size, int n,
+	struct ion_uniphier_pool_buf **bufs)
+{
+	int i, result;
+
+	for (i = 0; i < n; i++) {
+		result = ion_uniphier_pool_get(pool, size, &bufs[i]);
+		if (result) {
+			fprintf(stderr, "Failed to get buffer %d.\n", i);
+			while (i-- > 0) {
+				ion_uniphier_pool_put(pool, bufs[i]);
+			}
+			return result;
+		}
+		memset(bufs[i]->addr, i, 64);
+	}
+
+	return 0;
+}
+
+static void put_frames(struct ion_uniphier_pool *pool, int n,
+	struct ion_uniphier_pool_buf **bufs)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		ion_uniphier_pool_put(pool, bufs[i]);
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-H heap_id] [-s size] [-n buffers] "
+		"[-r rounds]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct ion_uniphier_pool_buf *bufs[TEST_MAX_BUFS];
+	struct ion_uniphier_pool_buf *first[TEST_MAX_BUFS];
+	struct ion_uniphier_pool_stat st;
+	struct ion_uniphier_pool *pool, *nocache;
+	int heap_id = ION_HEAP_ID_MEDIA;
+	size_t size = 0x7e9000;
+	int n = 4, rounds = 100;
+	int opt, round, i, j, fd_pressure, result = 0;
+	uint64_t start, t_pool, t_raw;
+
+	while ((opt = getopt(argc, argv, "H:s:n:r:h")) != -1) {
+		switch (opt) {
+		case 'H':
+			heap_id = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			n = strtol(optarg, NULL, 0);
+			break;
+		case 'r':
+			rounds = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (n < 1 || n > TEST_MAX_BUFS) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	pool = ion_uniphier_pool_open(1 << heap_id, ION_FLAG_CACHED,
+		size * n * 2);
+	if (!pool) {
+		fprintf(stderr, "Failed to ion_uniphier_pool_open().\n");
+		return errno;
+	}
+
+	/* warm up, then every get must be a hit of the same buffers */
+	result = get_frames(pool, size, n, first);
+	if (result) {
+		goto out;
+	}
+	put_frames(pool, n, first);
+
+	start = now_ns();
+	for (round = 0; round < rounds; round++) {
+		result = get_frames(pool, size, n, bufs);
+		if (result) {
+			goto out;
+		}
+		for (i = 0; i < n; i++) {
+			for (j = 0; j < n && bufs[i] != first[j]; j++) {
+			}
+			if (j == n || bufs[i]->fd != first[j]->fd ||
+				bufs[i]->addr != first[j]->addr ||
+				bufs[i]->phys != first[j]->phys) {
+				fprintf(stderr, "Buffer is not recycled.\n");
+				put_frames(pool, n, bufs);
+				result = -EINVAL;
+				goto out;
+			}
+		}
+		put_frames(pool, n, bufs);
+	}
+	t_pool = now_ns() - start;
+
+	ion_uniphier_pool_get_stat(pool, &st);
+	printf("hits:%llu, misses:%llu, cached:%zu bufs %zx bytes\n",
+		(unsigned long long)st.hits, (unsigned long long)st.misses,
+		st.cached_bufs, st.cached_bytes);
+	if (st.misses != n || st.hits != (uint64_t)n * rounds ||
+		st.cached_bufs != n || st.used_bufs != 0) {
+		fprintf(stderr, "Statistics are wrong.\n");
+		result = -EINVAL;
+		goto out;
+	}
+	printf("phys of buffer 0: %llx\n", (unsigned long long)first[0]->phys);
+	if (!first[0]->phys) {
+		fprintf(stderr, "Physical address is not resolved.\n");
+		result = -EINVAL;
+		goto out;
+	}
+
+	/* phys is cached, so movable buffers are refused */
+	nocache = ion_uniphier_pool_open(1 << heap_id,
+		ION_FLAG_CACHED | ION_UNIP_FLAG_MOVABLE, 0);
+	if (nocache || errno != EINVAL) {
+		fprintf(stderr, "Pool of movable buffers is opened.\n");
+		ion_uniphier_pool_close(nocache);
+		result = -EINVAL;
+		goto out;
+	}
+
+	/* same frames without caching */
+	nocache = ion_uniphier_pool_open(1 << heap_id, ION_FLAG_CACHED, 0);
+	if (!nocache) {
+		result = errno;
+		goto out;
+	}
+	start = now_ns();
+	for (round = 0; round < rounds; round++) {
+		result = get_frames(nocache, size, n, bufs);
+		if (result) {
+			break;
+		}
+		put_frames(nocache, n, bufs);
+	}
+	t_raw = now_ns() - start;
+	ion_uniphier_pool_get_stat(nocache, &st);
+	ion_uniphier_pool_close(nocache);
+	if (result) {
+		goto out;
+	}
+	if (st.hits != 0 || st.cached_bufs != 0) {
+		fprintf(stderr, "Pool without cache has cached buffers.\n");
+		result = -EINVAL;
+		goto out;
+	}
+	printf("per frame: pool %.2f us, no cache %.2f us\n",
+		t_pool / 1000.0 / rounds / n, t_raw / 1000.0 / rounds / n);
+
+	fd_pressure = ion_uniphier_pool_pressure_fd(pool, "medium");
+	if (fd_pressure == -1) {
+		printf("memory pressure: not available (%s)\n",
+			strerror(errno));
+	} else {
+		struct pollfd pfd = { .fd = fd_pressure, .events = POLLIN };
+
+		/* no pressure is expected, only check that it does not block */
+		if (poll(&pfd, 1, 0) > 0) {
+			ion_uniphier_pool_pressure_event(pool);
+		}
+		printf("memory pressure: fd %d\n", fd_pressure);
+	}
+
+	if (ion_uniphier_pool_trim(pool, size) != size * (n - 1)) {
+		fprintf(stderr, "Trim has released wrong size.\n");
+		result = -EINVAL;
+		goto out;
+	}
+	ion_uniphier_pool_trim(pool, 0);
+	ion_uniphier_pool_get_stat(pool, &st);
+	if (st.cached_bufs != 0 || st.cached_bytes != 0) {
+		fprintf(stderr, "Trim has left buffers.\n");
+		result = -EINVAL;
+		goto out;
+	}
+
+	printf("OK\n");
+
+out:
+	ion_uniphier_pool_close(pool);
+
+	return result;
+}
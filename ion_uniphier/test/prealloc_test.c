@@ -0,0 +1,176 @@
+/*
+ * Test of the preallocated buffers of ion-uniphier.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Claim each named buffer by ION_UNIP_IOC_CLAIM_PREALLOC, write a pattern,
+ * close it and claim it again, then check that the second claim returns
+ * the same buffer with the pattern. Also check that an unknown name is
+ * refused.
+ *
+ *   prealloc_test -n name [-n name ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <asm/ion.h>
+#include <asm/ion_uniphier.h>
+
+#define ION_DEVNAME      "/dev/ion"
+#define TEST_MAX_NAMES   8
+
+static int claim(int fd_ion, const char *name,
+	struct ion_uniphier_prealloc_data *data)
+{
+	struct ion_custom_data custom_buf;
+
+	memset(data, 0, sizeof(*data));
+	strncpy(data->name, name, sizeof(data->name) - 1);
+
+	memset(&custom_buf, 0, sizeof(custom_buf));
+	custom_buf.cmd = ION_UNIP_IOC_CLAIM_PREALLOC;
+	custom_buf.arg = (unsigned long)data;
+	if (ioctl(fd_ion, ION_IOC_CUSTOM, &custom_buf) != 0) {
+		return errno;
+	}
+
+	return 0;
+}
+
+static int check_buffer(int fd_ion, const char *name)
+{
+	struct ion_uniphier_prealloc_data first, second;
+	uint8_t *addr;
+	int result;
+
+	result = claim(fd_ion, name, &first);
+	if (result) {
+		fprintf(stderr, "Failed to claim '%s'.\n", name);
+		return result;
+	}
+	printf("%-8s heap:%u, phys:%llx, len:%llx\n", name, first.heap_id,
+		(unsigned long long)first.phys, (unsigned long long)first.len);
+
+	addr = mmap(NULL, first.len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		first.fd, 0);
+	if (addr == MAP_FAILED) {
+		result = errno;
+		fprintf(stderr, "Failed to mmap().\n");
+		close(first.fd);
+		return result;
+	}
+	addr[0] = 0x5a;
+	addr[first.len - 1] = 0xa5;
+	munmap(addr, first.len);
+	close(first.fd);
+
+	/* the driver holds the buffer, closing the fd does not free it */
+	result = claim(fd_ion, name, &second);
+	if (result) {
+		fprintf(stderr, "Failed to claim '%s' again.\n", name);
+		return result;
+	}
+	if (second.phys != first.phys || second.len != first.len ||
+		second.heap_id != first.heap_id) {
+		fprintf(stderr, "'%s' is another buffer.\n", name);
+		result = -EINVAL;
+		goto err_close;
+	}
+
+	addr = mmap(NULL, second.len, PROT_READ, MAP_SHARED, second.fd, 0);
+	if (addr == MAP_FAILED) {
+		result = errno;
+		fprintf(stderr, "Failed to mmap().\n");
+		goto err_close;
+	}
+	if (addr[0] != 0x5a || addr[second.len - 1] != 0xa5) {
+		fprintf(stderr, "'%s' lost the contents.\n", name);
+		result = -EINVAL;
+	}
+	munmap(addr, second.len);
+
+err_close:
+	close(second.fd);
+
+	return result;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s -n name [-n name ...]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct ion_uniphier_prealloc_data data;
+	const char *names[TEST_MAX_NAMES];
+	int nr_names = 0;
+	int fd_ion, opt, i, result = 0;
+
+	while ((opt = getopt(argc, argv, "n:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			if (nr_names < TEST_MAX_NAMES) {
+				names[nr_names++] = optarg;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (nr_names == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd_ion = open(ION_DEVNAME, O_RDWR);
+	if (fd_ion == -1) {
+		fprintf(stderr, "Failed to open(ion).\n");
+		return errno;
+	}
+
+	for (i = 0; i < nr_names; i++) {
+		result = check_buffer(fd_ion, names[i]);
+		if (result) {
+			goto out;
+		}
+	}
+
+	if (claim(fd_ion, "no-such-buffer", &data) != ENOENT) {
+		fprintf(stderr, "Unknown name is not refused.\n");
+		result = -EINVAL;
+		goto out;
+	}
+
+	printf("OK\n");
+
+out:
+	close(fd_ion);
+
+	return result;
+}
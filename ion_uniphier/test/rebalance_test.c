@@ -0,0 +1,244 @@
+/*
+ * Rebalance test of the carveout heaps of ion-uniphier.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Exhaust heap B, move free space at the boundary from the adjacent heap
+ * A to B by ION_UNIP_IOC_REBALANCE and check that B can allocate more.
+ * Then check that used space and non-adjacent heaps are refused, and
+ * move the space back.
+ *
+ *   rebalance_test [-A heap_id] [-B heap_id] [-N heap_id] [-s size]
+ *                  [-b buffer_size]
+ *
+ * Heap A must end where heap B starts, heap N must not be adjacent to A.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+
+#include <asm/ion.h>
+#include <asm/ion_uniphier.h>
+
+#define ION_DEVNAME      "/dev/ion"
+#define TEST_MAX_BUFS    1024
+
+static int buf_alloc(int fd_ion, int heap_id, size_t len, unsigned int flags,
+	ion_user_handle_t *handle)
+{
+	struct ion_allocation_data alloc_buf;
+
+	memset(&alloc_buf, 0, sizeof(alloc_buf));
+	alloc_buf.len = len;
+	alloc_buf.heap_id_mask = 0x1 << heap_id;
+	alloc_buf.flags = flags;
+	if (ioctl(fd_ion, ION_IOC_ALLOC, &alloc_buf) != 0) {
+		return errno;
+	}
+	*handle = alloc_buf.handle;
+
+	return 0;
+}
+
+static void buf_free(int fd_ion, ion_user_handle_t handle)
+{
+	struct ion_handle_data free_buf;
+
+	memset(&free_buf, 0, sizeof(free_buf));
+	free_buf.handle = handle;
+	ioctl(fd_ion, ION_IOC_FREE, &free_buf);
+}
+
+/**
+ * Allocate buffers until the heap is full.
+ *
+ * @return number of buffers allocated
+ */
+static int fill(int fd_ion, int heap_id, size_t len, ion_user_handle_t *bufs,
+	int nr_bufs)
+{
+	while (nr_bufs < TEST_MAX_BUFS &&
+		buf_alloc(fd_ion, heap_id, len, 0, &bufs[nr_bufs]) == 0) {
+		nr_bufs++;
+	}
+
+	return nr_bufs;
+}
+
+static int rebalance(int fd_ion, int from, int to, size_t size)
+{
+	struct ion_uniphier_rebalance_data rebalance_buf;
+	struct ion_custom_data custom_buf;
+
+	memset(&rebalance_buf, 0, sizeof(rebalance_buf));
+	rebalance_buf.from_heap_id = from;
+	rebalance_buf.to_heap_id = to;
+	rebalance_buf.size = size;
+
+	memset(&custom_buf, 0, sizeof(custom_buf));
+	custom_buf.cmd = ION_UNIP_IOC_REBALANCE;
+	custom_buf.arg = (unsigned long)&rebalance_buf;
+	if (ioctl(fd_ion, ION_IOC_CUSTOM, &custom_buf) != 0) {
+		return errno;
+	}
+
+	printf("moved %zx from %d to %d: %d:%llx-%llx, %d:%llx-%llx\n",
+		size, from, to,
+		from, (unsigned long long)rebalance_buf.from_base,
+		(unsigned long long)(rebalance_buf.from_base +
+			rebalance_buf.from_size),
+		to, (unsigned long long)rebalance_buf.to_base,
+		(unsigned long long)(rebalance_buf.to_base +
+			rebalance_buf.to_size));
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-A heap_id] [-B heap_id] [-N heap_id] "
+		"[-s size] [-b buffer_size]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	static ion_user_handle_t bufs[TEST_MAX_BUFS];
+	ion_user_handle_t pin = 0;
+	int heap_a = ION_HEAP_ID_MEDIA, heap_b = ION_HEAP_ID_GPU;
+	int heap_n = ION_HEAP_ID_FB;
+	size_t size = 0x400000, buf_size = 0x100000;
+	int fd_ion, opt, i, nr_full, nr_bufs = 0, result = 0;
+
+	while ((opt = getopt(argc, argv, "A:B:N:s:b:h")) != -1) {
+		switch (opt) {
+		case 'A':
+			heap_a = strtol(optarg, NULL, 0);
+			break;
+		case 'B':
+			heap_b = strtol(optarg, NULL, 0);
+			break;
+		case 'N':
+			heap_n = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			buf_size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (buf_size == 0 || size < buf_size) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd_ion = open(ION_DEVNAME, O_RDWR);
+	if (fd_ion == -1) {
+		fprintf(stderr, "Failed to open(ion).\n");
+		return errno;
+	}
+
+	nr_full = fill(fd_ion, heap_b, buf_size, bufs, 0);
+	printf("heap %d is full with %d buffers of %zx\n", heap_b, nr_full,
+		buf_size);
+
+	/* free space of A goes to B */
+	result = rebalance(fd_ion, heap_a, heap_b, size);
+	if (result) {
+		fprintf(stderr, "Failed to rebalance: %s\n", strerror(result));
+		goto out;
+	}
+	nr_bufs = fill(fd_ion, heap_b, buf_size, bufs, nr_full);
+	printf("heap %d got %d more buffers\n", heap_b, nr_bufs - nr_full);
+	if (nr_bufs - nr_full != size / buf_size) {
+		fprintf(stderr, "Moved space is not usable.\n");
+		result = -EINVAL;
+		goto out_free;
+	}
+
+	/* space used by a buffer is not moved */
+	result = buf_alloc(fd_ion, heap_a, buf_size, ION_UNIP_FLAG_LONG_LIVED,
+		&pin);
+	if (result) {
+		fprintf(stderr, "Failed to allocate in heap %d.\n", heap_a);
+		goto out_free;
+	}
+	result = rebalance(fd_ion, heap_a, heap_b, buf_size);
+	buf_free(fd_ion, pin);
+	if (result != EBUSY) {
+		fprintf(stderr, "Used space is moved: %d\n", result);
+		result = -EINVAL;
+		goto out_free;
+	}
+	result = rebalance(fd_ion, heap_b, heap_a, size);
+	if (result != EBUSY) {
+		fprintf(stderr, "Used space is moved back: %d\n", result);
+		result = -EINVAL;
+		goto out_free;
+	}
+
+	/* heaps that are not adjacent */
+	result = rebalance(fd_ion, heap_a, heap_n, buf_size);
+	if (result != EINVAL) {
+		fprintf(stderr, "Space is moved to non-adjacent heap: %d\n",
+			result);
+		result = -EINVAL;
+		goto out_free;
+	}
+
+	/* free all and restore the boundary */
+	for (i = 0; i < nr_bufs; i++) {
+		buf_free(fd_ion, bufs[i]);
+	}
+	nr_bufs = 0;
+	result = rebalance(fd_ion, heap_b, heap_a, size);
+	if (result) {
+		fprintf(stderr, "Failed to move back: %s\n", strerror(result));
+		goto out;
+	}
+	nr_bufs = fill(fd_ion, heap_b, buf_size, bufs, 0);
+	if (nr_bufs != nr_full) {
+		fprintf(stderr, "heap %d has %d buffers, not %d.\n", heap_b,
+			nr_bufs, nr_full);
+		result = -EINVAL;
+		goto out_free;
+	}
+
+	result = 0;
+	printf("OK\n");
+
+out_free:
+	for (i = 0; i < nr_bufs; i++) {
+		buf_free(fd_ion, bufs[i]);
+	}
+
+out:
+	close(fd_ion);
+
+	return result;
+}
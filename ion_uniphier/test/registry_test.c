@@ -0,0 +1,372 @@
+/*
+ * Test of the named buffer registry of ion-uniphier.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Publish a buffer by ION_UNIP_IOC_PUBLISH, open it by
+ * ION_UNIP_IOC_OPEN_NAMED and check that it is the same buffer, then
+ * check duplicated, unknown and unpublished names, and that the name is
+ * dropped when the publisher closes its client or releases the buffer.
+ * Also print the time of open by name.
+ *
+ *   registry_test [-H heap_id] [-s size] [-n opens]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <asm/ion.h>
+#include <asm/ion_uniphier.h>
+
+#define ION_DEVNAME      "/dev/ion"
+#define TEST_NAME        "test-lut"
+
+struct test_buf {
+	ion_user_handle_t handle;
+	int fd;
+	uint8_t *addr;
+	size_t len;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int buf_alloc(int fd_ion, int heap_id, size_t len, struct test_buf *b)
+{
+	struct ion_allocation_data alloc_buf;
+	struct ion_fd_data share_buf;
+	struct ion_handle_data free_buf;
+	int result;
+
+	memset(&alloc_buf, 0, sizeof(alloc_buf));
+	alloc_buf.len = len;
+	alloc_buf.heap_id_mask = 0x1 << heap_id;
+	alloc_buf.flags = ION_FLAG_CACHED;
+	result = ioctl(fd_ion, ION_IOC_ALLOC, &alloc_buf);
+	if (result != 0) {
+		result = errno;
+		fprintf(stderr, "Failed to ioctl(alloc).\n");
+		return result;
+	}
+
+	memset(&share_buf, 0, sizeof(share_buf));
+	share_buf.handle = alloc_buf.handle;
+	result = ioctl(fd_ion, ION_IOC_SHARE, &share_buf);
+	if (result != 0) {
+		result = errno;
+		fprintf(stderr, "Failed to ioctl(share).\n");
+		goto err_free;
+	}
+
+	b->addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		share_buf.fd, 0);
+	if (b->addr == MAP_FAILED) {
+		result = errno;
+		fprintf(stderr, "Failed to mmap().\n");
+		goto err_close;
+	}
+
+	b->handle = alloc_buf.handle;
+	b->fd = share_buf.fd;
+	b->len = len;
+
+	return 0;
+
+err_close:
+	close(share_buf.fd);
+
+err_free:
+	memset(&free_buf, 0, sizeof(free_buf));
+	free_buf.handle = alloc_buf.handle;
+	ioctl(fd_ion, ION_IOC_FREE, &free_buf);
+
+	return result;
+}
+
+static void buf_free(int fd_ion, struct test_buf *b)
+{
+	struct ion_handle_data free_buf;
+
+	munmap(b->addr, b->len);
+	close(b->fd);
+
+	memset(&free_buf, 0, sizeof(free_buf));
+	free_buf.handle = b->handle;
+	ioctl(fd_ion, ION_IOC_FREE, &free_buf);
+}
+
+static uint64_t buf_phys(int fd_ion, struct test_buf *b)
+{
+	struct ion_uniphier_virt_to_phys_data v2p_buf;
+	struct ion_custom_data custom_buf;
+
+	memset(&v2p_buf, 0, sizeof(v2p_buf));
+	v2p_buf.handle = b->handle;
+	v2p_buf.virt = (uintptr_t)b->addr;
+	v2p_buf.len = b->len;
+
+	memset(&custom_buf, 0, sizeof(custom_buf));
+	custom_buf.cmd = ION_UNIP_IOC_VIRT_TO_PHYS;
+	custom_buf.arg = (unsigned long)&v2p_buf;
+	if (ioctl(fd_ion, ION_IOC_CUSTOM, &custom_buf) != 0) {
+		return 0;
+	}
+
+	return v2p_buf.phys;
+}
+
+static int publish(int fd_ion, const char *name, int fd, uint32_t access)
+{
+	struct ion_uniphier_publish_data publish_buf;
+	struct ion_custom_data custom_buf;
+
+	memset(&publish_buf, 0, sizeof(publish_buf));
+	strncpy(publish_buf.name, name, sizeof(publish_buf.name) - 1);
+	publish_buf.fd = fd;
+	publish_buf.access = access;
+
+	memset(&custom_buf, 0, sizeof(custom_buf));
+	custom_buf.cmd = ION_UNIP_IOC_PUBLISH;
+	custom_buf.arg = (unsigned long)&publish_buf;
+	if (ioctl(fd_ion, ION_IOC_CUSTOM, &custom_buf) != 0) {
+		return errno;
+	}
+
+	return 0;
+}
+
+static int open_named(int fd_ion, const char *name,
+	struct ion_uniphier_open_named_data *data)
+{
+	struct ion_custom_data custom_buf;
+
+	memset(data, 0, sizeof(*data));
+	strncpy(data->name, name, sizeof(data->name) - 1);
+
+	memset(&custom_buf, 0, sizeof(custom_buf));
+	custom_buf.cmd = ION_UNIP_IOC_OPEN_NAMED;
+	custom_buf.arg = (unsigned long)data;
+	if (ioctl(fd_ion, ION_IOC_CUSTOM, &custom_buf) != 0) {
+		return errno;
+	}
+
+	return 0;
+}
+
+static int check_open(int fd_ion, struct test_buf *b)
+{
+	struct ion_uniphier_open_named_data named;
+	uint64_t phys = buf_phys(fd_ion, b);
+	uint8_t *addr;
+	int result;
+
+	result = open_named(fd_ion, TEST_NAME, &named);
+	if (result) {
+		fprintf(stderr, "Failed to open '%s'.\n", TEST_NAME);
+		return result;
+	}
+	printf("%s: heap:%u, phys:%llx, len:%llx\n", TEST_NAME,
+		named.heap_id, (unsigned long long)named.phys,
+		(unsigned long long)named.len);
+	if (named.len < b->len || (phys && named.phys != phys)) {
+		fprintf(stderr, "'%s' is another buffer.\n", TEST_NAME);
+		result = -EINVAL;
+		goto err_close;
+	}
+
+	addr = mmap(NULL, b->len, PROT_READ, MAP_SHARED, named.fd, 0);
+	if (addr == MAP_FAILED) {
+		result = errno;
+		fprintf(stderr, "Failed to mmap().\n");
+		goto err_close;
+	}
+	if (memcmp(addr, b->addr, b->len) != 0) {
+		fprintf(stderr, "'%s' has other contents.\n", TEST_NAME);
+		result = -EINVAL;
+	}
+	munmap(addr, b->len);
+
+err_close:
+	close(named.fd);
+
+	return result;
+}
+
+static void bench_open(int fd_ion, int n)
+{
+	struct ion_uniphier_open_named_data named;
+	uint64_t start, total = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		start = now_ns();
+		if (open_named(fd_ion, TEST_NAME, &named) != 0) {
+			break;
+		}
+		total += now_ns() - start;
+		close(named.fd);
+	}
+	if (i > 0) {
+		printf("open by name: %.1f ns\n", (double)total / i);
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-H heap_id] [-s size] [-n opens]\n",
+		name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct ion_uniphier_open_named_data named;
+	struct test_buf b;
+	int heap_id = ION_HEAP_ID_MEDIA;
+	size_t size = 0x100000;
+	int n = 1000;
+	int fd_ion, fd_pub, opt, result = 0;
+
+	while ((opt = getopt(argc, argv, "H:s:n:h")) != -1) {
+		switch (opt) {
+		case 'H':
+			heap_id = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			n = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	fd_ion = open(ION_DEVNAME, O_RDWR);
+	if (fd_ion == -1) {
+		fprintf(stderr, "Failed to open(ion).\n");
+		return errno;
+	}
+
+	result = buf_alloc(fd_ion, heap_id, size, &b);
+	if (result) {
+		goto out;
+	}
+	memset(b.addr, 0x3c, b.len);
+
+	result = publish(fd_ion, TEST_NAME, b.fd, ION_UNIP_PUBLISH_GROUP);
+	if (result) {
+		fprintf(stderr, "Failed to publish '%s'.\n", TEST_NAME);
+		goto out_free;
+	}
+	if (publish(fd_ion, TEST_NAME, b.fd, 0) != EEXIST) {
+		fprintf(stderr, "Duplicated name is not refused.\n");
+		result = -EINVAL;
+		goto out_free;
+	}
+	if (publish(fd_ion, "test-bad", b.fd, 0x80) != EINVAL) {
+		fprintf(stderr, "Invalid access is not refused.\n");
+		result = -EINVAL;
+		goto out_free;
+	}
+	if (open_named(fd_ion, "no-such-buffer", &named) != ENOENT) {
+		fprintf(stderr, "Unknown name is not refused.\n");
+		result = -EINVAL;
+		goto out_free;
+	}
+
+	result = check_open(fd_ion, &b);
+	if (result) {
+		goto out_free;
+	}
+	bench_open(fd_ion, n);
+
+	/* unpublished by the publisher */
+	result = publish(fd_ion, TEST_NAME, -1, 0);
+	if (result) {
+		fprintf(stderr, "Failed to unpublish '%s'.\n", TEST_NAME);
+		goto out_free;
+	}
+	if (open_named(fd_ion, TEST_NAME, &named) != ENOENT) {
+		fprintf(stderr, "Unpublished name is opened.\n");
+		result = -EINVAL;
+		goto out_free;
+	}
+
+	/* dropped when the publisher closes its client */
+	fd_pub = open(ION_DEVNAME, O_RDWR);
+	if (fd_pub == -1) {
+		fprintf(stderr, "Failed to open(ion).\n");
+		result = errno;
+		goto out_free;
+	}
+	result = publish(fd_pub, TEST_NAME, b.fd, 0);
+	close(fd_pub);
+	if (result) {
+		fprintf(stderr, "Failed to publish '%s' by other client.\n",
+			TEST_NAME);
+		goto out_free;
+	}
+	if (open_named(fd_ion, TEST_NAME, &named) != ENOENT) {
+		fprintf(stderr, "Name of closed client is opened.\n");
+		close(named.fd);
+		result = -EINVAL;
+		goto out_free;
+	}
+
+	/* dropped when the publisher releases the buffer */
+	result = publish(fd_ion, TEST_NAME, b.fd, 0);
+	if (result) {
+		fprintf(stderr, "Failed to publish '%s' again.\n", TEST_NAME);
+		goto out_free;
+	}
+	buf_free(fd_ion, &b);
+	if (open_named(fd_ion, TEST_NAME, &named) != ENOENT) {
+		fprintf(stderr, "Released buffer is opened.\n");
+		close(named.fd);
+		result = -EINVAL;
+		goto out;
+	}
+
+	printf("OK\n");
+	goto out;
+
+out_free:
+	buf_free(fd_ion, &b);
+
+out:
+	close(fd_ion);
+
+	return result;
+}
@@ -0,0 +1,294 @@
+/*
+ * Test of the batched buffer hand-off of send_fd.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Allocate a ring of multi-plane buffers, hand the whole ring to a child
+ * process by one send_bufs() and check in the child that every buffer
+ * has the header and the contents of the parent, without lseek() or
+ * ION_UNIP_IOC_VIRT_TO_PHYS. Then print the time of the hand-off by
+ * send_bufs() and by send_fd() per buffer.
+ *
+ *   ring_share_test [-H heap_id] [-n buffers] [-w width] [-h height]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <asm/ion.h>
+#include <asm/ion_uniphier.h>
+
+#include "send_fd.h"
+
+#define ION_DEVNAME      "/dev/ion"
+#define TEST_ROUNDS      100
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int alloc_frame(int fd_ion, int heap_id, uint32_t width,
+	uint32_t height, struct send_fd_buf_info *info, int *fd)
+{
+	struct ion_uniphier_alloc_planes_data planes_buf;
+	struct ion_custom_data custom_buf;
+	uint8_t *addr;
+
+	memset(&planes_buf, 0, sizeof(planes_buf));
+	planes_buf.heap_id_mask = 0x1 << heap_id;
+	planes_buf.format = ION_UNIP_FMT_NV12;
+	planes_buf.width = width;
+	planes_buf.height = height;
+
+	memset(&custom_buf, 0, sizeof(custom_buf));
+	custom_buf.cmd = ION_UNIP_IOC_ALLOC_PLANES;
+	custom_buf.arg = (unsigned long)&planes_buf;
+	if (ioctl(fd_ion, ION_IOC_CUSTOM, &custom_buf) != 0) {
+		fprintf(stderr, "Failed to ioctl(alloc planes).\n");
+		return errno;
+	}
+
+	addr = mmap(NULL, planes_buf.size, PROT_READ | PROT_WRITE,
+		MAP_SHARED, planes_buf.fd, 0);
+	if (addr == MAP_FAILED) {
+		fprintf(stderr, "Failed to mmap().\n");
+		close(planes_buf.fd);
+		return errno;
+	}
+	/* the first byte of each plane tells the plane */
+	addr[planes_buf.planes[0].offset] = 0x10;
+	addr[planes_buf.planes[1].offset] = 0x11;
+	munmap(addr, planes_buf.size);
+
+	send_fd_info_from_planes(info, &planes_buf, heap_id);
+	*fd = planes_buf.fd;
+
+	return 0;
+}
+
+static int check_frame(const struct send_fd_buf_info *info,
+	const struct send_fd_buf_info *expect, int fd)
+{
+	uint8_t *addr;
+	int result = 0;
+
+	if (memcmp(info, expect, sizeof(*info)) != 0) {
+		fprintf(stderr, "Header is broken.\n");
+		return -EINVAL;
+	}
+
+	addr = mmap(NULL, info->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		fprintf(stderr, "Failed to mmap().\n");
+		return errno;
+	}
+	if (addr[info->planes[0].offset] != 0x10 ||
+		addr[info->planes[1].offset] != 0x11) {
+		fprintf(stderr, "Contents are broken.\n");
+		result = -EINVAL;
+	}
+	munmap(addr, info->size);
+
+	return result;
+}
+
+static int consumer(int sock, const struct send_fd_buf_info *expect, int n)
+{
+	struct send_fd_buf_info infos[SEND_FD_MAX_FDS];
+	int fds[SEND_FD_MAX_FDS];
+	char dummy[8];
+	int nr_bufs, fd, len, round, i, result = 0;
+
+	if (recv_bufs(sock, infos, fds, SEND_FD_MAX_FDS, &nr_bufs) != 0) {
+		return 1;
+	}
+	if (nr_bufs != n) {
+		fprintf(stderr, "Received %d of %d buffers.\n", nr_bufs, n);
+		result = 1;
+	}
+	for (i = 0; i < nr_bufs; i++) {
+		if (!result && check_frame(&infos[i], &expect[i], fds[i])) {
+			fprintf(stderr, "buffer %d is broken.\n", i);
+			result = 1;
+		}
+		close(fds[i]);
+	}
+
+	/* timed rounds, drop everything */
+	for (round = 0; round < TEST_ROUNDS; round++) {
+		if (recv_bufs(sock, infos, fds, SEND_FD_MAX_FDS,
+			&nr_bufs) != 0) {
+			return 1;
+		}
+		for (i = 0; i < nr_bufs; i++) {
+			close(fds[i]);
+		}
+	}
+	for (round = 0; round < TEST_ROUNDS * n; round++) {
+		if (recv_fd(sock, dummy, sizeof(dummy), &fd) != 0) {
+			return 1;
+		}
+		/* recv_fd() has no header, the size is asked to the fd */
+		len = lseek(fd, 0, SEEK_END);
+		(void)len;
+		close(fd);
+	}
+
+	return result;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-H heap_id] [-n buffers] [-w width] "
+		"[-h height]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct send_fd_buf_info infos[SEND_FD_MAX_FDS];
+	int fds[SEND_FD_MAX_FDS];
+	int heap_id = ION_HEAP_ID_MEDIA;
+	uint32_t width = 320, height = 240;
+	int n = 16, nr_bufs = 0;
+	int fd_ion, socks[2], opt, round, i, status, result = 0;
+	uint64_t start, t_bufs, t_fd;
+	pid_t pid;
+
+	while ((opt = getopt(argc, argv, "H:n:w:h:")) != -1) {
+		switch (opt) {
+		case 'H':
+			heap_id = strtol(optarg, NULL, 0);
+			break;
+		case 'n':
+			n = strtol(optarg, NULL, 0);
+			break;
+		case 'w':
+			width = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			height = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (n < 1 || n > SEND_FD_MAX_FDS) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd_ion = open(ION_DEVNAME, O_RDWR);
+	if (fd_ion == -1) {
+		fprintf(stderr, "Failed to open(ion).\n");
+		return errno;
+	}
+
+	for (nr_bufs = 0; nr_bufs < n; nr_bufs++) {
+		result = alloc_frame(fd_ion, heap_id, width, height,
+			&infos[nr_bufs], &fds[nr_bufs]);
+		if (result) {
+			goto out;
+		}
+	}
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, socks) != 0) {
+		result = errno;
+		fprintf(stderr, "Failed to socketpair().\n");
+		goto out;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		result = errno;
+		fprintf(stderr, "Failed to fork().\n");
+		goto out_close;
+	}
+	if (pid == 0) {
+		close(socks[0]);
+		exit(consumer(socks[1], infos, n));
+	}
+
+	if (send_bufs(socks[0], infos, fds, n) != 0) {
+		result = -EIO;
+		goto out_wait;
+	}
+
+	start = now_ns();
+	for (round = 0; round < TEST_ROUNDS; round++) {
+		if (send_bufs(socks[0], infos, fds, n) != 0) {
+			result = -EIO;
+			goto out_wait;
+		}
+	}
+	t_bufs = now_ns() - start;
+
+	start = now_ns();
+	for (round = 0; round < TEST_ROUNDS * n; round++) {
+		if (send_fd(socks[0], "buf", 4, fds[round % n]) != 0) {
+			result = -EIO;
+			goto out_wait;
+		}
+	}
+	t_fd = now_ns() - start;
+
+	printf("ring of %d buffers: send_bufs %.1f us, send_fd %.1f us\n", n,
+		t_bufs / 1000.0 / TEST_ROUNDS, t_fd / 1000.0 / TEST_ROUNDS);
+
+out_wait:
+	close(socks[0]);
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+		WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "Consumer has failed.\n");
+		result = -EINVAL;
+	}
+	if (!result) {
+		printf("OK\n");
+	}
+	socks[0] = -1;
+
+out_close:
+	if (socks[0] != -1) {
+		close(socks[0]);
+	}
+	close(socks[1]);
+
+out:
+	for (i = 0; i < nr_bufs; i++) {
+		close(fds[i]);
+	}
+	close(fd_ion);
+
+	return result;
+}
@@ -9,8 +9,17 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 
+#include <asm/ion_uniphier.h>
+
 #include "send_fd.h"
 
+/* Header of the message of send_bufs() */
+struct send_fd_msg_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t nr_bufs;
+};
+
 int connect_un(const char *path, int *sock)
 {
 	int s;
@@ -165,3 +174,208 @@ int recv_fd(int sock, void *message, size_t len_message, int *fd)
 
 	return 0;
 }
+
+/**
+ * Send fds in one SCM_RIGHTS message with the message.
+ *
+ * @return 0 on success, -1 on error
+ */
+int send_fds(int sock, const void *message, size_t len_message,
+	const int *fds, int nr_fds)
+{
+	struct iovec iov[1];
+	struct msghdr msg;
+	struct cmsghdr *cmsg = NULL;
+	union {
+		struct cmsghdr hdr;
+		char cmsgbuf[CMSG_SPACE(sizeof(int) * SEND_FD_MAX_FDS)];
+	} buf;
+	int result;
+
+	if (nr_fds < 1 || nr_fds > SEND_FD_MAX_FDS) {
+		return -1;
+	}
+
+	iov[0].iov_base = (void *)message;
+	iov[0].iov_len = len_message;
+
+	memset(&buf, 0, sizeof(buf));
+	cmsg = &buf.hdr;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nr_fds);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nr_fds);
+
+	msg.msg_name = NULL;
+	msg.msg_namelen = 0;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = buf.cmsgbuf;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * nr_fds);
+	msg.msg_flags = 0;
+
+	result = sendmsg(sock, &msg, 0);
+	if (result < 0) {
+		fprintf(stderr, "Failed to sendmsg(fds).\n");
+		return result;
+	}
+
+	return 0;
+}
+
+/**
+ * Receive fds that are sent by send_fds(). Received fds are close-on-exec.
+ *
+ * @param len_message  size of message, returns received size
+ * @return 0 on success, -1 on error, no fds are left open on error
+ */
+static int recv_fds_msg(int sock, struct iovec *iov, int iovlen,
+	size_t *len_message, int *fds, int max_fds, int *nr_fds)
+{
+	struct msghdr msg;
+	struct cmsghdr *cmsg = NULL;
+	union {
+		struct cmsghdr hdr;
+		char cmsgbuf[CMSG_SPACE(sizeof(int) * SEND_FD_MAX_FDS)];
+	} buf;
+	ssize_t result;
+	int n = 0, i;
+
+	if (max_fds < 1 || max_fds > SEND_FD_MAX_FDS) {
+		return -1;
+	}
+
+	msg.msg_name = NULL;
+	msg.msg_namelen = 0;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovlen;
+	msg.msg_control = buf.cmsgbuf;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * max_fds);
+	msg.msg_flags = 0;
+
+	result = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	if (result < 0) {
+		fprintf(stderr, "Failed to recvmsg(fds).\n");
+		return -1;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+			cmsg->cmsg_type == SCM_RIGHTS) {
+			n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * n);
+			break;
+		}
+	}
+	if (msg.msg_flags & (MSG_CTRUNC | MSG_TRUNC)) {
+		/* some fds or data are lost, the message is not usable */
+		fprintf(stderr, "Truncated recvmsg(fds).\n");
+		for (i = 0; i < n; i++) {
+			close(fds[i]);
+		}
+		return -1;
+	}
+
+	*len_message = result;
+	*nr_fds = n;
+
+	return 0;
+}
+
+int recv_fds(int sock, void *message, size_t len_message, int *fds,
+	int max_fds, int *nr_fds)
+{
+	struct iovec iov[1];
+
+	iov[0].iov_base = message;
+	iov[0].iov_len = len_message;
+
+	return recv_fds_msg(sock, iov, 1, &len_message, fds, max_fds, nr_fds);
+}
+
+/**
+ * Send buffers with their headers in one message.
+ *
+ * @return 0 on success, -1 on error
+ */
+int send_bufs(int sock, const struct send_fd_buf_info *infos,
+	const int *fds, int nr_bufs)
+{
+	struct {
+		struct send_fd_msg_hdr hdr;
+		struct send_fd_buf_info infos[SEND_FD_MAX_FDS];
+	} msg;
+
+	if (nr_bufs < 1 || nr_bufs > SEND_FD_MAX_FDS) {
+		return -1;
+	}
+
+	msg.hdr.magic = SEND_FD_MAGIC;
+	msg.hdr.version = SEND_FD_VERSION;
+	msg.hdr.nr_bufs = nr_bufs;
+	memcpy(msg.infos, infos, sizeof(*infos) * nr_bufs);
+
+	return send_fds(sock, &msg, sizeof(msg.hdr) + sizeof(*infos) * nr_bufs,
+		fds, nr_bufs);
+}
+
+/**
+ * Receive buffers that are sent by send_bufs().
+ *
+ * @return 0 on success, -1 on error, no fds are left open on error
+ */
+int recv_bufs(int sock, struct send_fd_buf_info *infos, int *fds,
+	int max_bufs, int *nr_bufs)
+{
+	struct send_fd_msg_hdr hdr;
+	struct iovec iov[2];
+	size_t len;
+	int n, i;
+
+	if (max_bufs < 1 || max_bufs > SEND_FD_MAX_FDS) {
+		return -1;
+	}
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = infos;
+	iov[1].iov_len = sizeof(*infos) * max_bufs;
+	if (recv_fds_msg(sock, iov, 2, &len, fds, max_bufs, &n) != 0) {
+		return -1;
+	}
+
+	if (len < sizeof(hdr) || hdr.magic != SEND_FD_MAGIC ||
+		hdr.version != SEND_FD_VERSION || hdr.nr_bufs != n ||
+		len != sizeof(hdr) + sizeof(*infos) * n) {
+		fprintf(stderr, "Invalid message of recv_bufs().\n");
+		for (i = 0; i < n; i++) {
+			close(fds[i]);
+		}
+		return -1;
+	}
+
+	*nr_bufs = n;
+
+	return 0;
+}
+
+/**
+ * Fill the header of the buffer allocated by ION_UNIP_IOC_ALLOC_PLANES.
+ */
+void send_fd_info_from_planes(struct send_fd_buf_info *info,
+	const struct ion_uniphier_alloc_planes_data *planes, uint32_t heap_id)
+{
+	uint32_t i;
+
+	memset(info, 0, sizeof(*info));
+	info->size = planes->size;
+	info->phys = planes->planes[0].phys;
+	info->heap_id = heap_id;
+	info->format = planes->format;
+	info->nr_planes = planes->nr_planes;
+	for (i = 0; i < planes->nr_planes && i < SEND_FD_MAX_PLANES; i++) {
+		info->planes[i].offset = planes->planes[i].offset;
+		info->planes[i].stride = planes->planes[i].stride;
+		info->planes[i].lines = planes->planes[i].lines;
+	}
+}
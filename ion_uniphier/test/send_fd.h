@@ -1,10 +1,69 @@
-
 #ifndef SEND_FD__
 #define SEND_FD__
 
+#include <stdint.h>
+#include <stddef.h>
+
+/* Max number of fds in one message, less than SCM_MAX_FD of the kernel */
+#define SEND_FD_MAX_FDS       32
+#define SEND_FD_MAX_PLANES    3
+
+#define SEND_FD_MAGIC         0x53464442 /* 'SFDB' */
+#define SEND_FD_VERSION       1
+
+/**
+ * struct send_fd_plane - layout of a plane in the buffer
+ *
+ * @param offset  Offset of the plane from the start of buffer.
+ * @param stride  Bytes per line.
+ * @param lines   Number of lines.
+ */
+struct send_fd_plane {
+	uint64_t offset;
+	uint32_t stride;
+	uint32_t lines;
+};
+
+/**
+ * struct send_fd_buf_info - header of a buffer, sent with the fd
+ *
+ * The receiver gets everything it needs to use the buffer, no lseek()
+ * or ION_UNIP_IOC_VIRT_TO_PHYS is needed.
+ *
+ * @param size       Size of the buffer.
+ * @param phys       Physical address, 0 if not contiguous.
+ * @param heap_id    Id of the heap that has the buffer.
+ * @param format     Pixel format (enum ion_uniphier_pixel_format),
+ *                   or -1 if the buffer is not an image.
+ * @param nr_planes  Number of planes, 0 if not an image.
+ * @param planes     Layout of planes.
+ */
+struct send_fd_buf_info {
+	uint64_t size;
+	uint64_t phys;
+	uint32_t heap_id;
+	uint32_t format;
+	uint32_t nr_planes;
+	uint32_t reserved;
+	struct send_fd_plane planes[SEND_FD_MAX_PLANES];
+};
+
+struct ion_uniphier_alloc_planes_data;
+
 int connect_un(const char *path, int *sock);
 int bind_un(const char *path, int *sock);
 int send_fd(int sock, void *message, size_t len_message, int fd);
 int recv_fd(int sock, void *message, size_t len_message, int *fd);
 
+int send_fds(int sock, const void *message, size_t len_message,
+	const int *fds, int nr_fds);
+int recv_fds(int sock, void *message, size_t len_message, int *fds,
+	int max_fds, int *nr_fds);
+int send_bufs(int sock, const struct send_fd_buf_info *infos,
+	const int *fds, int nr_bufs);
+int recv_bufs(int sock, struct send_fd_buf_info *infos, int *fds,
+	int max_bufs, int *nr_bufs);
+void send_fd_info_from_planes(struct send_fd_buf_info *info,
+	const struct ion_uniphier_alloc_planes_data *planes, uint32_t heap_id);
+
 #endif //SEND_FD__
@@ -0,0 +1,207 @@
+/*
+ * First-touch latency benchmark of ion-uniphier buffers.
+ *
+ * Copyright (c) 2016 Socionext Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Allocate a cached buffer with and without ION_UNIP_FLAG_PREFAULT,
+ * then measure the time of mmap() and of the first write to each page
+ * (that is a page fault if the buffer is mapped on fault), and the
+ * second pass for comparison.
+ *
+ *   touch_bench [-H heap_id] [-s size] [-r repeat]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <asm/ion.h>
+#include <asm/ion_uniphier.h>
+
+#define ION_DEVNAME      "/dev/ion"
+
+struct touch_result {
+	uint64_t mmap_ns;
+	uint64_t first_ns;
+	uint64_t first_max_ns;
+	uint64_t second_ns;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int touch_once(int fd_ion, int heap_id, size_t size,
+	unsigned int flags, struct touch_result *r)
+{
+	struct ion_allocation_data alloc_buf;
+	struct ion_fd_data share_buf;
+	struct ion_handle_data free_buf;
+	size_t page = sysconf(_SC_PAGESIZE);
+	volatile uint8_t *addr;
+	uint64_t start, t, lat;
+	size_t off;
+	int result;
+
+	memset(&alloc_buf, 0, sizeof(alloc_buf));
+	alloc_buf.len = size;
+	alloc_buf.align = page;
+	alloc_buf.heap_id_mask = 0x1 << heap_id;
+	alloc_buf.flags = flags;
+	result = ioctl(fd_ion, ION_IOC_ALLOC, &alloc_buf);
+	if (result != 0) {
+		result = errno;
+		fprintf(stderr, "Failed to ioctl(alloc).\n");
+		return result;
+	}
+
+	memset(&share_buf, 0, sizeof(share_buf));
+	share_buf.handle = alloc_buf.handle;
+	result = ioctl(fd_ion, ION_IOC_SHARE, &share_buf);
+	if (result != 0) {
+		result = errno;
+		fprintf(stderr, "Failed to ioctl(share).\n");
+		goto err_free;
+	}
+
+	start = now_ns();
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		share_buf.fd, 0);
+	r->mmap_ns = now_ns() - start;
+	if (addr == MAP_FAILED) {
+		result = errno;
+		fprintf(stderr, "Failed to mmap().\n");
+		goto err_close;
+	}
+
+	r->first_max_ns = 0;
+	start = now_ns();
+	for (off = 0; off < size; off += page) {
+		t = now_ns();
+		addr[off] = 1;
+		lat = now_ns() - t;
+		if (lat > r->first_max_ns) {
+			r->first_max_ns = lat;
+		}
+	}
+	r->first_ns = now_ns() - start;
+
+	start = now_ns();
+	for (off = 0; off < size; off += page) {
+		addr[off] = 2;
+	}
+	r->second_ns = now_ns() - start;
+
+	munmap((void *)addr, size);
+	result = 0;
+
+err_close:
+	close(share_buf.fd);
+
+err_free:
+	memset(&free_buf, 0, sizeof(free_buf));
+	free_buf.handle = alloc_buf.handle;
+	ioctl(fd_ion, ION_IOC_FREE, &free_buf);
+
+	return result;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-H heap_id] [-s size] [-r repeat]\n",
+		name);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct {
+		const char *name;
+		unsigned int flags;
+	} modes[] = {
+		{ "fault", ION_FLAG_CACHED },
+		{ "prefault", ION_FLAG_CACHED | ION_UNIP_FLAG_PREFAULT },
+	};
+	int heap_id = ION_HEAP_ID_MEDIA;
+	size_t size = 0x2000000;
+	size_t pages;
+	int rep = 3;
+	int fd_ion, opt, m, i, result = 0;
+
+	while ((opt = getopt(argc, argv, "H:s:r:h")) != -1) {
+		switch (opt) {
+		case 'H':
+			heap_id = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rep = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	pages = size / sysconf(_SC_PAGESIZE);
+
+	fd_ion = open(ION_DEVNAME, O_RDWR);
+	if (fd_ion == -1) {
+		fprintf(stderr, "Failed to open(ion).\n");
+		return errno;
+	}
+
+	printf("size:%zx, pages:%zu\n", size, pages);
+	printf("%-10s %12s %14s %14s %14s %14s\n", "mode", "mmap[us]",
+		"1st touch[us]", "1st avg[ns]", "1st max[ns]", "2nd touch[us]");
+	for (m = 0; m < 2; m++) {
+		for (i = 0; i < rep; i++) {
+			struct touch_result r = { 0 };
+
+			result = touch_once(fd_ion, heap_id, size,
+				modes[m].flags, &r);
+			if (result) {
+				goto out;
+			}
+
+			printf("%-10s %12.1f %14.1f %14.1f %14llu %14.1f\n",
+				modes[m].name, r.mmap_ns / 1000.0,
+				r.first_ns / 1000.0,
+				(double)r.first_ns / pages,
+				(unsigned long long)r.first_max_ns,
+				r.second_ns / 1000.0);
+		}
+	}
+
+out:
+	close(fd_ion);
+
+	return result;
+}
@@ -35,6 +35,7 @@ enum ion_heap_id_uniphier {
 	ION_HEAP_ID_CH2   = ION_NUM_HEAPS - 7,
 	ION_HEAP_ID_HSCADBS = ION_NUM_HEAPS - 8,
 	ION_HEAP_ID_VMLA  = ION_NUM_HEAPS - 9,
+	ION_HEAP_ID_USERPTR = ION_NUM_HEAPS - 10,
 };
 
 #define ION_HEAP_ID_MEDIA_MASK    (1 << ION_HEAP_ID_MEDIA)
@@ -46,6 +47,52 @@ enum ion_heap_id_uniphier {
 #define ION_HEAP_ID_CH2_MASK      (1 << ION_HEAP_ID_CH2)
 #define ION_HEAP_ID_HSCADBS_MASK  (1 << ION_HEAP_ID_HSCADBS)
 #define ION_HEAP_ID_VMLA_MASK     (1 << ION_HEAP_ID_VMLA)
+#define ION_HEAP_ID_USERPTR_MASK  (1 << ION_HEAP_ID_USERPTR)
+
+/*
+ * Allocation flags of UniPhier heaps, the high 16 bits of flags of
+ * ION_IOC_ALLOC are passed to the heap.
+ *
+ * Buffers without ION_FLAG_CACHED are mapped write-combined to user and
+ * kernel by ion.
+ *
+ * ION_UNIP_FLAG_PREFAULT: map the whole buffer to user at mmap() time.
+ *   By default, ION_FLAG_CACHED buffers are mapped page by page on fault
+ *   and ion keeps track of dirty pages. With this flag the buffer is
+ *   treated as ION_FLAG_CACHED_NEEDS_SYNC, so the user must sync the
+ *   buffer explicitly (ION_IOC_SYNC or ION_UNIP_IOC_SYNC_RANGE).
+ */
+#define ION_UNIP_FLAG_PREFAULT      (1 << 17)
+
+/*
+ * ION_UNIP_FLAG_LONG_LIVED: hint that the buffer is kept for a long time
+ *   (display planes, reference pools, etc.). Carveout heaps place it
+ *   from the top of the heap, and other buffers from the bottom by the
+ *   placement policy, so that freeing short-lived buffers does not leave
+ *   holes between long-lived ones. Ignored by other heaps.
+ */
+#define ION_UNIP_FLAG_LONG_LIVED    (1 << 18)
+
+/*
+ * ION_UNIP_FLAG_MOVABLE: the carveout heap may move the buffer to other
+ *   physical address to merge free space (compaction). It is moved only
+ *   when it is not mapped to the kernel, has at most one dma-buf and
+ *   the dma-buf is not attached to devices. Once the physical address
+ *   is got (e.g. ION_UNIP_IOC_PHYS), it is never moved. User mappings
+ *   are mapped on fault and follow the move. The buffer is treated as
+ *   ION_FLAG_CACHED_NEEDS_SYNC. Ignored by other heaps, and for
+ *   ION_UNIP_FLAG_LONG_LIVED buffers.
+ */
+#define ION_UNIP_FLAG_MOVABLE       (1 << 19)
+
+/*
+ * ION_UNIP_FLAG_REALTIME: the allocation must not wait for the migration
+ *   of pages. CMA heaps (socionext,cma of DT) serve it only from the
+ *   blocks pre-warmed by ION_UNIP_IOC_CMA_PREWARM, otherwise it fails on
+ *   the CMA heap and ion tries the next heap of heap_id_mask, e.g. a
+ *   small carveout heap. Ignored by other heaps.
+ */
+#define ION_UNIP_FLAG_REALTIME      (1 << 20)
 
 /**
  * struct ion_handle_data - a handle passed to/from the kernel
@@ -86,10 +133,471 @@ struct ion_uniphier_phys_data {
 	uint64_t len;
 };
 
+/**
+ * enum ion_uniphier_sync_dir - direction of cache maintenance
+ *
+ * @ION_UNIP_SYNC_FOR_DEVICE:  CPU wrote the range, device will read it
+ *                             (clean)
+ * @ION_UNIP_SYNC_FOR_CPU:     device wrote the range, CPU will read it
+ *                             (invalidate)
+ * @ION_UNIP_SYNC_BIDIRECTIONAL: both (clean and invalidate)
+ */
+enum ion_uniphier_sync_dir {
+	ION_UNIP_SYNC_FOR_DEVICE,
+	ION_UNIP_SYNC_FOR_CPU,
+	ION_UNIP_SYNC_BIDIRECTIONAL,
+};
+
+/**
+ * struct ion_uniphier_sync_range - a range of the buffer
+ *
+ * @param offset  Offset from the start of Ion buffer.
+ * @param len     Length of the range.
+ */
+struct ion_uniphier_sync_range {
+	uint64_t offset;
+	uint64_t len;
+};
+
+#define ION_UNIP_SYNC_MAX_RANGES    256
+
+/**
+ * struct ion_uniphier_sync_data - cache maintenance of ranges of the buffer
+ *
+ * If nr_ranges is 0, only the range (offset, len) is synced. Otherwise
+ * ranges points the array of struct ion_uniphier_sync_range that has
+ * nr_ranges (up to ION_UNIP_SYNC_MAX_RANGES) entries.
+ * It does nothing for the buffer that is not ION_FLAG_CACHED.
+ *
+ * @param fd         A dma-buf fd of Ion buffer.
+ * @param dir        enum ion_uniphier_sync_dir.
+ * @param offset     Offset of the single range.
+ * @param len        Length of the single range.
+ * @param nr_ranges  Number of ranges.
+ * @param ranges     User pointer to array of ranges.
+ */
+struct ion_uniphier_sync_data {
+	int fd;
+	int dir;
+	uint64_t offset;
+	uint64_t len;
+	uint32_t nr_ranges;
+	uint64_t ranges;
+};
+
+#define ION_UNIP_USERPTR_READONLY   (1 << 0)
+
+/**
+ * struct ion_uniphier_userptr_data - import user memory as Ion buffer
+ *
+ * The pages of user memory are pinned until the buffer is released.
+ * The buffer belongs to ION_HEAP_ID_USERPTR, it can not be allocated by
+ * ION_IOC_ALLOC.
+ *
+ * If ION_UNIP_USERPTR_READONLY is set, the pages are pinned without
+ * write. mmap() of the buffer must not be PROT_WRITE, and the kernel
+ * refuses to write to it (ION_UNIP_IOC_LOAD_FILE fails with EPERM).
+ *
+ * @param virt   Start address of user memory, page aligned.
+ * @param len    Length of user memory, page aligned.
+ * @param flags  ION_UNIP_USERPTR_READONLY if devices only read the memory.
+ * @param fd     Returns a dma-buf fd of Ion buffer.
+ * @param phys   Returns a physical address of the first page.
+ * @param cont   Returns the memory is physical-contineous or not.
+ */
+struct ion_uniphier_userptr_data {
+	uint64_t virt;
+	uint64_t len;
+	uint32_t flags;
+	int fd;
+	uint64_t phys;
+	int cont;
+};
+
+/**
+ * struct ion_uniphier_wrap_phys_data - wrap the physical range as Ion buffer
+ *
+ * The range must be inside of the carveout heap and must not be used by
+ * other buffers. The data in the range is kept, and is cleared when the
+ * buffer is freed unless the heap has 'socionext,keep-contents'.
+ * This needs CAP_SYS_RAWIO.
+ *
+ * @param heap_id  An id of the heap that has the range.
+ * @param flags    Ion allocation flags.
+ * @param phys     A physical address of the range, page aligned.
+ * @param len      A length of the range.
+ * @param fd       Returns a dma-buf fd of Ion buffer.
+ */
+struct ion_uniphier_wrap_phys_data {
+	uint32_t heap_id;
+	uint32_t flags;
+	uint64_t phys;
+	uint64_t len;
+	int fd;
+};
+
+/**
+ * struct ion_uniphier_load_file_data - read the file into the buffer
+ *
+ * Read len bytes at file_offset of the file into the buffer at
+ * buf_offset by the kernel mapping of the buffer, without user mapping.
+ * Cached buffers are cleaned after read. Reading stops at end of file.
+ *
+ * @param buf_fd       A dma-buf fd of Ion buffer.
+ * @param file_fd      A fd of the file opened for read.
+ * @param file_offset  Offset in the file.
+ * @param buf_offset   Offset in the buffer.
+ * @param len          Length to read.
+ * @param done         Returns the length that has been read.
+ */
+struct ion_uniphier_load_file_data {
+	int buf_fd;
+	int file_fd;
+	uint64_t file_offset;
+	uint64_t buf_offset;
+	uint64_t len;
+	uint64_t done;
+};
+
+/**
+ * struct ion_uniphier_cma_prewarm_data - pre-warm the CMA heap
+ *
+ * Allocate count blocks of size bytes from the CMA heap in advance, e.g.
+ * at the start of a stream, so that the migration of pages is done
+ * before the frames are allocated. Allocations of the same size take the
+ * pre-warmed blocks. Blocks that are not used for a while are returned
+ * to the system. count 0 returns all blocks now. This needs
+ * CAP_SYS_ADMIN, the blocks are taken from the memory of the system.
+ *
+ * @param heap_id  An id of the CMA heap.
+ * @param count    Number of blocks to add, 0 to release all.
+ * @param size     Size of each block.
+ * @param warmed   Returns the number of pre-warmed blocks of the heap.
+ * @param reserved Reserved, must be 0.
+ */
+struct ion_uniphier_cma_prewarm_data {
+	uint32_t heap_id;
+	uint32_t count;
+	uint64_t size;
+	uint32_t warmed;
+	uint32_t reserved;
+};
+
+/**
+ * struct ion_uniphier_rebalance_data - move free space between heaps
+ *
+ * Move size bytes of free space at the boundary of two adjacent carveout
+ * heaps from one heap to the other, e.g. from the tail of 'vmla' to the
+ * head of 'gpu' if 'gpu' starts at the end of 'vmla'. Only free space
+ * can be moved, -EBUSY is returned if a buffer is there. Needs
+ * CAP_SYS_ADMIN.
+ *
+ * @param from_heap_id  An id of the heap that gives the space.
+ * @param to_heap_id    An id of the heap that gets the space.
+ * @param size          Size to move, page aligned.
+ * @param from_base     Returns the new base address of from heap.
+ * @param from_size     Returns the new size of from heap.
+ * @param to_base       Returns the new base address of to heap.
+ * @param to_size       Returns the new size of to heap.
+ */
+struct ion_uniphier_rebalance_data {
+	uint32_t from_heap_id;
+	uint32_t to_heap_id;
+	uint64_t size;
+	uint64_t from_base;
+	uint64_t from_size;
+	uint64_t to_base;
+	uint64_t to_size;
+};
+
+#define ION_UNIP_PREALLOC_NAME_LEN   32
+
+/**
+ * struct ion_uniphier_prealloc_data - claim the preallocated buffer
+ *
+ * Heap nodes of DT declare buffers that the driver allocates at probe,
+ * e.g. the framebuffer or the boot splash, by child nodes:
+ *
+ *   fb-heap {
+ *       ...
+ *       splash {
+ *           size = <0x7e9000>;
+ *           align = <0x200000>;    (optional)
+ *           offset = <0x0>;        (optional, from the base of the heap)
+ *           owner-uid = <1000>;    (optional)
+ *           owner-gid = <1003>;    (optional)
+ *       };
+ *   };
+ *
+ * A buffer at the fixed offset of the heap that has
+ * 'socionext,keep-contents' holds the data left by the bootloader.
+ * Buffers live until the driver is removed, every claim returns a new
+ * fd of the same buffer. Only the process whose effective uid is
+ * owner-uid or that is in the group owner-gid can claim the buffer, or
+ * CAP_SYS_ADMIN. Others get EACCES, unknown names ENOENT.
+ *
+ * @param name     A name of the buffer (DT node name), NUL terminated.
+ * @param fd       Returns a dma-buf fd of Ion buffer.
+ * @param heap_id  Returns an id of the heap that has the buffer.
+ * @param phys     Returns a physical address of the buffer.
+ * @param len      Returns a length of the buffer.
+ */
+struct ion_uniphier_prealloc_data {
+	char name[ION_UNIP_PREALLOC_NAME_LEN];
+	int fd;
+	uint32_t heap_id;
+	uint64_t phys;
+	uint64_t len;
+};
+
+#define ION_UNIP_PUBLISH_NAME_LEN  32
+
+/* Processes that may open the published buffer, besides the same user */
+#define ION_UNIP_PUBLISH_GROUP     (1 << 0)
+#define ION_UNIP_PUBLISH_OTHERS    (1 << 1)
+
+/**
+ * struct ion_uniphier_publish_data - publish the buffer by name
+ *
+ * Other processes open the buffer by ION_UNIP_IOC_OPEN_NAMED, without
+ * passing the fd through unix sockets. The name belongs to the ion
+ * client (the /dev/ion fd) that publishes it, and is dropped when the
+ * publisher closes that client, when the buffer is released by the
+ * publisher and by all processes that have opened it, or when the
+ * publisher unpublishes it by fd of -1.
+ *
+ * The effective user of the publisher can always open the buffer,
+ * CAP_SYS_ADMIN can always open and unpublish it.
+ *
+ * @param name    A name of the buffer, NUL terminated.
+ * @param fd      A dma-buf fd of Ion buffer, or -1 to unpublish the name.
+ * @param access  ION_UNIP_PUBLISH_* flags.
+ */
+struct ion_uniphier_publish_data {
+	char name[ION_UNIP_PUBLISH_NAME_LEN];
+	int fd;
+	uint32_t access;
+};
+
+/**
+ * struct ion_uniphier_open_named_data - open the published buffer
+ *
+ * @param name     A name of the buffer, NUL terminated.
+ * @param fd       Returns a dma-buf fd of Ion buffer.
+ * @param heap_id  Returns an id of the heap that has the buffer.
+ * @param phys     Returns a physical address of the buffer, 0 if the
+ *                 buffer is not physical-contineous.
+ * @param len      Returns a length of the buffer.
+ */
+struct ion_uniphier_open_named_data {
+	char name[ION_UNIP_PUBLISH_NAME_LEN];
+	int fd;
+	uint32_t heap_id;
+	uint64_t phys;
+	uint64_t len;
+};
+
+/**
+ * struct ion_uniphier_alloc_async_data - queue an allocation
+ *
+ * The allocation runs in a worker of the driver, the ioctl returns the
+ * ticket at once. Completion is signalled to the eventfd, the result is
+ * collected by ION_UNIP_IOC_ALLOC_RESULT with the ticket, by the same
+ * client. A client can have 64 requests that are not collected, more
+ * fail with EBUSY. The client is kept open while it has requests.
+ * Results that are not collected are freed by later requests after the
+ * process has exited or has closed the client.
+ *
+ * @param len           Size of the buffer.
+ * @param align         Alignment of the buffer.
+ * @param heap_id_mask  Mask of heaps to allocate from.
+ * @param flags         Ion allocation flags.
+ * @param eventfd       An eventfd that is signalled on completion, or -1.
+ * @param ticket        Returns a ticket of the request.
+ */
+struct ion_uniphier_alloc_async_data {
+	uint64_t len;
+	uint64_t align;
+	uint32_t heap_id_mask;
+	uint32_t flags;
+	int32_t eventfd;
+	uint32_t ticket;
+};
+
+/* Wait for the completion, instead of EAGAIN */
+#define ION_UNIP_ASYNC_WAIT        (1 << 0)
+
+/**
+ * struct ion_uniphier_alloc_result_data - collect the queued allocation
+ *
+ * Fails with EAGAIN if the allocation has not completed and
+ * ION_UNIP_ASYNC_WAIT is not set, with ENOENT if the ticket is unknown
+ * or has been collected. The error of the allocation is returned as the
+ * error of the ioctl, the ticket is collected in that case too.
+ *
+ * @param ticket  A ticket of ION_UNIP_IOC_ALLOC_ASYNC.
+ * @param flags   ION_UNIP_ASYNC_* flags.
+ * @param fd      Returns a dma-buf fd of Ion buffer.
+ * @param reserved  Must be 0.
+ * @param phys    Returns a physical address of the buffer, 0 if the
+ *                buffer is not physical-contineous.
+ * @param len     Returns a length of the buffer.
+ */
+struct ion_uniphier_alloc_result_data {
+	uint32_t ticket;
+	uint32_t flags;
+	int fd;
+	uint32_t reserved;
+	uint64_t phys;
+	uint64_t len;
+};
+
+/**
+ * enum ion_uniphier_pixel_format - pixel formats of multi-plane buffer
+ *
+ * @ION_UNIP_FMT_NV12:    Y plane, interleaved CbCr plane (4:2:0)
+ * @ION_UNIP_FMT_NV16:    Y plane, interleaved CbCr plane (4:2:2)
+ * @ION_UNIP_FMT_YUV420:  Y, Cb and Cr planes (4:2:0)
+ * @ION_UNIP_FMT_P010:    same as NV12 but 16bit per sample
+ */
+enum ion_uniphier_pixel_format {
+	ION_UNIP_FMT_NV12,
+	ION_UNIP_FMT_NV16,
+	ION_UNIP_FMT_YUV420,
+	ION_UNIP_FMT_P010,
+	ION_UNIP_FMT_NR_FORMATS,
+};
+
+#define ION_UNIP_MAX_PLANES     3
+#define ION_UNIP_MAX_PIXELS     16384
+#define ION_UNIP_MAX_HEIGHT_ALIGN  256
+#define ION_UNIP_MAX_STRIDE_ALIGN  4096
+
+/**
+ * struct ion_uniphier_plane_info - layout of a plane
+ *
+ * @param offset  Offset of the plane from the start of Ion buffer.
+ * @param size    Size of the plane (stride * lines).
+ * @param phys    A physical address of the plane, 0 if the buffer is not
+ *                physical-contineous.
+ * @param stride  Bytes per line.
+ * @param lines   Number of lines.
+ */
+struct ion_uniphier_plane_info {
+	uint64_t offset;
+	uint64_t size;
+	uint64_t phys;
+	uint32_t stride;
+	uint32_t lines;
+};
+
+/**
+ * struct ion_uniphier_alloc_planes_data - allocate multi-plane buffer
+ *
+ * All planes are in one buffer, packed in order of planes. Alignments
+ * of 0 mean no alignment.
+ *
+ * @param heap_id_mask  Mask of heaps to allocate from.
+ * @param flags         Ion allocation flags.
+ * @param format        enum ion_uniphier_pixel_format.
+ * @param width         Width in pixels.
+ * @param height        Height in pixels.
+ * @param height_align  Alignment of the height of luma plane, in lines,
+ *                      up to ION_UNIP_MAX_HEIGHT_ALIGN.
+ * @param stride_align  Alignment of stride of each plane, in bytes,
+ *                      up to ION_UNIP_MAX_STRIDE_ALIGN.
+ * @param offset_align  Alignment of offset of each plane, in bytes,
+ *                      power of 2. The buffer is aligned to the maximum.
+ * @param chroma_skew   Gap between luma and chroma planes in bytes before
+ *                      alignment, to put chroma on other DRAM banks.
+ * @param fd            Returns a dma-buf fd of Ion buffer.
+ * @param nr_planes     Returns the number of planes.
+ * @param size          Returns the size of the buffer.
+ * @param planes        Returns the layout of planes.
+ */
+struct ion_uniphier_alloc_planes_data {
+	uint32_t heap_id_mask;
+	uint32_t flags;
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t height_align;
+	uint32_t stride_align[ION_UNIP_MAX_PLANES];
+	uint32_t offset_align[ION_UNIP_MAX_PLANES];
+	uint32_t chroma_skew;
+	int fd;
+	uint32_t nr_planes;
+	uint64_t size;
+	struct ion_uniphier_plane_info planes[ION_UNIP_MAX_PLANES];
+};
+
+/**
+ * enum ion_uniphier_trace_type - type of recorded allocation event
+ *
+ * ION_UNIP_TRACE_ALLOC_FAIL is recorded when the heap has no space for
+ * the request, phys of the event is ~0.
+ *
+ * ION_UNIP_TRACE_SHARE is recorded when an ioctl of this driver gives
+ * out the fd of a buffer (ION_UNIP_IOC_ALLOC_PLANES, CLAIM_PREALLOC,
+ * OPEN_NAMED, ALLOC_RESULT), and ION_UNIP_TRACE_IMPORT when it makes a
+ * buffer of memory or a dma-buf from outside (ION_UNIP_IOC_USERPTR,
+ * WRAP_PHYS, PUBLISH). ION_IOC_SHARE and ION_IOC_IMPORT of ion core
+ * are not recorded, ion gives heaps no hook on them.
+ */
+enum ion_uniphier_trace_type {
+	ION_UNIP_TRACE_ALLOC,
+	ION_UNIP_TRACE_ALLOC_FAIL,
+	ION_UNIP_TRACE_FREE,
+	ION_UNIP_TRACE_SHARE,
+	ION_UNIP_TRACE_IMPORT,
+	ION_UNIP_TRACE_MAP_USER,
+};
+
+/**
+ * struct ion_uniphier_trace_event - an event of the allocation recorder
+ *
+ * The debugfs file 'ion_uniphier/alloc_trace' returns the array of this
+ * struct. Events are recorded per CPU, so they are not sorted by time.
+ *
+ * @param timestamp  time of the event in ns (ktime_get_ns)
+ * @param phys       physical address of the buffer
+ * @param size       size of the buffer
+ * @param align      requested alignment, only for ALLOC
+ * @param buffer_id  unique id of the buffer
+ * @param flags      allocation flags of the buffer
+ * @param pid        pid of the process of the event
+ * @param type       enum ion_uniphier_trace_type
+ * @param heap_id    heap id
+ * @param cpu        CPU that recorded the event
+ */
+struct ion_uniphier_trace_event {
+	uint64_t timestamp;
+	uint64_t phys;
+	uint64_t size;
+	uint64_t align;
+	uint64_t buffer_id;
+	uint32_t flags;
+	uint32_t pid;
+	uint16_t type;
+	uint16_t heap_id;
+	uint32_t cpu;
+};
 
 #define ION_UNIP_IOC_MAGIC           'U'
 #define ION_UNIP_IOC_VIRT_TO_PHYS    _IOWR(ION_UNIP_IOC_MAGIC, 0, struct ion_uniphier_virt_to_phys_data)
 #define ION_UNIP_IOC_PHYS            _IOWR(ION_UNIP_IOC_MAGIC, 1, struct ion_uniphier_phys_data)
+#define ION_UNIP_IOC_SYNC_RANGE      _IOW(ION_UNIP_IOC_MAGIC, 2, struct ion_uniphier_sync_data)
+#define ION_UNIP_IOC_USERPTR         _IOWR(ION_UNIP_IOC_MAGIC, 3, struct ion_uniphier_userptr_data)
+#define ION_UNIP_IOC_WRAP_PHYS       _IOWR(ION_UNIP_IOC_MAGIC, 4, struct ion_uniphier_wrap_phys_data)
+#define ION_UNIP_IOC_LOAD_FILE       _IOWR(ION_UNIP_IOC_MAGIC, 5, struct ion_uniphier_load_file_data)
+#define ION_UNIP_IOC_ALLOC_PLANES    _IOWR(ION_UNIP_IOC_MAGIC, 6, struct ion_uniphier_alloc_planes_data)
+#define ION_UNIP_IOC_CMA_PREWARM     _IOWR(ION_UNIP_IOC_MAGIC, 7, struct ion_uniphier_cma_prewarm_data)
+#define ION_UNIP_IOC_REBALANCE       _IOWR(ION_UNIP_IOC_MAGIC, 8, struct ion_uniphier_rebalance_data)
+#define ION_UNIP_IOC_CLAIM_PREALLOC  _IOWR(ION_UNIP_IOC_MAGIC, 9, struct ion_uniphier_prealloc_data)
+#define ION_UNIP_IOC_PUBLISH         _IOW(ION_UNIP_IOC_MAGIC, 10, struct ion_uniphier_publish_data)
+#define ION_UNIP_IOC_OPEN_NAMED      _IOWR(ION_UNIP_IOC_MAGIC, 11, struct ion_uniphier_open_named_data)
+#define ION_UNIP_IOC_ALLOC_ASYNC     _IOWR(ION_UNIP_IOC_MAGIC, 12, struct ion_uniphier_alloc_async_data)
+#define ION_UNIP_IOC_ALLOC_RESULT    _IOWR(ION_UNIP_IOC_MAGIC, 13, struct ion_uniphier_alloc_result_data)
 
 
 #endif /* _UAPI_LINUX_ION_UNIPHIER_H__ */